@@ -0,0 +1,88 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+using std::shared_ptr;
+using std::vector;
+
+#include <kat/jellyfish_helper.hpp>
+
+namespace kat {
+
+    typedef boost::error_info<struct BatchLookupError,string> BatchLookupErrorInfo;
+    struct BatchLookupException: virtual boost::exception, virtual std::exception { };
+
+    /**
+     * Looks up counts for many K-mers of up to 32 bases at once in a jellyfish
+     * hash.  Keys are single words, as rolled by FixedMer<uint64_t>.
+     *
+     * Rather than multiplying each key by the hash's RectangularBinaryMatrix bit
+     * by bit, the product is built from one precomputed table per byte of key.
+     * The reverse complements and table lookups are done four keys at a time
+     * with AVX2 where the CPU has it, falling back to scalar code otherwise.
+     * All the buckets for a batch are prefetched before the previous batch is
+     * probed, so that their cache misses overlap.
+     */
+    class BatchLookup {
+    public:
+
+        static const size_t BATCH_SIZE = 8;
+        static const unsigned int MAX_MER_LEN = 32;
+
+        BatchLookup(const LargeHashArray& hash);
+
+        /**
+         * Replaces each of the n keys with its canonical form
+         */
+        static void canonicalise(uint64_t* keys, size_t n, unsigned int merLen);
+
+        /**
+         * The bucket in the hash where the search for each key starts.  Same as
+         * hash.matrix().times(key) & hash.size_mask().
+         */
+        void bucketIds(const uint64_t* keys, size_t n, uint64_t* ids) const;
+
+        /**
+         * Gets the count for each key.  Keys must already be canonical if the hash
+         * is.  Keys not in the hash get 0.
+         */
+        void getCounts(const uint64_t* keys, size_t n, uint64_t* counts) const;
+
+        /**
+         * Whether the vectorised kernels are used on this machine
+         */
+        static bool hasAvx2();
+
+    private:
+
+        const LargeHashArray& hash;
+        unsigned int merLen;
+        unsigned int nbTables;
+        vector<uint64_t> tables;    // 256 entries for each byte of key
+        const char* data;
+        size_t blockLen;
+        size_t blockBytes;
+
+        void prefetch(const uint64_t* ids, size_t n) const;
+    };
+
+    typedef shared_ptr<BatchLookup> BatchLookupPtr;
+}
@@ -19,17 +19,26 @@
 
 #include <iostream>
 #include <memory>
+#include <string>
 #include <vector>
+using std::istream;
 using std::ostream;
 using std::shared_ptr;
+using std::string;
 using std::vector;
 
+#include <boost/exception/all.hpp>
+
 #include <boost/filesystem/path.hpp>
 using boost::filesystem::path;
 
 namespace kat {
     
 const uint32_t   DEFAULT_NB_BINS = 1001;
+const string     COUNTERS_MAGIC = "# KAT comp counters v1";
+
+typedef boost::error_info<struct CompCountersError,string> CompCountersErrorInfo;
+struct CompCountersException: virtual boost::exception, virtual std::exception { };
 
 class CompCounters {
 public:
@@ -46,6 +55,8 @@ public:
     uint64_t shared_hash1_total;
     uint64_t shared_hash2_total;
     uint64_t shared_distinct;
+    bool hash1_targeted;    // Hash 1 only holds K-mers also in hash 2, so hash 1 only distinct counts are unknown
+    uint64_t sketch_scale;  // If > 0, counters were estimated from sketches keeping 1 in this many K-mers
 
     vector<uint64_t> spectrum1;
     vector<uint64_t> spectrum2;
@@ -74,8 +85,33 @@ public:
 
     static void updateSpectrum(vector<uint64_t>& spectrum, const uint64_t count);
 
+    static void addSpectrum(vector<uint64_t>& spectrum, const vector<uint64_t>& other);
+
     void printCounts(ostream &out);
 
+    /**
+     * Adds the counts and spectra from another set of counters, e.g. one made 
+     * from a different slice or shard of the same hashes
+     */
+    void add(const CompCounters& o);
+
+    /**
+     * Multiplies all counts and spectra by the given factor, e.g. to estimate the 
+     * counters for whole hashes from those for a sketch keeping 1 in factor K-mers
+     */
+    void scaleUp(uint64_t factor);
+
+    /**
+     * Writes all counters and spectra in a form that load can read back, so
+     * counters from runs on separate shards can be added up later
+     */
+    void save(ostream &out) const;
+
+    /**
+     * Reads counters written by save
+     */
+    static CompCounters load(istream &in);
+
     vector<uint64_t>& getSpectrum1() { return spectrum1; }
 
     vector<uint64_t>& getSpectrum2() { return spectrum2; }       
@@ -89,8 +125,6 @@ private:
     CompCounters final_matrix;
     vector<CompCounters> threaded_counters;
 
-    static void merge_spectrum(vector<uint64_t>& spectrum, const vector<uint64_t>& threaded_spectrum);
-
 public:
 
     ThreadedCompCounters();
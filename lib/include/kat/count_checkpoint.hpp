@@ -0,0 +1,154 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <chrono>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+namespace bfs = boost::filesystem;
+using bfs::path;
+
+#include <kat/jellyfish_helper.hpp>
+
+namespace kat {
+
+    typedef boost::error_info<struct CountCheckpointError,string> CountCheckpointErrorInfo;
+    struct CountCheckpointException: virtual boost::exception, virtual std::exception { };
+
+    const double DEFAULT_CHECKPOINT_INTERVAL = 30.0;       // Minutes between checkpoints
+    const size_t CHECKPOINT_ROUND_UNITS_PER_THREAD = 16;    // Input read by each thread between chances to checkpoint, in reader units
+
+    /**
+     * Periodic snapshots of the hashes being counted, along with how far through
+     * the input counting got, so that a long count interrupted by a node failure
+     * or preemption can carry on from the last snapshot rather than start again.
+     *
+     * A checkpoint is a binary hash per K-mer length plus a small text file
+     * describing the run and the position in the input.  The description file is
+     * written last and renamed into place, so it always names a complete set of
+     * hashes.  Each checkpoint's hashes are kept until the next is in place.
+     *
+     * Snapshots are written by a forked child process, which gets a copy-on-write
+     * view of the hashes as they were at the fork.  Counting carries on straight
+     * away, only pausing for the fork itself.  Pages of the hashes touched while
+     * the child is writing are copied, so memory use can rise by up to the size of
+     * the hashes.  If the fork fails, the snapshot is written before carrying on.
+     */
+    class CountCheckpoint {
+    public:
+
+        /**
+         * Where counting had got to: every unit before "unit" of input file "file"
+         * had been counted, along with all earlier files
+         */
+        struct Position {
+            size_t file = 0;
+            size_t unit = 0;
+        };
+
+        /**
+         * @param _dir Directory to keep checkpoints in, created if need be
+         * @param _interval Seconds between checkpoints
+         */
+        CountCheckpoint(const path& _dir, double _interval);
+
+        virtual ~CountCheckpoint();
+
+        const path& getDir() const { return dir; }
+
+        /**
+         * Describes the count being checkpointed.  Only checkpoints of a run with
+         * the same input files, unchanged since, and the same settings are resumed.
+         * threads is the number of threads the input is split for.
+         */
+        void setRun(const vector<path>& inputs, const vector<uint16_t>& merLens, bool canonical, 
+                uint16_t minQual, double sampleFraction, uint16_t threads);
+
+        /**
+         * Whether there is a checkpoint in the directory, from any run
+         */
+        bool exists() const { return bfs::exists(statePath()); }
+
+        /**
+         * Loads the last complete checkpoint into hashes, one per K-mer length, 
+         * which the caller takes ownership of.  Sets where counting had got to, and 
+         * the number of threads the input was split for, which must be used again 
+         * so that the units line up.  Returns false if there is no checkpoint.  
+         * Throws if there is one from a different run.
+         */
+        bool load(vector<LargeHashArrayPtr>& hashes, Position& position, uint16_t& threads);
+
+        /**
+         * Whether the interval has passed since the last checkpoint, or the start
+         */
+        bool due() const;
+
+        /**
+         * Starts writing a checkpoint of the given hashes, counted up to position.  
+         * Waits for the last checkpoint to finish first.  The hashes must not 
+         * change until this returns.
+         */
+        void save(const vector<LargeHashArrayPtr>& hashes, const Position& position);
+
+        /**
+         * Waits for a checkpoint being written in the background, if any.  Returns
+         * false if writing it failed.
+         */
+        bool wait();
+
+        /**
+         * Removes all checkpoints, e.g. once counting has finished
+         */
+        void remove();
+
+        /**
+         * Number of checkpoints written successfully so far
+         */
+        uint32_t getNbSaved() const { return nbSaved; }
+
+    protected:
+
+        path dir;
+        double interval;
+        string run;                 // Description of the run, compared on loading
+        uint16_t threads;
+        vector<uint16_t> merLens;
+        bool canonical;
+        uint64_t generation;        // Of the last checkpoint started
+        pid_t writer;               // Child writing a checkpoint, or 0
+        uint32_t nbSaved;
+        std::chrono::steady_clock::time_point last;
+
+        path statePath() const { return dir / "checkpoint"; }
+        path hashPath(uint64_t gen, uint16_t merLen) const;
+
+        /**
+         * Writes the hashes and then the state naming them.  Returns false on 
+         * failure.  Safe to call from a forked child.
+         */
+        bool write(const vector<LargeHashArrayPtr>& hashes, const Position& position, uint64_t gen) const;
+    };
+}
@@ -0,0 +1,180 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+using std::mutex;
+using std::ofstream;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+using boost::filesystem::path;
+
+#include <kat/jellyfish_helper.hpp>
+
+namespace kat {
+
+    typedef boost::error_info<struct DiskCounterError,string> DiskCounterErrorInfo;
+    struct DiskCounterException: virtual boost::exception, virtual std::exception { };
+
+    const uint16_t DEFAULT_MINIMIZER_LEN = 13;
+    const uint16_t DEFAULT_DISK_BUCKETS = 64;     // Used when the input size is unknown (e.g. pipes)
+    const uint16_t MAX_DISK_BUCKETS = 512;        // Keeps the number of open files reasonable
+
+    /**
+     * Out-of-core K-mer counter for inputs that are too large to count in memory.
+     *
+     * Counting happens in two phases.  First the input is streamed into on-disk
+     * buckets of super K-mers (runs of consecutive K-mers that share the same
+     * minimizer bucket), so that every occurrence of a K-mer, on either strand if
+     * counting canonically, ends up in the same bucket.  Then each bucket is counted
+     * in turn, using all threads, in a hash sized to fit within the memory limit.
+     * The per-bucket counts are finally sorted and merged into a single jellyfish
+     * "binary/sorted" hash, which can be loaded by any KAT or jellyfish tool.
+     *
+     * Temporary files are written to a unique directory under the system temp
+     * directory (override with TMPDIR), which is created on construction and removed
+     * when this object is destroyed.
+     */
+    class DiskCounter {
+    private:
+
+        uint16_t merLen;
+        bool canonical;
+        uint64_t maxMemory;
+        uint16_t threads;
+        uint16_t minimizerLen;
+        uint16_t nbBuckets;
+        uint16_t minQual;
+        path workDir;
+        bool verbose;
+
+        vector<path> bucketFiles;
+        vector<path> runFiles;
+        uint64_t distinct;
+
+    public:
+
+        DiskCounter(uint16_t _merLen, bool _canonical, uint64_t _maxMemory, uint16_t _threads);
+
+        virtual ~DiskCounter();
+
+        uint16_t getMinimizerLen() const {
+            return minimizerLen;
+        }
+
+        void setMinimizerLen(uint16_t minimizerLen) {
+            this->minimizerLen = minimizerLen;
+        }
+
+        uint16_t getNbBuckets() const {
+            return nbBuckets;
+        }
+
+        /**
+         * Override the number of buckets.  If not set (or set to 0) then the
+         * number of buckets is derived from the input size and the memory limit.
+         */
+        void setNbBuckets(uint16_t nbBuckets) {
+            this->nbBuckets = nbBuckets;
+        }
+
+        uint16_t getMinQual() const {
+            return minQual;
+        }
+
+        /**
+         * Bases with a Phred quality score lower than this are treated like
+         * invalid bases.  0 (the default) disables quality filtering.
+         */
+        void setMinQual(uint16_t minQual) {
+            this->minQual = minQual;
+        }
+
+        bool isVerbose() const {
+            return verbose;
+        }
+
+        void setVerbose(bool verbose) {
+            this->verbose = verbose;
+        }
+
+        /**
+         * Private directory holding temporary files.  Anything written here is
+         * removed when this object is destroyed.
+         */
+        path getWorkDir() const {
+            return workDir;
+        }
+
+        uint64_t getDistinct() const {
+            return distinct;
+        }
+
+        /**
+         * Counts all K-mers in the given sequence files and writes them to a
+         * jellyfish binary/sorted hash at the given location.
+         * @param seqFiles Fasta or Fastq files to count
+         * @param outputFile Where to write the resulting hash
+         */
+        void count(const vector<path>& seqFiles, const path& outputFile);
+
+        /**
+         * Estimates how many buckets are required so that counting a single bucket
+         * fits within the given memory limit.  Assumes the worst case that every byte
+         * in the input represents a distinct K-mer.
+         * @param inputBytes Size of the input on disk
+         * @param merLen K-mer length
+         * @param maxMemory Memory limit in bytes
+         * @return Number of buckets
+         */
+        static uint16_t calcNbBuckets(uint64_t inputBytes, uint16_t merLen, uint64_t maxMemory);
+
+        /**
+         * Mixes the bits of a 2-bit encoded minimizer, so that bucket assignment is
+         * not biased by the lexicographic order of the minimizer
+         */
+        static uint64_t hashMinimizer(uint64_t x) {
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdULL;
+            x ^= x >> 33;
+            x *= 0xc4ceb9fe1a85ec53ULL;
+            x ^= x >> 33;
+            return x;
+        }
+
+    protected:
+
+        void partition(const vector<path>& seqFiles);
+
+        void partitionSlice(ReadParser& parser, vector<shared_ptr<ofstream>>& buckets, vector<mutex>& locks, size_t flushSize);
+
+        void countBuckets();
+
+        void merge(file_header& header, const path& outputFile);
+
+        file_header createHeader();
+    };
+}
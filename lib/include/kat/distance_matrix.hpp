@@ -0,0 +1,115 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+namespace kat {
+
+    /**
+     * Sums over the bins of two spectra a and b, from which each of the
+     * distances in distance_metrics.hpp can be worked out
+     */
+    struct PairSums {
+        double l1 = 0.0;            // sum |a - b|
+        double l2 = 0.0;            // sum (a - b)^2
+        double dot = 0.0;           // sum a * b
+        double minSum = 0.0;        // sum min(a, b)
+        double maxSum = 0.0;        // sum max(a, b)
+        double canberra = 0.0;      // sum |a - b| / (a + b), over bins where a + b > 0
+    };
+
+    /**
+     * Distances between every pair of a set of spectra, using the same metrics
+     * as CompCounters::printCounts: Manhattan, Euclidean, Cosine, Canberra and
+     * Jaccard.
+     *
+     * Rather than running each DistanceMetric on each pair, all the sums the
+     * metrics need are taken in a single pass over the bins.  Pairs are worked
+     * through in tiles of spectra, one range of bins at a time, so that the
+     * parts of the spectra being compared stay in cache, and tiles are shared
+     * out between threads.  The sums are taken four bins at a time with AVX2
+     * where the CPU has it, falling back to scalar code otherwise.
+     */
+    class DistanceMatrix {
+    public:
+
+        enum Metric {
+            MANHATTAN,
+            EUCLIDEAN,
+            COSINE,
+            CANBERRA,
+            JACCARD,
+            NB_METRICS
+        };
+
+        static const size_t TILE_SPECTRA = 16;
+        static const size_t TILE_BINS = 1024;
+
+        /**
+         * Spectra may have different numbers of bins.  Missing bins count as 0.
+         */
+        DistanceMatrix(const vector<vector<uint64_t>>& spectra);
+
+        size_t size() const { return nbSpectra; }
+
+        /**
+         * Works out the distances between every pair of spectra, using the
+         * global thread pool
+         */
+        void compute();
+
+        double get(Metric metric, size_t i, size_t j) const {
+            return distances[metric][i * nbSpectra + j];
+        }
+
+        /**
+         * Name of the metric, as given by the matching DistanceMetric
+         */
+        static string metricName(Metric metric);
+
+        /**
+         * Adds the sums over n bins of a and b to s
+         */
+        static void addSums(const double* a, const double* b, size_t n, PairSums& s);
+
+        /**
+         * Distance given the sums for a pair and the sum of squares of each spectrum
+         */
+        static double distance(Metric metric, const PairSums& s, double squares1, double squares2);
+
+    private:
+
+        size_t nbSpectra;
+        size_t nbBins;                          // Padded to a multiple of 4
+        vector<double> data;                    // Spectrum i starts at i * nbBins
+        vector<double> squares;                 // Sum of squares of each spectrum
+        vector<vector<double>> distances;       // N x N for each metric
+
+        const double* spectrum(size_t i) const { return data.data() + i * nbBins; }
+
+        /**
+         * Fills in the distances between the spectra in two tiles
+         */
+        void computeTiles(size_t tile1, size_t tile2);
+    };
+}
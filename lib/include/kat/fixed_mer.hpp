@@ -0,0 +1,158 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+
+#include <jellyfish/mer_dna.hpp>
+using jellyfish::mer_dna;
+
+namespace kat {
+
+    // Holds K-mers of up to 64 bases
+    __extension__ typedef unsigned __int128 uint128_t;
+
+    /**
+     * How many machine words K-mers of a given length need.  Hot loops are
+     * instantiated once for each, and pick one before they start.
+     */
+    enum class MerWidth {
+        ONE_WORD,       // K <= 32
+        TWO_WORDS,      // K <= 64
+        DYNAMIC         // Anything longer, using mer_dna
+    };
+
+    inline MerWidth merWidth(unsigned int merLen) {
+        return merLen <= 32 ? MerWidth::ONE_WORD : merLen <= 64 ? MerWidth::TWO_WORDS : MerWidth::DYNAMIC;
+    }
+
+    /**
+     * A K-mer and its reverse complement, rolled along a sequence one base at a
+     * time.  Each is held in a single integer W, laid out as in mer_dna, with the
+     * first base in the highest bits.  Shifts and comparisons are then one or two
+     * word operations, rather than loops over mer_dna's word count.  Use toMer to
+     * get a key for jellyfish's hash.
+     */
+    template<typename W>
+    class FixedMer {
+    private:
+        unsigned int k;
+        W mask;
+        unsigned int topShift;
+        W fwd;
+        W rev;
+
+    public:
+        FixedMer(unsigned int _k) : k(_k),
+            mask(2 * _k >= 8 * sizeof(W) ? ~(W)0 : ((W)1 << (2 * _k)) - 1),
+            topShift(2 * _k - 2), fwd(0), rev(0) {}
+
+        unsigned int merLen() const { return k; }
+
+        /**
+         * Adds a base, given as its mer_dna code (0-3), to the end of the K-mer
+         */
+        void shiftLeft(int code) {
+            fwd = ((fwd << 2) | (W)code) & mask;
+            rev = (rev >> 2) | ((W)(3 - code) << topShift);
+        }
+
+        const W& forward() const { return fwd; }
+        const W& reverse() const { return rev; }
+        const W& canonical() const { return fwd < rev ? fwd : rev; }
+        const W& get(bool canon) const { return canon ? canonical() : fwd; }
+
+        /**
+         * The forward and reverse complement of the K-mer made of the last j <= K
+         * bases
+         */
+        void forward(unsigned int j, W& out) const {
+            out = j == k ? fwd : fwd & (((W)1 << (2 * j)) - 1);
+        }
+
+        void reverse(unsigned int j, W& out) const {
+            out = rev >> (2 * (k - j));
+        }
+
+        /**
+         * Copies a K-mer into a mer_dna, clearing any higher words, so it can be
+         * used as a hash key
+         */
+        static void toMer(const W& w, mer_dna& m);
+    };
+
+    template<>
+    inline void FixedMer<uint64_t>::toMer(const uint64_t& w, mer_dna& m) {
+        m.polyA();
+        m.word__(0) = w;
+    }
+
+    template<>
+    inline void FixedMer<uint128_t>::toMer(const uint128_t& w, mer_dna& m) {
+        m.polyA();
+        m.word__(0) = (uint64_t)w;
+        if (m.nb_words() > 1) m.word__(1) = (uint64_t)(w >> 64);
+    }
+
+    /**
+     * Fallback for K > 64, with the same interface, on top of mer_dna
+     */
+    template<>
+    class FixedMer<mer_dna> {
+    private:
+        unsigned int k;
+        mer_dna fwd;
+        mer_dna rev;
+
+        static void extract(const mer_dna& src, unsigned int start, unsigned int len, mer_dna& dest) {
+            dest.polyA();
+            for (unsigned int b = 0; b < len; b += 64) {
+                const unsigned int n = std::min(64u, len - b);
+                dest.set_bits(b, n, src.get_bits(start + b, n));
+            }
+        }
+
+    public:
+        FixedMer(unsigned int _k) : k(_k) {}
+
+        unsigned int merLen() const { return k; }
+
+        void shiftLeft(int code) {
+            fwd.shift_left(code);
+            rev.shift_right(3 - code);
+        }
+
+        const mer_dna& forward() const { return fwd; }
+        const mer_dna& reverse() const { return rev; }
+        const mer_dna& canonical() const { return fwd < rev ? fwd : rev; }
+        const mer_dna& get(bool canon) const { return canon ? canonical() : fwd; }
+
+        void forward(unsigned int j, mer_dna& out) const {
+            extract(fwd, 0, 2 * j, out);
+        }
+
+        void reverse(unsigned int j, mer_dna& out) const {
+            extract(rev, 2 * (k - j), 2 * j, out);
+        }
+
+        static void toMer(const mer_dna& w, mer_dna& m) {
+            m = w;
+        }
+    };
+}
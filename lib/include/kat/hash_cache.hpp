@@ -0,0 +1,110 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+namespace bfs = boost::filesystem;
+using bfs::path;
+
+#include <kat/jellyfish_helper.hpp>
+
+namespace kat {
+
+    typedef boost::error_info<struct HashCacheError,string> HashCacheErrorInfo;
+    struct HashCacheException: virtual boost::exception, virtual std::exception { };
+
+    const uint64_t DEFAULT_CACHE_SIZE = 20000;     // MB
+    const string   CACHE_DIR_ENV = "KAT_CACHE_DIR";
+
+    /**
+     * A directory of jellyfish hashes counted by earlier runs, so that tools run
+     * on the same input can skip counting.  Each hash is named by a key made from
+     * the input files and the settings that affect the counts.
+     *
+     * Hashes are written to a temporary file and renamed into place, so other
+     * processes never see a partial hash.  Using a hash marks it as recently used.
+     * After each store, the least recently used hashes are removed until the
+     * cache fits within its size limit.
+     */
+    class HashCache {
+    private:
+
+        path dir;
+        uint64_t limit;     // bytes, or 0 for no limit
+
+    public:
+
+        HashCache(const path& _dir, uint64_t _limit);
+
+        const path& getDir() const { return dir; }
+
+        /**
+         * The cache directory given by the KAT_CACHE_DIR environment variable, or
+         * empty if it isn't set
+         */
+        static path defaultDir();
+
+        /**
+         * Key for a hash counted from the given files with the given settings.
+         * Files are fingerprinted by absolute path, size and modification time,
+         * and also by a digest of their content if digest is set.  Returns an
+         * empty string if any input can't be fingerprinted, e.g. a pipe.
+         */
+        static string key(const vector<path>& inputs, uint16_t merLen, bool canonical, uint64_t hashSize,
+                uint16_t minQual, bool digest);
+
+        /**
+         * Path to the hash with the given key, or empty if it isn't cached.  A
+         * found hash is marked as recently used.
+         */
+        path find(const string& key) const;
+
+        /**
+         * Writes the hash to the cache under the given key, leaving the hash
+         * intact, then evicts older hashes if the cache is over its limit.
+         * Returns the path of the cached hash.
+         */
+        path store(const string& key, LargeHashArrayPtr hash, file_header& header, uint16_t threads) const;
+
+        /**
+         * Total size of the cached hashes, in bytes
+         */
+        uint64_t size() const;
+
+        /**
+         * Removes the least recently used hashes, other than keep, until the cache
+         * is within its limit
+         */
+        void evict(const path& keep) const;
+
+    protected:
+
+        path hashPath(const string& key) const;
+
+        static bool isCachedHash(const path& p);
+
+        static uint64_t digestFile(const path& p);
+    };
+}
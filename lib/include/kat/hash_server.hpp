@@ -0,0 +1,227 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+using std::ostream;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+namespace bfs = boost::filesystem;
+using bfs::path;
+
+#include <kat/batch_lookup.hpp>
+#include <kat/jellyfish_helper.hpp>
+
+namespace kat {
+
+    typedef boost::error_info<struct HashServerError,string> HashServerErrorInfo;
+    struct HashServerException: virtual boost::exception, virtual std::exception { };
+
+    /**
+     * Connection to a hash server over a UNIX domain socket.  Requests and
+     * responses are a fixed size header followed by an array of 64-bit words.
+     */
+    class HashConnection {
+    public:
+
+        enum Op : uint32_t {
+            OPEN = 1,   // Select a hash by path.  Payload is the path.
+            COUNT,      // Look up the counts of a batch of keys
+            SLICE,      // Start iterating over a slice of a hash
+            NEXT        // Get the next batch of keys and counts from the slice
+        };
+
+        struct Request {
+            uint32_t op;
+            uint32_t id;        // Which hash, as returned by OPEN
+            uint64_t n;         // Number of keys, or bytes for OPEN
+            uint64_t a;
+            uint64_t b;
+        };
+
+        struct Response {
+            int64_t status;     // < 0 on error
+            uint64_t n;         // Number of entries following
+            uint64_t a;
+            uint64_t b;
+        };
+
+        static const uint64_t MAX_BATCH;   // Largest number of keys in a single request
+
+        HashConnection(int _fd) : fd(_fd) {}     // Takes ownership of an accepted socket
+        HashConnection(const path& socketPath);
+        ~HashConnection();
+
+        HashConnection(const HashConnection&) = delete;
+        HashConnection& operator=(const HashConnection&) = delete;
+
+        /**
+         * Sends or receives exactly size bytes.  Returns false if the other end
+         * closed the connection before any bytes were read.
+         */
+        void send(const void* data, size_t size);
+        bool recv(void* data, size_t size);
+
+    private:
+        int fd;
+    };
+
+    /**
+     * Holds jellyfish hashes in memory and answers count queries on them from
+     * other KAT processes, so a large hash only needs loading once when it is
+     * queried repeatedly.  Clients select a hash by the path it was loaded from.
+     * Each client connection is served by its own thread.
+     */
+    class HashServer {
+    public:
+
+        HashServer(const vector<path>& _hashPaths, const path& _socketPath);
+        ~HashServer();
+
+        /**
+         * Loads the hashes into memory
+         */
+        void load(ostream& out);
+
+        /**
+         * Serves requests until the process is interrupted or terminated, or
+         * stop is called
+         */
+        void serve(ostream& out);
+
+        /**
+         * Makes serve return once the current clients have disconnected
+         */
+        void stop();
+
+        size_t nbHashes() const { return hashes.size(); }
+
+        /**
+         * Back the hashes with transparent huge pages, which suits the random
+         * lookups a server answers
+         */
+        void setHugePages(bool hugePages) { this->hugePages = hugePages; }
+
+        /**
+         * Fault in the hash files with this many threads while loading, if > 0
+         */
+        void setPrefaultThreads(uint16_t prefaultThreads) { this->prefaultThreads = prefaultThreads; }
+
+    protected:
+
+        struct ServedHash {
+            path source;                // Canonical path the hash was loaded from
+            shared_ptr<HashLoader> loader;
+            LargeHashArrayPtr hash;
+            BatchLookupPtr lookup;
+            uint16_t merLen;
+            bool canonical;
+        };
+
+        vector<path> hashPaths;
+        path socketPath;
+        vector<ServedHash> hashes;
+        int listenFd;
+        bool hugePages;
+        uint16_t prefaultThreads;
+
+        std::mutex clientsMu;
+        std::condition_variable clientsDone;
+        std::set<int> clients;      // Sockets of connected clients
+
+        void handle(int fd);
+        void serveClient(HashConnection& conn) const;
+
+        void count(const ServedHash& h, const vector<uint64_t>& words, size_t n, vector<uint64_t>& counts) const;
+    };
+
+    /**
+     * Queries a hash held by a HashServer.  Safe to use from several threads,
+     * each request using a connection from a pool.
+     */
+    class HashClient {
+    public:
+
+        /**
+         * Iterates over one slice of the served hash, like eager_slice, on a
+         * connection of its own
+         */
+        class Slice {
+        public:
+            Slice(const HashClient& _client, uint32_t slice, uint32_t nbSlices);
+
+            /**
+             * Fetches up to max keys and their counts.  Each key takes
+             * nbWords() words.  Returns the number fetched, 0 at the end.
+             */
+            size_t next(size_t max, vector<uint64_t>& words, vector<uint64_t>& counts);
+
+        private:
+            const HashClient& client;
+            HashConnection conn;
+        };
+
+        /**
+         * Connects to the server and selects the hash loaded from hashPath.
+         * Returns nullptr if the server doesn't hold that hash.  Throws if the
+         * server can't be reached.
+         */
+        static shared_ptr<HashClient> connect(const path& socketPath, const path& hashPath);
+
+        uint16_t getMerLen() const { return merLen; }
+        bool getCanonical() const { return canonical; }
+        uint16_t nbWords() const { return (merLen + 31) / 32; }
+        const path& getSocketPath() const { return socketPath; }
+
+        /**
+         * Looks up the counts for n keys, given as nbWords() words each.  Keys
+         * must already be canonical if the hash is.
+         */
+        void getCounts(const uint64_t* words, size_t n, uint64_t* counts) const;
+
+        uint64_t getCount(const mer_dna& key) const;
+
+    protected:
+
+        path socketPath;
+        uint32_t id;
+        uint16_t merLen;
+        bool canonical;
+
+        mutable std::mutex mu;
+        mutable vector<std::unique_ptr<HashConnection>> idle;
+
+        HashClient(const path& _socketPath, uint32_t _id, uint16_t _merLen, bool _canonical);
+
+        std::unique_ptr<HashConnection> acquire() const;
+        void release(std::unique_ptr<HashConnection> conn) const;
+    };
+
+    typedef shared_ptr<HashClient> HashClientPtr;
+}
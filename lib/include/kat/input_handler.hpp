@@ -17,11 +17,23 @@
 
 #pragma once
 
+#include <iostream>
 #include <memory>
+using std::ostream;
 using std::shared_ptr;
 
+#include <kat/batch_lookup.hpp>
+#include <kat/count_checkpoint.hpp>
+#include <kat/fixed_mer.hpp>
+#include <kat/hash_cache.hpp>
+#include <kat/hash_server.hpp>
 #include <kat/jellyfish_helper.hpp>
+#include <kat/memory_budget.hpp>
+#include <kat/memory_pages.hpp>
+#include <kat/multi_k_counter.hpp>
+#include <kat/numa.hpp>
 using kat::JellyfishHelper;
+using kat::MultiKCounter;
 
 typedef shared_ptr<path> path_ptr;
 
@@ -47,31 +59,291 @@ namespace kat {
         uint64_t hashSize = DEFAULT_HASH_SIZE;
         uint16_t merLen = DEFAULT_MER_LEN;
         bool dumpHash = false;
+        uint32_t dumpShards = 0;                // If > 1, dump the hash as this many shards, each holding a distinct part of the K-mers
         bool disableHashGrow = false;
+        uint64_t maxMemory = 0;                 // If > 0, keep within this many bytes, counting out-of-core or querying the hash in place if need be.  A cgroup limit also applies, but only switches counting out-of-core if this is set.
+        uint16_t minQual = 0;                   // If > 0, don't count K-mers containing bases with a lower Phred score
+        double sampleFraction = 1.0;            // If < 1, only count this fraction of the reads
+        double tolerance = 0.0;                 // If > 0, stop counting once the spectrum changes by less than this between checkpoints
+        LargeHashArrayPtr targetHash = nullptr; // If set, only count K-mers present in this hash
+        path cacheDir;                          // If set, reuse hashes counted by earlier runs from here, and store new ones here
+        uint64_t cacheSize = DEFAULT_CACHE_SIZE * 1000000;  // Evict least recently used hashes once the cache exceeds this many bytes.  0 for no limit.
+        bool cacheDigest = false;               // Also fingerprint inputs by their content when looking up cached hashes
+        path checkpointDir;                     // If set, periodically save the hash being counted here, so an interrupted count can be resumed
+        double checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL;   // Minutes between checkpoints
+        bool resume = false;                    // Carry on from a checkpoint left in checkpointDir by an interrupted run
+        bool hugePages = false;                 // Back hashes with transparent huge pages, to cut TLB misses on random lookups
+        uint16_t prefaultThreads = 0;           // If > 0, fault in mapped hash and bloom counter files up front using this many threads
+        NumaPlacement numa = NumaPlacement::NONE;   // How to place the hash's memory across NUMA nodes, see placeHash
+        path hashServer;                        // If set, query the hash held by the kat serve process listening on this socket, rather than loading it
+        HashClientPtr client = nullptr;         // Only applicable if the hash is held by a hash server
+        uint64_t untargetedTotal = 0;           // Total K-mers in the input that were not in the target hash
         HashCounterPtr hashCounter = nullptr;
         shared_ptr<HashLoader> hashLoader = nullptr;
         LargeHashArrayPtr hash = nullptr;
+        BloomCounterPtr bloom = nullptr;        // Only applicable if a bloom counter was loaded
+        MappedHashPtr mapped = nullptr;         // Only applicable if the hash was too large for the memory budget, so is queried in place
+        BatchLookupPtr lookup = nullptr;        // Batched lookups into hash, if its K-mers fit in one word
+        bool allowBloom = false;                // Set by tools that only need to query individual K-mers.  Also allows querying a hash in place.
+        double bloomFpr = 0.0;                  // Expected false positive rate of the bloom counter
         shared_ptr<file_header> header;         // Only applicable if loaded
+        shared_ptr<LargeHashArray> ownedHash = nullptr;        // Owns the hash produced by targeted or multi-K counting
+        ostream* out = &std::cout;              // Progress messages go here.  Redirect when processing inputs concurrently.
 
         void setSingleInput(const path& p) { input.clear(); input.push_back(p); }
         void setMultipleInputs(const vector<path>& inputs);
         path getSingleInput() { return input[0]; }
         string pathString();
         string fileName();
+        uint64_t sizeOnDisk();  // Combined size of all input files, excluding pipes
+        uint64_t countBytes() const;  // Bytes needed to count the input in memory, going by the requested hash size
+        bool fitsInMemory(uint64_t limit);  // Whether counting the input in memory should stay within limit bytes
+        bool canCountOnDisk();  // Whether the input can be counted out-of-core, i.e. is all uncompressed files
         void validateInput();   // Throws if input is not present.  Sets input mode.
         void loadHeader();
         void validateMerLen(const uint16_t merLen);   // Throws if incorrect merlen
-        void count(const uint16_t threads);   // Uses the jellyfish library to count kmers in the input
+        void count(const uint16_t threads);   // Uses the jellyfish library to count kmers in the input, unless already counted by countMultiK or cached
+        bool countInMemory(const uint16_t threads);   // Counts kmers into a hash held in memory.  False if the hash filled the --max_memory budget, in which case nothing was counted.
+        void countOnDisk(const uint16_t threads);   // Counts kmers out-of-core, within the memory limit
+        uint64_t memoryLimit() const { return MemoryBudget::limit(maxMemory); }   // maxMemory or the cgroup limit, whichever is lower.  0 if neither is set.
+        void countTargeted(const uint16_t threads);   // Counts only kmers present in targetHash
+        void countSampled(const uint16_t threads);   // Counts a sample of the reads, or until the spectrum converges
         void loadHash();
-        void dump(const path& outputPath, const uint16_t threads);
+        void placeHash(const uint16_t threads);   // Places the counted or loaded hash across NUMA nodes according to numa
+        void dump(const path& outputPath, const uint16_t threads);   // Dumps the hash, or its shards if dumpShards > 1
+        bool isBloom() const { return bloom != nullptr; }
+        bool isServed() const { return client != nullptr; }
+        bool isMapped() const { return mapped != nullptr; }
+        
+        /**
+         * Looks up the count for the given K-mer from whichever backend was loaded 
+         * or counted for this input.  Bloom counters return approximate counts.
+         */
+        uint64_t getCount(const mer_dna& kmer) const {
+            if (client != nullptr) {
+                return client->getCount(canonical ? kmer.get_canonical() : kmer);
+            }
+            if (mapped != nullptr) {
+                return JellyfishHelper::getCount(mapped, kmer, canonical);
+            }
+            return bloom != nullptr ? 
+                JellyfishHelper::getCount(bloom, kmer, canonical) : 
+                JellyfishHelper::getCount(hash, kmer, canonical);
+        }
+        
+        /**
+         * As getCount, but the key must already be canonical if this input is, so
+         * no reverse complement is taken
+         */
+        uint64_t getCountForKey(const mer_dna& key) const {
+            uint64_t val = 0;
+            if (client != nullptr) {
+                val = client->getCount(key);
+            }
+            else if (bloom != nullptr) {
+                val = bloom->check(key);
+            }
+            else if (mapped != nullptr) {
+                val = mapped->check(key);
+            }
+            else {
+                hash->get_val_for_key(key, &val);
+            }
+            return val;
+        }
+        
+        /**
+         * Calls f(pos, valid, count) for the K-mer starting at each position in 
+         * seq.  valid is false if the K-mer contains anything other than A, C, G
+         * or T, in which case count is 0.  K-mers are rolled along the sequence
+         * using the FixedMer suited to merLen, which is chosen once per call.
+         */
+        template<typename F>
+        void forEachCount(const string& seq, F f) const {
+            if (client != nullptr) {
+                switch (merWidth(merLen)) {
+                    case MerWidth::ONE_WORD:
+                        forEachCountServed<uint64_t>(seq, f);
+                        break;
+                    case MerWidth::TWO_WORDS:
+                        forEachCountServed<uint128_t>(seq, f);
+                        break;
+                    default:
+                        forEachCountServed<mer_dna>(seq, f);
+                        break;
+                }
+                return;
+            }
+            
+            switch (merWidth(merLen)) {
+                case MerWidth::ONE_WORD:
+                    if (lookup != nullptr) {
+                        forEachCountBatched(seq, f);
+                    }
+                    else {
+                        forEachCountFixed<uint64_t>(seq, f);
+                    }
+                    break;
+                case MerWidth::TWO_WORDS:
+                    forEachCountFixed<uint128_t>(seq, f);
+                    break;
+                default:
+                    forEachCountFixed<mer_dna>(seq, f);
+                    break;
+            }
+        }
         
         static shared_ptr<vector<path>> globFiles(const string& input);
         static shared_ptr<vector<path>> globFiles(const vector<path>& input);
         
         static string determineSequenceFileType(const path& file);
+        
+        /**
+         * Path of one shard of a sharded hash dump, e.g. shard 2 of 4 of 
+         * "out-hash.jf27" is "out-hash-shard2of4.jf27".  Shards are numbered 
+         * from 1.
+         */
+        static path shardPath(const path& hashPath, uint32_t shard, uint32_t nbShards);
+        
+        /**
+         * Counts the same sequence file input at several K-mer lengths in a single 
+         * pass.  Each handler should have the same input, but a different K-mer 
+         * length.  Other counting settings are taken from the first handler.  
+         * Afterwards each handler holds the hash for its K-mer length, as if count
+         * had been called on it.
+         */
+        static void countMultiK(const vector<InputHandler*>& inputs, const uint16_t threads);
+        
+        /**
+         * Parses a comma separated list of K-mer lengths, e.g. "17,21,25"
+         */
+        static vector<uint16_t> parseMerLens(const string& merLens);
        
     private:
         static int globerr(const char *path, int eerrno);
+        void createHeader();    // Creates a header for a newly counted hash
+        void dumpSharded(const path& outputPath, const uint16_t threads);   // Dumps each of dumpShards shards of the hash
+        void setHash(LargeHashArrayPtr h);  // Sets the hash, and prepares batched lookups into it
+        shared_ptr<HashLoader> newLoader() const;  // Creates a hash loader with this input's memory settings
+        string cacheKey() const;    // Key for this input's hash in the cache, or empty if it shouldn't be cached
+        bool loadCached(const string& key);     // Loads the hash from the cache, returning false if it isn't there
+        void storeCached(const string& key, const uint16_t threads);   // Stores the counted hash in the cache
+        void checkSampling();   // Throws if sampling was requested along with an incompatible way of counting
+        static void reportConvergence(ostream& out, const MultiKCounter& counter);   // Reports how far through the input adaptive counting got
+
+        template<typename W, typename F>
+        void forEachCountFixed(const string& seq, F& f) const {
+
+            FixedMer<W> m(merLen);
+            mer_dna key;
+            unsigned int filled = 0;
+
+            for (size_t i = 0; i < seq.size(); i++) {
+                const int code = mer_dna::code(seq[i]);
+                if (code >= 0) {
+                    m.shiftLeft(code);
+                    if (filled < merLen) filled++;
+                }
+                else {
+                    filled = 0;
+                }
+
+                if (i + 1 < merLen) continue;
+
+                if (filled < merLen) {
+                    f(i + 1 - merLen, false, 0);
+                }
+                else {
+                    FixedMer<W>::toMer(m.get(canonical), key);
+                    f(i + 1 - merLen, true, getCountForKey(key));
+                }
+            }
+        }
+
+        /**
+         * As forEachCountFixed for single word K-mers, but looks up all the
+         * K-mers in the sequence together, using lookup
+         */
+        template<typename F>
+        void forEachCountBatched(const string& seq, F& f) const {
+
+            const size_t nbMers = seq.size() >= merLen ? seq.size() - merLen + 1 : 0;
+            vector<bool> valid(nbMers, false);
+            vector<uint64_t> keys;
+            keys.reserve(nbMers);
+
+            FixedMer<uint64_t> m(merLen);
+            unsigned int filled = 0;
+
+            for (size_t i = 0; i < seq.size(); i++) {
+                const int code = mer_dna::code(seq[i]);
+                if (code >= 0) {
+                    m.shiftLeft(code);
+                    if (filled < merLen) filled++;
+                }
+                else {
+                    filled = 0;
+                }
+
+                if (i + 1 >= merLen && filled >= merLen) {
+                    valid[i + 1 - merLen] = true;
+                    keys.push_back(m.get(canonical));
+                }
+            }
+
+            vector<uint64_t> counts(keys.size());
+            lookup->getCounts(keys.data(), keys.size(), counts.data());
+
+            size_t j = 0;
+            for (size_t pos = 0; pos < nbMers; pos++) {
+                f(pos, valid[pos], valid[pos] ? counts[j++] : 0);
+            }
+        }
+
+        /**
+         * As forEachCountFixed, but sends all the K-mers in the sequence to the
+         * hash server in one request
+         */
+        template<typename W, typename F>
+        void forEachCountServed(const string& seq, F& f) const {
+
+            const size_t nbMers = seq.size() >= merLen ? seq.size() - merLen + 1 : 0;
+            const uint16_t nbWords = client->nbWords();
+            vector<bool> valid(nbMers, false);
+            vector<uint64_t> words;
+            words.reserve(nbMers * nbWords);
+
+            FixedMer<W> m(merLen);
+            mer_dna key;
+            unsigned int filled = 0;
+
+            for (size_t i = 0; i < seq.size(); i++) {
+                const int code = mer_dna::code(seq[i]);
+                if (code >= 0) {
+                    m.shiftLeft(code);
+                    if (filled < merLen) filled++;
+                }
+                else {
+                    filled = 0;
+                }
+
+                if (i + 1 >= merLen && filled >= merLen) {
+                    valid[i + 1 - merLen] = true;
+                    FixedMer<W>::toMer(m.get(canonical), key);
+                    for (uint16_t w = 0; w < nbWords; w++) {
+                        words.push_back(key.word(w));
+                    }
+                }
+            }
+
+            vector<uint64_t> counts(words.size() / nbWords);
+            client->getCounts(words.data(), counts.size(), counts.data());
+
+            size_t j = 0;
+            for (size_t pos = 0; pos < nbMers; pos++) {
+                f(pos, valid[pos], valid[pos] ? counts[j++] : 0);
+            }
+        }
     };
     
 }
\ No newline at end of file
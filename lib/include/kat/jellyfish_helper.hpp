@@ -48,23 +48,32 @@ using boost::timer::auto_cpu_timer;
 #include <jellyfish/jellyfish.hpp>
 #include <jellyfish/large_hash_array.hpp>
 #include <jellyfish/large_hash_iterator.hpp>
+#include <jellyfish/mer_dna_bloom_counter.hpp>
 #include <jellyfish/mer_iterator.hpp>
 #include <jellyfish/mer_overlap_sequence_parser.hpp>
+#include <jellyfish/mer_qual_iterator.hpp>
 #include <jellyfish/storage.hpp>
 #include <jellyfish/stream_manager.hpp>
+#include <jellyfish/whole_sequence_parser.hpp>
 using jellyfish::mer_dna;
 using jellyfish::file_header;
 using jellyfish::mapped_file;
 
+#include <kat/parallel_seq_reader.hpp>
+using kat::ParallelSeqReader;
+
 typedef shared_ptr<file_header> HashHeaderPtr;
 typedef shared_ptr<binary_reader> HashReaderPtr;
 typedef jellyfish::stream_manager<vector<const char*>::const_iterator> StreamManager;
 typedef jellyfish::mer_overlap_sequence_parser<StreamManager> SequenceParser;
 typedef jellyfish::mer_iterator<SequenceParser, mer_dna> MerIterator;
+typedef jellyfish::whole_sequence_parser<StreamManager> ReadParser;     // Keeps quality scores, unlike SequenceParser
+typedef jellyfish::mer_qual_iterator<ReadParser, mer_dna> MerQualIterator;
 typedef jellyfish::cooperative::hash_counter<mer_dna> HashCounter;
 typedef shared_ptr<HashCounter> HashCounterPtr;
 typedef HashCounter::array LargeHashArray;
 typedef LargeHashArray* LargeHashArrayPtr;
+typedef shared_ptr<ParallelSeqReader> ParallelSeqReaderPtr;
 
 namespace kat {
 
@@ -74,21 +83,117 @@ namespace kat {
     const uint64_t DEFAULT_HASH_SIZE = 100000000;
     const uint16_t DEFAULT_MER_LEN = 27;
     
+    const string BLOOM_COUNTER_FORMAT = "bloomcounter";
+    
+    class CountCheckpoint;
+    
+    /**
+     * A memory mapped jellyfish bloom counter (as produced by "jellyfish bc").  Each
+     * K-mer maps to an approximate count of 0, 1 or 2, where 2 means "2 or more".  Counts
+     * can be overestimated (but never underestimated) due to false positives.
+     */
+    class BloomCounter : public jellyfish::mer_dna_bloom_counter_file {
+    public:
+        
+        BloomCounter(const file_header& header, const boost::filesystem::path& bcPath) :
+            jellyfish::mer_dna_bloom_counter_file(
+                header.size(), 
+                header.nb_hashes(), 
+                bcPath.c_str(), 
+                jellyfish::hash_pair<mer_dna>(header.matrix(1), header.matrix(2)), 
+                header.offset()) {}
+        
+        /**
+         * Proportion of cells in the bloom counter that are non-zero.  Requires a
+         * single pass over the data.
+         * @return Occupancy between 0 and 1
+         */
+        double occupancy() const;
+        
+        /**
+         * The expected false positive rate given the current occupancy of the counter.
+         * This is the probability that a K-mer not present in the input reports a non-zero count.
+         * @return Expected false positive rate
+         */
+        double expectedFpr() const;
+        
+        /**
+         * Faults in the whole mapped file up front, using the given number of
+         * threads, rather than page by page as it's queried
+         */
+        void prefault(uint16_t threads) const;
+    };
+    
+    typedef shared_ptr<BloomCounter> BloomCounterPtr;
+    
+    /**
+     * A binary jellyfish hash queried in place from the memory mapped file,
+     * rather than loaded into a hash array.  Records in the file are sorted by
+     * their position in the hash, then by key, so each lookup is a binary
+     * search.  Slower per lookup than a loaded hash, but pages are only
+     * brought into memory as they are queried, and the kernel can reclaim them
+     * again under memory pressure.  Safe to query from several threads.
+     */
+    class MappedHash {
+    public:
+        
+        MappedHash(const file_header& header, const path& hashPath);
+        
+        /**
+         * Count for the given K-mer, or 0 if it isn't in the hash.  The K-mer
+         * must already be canonical if the hash is.
+         */
+        uint64_t check(const mer_dna& key) const;
+        
+        uint64_t nbRecords() const { return records; }
+        
+        /**
+         * Faults in the whole mapped file up front, using the given number of
+         * threads, rather than page by page as it's queried
+         */
+        void prefault(uint16_t threads) const;
+        
+    private:
+        
+        mapped_file map;
+        const char* data;
+        jellyfish::RectangularBinaryMatrix matrix;
+        uint64_t mask;
+        size_t keyBytes;
+        size_t valBytes;
+        size_t recordBytes;
+        uint64_t records;
+        
+        uint64_t pos(const mer_dna& key) const { return matrix.times(key) & mask; }
+        void keyAt(uint64_t i, mer_dna& key) const;
+        uint64_t valAt(uint64_t i) const;
+    };
+    
+    typedef shared_ptr<MappedHash> MappedHashPtr;
+    
     class HashLoader {
         
     private:
         
         LargeHashArrayPtr hash;
+        BloomCounterPtr bloom;
+        MappedHashPtr mapped;
         bool canonical;
         uint16_t merLen;
         file_header header;
+        bool hugePages;             // Back loaded hashes with transparent huge pages
+        uint16_t prefaultThreads;   // If > 0, fault in mapped files up front with this many threads
         
     public:
         
         HashLoader() {
             hash = nullptr;
+            bloom = nullptr;
+            mapped = nullptr;
             canonical = false;
             merLen = 0;
+            hugePages = false;
+            prefaultThreads = 0;
         }
         
         virtual ~HashLoader() {
@@ -106,13 +211,56 @@ namespace kat {
          */
         LargeHashArrayPtr loadHash(const path& jfHashPath, bool verbose);
         
+        /**
+         * Memory maps a jellyfish bloom counter file.  Results stored at the "bloom" pointer
+         * variable, which is also returned from this function.  Pages are only brought into memory
+         * as they are queried.
+         * @param bcPath Path to the jellyfish bloom counter file
+         * @param verbose Output additional information to cerr
+         * @return The bloom counter
+         */
+        BloomCounterPtr loadBloomCounter(const path& bcPath, bool verbose);
+        
+        /**
+         * Memory maps a binary jellyfish hash to query it in place, for when it's
+         * too large to load.  Results stored at the "mapped" pointer variable, 
+         * which is also returned from this function.
+         * @param jfHashPath Path to the jellyfish hash file
+         * @param verbose Output additional information to cerr
+         * @return The mapped hash
+         */
+        MappedHashPtr mapHash(const path& jfHashPath, bool verbose);
+        
+        /**
+         * Approximate number of bytes needed to load the given binary hash file
+         * into memory with loadHash
+         */
+        static uint64_t loadedBytes(const path& jfHashPath);
+        
         LargeHashArrayPtr getHash() { return hash; }
         
+        /**
+         * Hands over the loaded hash.  Caller takes ownership of the returned hash.
+         */
+        LargeHashArrayPtr releaseHash() { 
+            LargeHashArrayPtr h = hash; 
+            hash = nullptr; 
+            return h; 
+        }
+        
+        BloomCounterPtr getBloomCounter() { return bloom; }
+        
+        MappedHashPtr getMappedHash() { return mapped; }
+        
         bool getCanonical() { return header.canonical(); }
         
         uint16_t getMerLen() { return merLen; }
         
         const file_header& getHeader() { return header; }
+        
+        void setHugePages(bool hugePages) { this->hugePages = hugePages; }
+        
+        void setPrefaultThreads(uint16_t prefaultThreads) { this->prefaultThreads = prefaultThreads; }
     };
     
     
@@ -123,6 +271,21 @@ namespace kat {
 
         static uint64_t getCount(LargeHashArrayPtr hash, const mer_dna& kmer, bool canonical);
         
+        /**
+         * Approximate count for the given K-mer from a bloom counter.  Returns 0, 1 or 2, 
+         * where 2 represents 2 or more occurrences.
+         * @param bloom The bloom counter to query
+         * @param kmer The K-mer to look up
+         * @param canonical Whether the K-mer should be canonicalised before lookup
+         * @return Approximate count
+         */
+        static uint64_t getCount(BloomCounterPtr bloom, const mer_dna& kmer, bool canonical);
+        
+        /**
+         * Count for the given K-mer from a hash queried in place
+         */
+        static uint64_t getCount(MappedHashPtr mapped, const mer_dna& kmer, bool canonical);
+        
         /**
         * Simple count routine
         * @param ary Hash array which contains the counted kmers
@@ -131,29 +294,155 @@ namespace kat {
         */
         static void countSlice(HashCounter& ary, SequenceParser& parser, bool canonical);
 
+        /**
+         * Quality aware count routine.  Bases with a quality character below minQualChar
+         * break the sequence, so no K-mer containing them is counted.
+         * @param ary Hash array which contains the counted kmers
+         * @param parser The parser that handles the input stream and chunking
+         * @param canonical whether or not the kmers should be treated as canonical or not
+         * @param minQualChar Lowest acceptable quality character
+         */
+        static void countSliceQual(HashCounter& ary, ReadParser& parser, bool canonical, char minQualChar);
+
         /**
          * Counts kmers in the given sequence file (Fasta or Fastq) returning
          * a hash array of those kmers
          * @param seqFile Sequence file to count
+         * @param minQual If > 0, ignore K-mers containing bases with a lower Phred score
          * @return The hash array counter
          */
-        static LargeHashArrayPtr countSeqFile(const path& p, HashCounter& hashCounter, bool canonical, uint16_t threads) {
+        static LargeHashArrayPtr countSeqFile(const path& p, HashCounter& hashCounter, bool canonical, uint16_t threads, uint16_t minQual = 0) {
             vector<path> paths;
             paths.push_back(p);
-            return countSeqFile(paths, hashCounter, canonical, threads);
+            return countSeqFile(paths, hashCounter, canonical, threads, minQual);
         }
 
         /**
          * Counts kmers in the given sequence file (Fasta or Fastq) returning
          * a hash array of those kmers
          * @param seqFile Sequence file to count
+         * @param minQual If > 0, ignore K-mers containing bases with a lower Phred score
+         * @param checkpoint If set, count in rounds, periodically saving the hash and
+         * how far through the input counting got here.  If it already holds a 
+         * checkpoint of this count, carry on from there.  Checkpoints are removed 
+         * once counting finishes.  Pipes are not supported.
          * @return The hash array counter
          */
-        static LargeHashArrayPtr countSeqFile(const vector<path>& seqFiles, HashCounter& hashCounter, bool canonical, uint16_t threads);
+        static LargeHashArrayPtr countSeqFile(const vector<path>& seqFiles, HashCounter& hashCounter, bool canonical, uint16_t threads, uint16_t minQual = 0, CountCheckpoint* checkpoint = nullptr);
+
+        /**
+         * Whether the given sequence files should be parsed with ParallelSeqReader
+         * rather than jellyfish's stream parser, which can't read compressed files and
+         * only uses one thread per file for parsing.  Pipes always go through jellyfish.
+         * @param seqFiles Sequence files to count
+         * @param threads Number of threads to use
+         * @return True if any file is compressed, or if there are fewer files than threads
+         */
+        static bool useParallelReader(const vector<path>& seqFiles, uint16_t threads);
+
+        /**
+         * Count routine for use with ParallelSeqReader.  Processes the readers in order.
+         * @param ary Hash array which contains the counted kmers
+         * @param readers Readers for each input file
+         * @param canonical whether or not the kmers should be treated as canonical or not
+         */
+        static void countSliceParallel(HashCounter& ary, vector<ParallelSeqReaderPtr>& readers, bool canonical);
+
+        /**
+         * Creates a new hash array containing all the keys from the source hash, each
+         * with a count of 0.  The new hash is suitable for targeted counting.  Caller
+         * takes ownership of the returned hash.
+         * @param source The hash containing the K-mers to target
+         * @param threads Number of threads to use
+         * @return A new hash array containing the target K-mers
+         */
+        static LargeHashArrayPtr createTargetHash(const LargeHashArray& source, uint16_t threads);
+
+        /**
+         * Targeted count routine.  Only increments K-mers that already exist in the hash.
+         * @param ary Hash array, pre-populated with the target K-mers
+         * @param parser The parser that handles the input stream and chunking
+         * @param canonical whether or not the kmers should be treated as canonical or not
+         * @param absent Set to the number of K-mers found that are not in the hash
+         * @param full Set if the hash did not have room to store a large count
+         */
+        static void countSliceTargeted(LargeHashArray& ary, SequenceParser& parser, bool canonical, uint64_t& absent, bool& full);
+
+        /**
+         * Quality aware targeted count routine
+         * @param ary Hash array, pre-populated with the target K-mers
+         * @param parser The parser that handles the input stream and chunking
+         * @param canonical whether or not the kmers should be treated as canonical or not
+         * @param minQualChar Lowest acceptable quality character
+         * @param absent Set to the number of K-mers found that are not in the hash
+         * @param full Set if the hash did not have room to store a large count
+         */
+        static void countSliceTargetedQual(LargeHashArray& ary, ReadParser& parser, bool canonical, char minQualChar, uint64_t& absent, bool& full);
+
+        /**
+         * Targeted count routine for use with ParallelSeqReader
+         * @param ary Hash array, pre-populated with the target K-mers
+         * @param readers Readers for each input file
+         * @param canonical whether or not the kmers should be treated as canonical or not
+         * @param absent Set to the number of K-mers found that are not in the hash
+         * @param full Set if the hash did not have room to store a large count
+         */
+        static void countSliceTargetedParallel(LargeHashArray& ary, vector<ParallelSeqReaderPtr>& readers, bool canonical, uint64_t& absent, bool& full);
+
+        /**
+         * Counts kmers in the given sequence files, but only those already present in
+         * the target hash (see createTargetHash).  Memory usage therefore depends on the
+         * size of the target, not the input.  K-mers not in the target are tallied but
+         * otherwise discarded.
+         * @param seqFiles Sequence files to count
+         * @param target Hash array, pre-populated with the target K-mers
+         * @param canonical Whether to count canonical K-mers
+         * @param threads Number of threads to use
+         * @param minQual If > 0, ignore K-mers containing bases with a lower Phred score
+         * @return The total number of K-mers found in the input that were not in the target
+         */
+        static uint64_t countSeqFileTargeted(const vector<path>& seqFiles, LargeHashArray& target, bool canonical, uint16_t threads, uint16_t minQual = 0);
+
+        /**
+         * Creates a copy of the given hash, without any K-mers that have a count of 0.
+         * Caller takes ownership of the returned hash.
+         * @param ary The hash to compact
+         * @param threads Number of threads to use
+         * @return A new hash array containing only K-mers with non-zero counts
+         */
+        static LargeHashArrayPtr compactHash(const LargeHashArray& ary, uint16_t threads);
+
+        /**
+         * Which of nbShards shards the given K-mer belongs to.  Shards are chosen
+         * by the prefix of a hash of the K-mer, so they depend only on the K-mer
+         * itself, and hashes of different inputs split the same way as long as
+         * they share the same K-mer length and canonical setting.
+         * @param kmer The K-mer, canonical if the hash holds canonical K-mers
+         * @param nbShards Number of shards
+         * @return The shard index, between 0 and nbShards - 1
+         */
+        static uint32_t shardOf(const mer_dna& kmer, uint32_t nbShards);
+
+        /**
+         * Creates a copy of the given hash holding only the K-mers with a non-zero
+         * count in the given shard.  The copy is sized to fit the shard, so holds
+         * roughly 1/nbShards of the K-mers.  Caller takes ownership of the
+         * returned hash.
+         * @param ary The hash to split
+         * @param shard Index of the shard to keep
+         * @param nbShards Number of shards
+         * @param threads Number of threads to use
+         * @return A new hash array containing only the K-mers in the shard
+         */
+        static LargeHashArrayPtr shardHash(const LargeHashArray& ary, uint32_t shard, uint32_t nbShards, uint16_t threads);
 
         
         
-        static void dumpHash(LargeHashArrayPtr ary, file_header& header, uint16_t threads, const path& outputFile);
+        /**
+         * Writes the hash to disk.  Unless keepHash is set, the hash is emptied as
+         * it is written.
+         */
+        static void dumpHash(LargeHashArrayPtr ary, file_header& header, uint16_t threads, const path& outputFile, bool keepHash = false);
         
         /**
         * Extracts the jellyfish hash file header
@@ -185,6 +474,15 @@ namespace kat {
          */
         static bool isSequenceFile(const path& filename);
         
+        /**
+         * Returns whether or not the header describes a jellyfish bloom counter
+         * @param header Jellyfish file header
+         * @return Whether or not the header belongs to a bloom counter
+         */
+        static bool isBloomCounter(const file_header& header) {
+            return header.format() == BLOOM_COUNTER_FORMAT;
+        }
+        
     protected:
 
         
@@ -0,0 +1,170 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+using std::istream;
+using std::ostream;
+using std::pair;
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+using boost::filesystem::path;
+
+#include <kat/jellyfish_helper.hpp>
+
+namespace kat {
+
+    typedef boost::error_info<struct KmerSketchError,string> KmerSketchErrorInfo;
+    struct KmerSketchException: virtual boost::exception, virtual std::exception { };
+
+    const string SKETCH_MAGIC = "# KAT sketch v1";
+    const string SKETCH_EXTENSION = ".sketch";
+    const uint64_t DEFAULT_SKETCH_SCALE = 1000;
+
+    /**
+     * A FracMinHash (scaled) sketch of the K-mer counts in an input.  Each K-mer
+     * is hashed, and only those whose hash falls in the lowest 1 / scale of the
+     * hash range are kept, along with their counts.  The same K-mers are kept
+     * from every input, so comparing two sketches compares a uniform sample of
+     * the K-mers in both, and counts of distinct K-mers, totals and spectra
+     * from the sample can be multiplied by the scale to estimate those for
+     * the whole inputs.
+     *
+     * Sketches are only comparable if they have the same K-mer length, canonical
+     * setting and scale.  The hash is independent of the one used to split
+     * sharded hashes, so the sample is not skewed towards any shard.
+     */
+    class KmerSketch {
+    public:
+
+        /**
+         * A hash of a K-mer and its count.  Entries are kept in order of hash.
+         */
+        typedef pair<uint64_t, uint64_t> Entry;
+
+        KmerSketch() : KmerSketch(DEFAULT_MER_LEN, true, DEFAULT_SKETCH_SCALE) {}
+
+        KmerSketch(uint16_t _merLen, bool _canonical, uint64_t _scale);
+
+        uint16_t getMerLen() const { return merLen; }
+
+        bool isCanonical() const { return canonical; }
+
+        uint64_t getScale() const { return scale; }
+
+        /**
+         * Description of what was sketched, e.g. the input paths
+         */
+        const string& getSource() const { return source; }
+
+        void setSource(const string& source) { this->source = source; }
+
+        const vector<Entry>& getEntries() const { return entries; }
+
+        size_t size() const { return entries.size(); }
+
+        /**
+         * Whether a K-mer with this hash belongs in the sketch
+         */
+        bool keeps(uint64_t h) const { return h <= maxHash; }
+
+        /**
+         * Sketches the K-mers in the given sequence files, reading them with
+         * ParallelSeqReader.  No hash of the whole input is built, so memory use
+         * depends on the size of the sketch.  Pipes are not supported.
+         * @param minQual If > 0, ignore K-mers containing bases with a lower Phred score
+         */
+        void sketchSeqFiles(const vector<path>& seqFiles, uint16_t threads, uint16_t minQual = 0);
+
+        /**
+         * Sketches the K-mers in a counted or loaded hash.  Keys must already be
+         * canonical if the sketch is.
+         */
+        void sketchHash(const LargeHashArray& hash, uint16_t threads);
+
+        /**
+         * Throws if the two sketches can't be compared
+         */
+        void checkCompatible(const KmerSketch& other) const;
+
+        /**
+         * Calls f(count1, count2) for every K-mer kept by either sketch, where
+         * the count is 0 for a sketch that doesn't hold the K-mer
+         */
+        template<typename F>
+        static void forEachPair(const KmerSketch& s1, const KmerSketch& s2, F f) {
+            s1.checkCompatible(s2);
+            auto a = s1.entries.begin(), b = s2.entries.begin();
+            while (a != s1.entries.end() || b != s2.entries.end()) {
+                if (b == s2.entries.end() || (a != s1.entries.end() && a->first < b->first)) {
+                    f(a->second, (uint64_t)0);
+                    ++a;
+                }
+                else if (a == s1.entries.end() || b->first < a->first) {
+                    f((uint64_t)0, b->second);
+                    ++b;
+                }
+                else {
+                    f(a->second, b->second);
+                    ++a;
+                    ++b;
+                }
+            }
+        }
+
+        void save(ostream& out) const;
+
+        void save(const path& file) const;
+
+        static KmerSketch load(istream& in);
+
+        static KmerSketch load(const path& file);
+
+        /**
+         * Whether the given file holds a sketch, judging by its first line
+         */
+        static bool isSketchFile(const path& file);
+
+        /**
+         * Hash of a K-mer used to decide whether it's kept
+         */
+        static uint64_t hashOf(const mer_dna& kmer);
+
+    protected:
+
+        uint16_t merLen;
+        bool canonical;
+        uint64_t scale;
+        uint64_t maxHash;
+        string source;
+        vector<Entry> entries;
+
+        /**
+         * Replaces the entries with the given ones, sorting them by hash and
+         * adding up the counts of any duplicates
+         */
+        void setEntries(vector<Entry>& unsorted);
+    };
+}
@@ -40,6 +40,7 @@ namespace mme {
     const string KEY_TITLE = "# Title:";
     const string KEY_MAX_VAL = "# MaxVal:";
     const string KEY_TRANSPOSE = "# Transpose:";
+    const string KEY_FPR = "# Expected false positive rate:";
     const string MX_META_END = "###";
 
     void trim(string& str);
@@ -0,0 +1,87 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+using std::string;
+
+#include <boost/filesystem/path.hpp>
+namespace bfs = boost::filesystem;
+using bfs::path;
+
+namespace kat {
+
+    /**
+     * How much memory a KAT process may use, and estimates of what its large
+     * structures will need, so that tools can pick a strategy that fits before
+     * allocating rather than be killed part way through.  The limit is the
+     * smaller of the budget requested with --max_memory and the cgroup v2
+     * memory.max of the process, whichever are set.
+     */
+    class MemoryBudget {
+    public:
+
+        /**
+         * The memory limit in bytes given a requested budget (0 for none), also
+         * taking in the cgroup limit.  0 if neither is set.
+         */
+        static uint64_t limit(uint64_t requested);
+
+        /**
+         * The tightest memory.max on the path from this process's cgroup v2 up
+         * to the root, or 0 if there's no limit or no cgroup v2 hierarchy.  Read
+         * once and remembered.
+         */
+        static uint64_t cgroupLimit();
+
+        /**
+         * As cgroupLimit, for a process whose /proc/<pid>/cgroup is procCgroup,
+         * with the cgroup v2 hierarchy mounted at cgroupRoot
+         */
+        static uint64_t cgroupLimit(const path& procCgroup, const path& cgroupRoot);
+
+        /**
+         * Resident set size of this process in bytes, or 0 if unknown
+         */
+        static uint64_t currentRss();
+
+        /**
+         * Bytes left under the limit given what the process already holds.  0 if
+         * the process is already at or over the limit, or if limit is 0, i.e.
+         * unlimited, so callers should check the limit first.
+         */
+        static uint64_t remaining(uint64_t limit);
+
+        /**
+         * Bytes used by a hash array with room for the given number of entries,
+         * as jellyfish allocates it, i.e. rounded up to a power of 2
+         */
+        static uint64_t hashBytes(uint64_t entries, uint16_t merLen);
+
+        /**
+         * The largest hash size, in entries, whose array fits in the given bytes
+         */
+        static uint64_t hashEntries(uint64_t bytes, uint16_t merLen);
+
+        /**
+         * Formats bytes as whole MB for messages, e.g. "512MB"
+         */
+        static string toMB(uint64_t bytes);
+    };
+}
@@ -0,0 +1,57 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+
+#include <kat/jellyfish_helper.hpp>
+
+namespace kat {
+
+    /**
+     * Control over how the pages behind hashes and mapped files are backed and
+     * faulted in.  Hash arrays are large and probed at random, so with normal 4KB
+     * pages most lookups miss the TLB.  Backing them with transparent huge pages
+     * cuts the misses a great deal.  Mapped files are normally faulted in one page
+     * at a time as they're first touched, so faulting them in up front from
+     * several threads, much as MAP_POPULATE would, gets them into memory sooner.
+     */
+    class MemoryPages {
+    public:
+
+        /**
+         * Asks the kernel to back the given range with transparent huge pages.
+         * Only affects pages faulted in afterwards, and whether huge pages are
+         * actually used depends on the system's THP settings and free memory.
+         * Returns false if the kernel doesn't support it.
+         */
+        static bool adviseHugePages(void* addr, size_t len);
+
+        /**
+         * As adviseHugePages, for the whole of a hash array.  Best called
+         * straight after the hash is created, before anything is added.
+         */
+        static bool adviseHugePages(const LargeHashArray& ary);
+
+        /**
+         * Faults in every page in the given range, by reading a byte from each,
+         * using the given number of threads
+         */
+        static void prefault(const void* addr, size_t len, uint16_t threads);
+    };
+}
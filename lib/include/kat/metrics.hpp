@@ -0,0 +1,139 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using std::ostream;
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/timer/timer.hpp>
+namespace bfs = boost::filesystem;
+using bfs::path;
+
+#include <kat/perf_counters.hpp>
+
+namespace kat {
+
+    typedef boost::error_info<struct MetricsError,string> MetricsErrorInfo;
+    struct MetricsException: virtual boost::exception, virtual std::exception { };
+
+    /**
+     * Performance metrics for each phase of a run (counting, loading, comparing,
+     * merging, saving, plotting, ...), so that performance can be tracked across
+     * versions and datasets.  Phases record themselves in the global registry,
+     * which tools write out as JSON when asked to with --metrics.
+     */
+    class Metrics {
+    public:
+
+        struct Record {
+            string phase;
+            string input;           // What the phase worked on, if relevant
+            double wall;            // seconds
+            double user;            // CPU seconds of the whole process during the phase
+            double system;
+            uint64_t peakRss;       // Peak resident memory of the process so far, in bytes
+            uint64_t bytesRead;     // The counters are 0 where a phase doesn't measure them
+            uint64_t kmers;         // K-mers processed
+            uint64_t lookups;       // Hash lookups made
+            bool hasPerf;           // Whether hardware counters were recorded
+            PerfValues perf;        // Over all threads
+            vector<PerfValues> threadPerf;  // For each worker, by thread index, if the phase recorded them
+        };
+
+        /**
+         * Times a phase from construction to destruction, then adds it to the
+         * global registry.  Add the phase's throughput counters as they become
+         * known.
+         *
+         * If hardware counters are enabled, the phase counts events on its own
+         * thread and any threads it creates.  Work run on the thread pool is
+         * added with addThreadCounters.
+         */
+        class Phase {
+        public:
+
+            Phase(const string& name, const string& input = "");
+            ~Phase();
+
+            Phase(const Phase&) = delete;
+            Phase& operator=(const Phase&) = delete;
+
+            void addBytesRead(uint64_t n) { record.bytesRead += n; }
+            void addKmers(uint64_t n) { record.kmers += n; }
+            void addLookups(uint64_t n) { record.lookups += n; }
+
+            /**
+             * Adds the events counted by a worker while it ran the phase's
+             * slice th_id.  Safe to call from several threads at once.
+             */
+            void addThreadCounters(uint16_t th_id, const PerfCounters& counters);
+
+        private:
+            Record record;
+            boost::timer::cpu_timer timer;
+            std::unique_ptr<PerfCounters> counters;
+            std::thread::id owner;
+            std::mutex mu;
+            PerfValues others;      // Counted on threads other than the owner's
+        };
+
+        static Metrics& global();
+
+        void add(const Record& record);
+
+        /**
+         * Prints a summary of each phase's hardware counters here as the phase
+         * ends, if set
+         */
+        void setReport(ostream* out) { report = out; }
+
+        vector<Record> getRecords() const;
+
+        /**
+         * Writes the run's metrics as JSON: the tool, its settings, total time
+         * and memory, then each phase in the order it finished
+         */
+        void write(ostream& out, const string& tool, uint16_t threads) const;
+
+        void save(const path& file, const string& tool, uint16_t threads) const;
+
+        /**
+         * Peak resident memory of this process so far, in bytes
+         */
+        static uint64_t peakRss();
+
+    protected:
+
+        mutable std::mutex mu;
+        vector<Record> records;
+        ostream* report = nullptr;
+        boost::timer::cpu_timer timer;     // Since the registry was created
+
+        static string escape(const string& s);
+    };
+}
@@ -0,0 +1,230 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+using boost::filesystem::path;
+
+#include <jellyfish/locks_pthread.hpp>
+
+#include <kat/jellyfish_helper.hpp>
+#include <kat/spectra_helper.hpp>
+
+namespace kat {
+
+    typedef boost::error_info<struct MultiKCounterError,string> MultiKCounterErrorInfo;
+    struct MultiKCounterException: virtual boost::exception, virtual std::exception { };
+
+    const size_t CHECKPOINT_UNITS_PER_THREAD = 2;   // Input read by each thread before the first checkpoint, in reader units
+    const double CHECKPOINT_GROWTH = 1.5;           // Each checkpoint is after this much more input than the last
+    const uint32_t CHECKPOINT_MAX_COUNT = 65536;    // Counts above this are binned together when comparing spectra
+    const double DEFAULT_ADAPTIVE_TOLERANCE = 0.02; // Spectra changing less than this between checkpoints have converged
+
+    /**
+     * Counts K-mers of several different lengths in a single pass over the input,
+     * so that reading and parsing, which dominates the cost of counting short
+     * K-mers, is only done once.  Each K-mer length is counted into its own hash.
+     *
+     * jellyfish's mer_dna has a single, global K-mer length, which is set to the
+     * longest length while counting.  Shorter K-mers are taken from the end of the
+     * longest K-mer ending at each base, and are held in the low bits of a mer_dna.
+     * This works because hash arrays only look at the first key_len bits of a key.
+     *
+     * Hashes grow in the same way as with jellyfish's cooperative hash_counter,
+     * except that all hashes share one set of synchronisation points.  Otherwise a
+     * thread waiting for one hash to grow could block another thread that is
+     * waiting for a different hash to grow.
+     *
+     * For a quick look at the input, counting can stop once the spectra have
+     * settled down.  The input is read in rounds, with a checkpoint between each
+     * that compares the spectrum of each hash with the one from the last
+     * checkpoint.  Rounds grow geometrically, so checkpoints cost little overall.
+     */
+    class MultiKCounter {
+    private:
+
+        vector<uint16_t> merLens;
+        uint16_t maxMerLen;
+        bool canonical;
+        uint16_t threads;
+        uint16_t minQual;
+        bool doSizeDoubling;
+        double sampleFraction;
+        double tolerance;
+
+        bool converged;
+        double progress;
+        double lastChange;
+        double spectrumError;
+        double distinctError;
+        vector<vector<Pos>> lastSpectra;
+
+        vector<LargeHashArrayPtr> arrays;
+        vector<LargeHashArrayPtr> newArrays;
+        unique_ptr<std::atomic<bool>[]> full;
+        jellyfish::locks::pthread::barrier sizeBarrier;
+        std::atomic<uint16_t> doneThreads;
+        std::atomic<uint16_t> sliceId;
+
+    public:
+
+        /**
+         * @param _merLens K-mer lengths to count
+         * @param hashSizes Initial size of the hash for each K-mer length
+         * @param _canonical Whether to count canonical K-mers
+         * @param _threads Number of threads to use
+         */
+        MultiKCounter(const vector<uint16_t>& _merLens, const vector<uint64_t>& hashSizes, bool _canonical, uint16_t _threads);
+
+        virtual ~MultiKCounter();
+
+        const vector<uint16_t>& getMerLens() const {
+            return merLens;
+        }
+
+        uint16_t getMinQual() const {
+            return minQual;
+        }
+
+        /**
+         * Bases with a Phred quality score lower than this are treated like
+         * invalid bases.  0 (the default) disables quality filtering.
+         */
+        void setMinQual(uint16_t minQual) {
+            this->minQual = minQual;
+        }
+
+        bool isDoSizeDoubling() const {
+            return doSizeDoubling;
+        }
+
+        /**
+         * Whether to double the size of a hash when it fills up (the default), or
+         * give up with an error
+         */
+        void setDoSizeDoubling(bool doSizeDoubling) {
+            this->doSizeDoubling = doSizeDoubling;
+        }
+
+        double getSampleFraction() const {
+            return sampleFraction;
+        }
+
+        /**
+         * Only counts this fraction of the reads, selected by a hash of the read
+         * name.  1 (the default) counts everything.
+         */
+        void setSampleFraction(double sampleFraction) {
+            this->sampleFraction = sampleFraction;
+        }
+
+        double getTolerance() const {
+            return tolerance;
+        }
+
+        /**
+         * If greater than 0, stop reading the input once no spectrum has changed
+         * by more than this since the last checkpoint (see SpectraHelper::spectraDistance).
+         * 0 (the default) reads all the input.
+         */
+        void setTolerance(double tolerance) {
+            this->tolerance = tolerance;
+        }
+
+        /**
+         * Whether counting stopped early because the spectra converged
+         */
+        bool isConverged() const {
+            return converged;
+        }
+
+        /**
+         * Approximate fraction of the input that was read
+         */
+        double getProgress() const {
+            return progress;
+        }
+
+        /**
+         * Largest change in a spectrum at the last checkpoint, or -1 if there
+         * weren't enough checkpoints to tell
+         */
+        double getLastChange() const {
+            return lastChange;
+        }
+
+        /**
+         * Uncertainty in the shape of the spectrum counted so far: the largest
+         * change, between the last two checkpoints, in the fraction of distinct
+         * K-mers found at any one frequency.  -1 if there weren't enough
+         * checkpoints to tell.
+         */
+        double getSpectrumError() const {
+            return spectrumError;
+        }
+
+        /**
+         * Uncertainty in the number of distinct K-mers per K-mer counted: its
+         * largest relative change between the last two checkpoints.  -1 if
+         * there weren't enough checkpoints to tell.
+         */
+        double getDistinctError() const {
+            return distinctError;
+        }
+
+        /**
+         * Counts all K-mers in the given sequence files.  Pipes are not supported.
+         * On return mer_dna::k() is set to the longest K-mer length, so make sure it
+         * is set appropriately before using the keys from any other hash.
+         * @param seqFiles Fasta, Fastq or BAM files to count
+         */
+        void count(const vector<path>& seqFiles);
+
+        /**
+         * Hands over the hash for the K-mer length at the given index.  Caller
+         * takes ownership of the returned hash.
+         */
+        LargeHashArrayPtr releaseHash(size_t index);
+
+    protected:
+
+        void countSlice(ParallelSeqReader& reader);
+
+        template<typename W>
+        void countSliceFixed(ParallelSeqReader& reader);
+
+        void checkpoint();
+
+        vector<Pos> spectrum(LargeHashArray& hash);
+
+        void add(size_t index, const mer_dna& key);
+
+        void done();
+
+        bool handleFull();
+
+        void doubleSize(size_t index, bool serialThread);
+    };
+}
@@ -0,0 +1,109 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <sched.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <kat/jellyfish_helper.hpp>
+
+namespace kat {
+
+    /**
+     * Where to place a hash's memory across NUMA nodes
+     */
+    enum class NumaPlacement {
+        NONE,           // Leave it wherever it was first touched
+        INTERLEAVE,     // Spread pages evenly over all nodes, for random lookups
+        SLICES          // Put each thread's slice (see region_slice) on the node that thread is pinned to
+    };
+
+    /**
+     * NUMA placement of hash memory and pinning of threads to nodes, using the
+     * mbind and sched_setaffinity system calls directly, so libnuma isn't
+     * needed.  Thread i of n is pinned to node i * nodes / n, so neighbouring
+     * threads, and their neighbouring slices of a hash, share a node.
+     *
+     * Everything is a no-op on machines with a single node.
+     */
+    class Numa {
+    public:
+
+        /**
+         * IDs of the online NUMA nodes.  A single node 0 if the machine isn't
+         * NUMA, or the topology can't be read.
+         */
+        static const vector<uint16_t>& nodes();
+
+        static bool isNuma() { return nodes().size() > 1; }
+
+        /**
+         * The node thread th_id of threads is pinned to
+         */
+        static uint16_t nodeOf(uint16_t th_id, uint16_t threads);
+
+        /**
+         * Pins the calling thread to the CPUs of the node for thread th_id of
+         * threads.  Returns false if that failed.
+         */
+        static bool pinThread(uint16_t th_id, uint16_t threads);
+
+        /**
+         * Pins the calling thread as pinThread does while in scope, then lets it
+         * run on the CPUs it could before.  Use this in tasks run on the
+         * ThreadPool, so that workers aren't left pinned for later tasks.
+         */
+        class ThreadPin {
+        public:
+            ThreadPin(uint16_t th_id, uint16_t threads, bool enabled = true);
+            ~ThreadPin();
+
+            ThreadPin(const ThreadPin&) = delete;
+            ThreadPin& operator=(const ThreadPin&) = delete;
+
+            bool isPinned() const { return pinned; }
+
+        private:
+            bool pinned;
+            cpu_set_t previous;
+        };
+
+        /**
+         * Places the hash's memory as requested, migrating any pages already in
+         * use.  For SLICES, threads should be the number of slices the hash will
+         * be iterated in.  Returns false if the kernel refused.
+         */
+        static bool place(const LargeHashArray& ary, NumaPlacement placement, uint16_t threads);
+
+        /**
+         * Parses a list of numbers and ranges as found in sysfs, e.g. "0-3,8"
+         */
+        static vector<uint16_t> parseList(const string& list);
+
+    protected:
+
+        static bool interleave(void* addr, size_t len);
+        static bool bind(void* addr, size_t len, uint16_t node);
+        static bool mbind(void* addr, size_t len, int mode, const vector<uint16_t>& nodeSet);
+        static const vector<uint16_t>& cpusOf(uint16_t node);
+    };
+}
@@ -0,0 +1,320 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using std::condition_variable;
+using std::deque;
+using std::function;
+using std::mutex;
+using std::once_flag;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+using boost::filesystem::path;
+
+namespace kat {
+
+    typedef boost::error_info<struct SeqReaderError,string> SeqReaderErrorInfo;
+    struct SeqReaderException: virtual boost::exception, virtual std::exception { };
+
+    const size_t SEQ_READER_UNIT_SIZE = 4 * 1024 * 1024;    // Target amount of sequence data handed to a thread at a time
+    const size_t SEQ_READER_MIN_UNIT_SIZE = 64 * 1024;      // Don't bother splitting smaller than this
+    const size_t SEQ_READER_LOOKBACK = 64 * 1024;           // Longest FastA header line we expect to see
+    const uint16_t PHRED_OFFSET = 33;                       // FastQ quality scores are expected to be Phred+33 encoded
+
+    /**
+     * Called for each stretch of sequence found in the input.  Every K-mer within
+     * the stretch should be processed.  Stretches never span two sequences.
+     * K-mers starting at or after position "owned" are handled by the stretch
+     * that follows, in another chunk.  These are always shorter than the reader's
+     * K-mer length, so can be ignored unless counting shorter K-mers too.
+     */
+    typedef function<void(const char* seq, size_t len, size_t owned)> SeqHandler;
+
+    /**
+     * A contiguous buffer of sequence file data, along with the range of the data
+     * that the owning thread is responsible for.  Parsing emits every K-mer (FastA)
+     * or record (FastQ) that starts within [begin, end).  Data outside this range
+     * provides the context required to do this.
+     */
+    struct SeqChunk {
+        const char* data;
+        size_t len;
+        size_t begin;
+        size_t end;
+        bool lineStartAt0;      // data[0] is known to be at the start of a line
+        bool atEof;             // Nothing follows data[len - 1] in the file
+    };
+
+    /**
+     * Lets several threads share the parsing of a single Fasta or Fastq file, so that
+     * counting a single large file can use all available cores.
+     *
+     * Uncompressed files are memory mapped and split into byte ranges.  Each thread
+     * resynchronises to the first record (FastQ) or K-mer (FastA) starting in its
+     * range, and reads past the end of its range as needed to finish the last one.
+     * BGZF files (e.g. from bgzip) are split on block boundaries, and each thread
+     * decompresses its own blocks.  Ordinary gzip files cannot be split, so are
+     * decompressed on a separate thread, which cuts the output into chunks for the
+     * parsing threads.
+     *
+     * Unaligned BAM files are also supported.  These are BGZF compressed, but records
+     * can't be found from an arbitrary offset, so blocks are decompressed in parallel
+     * batches on a separate thread, which unpacks the read sequences into chunks for
+     * the parsing threads.  Secondary and supplementary alignments are skipped.
+     *
+     * FastQ records are expected to have exactly four lines.  If a minimum quality is
+     * set, FastQ and BAM bases scoring below it break the sequence, as with
+     * jellyfish's mer_qual_iterator.  FastA input has no qualities so is unaffected.
+     *
+     * A fraction of the reads (or FastA sequences) can be sampled instead of
+     * processing everything.  Reads are selected by a hash of their name, so the
+     * same reads are picked whatever the number of threads or how the file is split.
+     *
+     * Usage: each worker thread calls process() which returns when there is no more
+     * work.  Any error is recorded and can be retrieved with getError() once all
+     * threads have finished.  Processing can be paused part way through by setting a
+     * unit limit, and resumed by raising the limit and calling process() again.
+     */
+    class ParallelSeqReader {
+    public:
+
+        enum class Compression {
+            NONE,
+            GZIP,
+            BGZF
+        };
+
+        ParallelSeqReader(const path& file, uint16_t merLen, uint16_t threads);
+
+        virtual ~ParallelSeqReader();
+
+        Compression getCompression() const {
+            return compression;
+        }
+
+        bool isFastq() const {
+            return fastq;
+        }
+
+        bool isBam() const {
+            return bam;
+        }
+
+        size_t getNbUnits() const {
+            return nbUnits;
+        }
+
+        uint16_t getMinQual() const {
+            return minQual;
+        }
+
+        /**
+         * Bases with a Phred quality score lower than this are treated like
+         * invalid bases.  0 (the default) disables quality filtering.  Must be set
+         * before processing starts.
+         */
+        void setMinQual(uint16_t minQual) {
+            this->minQual = minQual;
+        }
+
+        double getSampleFraction() const {
+            return sampleFraction;
+        }
+
+        /**
+         * Only processes this fraction of the reads.  Reads are selected by a hash
+         * of their name, ignoring any /1 or /2 suffix, so the same reads are picked
+         * on every run and from both files of a pair.  1 (the default) processes
+         * everything.  Must be set before processing starts.
+         */
+        void setSampleFraction(double sampleFraction) {
+            this->sampleFraction = sampleFraction;
+        }
+
+        size_t getUnitLimit() const {
+            return unitLimit;
+        }
+
+        /**
+         * Makes process() return once this many units of work have been handed out
+         * in total.  Raise the limit and call process() again to carry on.  No limit
+         * by default.
+         */
+        void setUnitLimit(size_t unitLimit) {
+            this->unitLimit = unitLimit;
+        }
+
+        /**
+         * Skips the first units of the file, e.g. those counted by an earlier run
+         * that was interrupted.  Units only line up if the reader was created with
+         * the same number of threads as before.  Must be set before processing
+         * starts.
+         */
+        void setFirstUnit(size_t firstUnit) {
+            this->firstUnit = firstUnit;
+            this->nextUnit = firstUnit;
+        }
+
+        /**
+         * Number of units of work handed out so far, including any skipped
+         */
+        size_t getUnitsStarted() const {
+            return nextUnit;
+        }
+
+        /**
+         * Whether the whole file has been handed out for processing, or an error
+         * occurred
+         */
+        bool isFinished();
+
+        /**
+         * Approximate fraction of the file that has been handed out for processing
+         */
+        double getProgress();
+
+        /**
+         * Processes units of work, calling handler for each stretch of sequence found,
+         * until the whole file has been processed, the unit limit is reached or an
+         * error occurs.  Thread safe.
+         */
+        void process(const SeqHandler& handler);
+
+        /**
+         * Empty unless an error occurred during processing
+         */
+        string getError() const;
+
+        /**
+         * Works out the compression used by the given file by looking at its first
+         * few bytes
+         */
+        static Compression detectCompression(const path& file);
+
+        /**
+         * Whether the given file is a BAM file, based on its contents
+         */
+        static bool isBamFile(const path& file);
+
+        /**
+         * Whether the chunk contains enough data past its end to complete processing
+         * of everything that starts within its range
+         */
+        static bool hasLookahead(const SeqChunk& chunk, bool fastq, uint16_t merLen);
+
+        /**
+         * Parses the given chunk, calling handler for each stretch of sequence starting
+         * in the chunk's range.  FastQ reads are split around bases with a Phred
+         * quality below minQual, if minQual is greater than 0.  Only reads selected
+         * by isSampled are processed.
+         */
+        static void parse(const SeqChunk& chunk, bool fastq, uint16_t merLen, const SeqHandler& handler, uint16_t minQual = 0, double sampleFraction = 1.0);
+
+        /**
+         * Whether the read with the given name is part of a sample of this fraction
+         * of all reads.  The name ends at the first whitespace, and a trailing /1
+         * or /2 is ignored.
+         */
+        static bool isSampled(const char* name, size_t len, double sampleFraction);
+
+    protected:
+
+        path file;
+        uint16_t merLen;
+        uint16_t threads;
+        Compression compression;
+        bool fastq;
+        bool bam;
+        uint16_t minQual;
+        double sampleFraction;
+        size_t unitLimit;
+
+        // Uncompressed input
+        int fd;
+        const char* mapped;
+        size_t fileSize;
+        size_t unitSize;
+
+        // BGZF input
+        vector<uint64_t> blockOffsets;  // Includes the end of the file as the last entry
+        size_t blocksPerUnit;
+
+        size_t nbUnits;
+        std::atomic<size_t> nextUnit;
+        size_t firstUnit;
+
+        // Gzip and BAM input
+        thread producer;
+        once_flag producerStarted;
+        mutex queueMutex;
+        condition_variable queueNotEmpty;
+        condition_variable queueNotFull;
+        deque<shared_ptr<string>> chunks;
+        deque<size_t> chunkEnds;
+        size_t produced;                        // Chunks cut by the producer so far
+        bool producerDone;
+        bool drained;                           // Producer is done and the queue is empty
+        bool stop;
+        std::atomic<uint64_t> compressedRead;   // How far through the file the producer is
+
+        mutable mutex errorMutex;
+        string error;
+
+        void setError(const string& msg);
+
+        bool claimUnit(size_t& unit);
+
+        void mapFile();
+
+        void indexBlocks();
+
+        void inflateBlock(size_t block, string& out) const;
+
+        void processMapped(const SeqHandler& handler);
+
+        void processBgzf(const SeqHandler& handler);
+
+        void processQueue(const SeqHandler& handler);
+
+        bool pushChunk(const shared_ptr<string>& data, size_t end);
+
+        void produceGzip();
+
+        void produceBam();
+
+        static size_t findLineStart(const char* data, size_t pos, size_t limit, bool lineStartAt0, bool& found);
+
+        static size_t resyncFastq(const SeqChunk& chunk, size_t from);
+
+        static size_t findHeader(const char* data, size_t pos, bool lineStartAt0);
+    };
+}
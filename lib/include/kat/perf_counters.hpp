@@ -0,0 +1,101 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <iostream>
+#include <string>
+using std::ostream;
+using std::string;
+
+namespace kat {
+
+    /**
+     * Hardware counter totals for some stretch of work
+     */
+    struct PerfValues {
+        uint64_t cycles;
+        uint64_t instructions;
+        uint64_t llcMisses;     // Last level cache misses
+        uint64_t dtlbMisses;    // Data TLB read misses
+
+        PerfValues() : cycles(0), instructions(0), llcMisses(0), dtlbMisses(0) {}
+
+        PerfValues& operator+=(const PerfValues& other);
+
+        double ipc() const { return cycles > 0 ? (double)instructions / cycles : 0.0; }
+
+        /**
+         * Misses per thousand instructions
+         */
+        double llcMpki() const { return instructions > 0 ? llcMisses * 1000.0 / instructions : 0.0; }
+        double dtlbMpki() const { return instructions > 0 ? dtlbMisses * 1000.0 / instructions : 0.0; }
+
+        /**
+         * One line summary, e.g. for verbose output
+         */
+        void print(ostream& out) const;
+    };
+
+    /**
+     * Counts cycles, instructions, LLC misses and dTLB misses for the calling
+     * thread, from construction until read, using perf_event_open.  Only user
+     * space is counted, so it works with the default perf_event_paranoid
+     * setting of 2 and no external profiler is needed.
+     *
+     * Counting is off unless enabled, in which case constructing one costs
+     * nothing.  Counters the kernel or CPU doesn't support read as 0.  Counts
+     * are scaled up if the kernel had to multiplex the counters.
+     */
+    class PerfCounters {
+    public:
+
+        /**
+         * Starts counting for the calling thread, and also for threads it
+         * creates from now on if inherit is set.  Inherited counts are added in
+         * as those threads exit.
+         */
+        PerfCounters(bool inherit = false);
+        ~PerfCounters();
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        /**
+         * True if at least one counter is running
+         */
+        bool isOpen() const;
+
+        PerfValues read() const;
+
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+
+        /**
+         * Whether this process can count any of the events, e.g. not if
+         * perf_event_paranoid is 3 or the machine is a VM without a virtual PMU
+         */
+        static bool isAvailable();
+
+    private:
+
+        static const int NB_EVENTS = 4;
+
+        int fds[NB_EVENTS];
+    };
+}
@@ -126,6 +126,26 @@ public:
         return mat[i][j];
     }
 
+    /**
+     * Adds every non-zero cell of other to this matrix, visiting only the cells
+     * that are set
+     */
+    void add(const SparseMatrix<T>& other) {
+        for (auto& row : other.mat) {
+            col_t& col = mat[row.first];
+            for (auto& cell : row.second) {
+                col[cell.first] += cell.second;
+            }
+        }
+    }
+
+    /**
+     * Frees all the cells, leaving an empty matrix of the same size
+     */
+    void clear() {
+        mat_t().swap(mat);
+    }
+
     T get(uint32_t i, uint32_t j) const {
         if (i >= m || j >= n) {
             BOOST_THROW_EXCEPTION(SparseMatrixException() << SparseMatrixErrorInfo(string(
@@ -314,6 +334,21 @@ public:
     virtual ~ThreadedSparseMatrix() {
     }
 
+    // Approximate bytes used by each set cell, a map node plus allocator overhead
+    static const uint64_t CELL_BYTES = 64;
+
+    /**
+     * Bytes used by one width x height matrix in the worst case, i.e. when
+     * every cell is set
+     */
+    static uint64_t maxBytes(uint16_t width, uint16_t height) {
+        return (uint64_t)width * height * CELL_BYTES;
+    }
+
+    uint16_t getThreads() const {
+        return threads;
+    }
+
     const SM64& getFinalMatrix() const {
         return final_matrix;
     }
@@ -335,6 +370,21 @@ public:
         return final_matrix;
     }
     
+    /**
+     * As mergeThreadedMatricies, but frees each thread's matrix as soon as it
+     * is merged and only visits the cells that are set.  Peak memory is lower,
+     * which matters when there are many threads, but the thread matrices are
+     * left empty.
+     */
+    const SM64& streamMergeThreadedMatricies() {
+        for (auto& tm : threaded_matricies) {
+            final_matrix.add(tm);
+            tm.clear();
+        }
+
+        return final_matrix;
+    }
+    
     uint64_t incTM(uint16_t index, size_t i, size_t j, uint64_t val) {
         return threaded_matricies[index].inc(i, j, val);
     }
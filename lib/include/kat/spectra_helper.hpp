@@ -17,8 +17,10 @@
 
 #pragma once
 
+#include <cmath>
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -128,6 +130,51 @@ namespace kat {
             return Pos();
         }
         
+        /**
+         * How different the shapes of two spectra are, regardless of how much data
+         * each was counted from.  Each spectrum is turned into the distribution of
+         * K-mer instances over relative frequency (count / total K-mers).  Returns
+         * the earth mover's distance between the two, as a fraction of the mean
+         * relative frequency in s2.  Error K-mers sit close to 0 in both, so have
+         * little effect.  Returns 1 if either spectrum is empty.
+         */
+        static double spectraDistance(const vector<Pos>& s1, const vector<Pos>& s2) {
+
+            double total1 = 0.0, total2 = 0.0;
+            for (auto& p : s1) total1 += (double)p.first * p.second;
+            for (auto& p : s2) total2 += (double)p.first * p.second;
+
+            if (total1 == 0.0 || total2 == 0.0) {
+                return 1.0;
+            }
+
+            double mean2 = 0.0;
+            for (auto& p : s2) mean2 += ((double)p.first * p.second / total2) * (p.first / total2);
+
+            // Integrate the difference between the two cumulative distributions
+            double cdf1 = 0.0, cdf2 = 0.0, x = 0.0, distance = 0.0;
+            size_t i = 0, j = 0;
+            while (i < s1.size() || j < s2.size()) {
+                double x1 = i < s1.size() ? s1[i].first / total1 : std::numeric_limits<double>::max();
+                double x2 = j < s2.size() ? s2[j].first / total2 : std::numeric_limits<double>::max();
+                double next = std::min(x1, x2);
+
+                distance += std::abs(cdf1 - cdf2) * (next - x);
+                x = next;
+
+                if (x1 == next) {
+                    cdf1 += (double)s1[i].first * s1[i].second / total1;
+                    i++;
+                }
+                if (x2 == next) {
+                    cdf2 += (double)s2[j].first * s2[j].second / total2;
+                    j++;
+                }
+            }
+
+            return distance / mean2;
+        }
+
         /*static Coord findPeak(const SparseMatrix<uint64_t>& mx) {
             
             uint64_t previous = std::numeric_limits<uint64_t>::max();
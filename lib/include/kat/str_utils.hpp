@@ -148,12 +148,16 @@ namespace kat {
         return out_str.str();
     }
 
+    static bool isGC(const char c) {
+        return c == 'G' || c == 'g' || c == 'C' || c == 'c';
+    }
+
     static uint32_t gcCount(const string& seq) {
 
         uint32_t g_or_c = 0;
 
         for (const auto& c : seq) {
-            if (c == 'G' || c == 'g' || c == 'C' || c == 'c')
+            if (isGC(c))
                 g_or_c++;
         }
 
@@ -0,0 +1,143 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using std::function;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::vector;
+
+namespace kat {
+
+    /**
+     * A fixed set of worker threads shared by every phase of a run, so phases
+     * that run many times, like sect's per-batch analysis, don't create and
+     * join threads each time.
+     *
+     * Each worker has its own queue of tasks.  Workers take tasks from the back
+     * of their own queue and, when that's empty, steal from the front of the
+     * others'.  Tasks submitted from a worker go onto that worker's queue, and
+     * tasks submitted from other threads are spread over all the queues.
+     *
+     * A thread waiting for its tasks to finish runs queued tasks while it waits.
+     * Tasks can therefore submit tasks and wait for them (nested parallelFor)
+     * without deadlocking, even when every worker is busy.
+     *
+     * Tasks must not wait for each other by any other means, e.g. a barrier,
+     * because there's no guarantee they run at the same time.  Jellyfish's
+     * cooperative hash counters synchronise their threads whenever the hash
+     * grows, so code that adds to one needs threads of its own.
+     */
+    class ThreadPool {
+    public:
+
+        ThreadPool(uint16_t threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        uint16_t size() const { return workers.size(); }
+
+        /**
+         * Runs body(i) for i in [0, n) and returns when all have finished.  The
+         * calling thread runs some of them too.  If any throw, the first
+         * exception is rethrown once all have finished.
+         */
+        void parallelFor(size_t n, const function<void(size_t)>& body);
+
+        /**
+         * Queues f to run on the pool, returning a future for its result.  Use
+         * wait rather than the future's own get or wait from inside a task.
+         */
+        template<typename F>
+        auto submit(F f) -> std::future<decltype(f())> {
+
+            typedef decltype(f()) R;
+            shared_ptr<std::packaged_task<R()>> task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+            std::future<R> result = task->get_future();
+            push([this, task]() {
+                (*task)();
+                taskFinished();
+            });
+            return result;
+        }
+
+        /**
+         * Runs queued tasks until the future is ready, then returns its result
+         */
+        template<typename T>
+        T wait(std::future<T>& f) {
+
+            helpUntil([&f]() { return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready; });
+            return f.get();
+        }
+
+        /**
+         * The pool shared by the whole run, created on first use with the
+         * number of threads given to init, or one per core if init wasn't called
+         */
+        static ThreadPool& global();
+
+        /**
+         * Sets the number of threads in the global pool.  Call once from a
+         * tool's main, before anything uses the pool.  Has no effect afterwards.
+         */
+        static void init(uint16_t threads);
+
+    protected:
+
+        struct Queue {
+            std::mutex mu;
+            std::deque<function<void()>> tasks;
+        };
+
+        vector<unique_ptr<Queue>> queues;
+        vector<std::thread> workers;
+
+        std::mutex mu;
+        std::condition_variable wake;   // Tasks queued, or a task someone's waiting for finished
+        size_t pending;                 // Tasks queued but not yet started, guarded by mu
+        std::atomic<size_t> nextQueue;
+        bool stopping;
+
+        void push(function<void()> task);
+
+        /**
+         * Takes a task off the calling thread's queue, or steals one, and runs
+         * it.  Returns false if there were none.
+         */
+        bool runOne();
+
+        void taskFinished();
+
+        void helpUntil(const function<bool()>& done);
+
+        void work(uint16_t id);
+    };
+}
@@ -0,0 +1,221 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <limits>
+#include <string>
+using std::string;
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define KAT_X86_64 1
+#endif
+
+#include <boost/lexical_cast.hpp>
+using boost::lexical_cast;
+
+#include <kat/fixed_mer.hpp>
+#include <kat/batch_lookup.hpp>
+
+/**
+ * Reverse complement of a K-mer held in the low 2K bits of a word
+ */
+static inline uint64_t revComp(uint64_t x, unsigned int merLen) {
+    x = ~x;
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    x = __builtin_bswap64(x);
+    return x >> (64 - 2 * merLen);
+}
+
+static void canonicaliseScalar(uint64_t* keys, size_t n, unsigned int merLen) {
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = std::min(keys[i], revComp(keys[i], merLen));
+    }
+}
+
+static void bucketIdsScalar(const uint64_t* tables, unsigned int nbTables, uint64_t sizeMask,
+        const uint64_t* keys, size_t n, uint64_t* ids) {
+    for (size_t i = 0; i < n; i++) {
+        uint64_t k = keys[i];
+        uint64_t res = 0;
+        for (unsigned int b = 0; b < nbTables; b++, k >>= 8) {
+            res ^= tables[(b << 8) | (k & 0xff)];
+        }
+        ids[i] = res & sizeMask;
+    }
+}
+
+#ifdef KAT_X86_64
+
+__attribute__((target("avx2")))
+static void canonicaliseAvx2(uint64_t* keys, size_t n, unsigned int merLen) {
+
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    const __m256i m2 = _mm256_set1_epi64x(0x3333333333333333LL);
+    const __m256i m4 = _mm256_set1_epi64x(0x0F0F0F0F0F0F0F0FLL);
+    const __m256i sign = _mm256_set1_epi64x(std::numeric_limits<long long>::min());
+    const __m256i bswap = _mm256_setr_epi8(
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    const __m128i shift = _mm_cvtsi32_si128(64 - 2 * merLen);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256i fwd = _mm256_loadu_si256((const __m256i*)(keys + i));
+
+        __m256i rev = _mm256_xor_si256(fwd, ones);
+        rev = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(rev, 2), m2), _mm256_slli_epi64(_mm256_and_si256(rev, m2), 2));
+        rev = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(rev, 4), m4), _mm256_slli_epi64(_mm256_and_si256(rev, m4), 4));
+        rev = _mm256_shuffle_epi8(rev, bswap);
+        rev = _mm256_srl_epi64(rev, shift);
+
+        // Unsigned minimum, via a signed compare with the top bits flipped
+        const __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(fwd, sign), _mm256_xor_si256(rev, sign));
+        _mm256_storeu_si256((__m256i*)(keys + i), _mm256_blendv_epi8(fwd, rev, gt));
+    }
+
+    canonicaliseScalar(keys + i, n - i, merLen);
+}
+
+__attribute__((target("avx2")))
+static void bucketIdsAvx2(const uint64_t* tables, unsigned int nbTables, uint64_t sizeMask,
+        const uint64_t* keys, size_t n, uint64_t* ids) {
+
+    const __m256i byteMask = _mm256_set1_epi64x(0xff);
+    const __m256i idMask = _mm256_set1_epi64x((long long)sizeMask);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i k = _mm256_loadu_si256((const __m256i*)(keys + i));
+        __m256i res = _mm256_setzero_si256();
+        for (unsigned int b = 0; b < nbTables; b++) {
+            const __m256i idx = _mm256_and_si256(k, byteMask);
+            res = _mm256_xor_si256(res, _mm256_i64gather_epi64((const long long*)(tables + (b << 8)), idx, 8));
+            k = _mm256_srli_epi64(k, 8);
+        }
+        _mm256_storeu_si256((__m256i*)(ids + i), _mm256_and_si256(res, idMask));
+    }
+
+    bucketIdsScalar(tables, nbTables, sizeMask, keys + i, n - i, ids + i);
+}
+
+#endif
+
+const size_t kat::BatchLookup::BATCH_SIZE;
+const unsigned int kat::BatchLookup::MAX_MER_LEN;
+
+bool kat::BatchLookup::hasAvx2() {
+#ifdef KAT_X86_64
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+kat::BatchLookup::BatchLookup(const LargeHashArray& _hash) : hash(_hash) {
+
+    const jellyfish::RectangularBinaryMatrix& m = hash.matrix();
+    const unsigned int c = m.c();
+
+    if (c > 2 * MAX_MER_LEN) {
+        BOOST_THROW_EXCEPTION(BatchLookupException() << BatchLookupErrorInfo(string(
+                "Batched lookups only support K-mers of up to ") + lexical_cast<string>(MAX_MER_LEN) +
+                " bases.  Hash has K-mer length: " + lexical_cast<string>(c / 2)));
+    }
+
+    merLen = c / 2;
+
+    // Key bit i selects column c - 1 - i, so precompute the product for every
+    // value of each byte
+    nbTables = (c + 7) / 8;
+    tables.assign(nbTables << 8, 0);
+    for (unsigned int b = 0; b < nbTables; b++) {
+        for (unsigned int x = 0; x < 256; x++) {
+            uint64_t v = 0;
+            for (unsigned int t = 0; t < 8; t++) {
+                const unsigned int bit = b * 8 + t;
+                if (bit < c && ((x >> t) & 1)) v ^= m[c - 1 - bit];
+            }
+            tables[(b << 8) | x] = v;
+        }
+    }
+
+    char* start = nullptr;
+    hash.block_to_ptr(0, 1, &start, &blockBytes);
+    data = start;
+    blockLen = hash.blocks_for_records(1).second;
+}
+
+void kat::BatchLookup::canonicalise(uint64_t* keys, size_t n, unsigned int merLen) {
+#ifdef KAT_X86_64
+    if (hasAvx2()) {
+        canonicaliseAvx2(keys, n, merLen);
+        return;
+    }
+#endif
+    canonicaliseScalar(keys, n, merLen);
+}
+
+void kat::BatchLookup::bucketIds(const uint64_t* keys, size_t n, uint64_t* ids) const {
+#ifdef KAT_X86_64
+    if (hasAvx2()) {
+        bucketIdsAvx2(tables.data(), nbTables, hash.size_mask(), keys, n, ids);
+        return;
+    }
+#endif
+    bucketIdsScalar(tables.data(), nbTables, hash.size_mask(), keys, n, ids);
+}
+
+void kat::BatchLookup::prefetch(const uint64_t* ids, size_t n) const {
+    for (size_t i = 0; i < n; i++) {
+        const size_t block = ids[i] / blockLen;
+        const size_t offset = (ids[i] % blockLen) * blockBytes / blockLen;
+        __builtin_prefetch(data + block * blockBytes + offset, 0, 1);
+    }
+}
+
+void kat::BatchLookup::getCounts(const uint64_t* keys, size_t n, uint64_t* counts) const {
+
+    vector<uint64_t> ids(n);
+    bucketIds(keys, n, ids.data());
+
+    mer_dna key, tmp;
+    size_t id = 0;
+    const LargeHashArray::data_word* w = nullptr;
+    const LargeHashArray::offset_t* o = nullptr;
+
+    // Fetch the next batch's buckets while probing this one
+    prefetch(ids.data(), std::min(n, BATCH_SIZE));
+
+    for (size_t start = 0; start < n; start += BATCH_SIZE) {
+        const size_t end = std::min(n, start + BATCH_SIZE);
+        if (end < n) prefetch(ids.data() + end, std::min(n - end, BATCH_SIZE));
+
+        for (size_t i = start; i < end; i++) {
+            FixedMer<uint64_t>::toMer(keys[i], key);
+            counts[i] = hash.get_key_id(key, &id, tmp, &w, &o, ids[i]) ?
+                    hash.get_val_at_id(id, w, o, true, false) :
+                    0;
+        }
+    }
+}
@@ -15,11 +15,14 @@
 //  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
 //  *******************************************************************
 
+#include <algorithm>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 #include <cmath>
+using std::istream;
 using std::ostream;
 using std::shared_ptr;
 using std::string;
@@ -28,11 +31,15 @@ using std::vector;
 using std::endl;
 
 #include <boost/filesystem/path.hpp>
+#include <boost/lexical_cast.hpp>
 using boost::filesystem::path;
+using boost::lexical_cast;
 
 #include <kat/distance_metrics.hpp>
 using kat::DistanceMetric;
 
+#include <kat/str_utils.hpp>
+
 #include <kat/comp_counters.hpp>
 
 // ********** CompCounters ***********
@@ -57,6 +64,8 @@ kat::CompCounters::CompCounters(const path& _hash1_path, const path& _hash2_path
     shared_hash1_total = 0;
     shared_hash2_total = 0;
     shared_distinct = 0;
+    hash1_targeted = false;
+    sketch_scale = 0;
     
     spectrum1.resize(_dm_size, 0);
     spectrum2.resize(_dm_size, 0);
@@ -82,6 +91,8 @@ kat::CompCounters::CompCounters(const CompCounters& o) {
     shared_hash1_total = o.shared_hash1_total;
     shared_hash2_total = o.shared_hash2_total;
     shared_distinct = o.shared_distinct;
+    hash1_targeted = o.hash1_targeted;
+    sketch_scale = o.sketch_scale;
     spectrum1 = o.spectrum1;
     spectrum2 = o.spectrum2;
     shared_spectrum1 = o.shared_spectrum1;
@@ -152,6 +163,16 @@ void kat::CompCounters::printCounts(ostream &out) {
 
     out << endl;
 
+    if (sketch_scale > 0) {
+        out << "Note: these statistics are estimates from sketches keeping 1 in " << sketch_scale << " K-mers, "
+            << "scaled up to the whole hashes." << endl << endl;
+    }
+
+    if (hash1_targeted) {
+        out << "Note: hash 1 was counted targeting only K-mers found in hash 2.  K-mers only found in hash 1 are "
+            << "included in the totals, but not in the distinct counts, spectra or distances." << endl << endl;
+    }
+
     out << "Total K-mers in: " << endl;
     out << " - Hash 1: " << hash1_total << endl;
     out << " - Hash 2: " << hash2_total << endl;
@@ -162,7 +183,10 @@ void kat::CompCounters::printCounts(ostream &out) {
     out << endl;
 
     out << "Distinct K-mers in:" << endl;
-    out << " - Hash 1: " << hash1_distinct << endl;
+    if (hash1_targeted)
+        out << " - Hash 1: unknown (targeted counting)" << endl;
+    else
+        out << " - Hash 1: " << hash1_distinct << endl;
     out << " - Hash 2: " << hash2_distinct << endl;
     if (hash3_total > 0)
         out << " - Hash 3: " << hash3_distinct << endl;
@@ -175,7 +199,10 @@ void kat::CompCounters::printCounts(ostream &out) {
     out << endl;
 
     out << "Distinct K-mers only found in:" << endl;
-    out << " - Hash 1: " << hash1_only_distinct << endl;
+    if (hash1_targeted)
+        out << " - Hash 1: unknown (targeted counting)" << endl;
+    else
+        out << " - Hash 1: " << hash1_only_distinct << endl;
     out << " - Hash 2: " << hash2_only_distinct << endl << endl;
 
     out << "Shared K-mers:" << endl;
@@ -206,6 +233,179 @@ void kat::CompCounters::printCounts(ostream &out) {
 }
      
 
+void kat::CompCounters::add(const CompCounters& o) {
+
+    if (o.spectrum1.size() != spectrum1.size() || o.shared_spectrum1.size() != shared_spectrum1.size()) {
+        BOOST_THROW_EXCEPTION(CompCountersException() << CompCountersErrorInfo(string(
+                "Can't add counters with spectra of different sizes: ") + 
+                lexical_cast<string>(spectrum1.size()) + " and " + lexical_cast<string>(o.spectrum1.size())));
+    }
+
+    hash1_total += o.hash1_total;
+    hash2_total += o.hash2_total;
+    hash3_total += o.hash3_total;
+    hash1_distinct += o.hash1_distinct;
+    hash2_distinct += o.hash2_distinct;
+    hash3_distinct += o.hash3_distinct;
+    hash1_only_total += o.hash1_only_total;
+    hash2_only_total += o.hash2_only_total;
+    hash1_only_distinct += o.hash1_only_distinct;
+    hash2_only_distinct += o.hash2_only_distinct;
+    shared_hash1_total += o.shared_hash1_total;
+    shared_hash2_total += o.shared_hash2_total;
+    shared_distinct += o.shared_distinct;
+    hash1_targeted = hash1_targeted || o.hash1_targeted;
+    sketch_scale = std::max(sketch_scale, o.sketch_scale);
+
+    addSpectrum(spectrum1, o.spectrum1);
+    addSpectrum(spectrum2, o.spectrum2);
+    addSpectrum(shared_spectrum1, o.shared_spectrum1);
+    addSpectrum(shared_spectrum2, o.shared_spectrum2);
+}
+
+void kat::CompCounters::scaleUp(uint64_t factor) {
+
+    hash1_total *= factor;
+    hash2_total *= factor;
+    hash3_total *= factor;
+    hash1_distinct *= factor;
+    hash2_distinct *= factor;
+    hash3_distinct *= factor;
+    hash1_only_total *= factor;
+    hash2_only_total *= factor;
+    hash1_only_distinct *= factor;
+    hash2_only_distinct *= factor;
+    shared_hash1_total *= factor;
+    shared_hash2_total *= factor;
+    shared_distinct *= factor;
+
+    for (auto* spectrum : { &spectrum1, &spectrum2, &shared_spectrum1, &shared_spectrum2 }) {
+        for (auto& v : *spectrum) {
+            v *= factor;
+        }
+    }
+}
+
+void kat::CompCounters::addSpectrum(vector<uint64_t>& spectrum, const vector<uint64_t>& other) {
+    
+    for(size_t i = 0; i < spectrum.size(); i++) {
+        spectrum[i] += other[i];
+    }
+}
+
+static void saveSpectrum(ostream &out, const string& name, const vector<uint64_t>& spectrum) {
+    
+    out << name;
+    for(auto v : spectrum) {
+        out << " " << v;
+    }
+    out << endl;
+}
+
+void kat::CompCounters::save(ostream &out) const {
+
+    out << COUNTERS_MAGIC << endl
+        << "hash1_path " << hash1_path.string() << endl
+        << "hash2_path " << hash2_path.string() << endl
+        << "hash3_path " << hash3_path.string() << endl
+        << "hash1_total " << hash1_total << endl
+        << "hash2_total " << hash2_total << endl
+        << "hash3_total " << hash3_total << endl
+        << "hash1_distinct " << hash1_distinct << endl
+        << "hash2_distinct " << hash2_distinct << endl
+        << "hash3_distinct " << hash3_distinct << endl
+        << "hash1_only_total " << hash1_only_total << endl
+        << "hash2_only_total " << hash2_only_total << endl
+        << "hash1_only_distinct " << hash1_only_distinct << endl
+        << "hash2_only_distinct " << hash2_only_distinct << endl
+        << "shared_hash1_total " << shared_hash1_total << endl
+        << "shared_hash2_total " << shared_hash2_total << endl
+        << "shared_distinct " << shared_distinct << endl
+        << "hash1_targeted " << hash1_targeted << endl
+        << "sketch_scale " << sketch_scale << endl;
+    
+    saveSpectrum(out, "spectrum1", spectrum1);
+    saveSpectrum(out, "spectrum2", spectrum2);
+    saveSpectrum(out, "shared_spectrum1", shared_spectrum1);
+    saveSpectrum(out, "shared_spectrum2", shared_spectrum2);
+}
+
+kat::CompCounters kat::CompCounters::load(istream &in) {
+
+    string line;
+    if (!getline(in, line) || line != COUNTERS_MAGIC) {
+        BOOST_THROW_EXCEPTION(CompCountersException() << CompCountersErrorInfo(string(
+                "Not a KAT comp counters file")));
+    }
+    
+    CompCounters cc(0);
+    
+    std::map<string, uint64_t*> fields = {
+        { "hash1_total", &cc.hash1_total },
+        { "hash2_total", &cc.hash2_total },
+        { "hash3_total", &cc.hash3_total },
+        { "hash1_distinct", &cc.hash1_distinct },
+        { "hash2_distinct", &cc.hash2_distinct },
+        { "hash3_distinct", &cc.hash3_distinct },
+        { "hash1_only_total", &cc.hash1_only_total },
+        { "hash2_only_total", &cc.hash2_only_total },
+        { "hash1_only_distinct", &cc.hash1_only_distinct },
+        { "hash2_only_distinct", &cc.hash2_only_distinct },
+        { "shared_hash1_total", &cc.shared_hash1_total },
+        { "shared_hash2_total", &cc.shared_hash2_total },
+        { "shared_distinct", &cc.shared_distinct },
+        { "sketch_scale", &cc.sketch_scale }
+    };
+    
+    std::map<string, vector<uint64_t>*> spectra = {
+        { "spectrum1", &cc.spectrum1 },
+        { "spectrum2", &cc.spectrum2 },
+        { "shared_spectrum1", &cc.shared_spectrum1 },
+        { "shared_spectrum2", &cc.shared_spectrum2 }
+    };
+    
+    while (getline(in, line)) {
+        
+        if (line.empty()) continue;
+        
+        const size_t sep = line.find(' ');
+        const string key = line.substr(0, sep);
+        const string value = sep == string::npos ? string() : line.substr(sep + 1);
+        
+        try {
+            if (key == "hash1_path") {
+                cc.hash1_path = value;
+            }
+            else if (key == "hash2_path") {
+                cc.hash2_path = value;
+            }
+            else if (key == "hash3_path") {
+                cc.hash3_path = value;
+            }
+            else if (key == "hash1_targeted") {
+                cc.hash1_targeted = lexical_cast<bool>(value);
+            }
+            else if (fields.count(key)) {
+                *fields[key] = lexical_cast<uint64_t>(value);
+            }
+            else if (spectra.count(key)) {
+                *spectra[key] = kat::splitUInt64(value, ' ');
+            }
+            else {
+                BOOST_THROW_EXCEPTION(CompCountersException() << CompCountersErrorInfo(string(
+                        "Unknown entry in comp counters file: ") + key));
+            }
+        }
+        catch (boost::bad_lexical_cast& e) {
+            BOOST_THROW_EXCEPTION(CompCountersException() << CompCountersErrorInfo(string(
+                    "Could not parse comp counters entry: ") + line));
+        }
+    }
+    
+    return cc;
+}
+     
+
 // ******** ThreadedCompCounters *********
 
 kat::ThreadedCompCounters::ThreadedCompCounters() : ThreadedCompCounters("", "", "", DEFAULT_NB_BINS) {}
@@ -231,32 +431,6 @@ void kat::ThreadedCompCounters::merge() {
 
     // Merge counters
     for (const auto& itp : threaded_counters) {
-
-        final_matrix.hash1_total += itp.hash1_total;
-        final_matrix.hash2_total += itp.hash2_total;
-        final_matrix.hash3_total += itp.hash3_total;
-        final_matrix.hash1_distinct += itp.hash1_distinct;
-        final_matrix.hash2_distinct += itp.hash2_distinct;
-        final_matrix.hash3_distinct += itp.hash3_distinct;
-        final_matrix.hash1_only_total += itp.hash1_only_total;
-        final_matrix.hash2_only_total += itp.hash2_only_total;
-        final_matrix.hash1_only_distinct += itp.hash1_only_distinct;
-        final_matrix.hash2_only_distinct += itp.hash2_only_distinct;
-        final_matrix.shared_hash1_total += itp.shared_hash1_total;
-        final_matrix.shared_hash2_total += itp.shared_hash2_total;
-        final_matrix.shared_distinct += itp.shared_distinct;
-        
-        merge_spectrum(final_matrix.spectrum1, itp.spectrum1);
-        merge_spectrum(final_matrix.spectrum2, itp.spectrum2);
-        merge_spectrum(final_matrix.shared_spectrum1, itp.shared_spectrum1);
-        merge_spectrum(final_matrix.shared_spectrum2, itp.shared_spectrum2);
-    }
-}
-
-        
-void kat::ThreadedCompCounters::merge_spectrum(vector<uint64_t>& spectrum, const vector<uint64_t>& threaded_spectrum) {
-    
-    for(size_t i = 0; i < spectrum.size(); i++) {
-        spectrum[i] += threaded_spectrum[i];
+        final_matrix.add(itp);
     }
 }
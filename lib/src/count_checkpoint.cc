@@ -0,0 +1,269 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+using std::cerr;
+using std::endl;
+using std::ifstream;
+using std::ofstream;
+using std::ostringstream;
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+using boost::lexical_cast;
+
+#include <kat/count_checkpoint.hpp>
+
+static const string STATE_VERSION = "kat-count-checkpoint-v1";
+
+/**
+ * Flushes a file or directory to disk, so a checkpoint survives the node going down
+ */
+static bool syncPath(const path& p) {
+    int fd = ::open(p.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+kat::CountCheckpoint::CountCheckpoint(const path& _dir, double _interval) : 
+    dir(_dir), interval(_interval), threads(1), canonical(false), generation(0), writer(0), nbSaved(0),
+    last(std::chrono::steady_clock::now()) {
+}
+
+kat::CountCheckpoint::~CountCheckpoint() {
+    wait();
+}
+
+void kat::CountCheckpoint::setRun(const vector<path>& inputs, const vector<uint16_t>& merLens, bool canonical, 
+        uint16_t minQual, double sampleFraction, uint16_t threads) {
+
+    this->merLens = merLens;
+    this->canonical = canonical;
+    this->threads = threads;
+
+    ostringstream desc;
+    desc << "canonical " << canonical << endl
+         << "min_qual " << minQual << endl
+         << "sample_fraction " << sampleFraction << endl
+         << "mer_lens";
+    for (auto k : merLens) {
+        desc << " " << k;
+    }
+    desc << endl;
+    for (auto& p : inputs) {
+        desc << "input " << bfs::file_size(p) << " " << bfs::last_write_time(p) << " " << bfs::canonical(p).string() << endl;
+    }
+    run = desc.str();
+}
+
+path kat::CountCheckpoint::hashPath(uint64_t gen, uint16_t merLen) const {
+    return dir / ("hash-" + lexical_cast<string>(gen) + ".jf" + lexical_cast<string>(merLen));
+}
+
+bool kat::CountCheckpoint::load(vector<LargeHashArrayPtr>& hashes, Position& position, uint16_t& threads) {
+
+    if (!exists()) {
+        return false;
+    }
+
+    ifstream in(statePath().c_str());
+    string line;
+    std::getline(in, line);
+    if (line != STATE_VERSION) {
+        BOOST_THROW_EXCEPTION(CountCheckpointException() << CountCheckpointErrorInfo(string(
+                "Not a KAT counting checkpoint: ") + statePath().string()));
+    }
+
+    ostringstream saved;
+    uint64_t gen = 0;
+    bool complete = false;
+    while (std::getline(in, line)) {
+        vector<string> parts;
+        boost::split(parts, line, boost::is_any_of(" "));
+        if (parts[0] == "generation" && parts.size() == 2) {
+            gen = lexical_cast<uint64_t>(parts[1]);
+        }
+        else if (parts[0] == "threads" && parts.size() == 2) {
+            threads = lexical_cast<uint16_t>(parts[1]);
+        }
+        else if (parts[0] == "position" && parts.size() == 3) {
+            position.file = lexical_cast<size_t>(parts[1]);
+            position.unit = lexical_cast<size_t>(parts[2]);
+            complete = true;
+        }
+        else {
+            saved << line << endl;
+        }
+    }
+
+    if (!complete) {
+        BOOST_THROW_EXCEPTION(CountCheckpointException() << CountCheckpointErrorInfo(string(
+                "Checkpoint is incomplete: ") + statePath().string()));
+    }
+
+    if (saved.str() != run) {
+        BOOST_THROW_EXCEPTION(CountCheckpointException() << CountCheckpointErrorInfo(string(
+                "The checkpoint in ") + dir.string() + " is from a count of different input files, or with different settings, " + 
+                "or the input files have changed since.  Remove it, or use another checkpoint directory, to start again."));
+    }
+
+    hashes.clear();
+    for (auto k : merLens) {
+        HashLoader loader;
+        loader.loadHash(hashPath(gen, k), false);
+        hashes.push_back(loader.releaseHash());
+    }
+
+    // Later checkpoints carry on splitting the input the same way
+    this->threads = threads;
+    generation = gen;
+    last = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool kat::CountCheckpoint::due() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count() >= interval;
+}
+
+bool kat::CountCheckpoint::write(const vector<LargeHashArrayPtr>& hashes, const Position& position, uint64_t gen) const {
+
+    try {
+        for (size_t i = 0; i < hashes.size(); i++) {
+
+            mer_dna::k(merLens[i]);
+
+            file_header header;
+            header.fill_standard();
+            header.update_from_ary(*hashes[i]);
+            header.counter_len(4);
+            header.canonical(canonical);
+            header.format(binary_dumper::format);
+
+            path p = hashPath(gen, merLens[i]);
+            path tmp = path(p.string() + ".tmp");
+            JellyfishHelper::dumpHash(hashes[i], header, 1, tmp, true);
+            if (!syncPath(tmp)) return false;
+            bfs::rename(tmp, p);
+        }
+
+        path tmp = path(statePath().string() + ".tmp");
+        {
+            ofstream out(tmp.c_str());
+            out << STATE_VERSION << endl
+                << run
+                << "generation " << gen << endl
+                << "threads " << threads << endl
+                << "position " << position.file << " " << position.unit << endl;
+            out.close();
+            if (!out) return false;
+        }
+        if (!syncPath(tmp)) return false;
+        bfs::rename(tmp, statePath());
+        syncPath(dir);
+
+        // The previous checkpoint is no longer needed
+        boost::system::error_code ec;
+        for (auto k : merLens) {
+            bfs::remove(hashPath(gen - 1, k), ec);
+        }
+    }
+    catch(...) {
+        return false;
+    }
+
+    return true;
+}
+
+void kat::CountCheckpoint::save(const vector<LargeHashArrayPtr>& hashes, const Position& position) {
+
+    wait();
+
+    bfs::create_directories(dir);
+
+    generation++;
+    last = std::chrono::steady_clock::now();
+
+    // The child sees the hashes as they are now, while counting carries on here
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(write(hashes, position, generation) ? 0 : 1);
+    }
+    
+    if (pid > 0) {
+        writer = pid;
+    }
+    else if (write(hashes, position, generation)) {
+        nbSaved++;
+    }
+    else {
+        cerr << "Warning: failed to write a checkpoint to " << dir.string() << endl;
+    }
+}
+
+bool kat::CountCheckpoint::wait() {
+
+    if (writer == 0) {
+        return true;
+    }
+
+    int status = 0;
+    const bool ok = waitpid(writer, &status, 0) == writer && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    writer = 0;
+
+    if (ok) {
+        nbSaved++;
+    }
+    else {
+        cerr << "Warning: failed to write a checkpoint to " << dir.string() << endl;
+    }
+    return ok;
+}
+
+void kat::CountCheckpoint::remove() {
+
+    wait();
+
+    if (!bfs::is_directory(dir)) {
+        return;
+    }
+
+    boost::system::error_code ec;
+    bfs::remove(statePath(), ec);
+    bfs::remove(path(statePath().string() + ".tmp"), ec);
+    vector<path> hashes;
+    for (bfs::directory_iterator it(dir); it != bfs::directory_iterator(); ++it) {
+        if (boost::starts_with(it->path().filename().string(), "hash-")) {
+            hashes.push_back(it->path());
+        }
+    }
+    for (auto& p : hashes) {
+        bfs::remove(p, ec);
+    }
+}
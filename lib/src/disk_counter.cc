@@ -0,0 +1,443 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+using std::deque;
+using std::ifstream;
+using std::lock_guard;
+using std::make_shared;
+using std::pair;
+using std::priority_queue;
+using std::thread;
+using std::unique_ptr;
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+namespace bfs = boost::filesystem;
+using boost::lexical_cast;
+
+#include <jellyfish/jellyfish.hpp>
+#include <jellyfish/large_hash_array.hpp>
+#include <jellyfish/rectangular_binary_matrix.hpp>
+using jellyfish::RectangularBinaryMatrix;
+
+#include <kat/jellyfish_helper.hpp>
+#include <kat/disk_counter.hpp>
+#include <kat/thread_pool.hpp>
+
+namespace kat {
+
+    /**
+     * A single K-mer count read back from a bucket's run file, along with its
+     * position in the final hash, which determines the sort order.
+     */
+    struct DiskRecord {
+        uint64_t pos;
+        mer_dna key;
+        uint64_t val;
+        size_t run;
+
+        bool operator<(const DiskRecord& o) const {
+            return pos == o.pos ? key < o.key : pos < o.pos;
+        }
+
+        bool operator>(const DiskRecord& o) const {
+            return pos == o.pos ? key > o.key : pos > o.pos;
+        }
+    };
+
+    // 2-bit codes for each base.  Anything other than ACGT (in either case) is -1.
+    static int8_t baseCode(const char c) {
+        switch (c) {
+            case 'A': case 'a': return 0;
+            case 'C': case 'c': return 1;
+            case 'G': case 'g': return 2;
+            case 'T': case 't': return 3;
+            default: return -1;
+        }
+    }
+}
+
+kat::DiskCounter::DiskCounter(uint16_t _merLen, bool _canonical, uint64_t _maxMemory, uint16_t _threads) :
+    merLen(_merLen), canonical(_canonical), maxMemory(_maxMemory), threads(_threads) {
+
+    minimizerLen = std::min(DEFAULT_MINIMIZER_LEN, merLen);
+    nbBuckets = 0;
+    minQual = 0;
+    verbose = false;
+    distinct = 0;
+
+    // Create a private working directory for the bucket and run files
+    string tmpl = (bfs::temp_directory_path() / "kat-disk-count-XXXXXX").string();
+    vector<char> dir(tmpl.begin(), tmpl.end());
+    dir.push_back('\0');
+    if (mkdtemp(dir.data()) == NULL) {
+        BOOST_THROW_EXCEPTION(DiskCounterException() << DiskCounterErrorInfo(string(
+                "Could not create temporary directory for out-of-core counting: ") + tmpl));
+    }
+    workDir = path(dir.data());
+}
+
+kat::DiskCounter::~DiskCounter() {
+    boost::system::error_code ec;
+    bfs::remove_all(workDir, ec);
+}
+
+uint16_t kat::DiskCounter::calcNbBuckets(uint64_t inputBytes, uint16_t merLen, uint64_t maxMemory) {
+
+    if (inputBytes == 0) {
+        return DEFAULT_DISK_BUCKETS;
+    }
+
+    // Bytes required per K-mer in a hash of a representative size
+    const size_t sample = (size_t)1 << 20;
+    LargeHashArray::usage_info ui(merLen * 2, 7, 126);
+    const double bytesPerKmer = (double)ui.mem(sample) / (double)sample;
+
+    // Allow for the hash to double in size once while counting a bucket
+    const double required = (double)inputBytes * bytesPerKmer * 2.0;
+
+    uint64_t n = (uint64_t)std::ceil(required / (double)std::max(maxMemory, (uint64_t)1));
+    return (uint16_t)std::max((uint64_t)1, std::min(n, (uint64_t)MAX_DISK_BUCKETS));
+}
+
+void kat::DiskCounter::count(const vector<path>& seqFiles, const path& outputFile) {
+
+    if (maxMemory == 0) {
+        BOOST_THROW_EXCEPTION(DiskCounterException() << DiskCounterErrorInfo(string(
+                "Out-of-core counting requires a memory limit greater than 0")));
+    }
+
+    if (minimizerLen == 0 || minimizerLen > merLen || minimizerLen > 31) {
+        BOOST_THROW_EXCEPTION(DiskCounterException() << DiskCounterErrorInfo(string(
+                "Minimizer length must be between 1 and the smaller of the K-mer length and 31.  Minimizer length: ") +
+                lexical_cast<string>(minimizerLen)));
+    }
+
+    for (auto& p : seqFiles) {
+        if (!JellyfishHelper::isPipe(p) && ParallelSeqReader::detectCompression(p) != ParallelSeqReader::Compression::NONE) {
+            BOOST_THROW_EXCEPTION(DiskCounterException() << DiskCounterErrorInfo(string(
+                    "Out-of-core counting does not support compressed input.  Please decompress first: ") + p.string()));
+        }
+    }
+
+    if (nbBuckets == 0) {
+        uint64_t inputBytes = 0;
+        for (auto& p : seqFiles) {
+            if (JellyfishHelper::isPipe(p)) {
+                inputBytes = 0;
+                break;
+            }
+            inputBytes += bfs::file_size(p);
+        }
+        nbBuckets = calcNbBuckets(inputBytes, merLen, maxMemory);
+    }
+
+    if (verbose) {
+        cerr << endl
+             << "Out-of-core counting:" << endl
+             << " - Temporary directory: " << workDir.string() << endl
+             << " - Memory limit (bytes): " << maxMemory << endl
+             << " - Minimizer length: " << minimizerLen << endl
+             << " - # buckets: " << nbBuckets << endl << endl;
+    }
+
+    partition(seqFiles);
+
+    countBuckets();
+
+    file_header header = createHeader();
+
+    merge(header, outputFile);
+}
+
+void kat::DiskCounter::partition(const vector<path>& seqFiles) {
+
+    bucketFiles.clear();
+    vector<shared_ptr<ofstream>> buckets;
+    for (uint16_t i = 0; i < nbBuckets; i++) {
+        path p = workDir / (string("bucket_") + lexical_cast<string>(i) + ".fa");
+        bucketFiles.push_back(p);
+        buckets.push_back(make_shared<ofstream>(p.c_str()));
+        if (!buckets.back()->good()) {
+            BOOST_THROW_EXCEPTION(DiskCounterException() << DiskCounterErrorInfo(string(
+                    "Could not open bucket file for writing: ") + p.string()));
+        }
+    }
+    vector<mutex> locks(nbBuckets);
+
+    // Each thread buffers a little data for every bucket before writing it out,
+    // so make sure that doesn't eat much into the memory limit
+    size_t flushSize = std::max((uint64_t)4096, std::min((uint64_t)1 << 20, maxMemory / (4 * threads * nbBuckets)));
+
+    vector<const char*> paths;
+    for (auto& p : seqFiles) {
+        paths.push_back(p.c_str());
+    }
+
+    StreamManager streams(paths.begin(), paths.end(), (int) std::min(paths.size(), (size_t) threads));
+    ReadParser parser(3 * threads, 100, streams.nb_streams(), streams);
+
+    ThreadPool::global().parallelFor(threads, [&](size_t i) {
+        partitionSlice(parser, buckets, locks, flushSize);
+    });
+
+    for (auto& b : buckets) {
+        b->close();
+    }
+}
+
+void kat::DiskCounter::partitionSlice(ReadParser& parser, vector<shared_ptr<ofstream>>& buckets, vector<mutex>& locks, size_t flushSize) {
+
+    vector<string> buffers(nbBuckets);
+
+    const uint16_t k = merLen;
+    const uint16_t m = minimizerLen;
+    const uint16_t w = k - m + 1;   // Number of m-mers in a K-mer
+    const uint64_t mask = m == 32 ? ~(uint64_t)0 : ((uint64_t)1 << (2 * m)) - 1;
+    const uint16_t rcShift = 2 * (m - 1);
+    const char minQualChar = minQual > 0 ? (char)std::min<uint16_t>(PHRED_OFFSET + minQual, 127) : 0;
+
+    auto flush = [&](uint16_t bucket) {
+        lock_guard<mutex> lock(locks[bucket]);
+        buckets[bucket]->write(buffers[bucket].data(), buffers[bucket].size());
+        buffers[bucket].clear();
+    };
+
+    while (true) {
+        ReadParser::job j(parser);
+        if (j.is_empty()) break;
+
+        for (size_t i = 0; i < j->nb_filled; i++) {
+
+            const string& seq = j->data[i].seq;
+            const string& qual = j->data[i].qual;
+
+            uint64_t fwd = 0, rev = 0;
+            uint64_t validLen = 0;
+            deque<pair<uint64_t, uint64_t>> window;     // (hash, end position) of m-mers, increasing by hash
+
+            int32_t current = -1;       // Bucket of the current super K-mer
+            uint64_t start = 0;         // Start of the current super K-mer in seq
+
+            auto emit = [&](uint64_t end) {
+                if (current >= 0) {
+                    string& b = buffers[current];
+                    b += ">\n";
+                    for (uint64_t p = start; p < end; p++) {
+                        b += (char)toupper(seq[p]);
+                    }
+                    b += '\n';
+                    if (b.size() >= flushSize) flush(current);
+                }
+                current = -1;
+            };
+
+            for (uint64_t pos = 0; pos < seq.size(); pos++) {
+
+                const int8_t c = minQualChar > 0 && pos < qual.size() && qual[pos] < minQualChar ? -1 : baseCode(seq[pos]);
+
+                if (c < 0) {
+                    emit(pos);
+                    validLen = 0;
+                    fwd = 0;
+                    rev = 0;
+                    window.clear();
+                    continue;
+                }
+
+                validLen++;
+                fwd = ((fwd << 2) | c) & mask;
+                rev = (rev >> 2) | ((uint64_t)(3 - c) << rcShift);
+
+                if (validLen >= m) {
+                    const uint64_t h = hashMinimizer(canonical ? std::min(fwd, rev) : fwd);
+                    while (!window.empty() && window.back().first > h) {
+                        window.pop_back();
+                    }
+                    window.push_back(pair<uint64_t, uint64_t>(h, pos));
+                }
+
+                if (validLen >= k) {
+                    while (window.front().second + w <= pos) {
+                        window.pop_front();
+                    }
+
+                    const int32_t bucket = window.front().first % nbBuckets;
+                    if (bucket != current) {
+                        // The super K-mer ends with the previous K-mer, which finishes at pos - 1
+                        emit(pos);
+                        current = bucket;
+                        start = pos + 1 - k;
+                    }
+                }
+            }
+
+            emit(seq.size());
+        }
+    }
+
+    for (uint16_t b = 0; b < nbBuckets; b++) {
+        if (!buffers[b].empty()) flush(b);
+    }
+}
+
+void kat::DiskCounter::countBuckets() {
+
+    runFiles.clear();
+    distinct = 0;
+
+    LargeHashArray::usage_info ui(merLen * 2, 7, 126);
+
+    // Leave room for the hash to double once if our estimate is too small
+    const uint64_t maxSize = ui.size(maxMemory / 2);
+
+    for (uint16_t i = 0; i < nbBuckets; i++) {
+
+        path runFile = workDir / (string("run_") + lexical_cast<string>(i) + ".bin");
+        runFiles.push_back(runFile);
+        ofstream out(runFile.c_str(), std::ios::out | std::ios::binary);
+
+        const uint64_t bucketBytes = bfs::file_size(bucketFiles[i]);
+
+        if (bucketBytes > 0) {
+
+            // Bucket size on disk is an upper bound on the number of K-mers it holds
+            const uint64_t hashSize = std::max((uint64_t)1024, std::min(maxSize, (uint64_t)ui.asize(bucketBytes)));
+
+            HashCounter counter(hashSize, merLen * 2, 7, threads);
+            counter.do_size_doubling(true);
+
+            LargeHashArrayPtr ary = JellyfishHelper::countSeqFile(bucketFiles[i], counter, canonical, threads);
+
+            binary_writer writer(4, merLen * 2);
+            LargeHashArray::eager_iterator it = ary->eager_slice(0, 1);
+            while (it.next()) {
+                writer.write(out, it.key(), it.val());
+                distinct++;
+            }
+        }
+
+        out.close();
+
+        // Bucket contents no longer required
+        bfs::remove(bucketFiles[i]);
+    }
+}
+
+file_header kat::DiskCounter::createHeader() {
+
+    const uint16_t keyLen = merLen * 2;
+    const uint16_t lsize = std::min((uint16_t)jellyfish::ceilLog2(std::max(distinct, (uint64_t)1) * 2), keyLen);
+
+    RectangularBinaryMatrix matrix(lsize, keyLen);
+    matrix.randomize_pseudo_inverse();
+
+    file_header header;
+    header.fill_standard();
+    header.size((size_t)1 << lsize);
+    header.key_len(keyLen);
+    header.val_len(7);
+    header.max_reprobe(126);
+    header.set_reprobes(jellyfish::quadratic_reprobes);
+    header.matrix(matrix);
+    header.counter_len(4);
+    header.canonical(canonical);
+    header.format(binary_dumper::format);
+
+    return header;
+}
+
+void kat::DiskCounter::merge(file_header& header, const path& outputFile) {
+
+    binary_writer writer(header.counter_len(), header.key_len());
+
+    // Sort each run into hash order.  Each run holds the distinct K-mers from a
+    // single bucket, so should be comfortably within the memory limit.
+    for (auto& runFile : runFiles) {
+
+        vector<DiskRecord> records;
+        {
+            ifstream in(runFile.c_str(), std::ios::in | std::ios::binary);
+            binary_reader reader(in, &header);
+            while (reader.next()) {
+                records.push_back(DiskRecord{ reader.pos(), reader.key(), reader.val(), 0 });
+            }
+        }
+
+        std::sort(records.begin(), records.end());
+
+        ofstream out(runFile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        for (auto& r : records) {
+            writer.write(out, r.key, r.val);
+        }
+    }
+
+    // K-way merge of the sorted runs into the final hash
+    vector<unique_ptr<ifstream>> streams;
+    vector<unique_ptr<binary_reader>> readers;
+    priority_queue<DiskRecord, vector<DiskRecord>, std::greater<DiskRecord>> heap;
+
+    for (size_t i = 0; i < runFiles.size(); i++) {
+        streams.push_back(unique_ptr<ifstream>(new ifstream(runFiles[i].c_str(), std::ios::in | std::ios::binary)));
+        readers.push_back(unique_ptr<binary_reader>(new binary_reader(*streams[i], &header)));
+        if (readers[i]->next()) {
+            heap.push(DiskRecord{ readers[i]->pos(), readers[i]->key(), readers[i]->val(), i });
+        }
+    }
+
+    ofstream out(outputFile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.good()) {
+        BOOST_THROW_EXCEPTION(DiskCounterException() << DiskCounterErrorInfo(string(
+                "Could not open output file for writing: ") + outputFile.string()));
+    }
+
+    header.write(out);
+
+    while (!heap.empty()) {
+        const DiskRecord top = heap.top();
+        heap.pop();
+        writer.write(out, top.key, top.val);
+
+        binary_reader& reader = *readers[top.run];
+        if (reader.next()) {
+            heap.push(DiskRecord{ reader.pos(), reader.key(), reader.val(), top.run });
+        }
+    }
+
+    out.close();
+
+    for (auto& runFile : runFiles) {
+        bfs::remove(runFile);
+    }
+}
@@ -0,0 +1,194 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define KAT_X86_64 1
+#endif
+
+#include <kat/batch_lookup.hpp>
+#include <kat/thread_pool.hpp>
+
+#include <kat/distance_matrix.hpp>
+
+static void addSumsScalar(const double* a, const double* b, size_t n, kat::PairSums& s) {
+    for (size_t i = 0; i < n; i++) {
+        const double diff = std::abs(a[i] - b[i]);
+        const double total = a[i] + b[i];
+        s.l1 += diff;
+        s.l2 += diff * diff;
+        s.dot += a[i] * b[i];
+        s.minSum += std::min(a[i], b[i]);
+        s.maxSum += std::max(a[i], b[i]);
+        if (total > 0.0) s.canberra += diff / total;
+    }
+}
+
+#ifdef KAT_X86_64
+
+__attribute__((target("avx2")))
+static double sumLanes(__m256d v) {
+    double lanes[4];
+    _mm256_storeu_pd(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx2")))
+static void addSumsAvx2(const double* a, const double* b, size_t n, kat::PairSums& s) {
+
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d l1 = zero, l2 = zero, dot = zero, minSum = zero, maxSum = zero, canberra = zero;
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256d x = _mm256_loadu_pd(a + i);
+        const __m256d y = _mm256_loadu_pd(b + i);
+        const __m256d diff = _mm256_andnot_pd(sign, _mm256_sub_pd(x, y));
+        const __m256d total = _mm256_add_pd(x, y);
+
+        l1 = _mm256_add_pd(l1, diff);
+        l2 = _mm256_add_pd(l2, _mm256_mul_pd(diff, diff));
+        dot = _mm256_add_pd(dot, _mm256_mul_pd(x, y));
+        minSum = _mm256_add_pd(minSum, _mm256_min_pd(x, y));
+        maxSum = _mm256_add_pd(maxSum, _mm256_max_pd(x, y));
+
+        // Bins where both are 0 give 0 / 0, which the mask clears
+        const __m256d nonZero = _mm256_cmp_pd(total, zero, _CMP_GT_OQ);
+        canberra = _mm256_add_pd(canberra, _mm256_and_pd(nonZero, _mm256_div_pd(diff, total)));
+    }
+
+    s.l1 += sumLanes(l1);
+    s.l2 += sumLanes(l2);
+    s.dot += sumLanes(dot);
+    s.minSum += sumLanes(minSum);
+    s.maxSum += sumLanes(maxSum);
+    s.canberra += sumLanes(canberra);
+
+    addSumsScalar(a + i, b + i, n - i, s);
+}
+
+#endif
+
+const size_t kat::DistanceMatrix::TILE_SPECTRA;
+const size_t kat::DistanceMatrix::TILE_BINS;
+
+kat::DistanceMatrix::DistanceMatrix(const vector<vector<uint64_t>>& spectra) : nbSpectra(spectra.size()), nbBins(0) {
+
+    for (auto& s : spectra) {
+        nbBins = std::max(nbBins, s.size());
+    }
+    nbBins = (nbBins + 3) / 4 * 4;
+
+    data.assign(nbSpectra * nbBins, 0.0);
+    for (size_t i = 0; i < nbSpectra; i++) {
+        std::copy(spectra[i].begin(), spectra[i].end(), data.begin() + i * nbBins);
+    }
+}
+
+string kat::DistanceMatrix::metricName(Metric metric) {
+    switch (metric) {
+        case MANHATTAN: return "Manhattan";
+        case EUCLIDEAN: return "Euclidean";
+        case COSINE:    return "Cosine";
+        case CANBERRA:  return "Canberra";
+        case JACCARD:   return "Jaccard";
+        default:        return "";
+    }
+}
+
+void kat::DistanceMatrix::addSums(const double* a, const double* b, size_t n, PairSums& s) {
+#ifdef KAT_X86_64
+    if (BatchLookup::hasAvx2()) {
+        addSumsAvx2(a, b, n, s);
+        return;
+    }
+#endif
+    addSumsScalar(a, b, n, s);
+}
+
+double kat::DistanceMatrix::distance(Metric metric, const PairSums& s, double squares1, double squares2) {
+    switch (metric) {
+        case MANHATTAN: return s.l1;
+        case EUCLIDEAN: return std::sqrt(s.l2);
+        case COSINE:    return 1.0 - (s.dot / (std::sqrt(squares1) * std::sqrt(squares2)));
+        case CANBERRA:  return s.canberra;
+        case JACCARD:   return 1.0 - (s.minSum / s.maxSum);
+        default:        return 0.0;
+    }
+}
+
+void kat::DistanceMatrix::compute() {
+
+    distances.assign(NB_METRICS, vector<double>(nbSpectra * nbSpectra, 0.0));
+
+    // Needed for the cosine distance of every pair, so only worked out once
+    squares.assign(nbSpectra, 0.0);
+    ThreadPool::global().parallelFor(nbSpectra, [&](size_t i) {
+        PairSums s;
+        addSums(spectrum(i), spectrum(i), nbBins, s);
+        squares[i] = s.dot;
+    });
+
+    const size_t nbTiles = (nbSpectra + TILE_SPECTRA - 1) / TILE_SPECTRA;
+    vector<std::pair<size_t, size_t>> tilePairs;
+    for (size_t t1 = 0; t1 < nbTiles; t1++) {
+        for (size_t t2 = t1; t2 < nbTiles; t2++) {
+            tilePairs.push_back(std::make_pair(t1, t2));
+        }
+    }
+
+    ThreadPool::global().parallelFor(tilePairs.size(), [&](size_t t) {
+        computeTiles(tilePairs[t].first, tilePairs[t].second);
+    });
+}
+
+void kat::DistanceMatrix::computeTiles(size_t tile1, size_t tile2) {
+
+    const size_t begin1 = tile1 * TILE_SPECTRA, end1 = std::min(begin1 + TILE_SPECTRA, nbSpectra);
+    const size_t begin2 = tile2 * TILE_SPECTRA, end2 = std::min(begin2 + TILE_SPECTRA, nbSpectra);
+
+    vector<PairSums> sums(TILE_SPECTRA * TILE_SPECTRA);
+
+    // Each range of bins from every spectrum in both tiles fits in cache
+    for (size_t bin = 0; bin < nbBins; bin += TILE_BINS) {
+        const size_t len = std::min(TILE_BINS, nbBins - bin);
+        for (size_t i = begin1; i < end1; i++) {
+            for (size_t j = std::max(begin2, i + 1); j < end2; j++) {
+                addSums(spectrum(i) + bin, spectrum(j) + bin, len, sums[(i - begin1) * TILE_SPECTRA + (j - begin2)]);
+            }
+        }
+    }
+
+    for (size_t i = begin1; i < end1; i++) {
+        for (size_t j = std::max(begin2, i + 1); j < end2; j++) {
+            const PairSums& s = sums[(i - begin1) * TILE_SPECTRA + (j - begin2)];
+            for (size_t m = 0; m < NB_METRICS; m++) {
+                const double d = distance((Metric)m, s, squares[i], squares[j]);
+                distances[m][i * nbSpectra + j] = d;
+                distances[m][j * nbSpectra + i] = d;
+            }
+        }
+    }
+}
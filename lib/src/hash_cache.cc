@@ -0,0 +1,188 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <tuple>
+using std::ifstream;
+using std::ostringstream;
+using std::tuple;
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+using boost::lexical_cast;
+
+#include <kat/hash_cache.hpp>
+
+static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+static const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+static uint64_t fnv1a(const char* data, size_t len, uint64_t h) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static string hex(uint64_t v) {
+    ostringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << v;
+    return ss.str();
+}
+
+kat::HashCache::HashCache(const path& _dir, uint64_t _limit) : dir(_dir), limit(_limit) {
+}
+
+path kat::HashCache::defaultDir() {
+    const char* env = getenv(CACHE_DIR_ENV.c_str());
+    return env != nullptr ? path(env) : path();
+}
+
+string kat::HashCache::key(const vector<path>& inputs, uint16_t merLen, bool canonical, uint64_t hashSize,
+        uint16_t minQual, bool digest) {
+
+    ostringstream desc;
+    desc << "kat-hash-cache-v1" << endl;
+
+    for (auto& p : inputs) {
+        if (JellyfishHelper::isPipe(p) || !bfs::is_regular_file(p)) {
+            return string();
+        }
+        desc << bfs::canonical(p).string() << "\t" << bfs::file_size(p) << "\t" << bfs::last_write_time(p);
+        if (digest) {
+            desc << "\t" << hex(digestFile(p));
+        }
+        desc << endl;
+    }
+
+    desc << "k=" << merLen << " canonical=" << canonical << " hash_size=" << hashSize << " min_qual=" << minQual << endl;
+
+    // Two differently seeded hashes of the description, to make collisions vanishingly unlikely
+    const string s = desc.str();
+    return hex(fnv1a(s.data(), s.size(), FNV_OFFSET)) + hex(fnv1a(s.data(), s.size(), ~FNV_OFFSET));
+}
+
+path kat::HashCache::hashPath(const string& key) const {
+    return dir / (key + ".jf");
+}
+
+bool kat::HashCache::isCachedHash(const path& p) {
+    return p.extension() == ".jf" && p.filename().string()[0] != '.';
+}
+
+path kat::HashCache::find(const string& key) const {
+
+    path p = hashPath(key);
+    if (!bfs::exists(p)) {
+        return path();
+    }
+
+    // Mark as recently used.  Not fatal if the cache is read only.
+    boost::system::error_code ec;
+    bfs::last_write_time(p, std::time(nullptr), ec);
+
+    return p;
+}
+
+path kat::HashCache::store(const string& key, LargeHashArrayPtr hash, file_header& header, uint16_t threads) const {
+
+    bfs::create_directories(dir);
+
+    path p = hashPath(key);
+    path tmp = dir / ("." + key + "." + lexical_cast<string>(getpid()) + ".tmp");
+
+    try {
+        JellyfishHelper::dumpHash(hash, header, threads, tmp, true);
+        bfs::rename(tmp, p);
+    }
+    catch(...) {
+        boost::system::error_code ec;
+        bfs::remove(tmp, ec);
+        throw;
+    }
+
+    evict(p);
+
+    return p;
+}
+
+uint64_t kat::HashCache::size() const {
+
+    uint64_t total = 0;
+    boost::system::error_code ec;
+    for (bfs::directory_iterator it(dir, ec), end; it != end; it.increment(ec)) {
+        if (isCachedHash(it->path())) {
+            total += bfs::file_size(it->path(), ec);
+        }
+    }
+    return total;
+}
+
+void kat::HashCache::evict(const path& keep) const {
+
+    if (limit == 0) return;
+
+    // Oldest first
+    vector<tuple<std::time_t, path, uint64_t>> hashes;
+    uint64_t total = 0;
+    boost::system::error_code ec;
+    for (bfs::directory_iterator it(dir, ec), end; it != end; it.increment(ec)) {
+        const path& p = it->path();
+        if (isCachedHash(p)) {
+            uint64_t size = bfs::file_size(p, ec);
+            hashes.push_back(std::make_tuple(bfs::last_write_time(p, ec), p, size));
+            total += size;
+        }
+    }
+    std::sort(hashes.begin(), hashes.end());
+
+    for (auto& h : hashes) {
+        if (total <= limit) break;
+        if (std::get<1>(h) == keep) continue;
+
+        // Another process may have removed it already
+        bfs::remove(std::get<1>(h), ec);
+        total -= std::get<2>(h);
+    }
+}
+
+uint64_t kat::HashCache::digestFile(const path& p) {
+
+    ifstream in(p.c_str(), std::ios::binary);
+    if (!in) {
+        BOOST_THROW_EXCEPTION(HashCacheException() << HashCacheErrorInfo(string(
+                "Could not open file to compute digest: ") + p.string()));
+    }
+
+    vector<char> buffer(1 << 20);
+    uint64_t h = FNV_OFFSET;
+    while (in) {
+        in.read(buffer.data(), buffer.size());
+        h = fnv1a(buffer.data(), in.gcount(), h);
+    }
+    return h;
+}
@@ -0,0 +1,519 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+using std::thread;
+using std::unique_ptr;
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/timer/timer.hpp>
+using boost::lexical_cast;
+using boost::timer::auto_cpu_timer;
+
+#include <kat/hash_server.hpp>
+
+const uint64_t kat::HashConnection::MAX_BATCH = 1 << 16;
+
+// Set by SIGINT and SIGTERM to stop the server
+static volatile sig_atomic_t stopServing = 0;
+
+static void onStopSignal(int sig) {
+    stopServing = 1;
+}
+
+static string errorString(const string& msg) {
+    return msg + ": " + strerror(errno);
+}
+
+kat::HashConnection::HashConnection(const path& socketPath) {
+
+    struct sockaddr_un addr;
+    if (socketPath.string().size() >= sizeof(addr.sun_path)) {
+        BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                "Hash server socket path is too long: ") + socketPath.string()));
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(errorString("Could not create socket")));
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        const string msg = errorString(string("Could not connect to hash server at ") + socketPath.string());
+        close(fd);
+        BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(msg));
+    }
+}
+
+kat::HashConnection::~HashConnection() {
+    if (fd >= 0) close(fd);
+}
+
+void kat::HashConnection::send(const void* data, size_t size) {
+
+    const char* p = (const char*)data;
+    while (size > 0) {
+        ssize_t sent = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(errorString("Could not send to hash server connection")));
+        }
+        p += sent;
+        size -= sent;
+    }
+}
+
+bool kat::HashConnection::recv(void* data, size_t size) {
+
+    char* p = (char*)data;
+    const size_t total = size;
+    while (size > 0) {
+        ssize_t got = ::recv(fd, p, size, 0);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(errorString("Could not receive from hash server connection")));
+        }
+        if (got == 0) {
+            if (size == total) return false;
+            BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                    "Hash server connection closed part way through a message")));
+        }
+        p += got;
+        size -= got;
+    }
+    return true;
+}
+
+
+kat::HashServer::HashServer(const vector<path>& _hashPaths, const path& _socketPath) :
+    hashPaths(_hashPaths), socketPath(_socketPath), listenFd(-1), hugePages(false), prefaultThreads(0) {
+}
+
+kat::HashServer::~HashServer() {
+    if (listenFd >= 0) close(listenFd);
+}
+
+void kat::HashServer::load(ostream& out) {
+
+    for(auto& p : hashPaths) {
+
+        auto_cpu_timer timer(out, 1, "  Time taken: %ws\n\n");
+
+        out << "Loading hash " << p.string() << " into memory ...";
+        out.flush();
+
+        if (!bfs::exists(p)) {
+            BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                    "Could not find hash at: ") + p.string()));
+        }
+
+        if (JellyfishHelper::isBloomCounter(*JellyfishHelper::loadHashHeader(p))) {
+            BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                    "Only jellyfish hashes can be served, not bloom counters: ") + p.string()));
+        }
+
+        ServedHash h;
+        h.source = bfs::canonical(p);
+        h.loader = make_shared<HashLoader>();
+        h.loader->setHugePages(hugePages);
+        h.loader->setPrefaultThreads(prefaultThreads);
+        h.hash = h.loader->loadHash(p, false);
+        h.merLen = h.loader->getMerLen();
+        h.canonical = h.loader->getCanonical();
+
+        // jellyfish keeps the K-mer length in a global, so every hash must share it
+        if (!hashes.empty() && h.merLen != hashes[0].merLen) {
+            BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                    "All served hashes must have the same K-mer length.  ") + p.string() + " has K-mer length " +
+                    lexical_cast<string>(h.merLen) + ", but " + hashes[0].source.string() + " has " +
+                    lexical_cast<string>(hashes[0].merLen)));
+        }
+
+        h.lookup = h.hash->key_len() <= 2 * BatchLookup::MAX_MER_LEN ? make_shared<BatchLookup>(*h.hash) : nullptr;
+        hashes.push_back(h);
+
+        out << " done.";
+        out.flush();
+    }
+}
+
+void kat::HashServer::serve(ostream& out) {
+
+    stopServing = 0;
+
+    struct sockaddr_un addr;
+    if (socketPath.string().size() >= sizeof(addr.sun_path)) {
+        BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                "Hash server socket path is too long: ") + socketPath.string()));
+    }
+
+    // Remove a socket left behind by a server that didn't shut down cleanly
+    if (bfs::status(socketPath).type() == bfs::socket_file) {
+        bfs::remove(socketPath);
+    }
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(errorString("Could not create socket")));
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 64) < 0) {
+        BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(errorString(
+                string("Could not listen on ") + socketPath.string())));
+    }
+
+    // Don't restart accept after a signal, so we notice we've been asked to stop
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onStopSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    out << "Serving " << hashes.size() << " hash" << (hashes.size() > 1 ? "es" : "") << " on " << socketPath.string()
+        << ".  Send SIGINT or SIGTERM to stop." << endl;
+
+    // Signals should wake this thread from accept, not a client's handler
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+
+    uint64_t nbConnections = 0;
+    while (!stopServing) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (stopServing || errno == EINTR || errno == ECONNABORTED) continue;
+            BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(errorString("Could not accept connection")));
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(clientsMu);
+            clients.insert(fd);
+        }
+        nbConnections++;
+        
+        sigset_t oldSignals;
+        pthread_sigmask(SIG_BLOCK, &stopSignals, &oldSignals);
+        thread(&HashServer::handle, this, fd).detach();
+        pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr);
+    }
+
+    // Wake up any handlers waiting on clients, and let them finish before the
+    // hashes go
+    {
+        std::unique_lock<std::mutex> lock(clientsMu);
+        for(auto fd : clients) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        clientsDone.wait(lock, [this]() { return clients.empty(); });
+    }
+
+    close(listenFd);
+    listenFd = -1;
+    bfs::remove(socketPath);
+
+    out << "Stopped serving after " << nbConnections << " connection" << (nbConnections != 1 ? "s" : "") << "." << endl;
+}
+
+void kat::HashServer::stop() {
+    
+    // Wakes serve from accept
+    stopServing = 1;
+    if (listenFd >= 0) shutdown(listenFd, SHUT_RDWR);
+}
+
+void kat::HashServer::handle(int fd) {
+
+    // The socket is closed before the lock is released, so its descriptor can't
+    // be reused by another client while still in the set
+    std::unique_lock<std::mutex> lock(clientsMu, std::defer_lock);
+    HashConnection conn(fd);
+
+    try {
+        serveClient(conn);
+    }
+    catch(HashServerException& e) {
+        // Client went away.  Nothing more to do for it.
+    }
+
+    lock.lock();
+    clients.erase(fd);
+    clientsDone.notify_all();
+}
+
+void kat::HashServer::serveClient(HashConnection& conn) const {
+
+    unique_ptr<LargeHashArray::eager_iterator> cursor;
+    uint16_t cursorWords = 0;
+    vector<uint64_t> words, counts;
+    string hashPath;
+
+    HashConnection::Request req;
+    while (conn.recv(&req, sizeof(req))) {
+
+        HashConnection::Response resp = { 0, 0, 0, 0 };
+
+        // Anything we can't make sense of ends the connection, as we can't tell
+        // how much payload to skip
+        if (req.op != HashConnection::OPEN && (req.id >= hashes.size() || req.n > HashConnection::MAX_BATCH)) {
+            resp.status = -1;
+            conn.send(&resp, sizeof(resp));
+            return;
+        }
+
+        switch(req.op) {
+            case HashConnection::OPEN: {
+                if (req.n > 4096) return;
+                hashPath.resize(req.n);
+                if (req.n > 0 && !conn.recv(&hashPath[0], req.n)) return;
+                resp.status = -1;
+                for(size_t i = 0; i < hashes.size(); i++) {
+                    if (hashes[i].source.string() == hashPath) {
+                        resp.status = i;
+                        resp.a = hashes[i].merLen;
+                        resp.b = hashes[i].canonical;
+                    }
+                }
+                conn.send(&resp, sizeof(resp));
+                break;
+            }
+            case HashConnection::COUNT: {
+                const ServedHash& h = hashes[req.id];
+                const uint16_t nbWords = (h.merLen + 31) / 32;
+                words.resize(req.n * nbWords);
+                if (req.n > 0 && !conn.recv(words.data(), words.size() * sizeof(uint64_t))) return;
+                count(h, words, req.n, counts);
+                resp.n = req.n;
+                conn.send(&resp, sizeof(resp));
+                conn.send(counts.data(), req.n * sizeof(uint64_t));
+                break;
+            }
+            case HashConnection::SLICE: {
+                // Slice a of b, which must be in range or eager_slice falls over
+                if (req.b == 0 || req.a >= req.b) {
+                    cursor.reset();
+                    resp.status = -1;
+                    conn.send(&resp, sizeof(resp));
+                    break;
+                }
+                const ServedHash& h = hashes[req.id];
+                cursor.reset(new LargeHashArray::eager_iterator(h.hash->eager_slice(req.a, req.b)));
+                cursorWords = (h.merLen + 31) / 32;
+                conn.send(&resp, sizeof(resp));
+                break;
+            }
+            case HashConnection::NEXT: {
+                if (cursor == nullptr) {
+                    resp.status = -1;
+                    conn.send(&resp, sizeof(resp));
+                    return;
+                }
+                words.resize(req.n * cursorWords);
+                counts.resize(req.n);
+                size_t n = 0;
+                while (n < req.n && cursor->next()) {
+                    for(uint16_t w = 0; w < cursorWords; w++) {
+                        words[n * cursorWords + w] = cursor->key().word(w);
+                    }
+                    counts[n] = cursor->val();
+                    n++;
+                }
+                resp.n = n;
+                conn.send(&resp, sizeof(resp));
+                conn.send(words.data(), n * cursorWords * sizeof(uint64_t));
+                conn.send(counts.data(), n * sizeof(uint64_t));
+                break;
+            }
+            default:
+                resp.status = -1;
+                conn.send(&resp, sizeof(resp));
+                return;
+        }
+    }
+}
+
+void kat::HashServer::count(const ServedHash& h, const vector<uint64_t>& words, size_t n, vector<uint64_t>& counts) const {
+
+    counts.resize(n);
+
+    if (h.lookup != nullptr) {
+        h.lookup->getCounts(words.data(), n, counts.data());
+        return;
+    }
+
+    const uint16_t nbWords = (h.merLen + 31) / 32;
+    mer_dna key;
+    for(size_t i = 0; i < n; i++) {
+        for(uint16_t w = 0; w < nbWords; w++) {
+            key.word__(w) = words[i * nbWords + w];
+        }
+        uint64_t val = 0;
+        h.hash->get_val_for_key(key, &val);
+        counts[i] = val;
+    }
+}
+
+
+kat::HashClient::HashClient(const path& _socketPath, uint32_t _id, uint16_t _merLen, bool _canonical) :
+    socketPath(_socketPath), id(_id), merLen(_merLen), canonical(_canonical) {
+}
+
+shared_ptr<kat::HashClient> kat::HashClient::connect(const path& socketPath, const path& hashPath) {
+
+    unique_ptr<HashConnection> conn(new HashConnection(socketPath));
+
+    const string source = bfs::canonical(hashPath).string();
+    HashConnection::Request req = { HashConnection::OPEN, 0, source.size(), 0, 0 };
+    conn->send(&req, sizeof(req));
+    conn->send(source.data(), source.size());
+
+    HashConnection::Response resp;
+    if (!conn->recv(&resp, sizeof(resp))) {
+        BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                "Hash server at ") + socketPath.string() + " closed the connection"));
+    }
+
+    if (resp.status < 0) {
+        return nullptr;
+    }
+
+    shared_ptr<HashClient> client(new HashClient(socketPath, resp.status, resp.a, resp.b != 0));
+    client->release(std::move(conn));
+    return client;
+}
+
+unique_ptr<kat::HashConnection> kat::HashClient::acquire() const {
+
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        if (!idle.empty()) {
+            unique_ptr<HashConnection> conn = std::move(idle.back());
+            idle.pop_back();
+            return conn;
+        }
+    }
+
+    return unique_ptr<HashConnection>(new HashConnection(socketPath));
+}
+
+void kat::HashClient::release(unique_ptr<HashConnection> conn) const {
+    std::lock_guard<std::mutex> lock(mu);
+    idle.push_back(std::move(conn));
+}
+
+void kat::HashClient::getCounts(const uint64_t* words, size_t n, uint64_t* counts) const {
+
+    unique_ptr<HashConnection> conn = acquire();
+
+    for(size_t start = 0; start < n; start += HashConnection::MAX_BATCH) {
+
+        const size_t batch = std::min(n - start, (size_t)HashConnection::MAX_BATCH);
+        HashConnection::Request req = { HashConnection::COUNT, id, batch, 0, 0 };
+        conn->send(&req, sizeof(req));
+        conn->send(words + start * nbWords(), batch * nbWords() * sizeof(uint64_t));
+
+        HashConnection::Response resp;
+        if (!conn->recv(&resp, sizeof(resp)) || resp.status < 0 || resp.n != batch) {
+            BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                    "Hash server at ") + socketPath.string() + " could not look up counts"));
+        }
+        if (!conn->recv(counts + start, batch * sizeof(uint64_t))) {
+            BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                    "Hash server at ") + socketPath.string() + " closed the connection while sending counts"));
+        }
+    }
+
+    // Only reuse the connection if nothing went wrong with it
+    release(std::move(conn));
+}
+
+uint64_t kat::HashClient::getCount(const mer_dna& key) const {
+
+    uint64_t words[4];
+    vector<uint64_t> moreWords;
+    uint64_t* w = words;
+    if (nbWords() > 4) {
+        moreWords.resize(nbWords());
+        w = moreWords.data();
+    }
+    for(uint16_t i = 0; i < nbWords(); i++) {
+        w[i] = key.word(i);
+    }
+
+    uint64_t count = 0;
+    getCounts(w, 1, &count);
+    return count;
+}
+
+
+kat::HashClient::Slice::Slice(const HashClient& _client, uint32_t slice, uint32_t nbSlices) :
+    client(_client), conn(_client.socketPath) {
+
+    HashConnection::Request req = { HashConnection::SLICE, client.id, 0, slice, nbSlices };
+    conn.send(&req, sizeof(req));
+
+    HashConnection::Response resp;
+    if (!conn.recv(&resp, sizeof(resp)) || resp.status < 0) {
+        BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                "Hash server at ") + client.socketPath.string() + " could not iterate over the hash"));
+    }
+}
+
+size_t kat::HashClient::Slice::next(size_t max, vector<uint64_t>& words, vector<uint64_t>& counts) {
+
+    HashConnection::Request req = { HashConnection::NEXT, client.id, std::min((uint64_t)max, HashConnection::MAX_BATCH), 0, 0 };
+    conn.send(&req, sizeof(req));
+
+    HashConnection::Response resp;
+    if (!conn.recv(&resp, sizeof(resp)) || resp.status < 0 || resp.n > req.n) {
+        BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                "Hash server at ") + client.socketPath.string() + " could not iterate over the hash"));
+    }
+
+    words.resize(resp.n * client.nbWords());
+    counts.resize(resp.n);
+    if (resp.n > 0) {
+        if (!conn.recv(words.data(), words.size() * sizeof(uint64_t)) ||
+                !conn.recv(counts.data(), counts.size() * sizeof(uint64_t))) {
+            BOOST_THROW_EXCEPTION(HashServerException() << HashServerErrorInfo(string(
+                    "Hash server at ") + client.socketPath.string() + " closed the connection while sending K-mers"));
+        }
+    }
+    return resp.n;
+}
@@ -19,11 +19,14 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <glob.h>
 using std::fstream;
 using std::stringstream;
+using std::unique_ptr;
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/path.hpp>
@@ -35,9 +38,22 @@ using boost::timer::auto_cpu_timer;
 using boost::split;
 
 #include <kat/jellyfish_helper.hpp>
+#include <kat/count_checkpoint.hpp>
+#include <kat/disk_counter.hpp>
+#include <kat/multi_k_counter.hpp>
 using kat::JellyfishHelper;
+using kat::CountCheckpoint;
+using kat::DiskCounter;
+using kat::MultiKCounter;
 
 #include <kat/input_handler.hpp>
+#include <kat/memory_budget.hpp>
+#include <kat/metrics.hpp>
+using kat::MemoryBudget;
+
+// Smallest hash to start counting with under a tight memory limit.  It doubles
+// as needed.
+static const uint64_t MIN_HASH_SIZE = 1 << 16;
 
 void kat::InputHandler::setMultipleInputs(const vector<path>& inputs) {
     for(auto& p : inputs) {
@@ -87,6 +103,11 @@ void kat::InputHandler::validateInput() {
 void kat::InputHandler::loadHeader() {
     if (mode == InputMode::LOAD) {
         header = JellyfishHelper::loadHashHeader(input[0]);
+        
+        if (JellyfishHelper::isBloomCounter(*header) && !allowBloom) {
+            BOOST_THROW_EXCEPTION(InputFileException() << InputFileErrorInfo(string(
+                "This tool needs to iterate over all K-mers in the input, which is not possible with a bloom counter.  Please provide a binary jellyfish hash or sequence file(s) instead: ") + input[0].string()));
+        }
     }    
 }
 
@@ -125,49 +146,613 @@ string kat::InputHandler::fileName() {
     return boost::trim_right_copy(s);
 }
 
+uint64_t kat::InputHandler::sizeOnDisk() {
+    
+    uint64_t size = 0;
+    for(auto& p : input) {
+        if (!JellyfishHelper::isPipe(p)) {
+            size += bfs::file_size(p);
+        }
+    }
+    return size;
+}
+
+uint64_t kat::InputHandler::countBytes() const {
+    
+    // The requested hash size is the caller's estimate of the distinct K-mers
+    return MemoryBudget::hashBytes(hashSize, merLen);
+}
+
+bool kat::InputHandler::fitsInMemory(uint64_t limit) {
+    
+    return countBytes() <= MemoryBudget::remaining(limit);
+}
+
+bool kat::InputHandler::canCountOnDisk() {
+    
+    // Out-of-core counting needs to read its input more than once, and can't 
+    // split compressed files, BAM files included
+    for(auto& p : input) {
+        if (JellyfishHelper::isPipe(p) || ParallelSeqReader::detectCompression(p) != ParallelSeqReader::Compression::NONE) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void kat::InputHandler::count(const uint16_t threads) {
     
-    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");      
+    // Already counted along with other K-mer lengths.  Just make sure jellyfish
+    // is working with our K-mer length from here on.
+    if (hash != nullptr) {
+        mer_dna::k(merLen);
+        return;
+    }
+    
+    checkSampling();
+    
+    if (targetHash != nullptr) {
+        countTargeted(threads);
+        return;
+    }
+    
+    if (sampleFraction < 1.0 || tolerance > 0.0) {
+        countSampled(threads);
+        return;
+    }
+    
+    const string key = cacheKey();
+    if (!key.empty() && loadCached(key)) {
+        return;
+    }
+    
+    // Only count out-of-core if asked to keep within a budget that the hash
+    // won't fit in, and the input allows it
+    const uint64_t limit = memoryLimit();
+    bool onDisk = false;
+    if (limit > 0 && !fitsInMemory(limit)) {
+        if (maxMemory == 0) {
+            *out << "Warning: counting input " << index << " needs about " << MemoryBudget::toMB(countBytes()) << ", more than is left under the " << MemoryBudget::toMB(limit) << " cgroup memory limit.  Counting in memory anyway.  Use --max_memory to count out-of-core instead." << endl;
+        }
+        else if (!canCountOnDisk()) {
+            *out << "Warning: counting input " << index << " needs about " << MemoryBudget::toMB(countBytes()) << ", more than is left under the " << MemoryBudget::toMB(limit) << " memory limit, but compressed files and pipes can't be counted out-of-core.  Counting in memory anyway." << endl;
+        }
+        else {
+            if (!checkpointDir.empty()) {
+                *out << "Warning: checkpoints are not saved when counting out-of-core, so input " << index << " won't be checkpointed to " << checkpointDir.string() << "." << endl;
+            }
+            onDisk = true;
+        }
+    }
+    
+    if (onDisk || !countInMemory(threads)) {
+        countOnDisk(threads);
+    }
+    
+    if (!key.empty()) {
+        storeCached(key, threads);
+    }
+}
+
+/**
+ * Stands in for growing the hash when counting within a memory budget.  Rather
+ * than writing the full hash out, it notes that the hash overflowed and clears
+ * it, so the rest of the count runs without using any more memory.
+ */
+class OverflowDumper : public jellyfish::dumper_t<LargeHashArray> {
+public:
+    bool overflowed = false;
+    
+protected:
+    virtual void _dump(LargeHashArray* ary) {
+        overflowed = true;
+        ary->clear();
+    }
+};
+
+bool kat::InputHandler::countInMemory(const uint16_t threads) {
+    
+    auto_cpu_timer timer(*out, 1, "  Time taken: %ws\n\n");      
+    Metrics::Phase phase("count", pathString());
+    phase.addBytesRead(sizeOnDisk());
+    
+    // Under --max_memory, the hash isn't allowed to grow past the budget if the 
+    // input can be counted out-of-core instead.  Checkpoints would record the 
+    // cleared hash after an overflow, so checkpointed counts can still grow.
+    const uint64_t limit = memoryLimit();
+    const bool bounded = maxMemory > 0 && checkpointDir.empty() && canCountOnDisk();
+    
+    // Start with a hash that fits, leaving room for it to double unless bounded
+    uint64_t size = hashSize;
+    if (bounded && MemoryBudget::hashBytes(size, merLen) > MemoryBudget::remaining(limit)) {
+        size = std::max(MemoryBudget::hashEntries(MemoryBudget::remaining(limit), merLen), MIN_HASH_SIZE);
+        *out << "Reducing the hash size for input " << index << " to " << size << " to fit the " << MemoryBudget::toMB(limit) << " memory limit." << endl;
+    }
+    else if (!bounded && limit > 0 && MemoryBudget::hashBytes(size, merLen) > MemoryBudget::remaining(limit) / 2) {
+        size = std::max(MemoryBudget::hashEntries(MemoryBudget::remaining(limit) / 2, merLen), MIN_HASH_SIZE);
+        *out << "Reducing the initial hash size for input " << index << " to " << size << " to fit the " << MemoryBudget::toMB(limit) << " memory limit." << endl;
+    }
     
-    hashCounter = make_shared<HashCounter>(hashSize, merLen * 2, 7, threads);
-    hashCounter->do_size_doubling(!disableHashGrow);
+    hashCounter = make_shared<HashCounter>(size, merLen * 2, 7, threads);
+    OverflowDumper overflow;
+    if (bounded) {
+        hashCounter->do_size_doubling(false);
+        hashCounter->dumper(&overflow);
+    }
+    else {
+        hashCounter->do_size_doubling(!disableHashGrow);
+    }
+    
+    // K-mers are inserted at random, so spread the hash over all nodes while counting
+    if (numa != NumaPlacement::NONE) {
+        Numa::place(*hashCounter->ary(), NumaPlacement::INTERLEAVE, threads);
+    }
+    if (hugePages) {
+        MemoryPages::adviseHugePages(*hashCounter->ary());
+    }
+        
+    // Inputs counted in the same run keep their checkpoints apart
+    unique_ptr<CountCheckpoint> checkpoint;
+    if (!checkpointDir.empty()) {
+        checkpoint.reset(new CountCheckpoint(checkpointDir / (string("input") + lexical_cast<string>(index) + "-k" + lexical_cast<string>(merLen)), checkpointInterval * 60.0));
+        if (checkpoint->exists() && !resume) {
+            BOOST_THROW_EXCEPTION(InputFileException() << InputFileErrorInfo(string(
+                    "A checkpoint from an earlier run was found in ") + checkpoint->getDir().string() + 
+                    ".  Use --resume to carry on from it, or remove it to start again."));
+        }
+        if (checkpoint->exists()) {
+            *out << "Resuming counting for input " << index << " from the checkpoint in " << checkpoint->getDir().string() << "." << endl;
+        }
+        else if (resume) {
+            *out << "No checkpoint found for input " << index << " in " << checkpoint->getDir().string() << ".  Counting from the start." << endl;
+        }
+    }
         
-    cout << "Input " << index << " is a sequence file.  Counting kmers for input " << index << " (" << pathString() << ") ...";
-    cout.flush();
+    *out << "Input " << index << " is a sequence file.  Counting kmers for input " << index << " (" << pathString() << ") ...";
+    out->flush();
+
+    LargeHashArrayPtr counted = JellyfishHelper::countSeqFile(input, *hashCounter, canonical, threads, minQual, checkpoint.get());
+    
+    if (overflow.overflowed) {
+        hashCounter = nullptr;
+        *out << " the hash filled up, and can't grow within the " << MemoryBudget::toMB(limit) << " memory limit.  Counting out-of-core instead.  Raise the hash size to count in memory, if the limit allows." << endl;
+        out->flush();
+        return false;
+    }
+    
+    setHash(counted);
+    createHeader();
+    
+    *out << " done.";
+    out->flush();
+    
+    const uint64_t hashBytes = MemoryBudget::hashBytes(hash->size(), merLen);
+    if (limit > 0 && hashBytes > limit) {
+        *out << endl << "Warning: the hash for input " << index << " grew to " << MemoryBudget::toMB(hashBytes) << ", past the " << MemoryBudget::toMB(limit) << " memory limit.";
+        out->flush();
+    }
+    
+    return true;
+}
+
+void kat::InputHandler::countOnDisk(const uint16_t threads) {
+    
+    auto_cpu_timer timer(*out, 1, "  Time taken: %ws\n\n");      
+    Metrics::Phase phase("count", pathString());
+    phase.addBytesRead(sizeOnDisk());
+    
+    const uint64_t limit = memoryLimit();
+    
+    *out << "Input " << index << " is a sequence file.  Counting kmers for input " << index << " (" << pathString() << ") out-of-core using at most " << MemoryBudget::toMB(limit) << " ...";
+    out->flush();
+    
+    {
+        DiskCounter counter(merLen, canonical, limit, threads);
+        counter.setMinQual(minQual);
+        path diskHash = counter.getWorkDir() / (string("counts.jf") + lexical_cast<string>(merLen));
+        counter.count(input, diskHash);
+
+        // Load the merged counts back in so the hash can be used like any other.
+        // Temporary files are removed when the counter goes out of scope.
+        hashLoader = newLoader();
+        hashLoader->loadHash(diskHash, false);
+        setHash(hashLoader->getHash());
+        header = make_shared<file_header>(hashLoader->getHeader());
+    }
+    
+    *out << " done.";
+    out->flush();    
+}
 
-    hash = JellyfishHelper::countSeqFile(input, *hashCounter, canonical, threads);
+void kat::InputHandler::countTargeted(const uint16_t threads) {
+    
+    auto_cpu_timer timer(*out, 1, "  Time taken: %ws\n\n");      
+    Metrics::Phase phase("count", pathString());
+    phase.addBytesRead(sizeOnDisk());
+    
+    if (targetHash->key_len() != merLen * 2) {
+        BOOST_THROW_EXCEPTION(InputFileException() << InputFileErrorInfo(string(
+                "Target hash has a different K-mer length to the one requested for input ") + lexical_cast<string>(index) +
+                ".  Expected: " + lexical_cast<string>(merLen) + ".  Target: " + lexical_cast<string>(targetHash->key_len() / 2)));
+    }
+    
+    *out << "Input " << index << " is a sequence file.  Counting kmers for input " << index << " (" << pathString() << "), targeting only those in the reference hash ...";
+    out->flush();
+
+    // Pre-populate a hash with the target K-mers, then only increment those
+    shared_ptr<LargeHashArray> counts(JellyfishHelper::createTargetHash(*targetHash, threads));
+    untargetedTotal = JellyfishHelper::countSeqFileTargeted(input, *counts, canonical, threads, minQual);
+    
+    // Drop any target K-mers that weren't found, so this looks like any other counted hash
+    ownedHash = shared_ptr<LargeHashArray>(JellyfishHelper::compactHash(*counts, threads));
+    counts.reset();
+    setHash(ownedHash.get());
+    
+    createHeader();
+    
+    *out << " done.  " << untargetedTotal << " K-mers not in the reference were skipped.";
+    out->flush();    
+}
+
+void kat::InputHandler::countSampled(const uint16_t threads) {
+    
+    auto_cpu_timer timer(*out, 1, "  Time taken: %ws\n\n");      
+    Metrics::Phase phase("count", pathString());
+    phase.addBytesRead(sizeOnDisk());
+    
+    *out << "Input " << index << " is a sequence file.  Counting kmers for input " << index << " (" << pathString() << ")";
+    if (sampleFraction < 1.0) *out << " in a " << (sampleFraction * 100.0) << "% sample of reads";
+    if (tolerance > 0.0) *out << " until the spectrum converges";
+    *out << " ...";
+    out->flush();
+
+    MultiKCounter counter(vector<uint16_t>(1, merLen), vector<uint64_t>(1, hashSize), canonical, threads);
+    counter.setMinQual(minQual);
+    counter.setDoSizeDoubling(!disableHashGrow);
+    counter.setSampleFraction(sampleFraction);
+    counter.setTolerance(tolerance);
+    counter.count(input);
+    
+    ownedHash = shared_ptr<LargeHashArray>(counter.releaseHash(0));
+    setHash(ownedHash.get());
+    
+    createHeader();
+    
+    *out << " done.";
+    reportConvergence(*out, counter);
+    out->flush();    
+}
+
+void kat::InputHandler::countMultiK(const vector<InputHandler*>& inputs, const uint16_t threads) {
+    
+    InputHandler& first = *inputs[0];
+    
+    if (first.targetHash != nullptr) {
+        BOOST_THROW_EXCEPTION(InputFileException() << InputFileErrorInfo(string(
+                "Counting several K-mer lengths at once is not supported with targeted counting")));
+    }
+    
+    first.checkSampling();
+    
+    // A hash per K-mer length at once may not fit, so count each in turn instead,
+    // out-of-core where need be
+    const uint64_t limit = first.memoryLimit();
+    uint64_t needed = 0;
+    for(auto in : inputs) {
+        needed += in->countBytes();
+    }
+    if (limit > 0 && needed > MemoryBudget::remaining(limit)) {
+        for(auto in : inputs) {
+            in->count(threads);
+        }
+        mer_dna::k(first.merLen);
+        return;
+    }
+    
+    // Nothing to count if every K-mer length was cached by an earlier run
+    vector<string> keys;
+    bool allCached = true;
+    for(auto in : inputs) {
+        keys.push_back(in->cacheKey());
+        allCached = allCached && !keys.back().empty() && !HashCache(in->cacheDir, in->cacheSize).find(keys.back()).empty();
+    }
+    if (allCached) {
+        for(size_t i = 0; i < inputs.size(); i++) {
+            inputs[i]->loadCached(keys[i]);
+        }
+        mer_dna::k(first.merLen);
+        return;
+    }
+    
+    vector<uint16_t> merLens;
+    vector<uint64_t> hashSizes;
+    for(auto in : inputs) {
+        if (std::find(merLens.begin(), merLens.end(), in->merLen) != merLens.end()) {
+            BOOST_THROW_EXCEPTION(InputFileException() << InputFileErrorInfo(string(
+                    "K-mer length requested more than once: ") + lexical_cast<string>(in->merLen)));
+        }
+        merLens.push_back(in->merLen);
+        hashSizes.push_back(in->hashSize);
+    }
+    
+    {
+        auto_cpu_timer timer(*first.out, 1, "  Time taken: %ws\n\n");      
+        Metrics::Phase phase("count", first.pathString());
+        phase.addBytesRead(first.sizeOnDisk());
+    
+        *first.out << "Input " << first.index << " is a sequence file.  Counting kmers for input " << first.index << " (" << first.pathString() << ") at K-mer lengths";
+        for(size_t i = 0; i < merLens.size(); i++) {
+            *first.out << (i == 0 ? " " : ", ") << merLens[i];
+        }
+        *first.out << " in a single pass";
+        if (first.sampleFraction < 1.0) *first.out << " over a " << (first.sampleFraction * 100.0) << "% sample of reads";
+        if (first.tolerance > 0.0) *first.out << " until the spectra converge";
+        *first.out << " ...";
+        first.out->flush();
+    
+        MultiKCounter counter(merLens, hashSizes, first.canonical, threads);
+        counter.setMinQual(first.minQual);
+        counter.setDoSizeDoubling(!first.disableHashGrow);
+        counter.setSampleFraction(first.sampleFraction);
+        counter.setTolerance(first.tolerance);
+        counter.count(first.input);
+    
+        for(size_t i = 0; i < inputs.size(); i++) {
+            InputHandler& in = *inputs[i];
+            in.canonical = first.canonical;
+            in.ownedHash = shared_ptr<LargeHashArray>(counter.releaseHash(i));
+            in.setHash(in.ownedHash.get());
+            in.createHeader();
+        }
+    
+        *first.out << " done.";
+        reportConvergence(*first.out, counter);
+        first.out->flush();    
+    }
+    
+    for(size_t i = 0; i < inputs.size(); i++) {
+        if (!keys[i].empty()) {
+            mer_dna::k(inputs[i]->merLen);
+            inputs[i]->storeCached(keys[i], threads);
+        }
+    }
+    mer_dna::k(first.merLen);
+}
+
+vector<uint16_t> kat::InputHandler::parseMerLens(const string& merLens) {
+    
+    vector<string> parts;
+    boost::split(parts, merLens, boost::is_any_of(","));
+    
+    vector<uint16_t> result;
+    for(auto& p : parts) {
+        boost::trim(p);
+        try {
+            result.push_back(lexical_cast<uint16_t>(p));
+        }
+        catch (boost::bad_lexical_cast& e) {
+            BOOST_THROW_EXCEPTION(InputFileException() << InputFileErrorInfo(string(
+                    "Invalid K-mer length: \"") + p + "\".  Expected a number or a comma separated list of numbers."));
+        }
+    }
+    return result;
+}
+
+void kat::InputHandler::checkSampling() {
+    
+    if (sampleFraction <= 0.0 || sampleFraction > 1.0) {
+        BOOST_THROW_EXCEPTION(InputFileException() << InputFileErrorInfo(string(
+                "Sample fraction must be greater than 0 and no more than 1: ") + lexical_cast<string>(sampleFraction)));
+    }
+    
+    if ((sampleFraction < 1.0 || tolerance > 0.0) && targetHash != nullptr) {
+        BOOST_THROW_EXCEPTION(InputFileException() << InputFileErrorInfo(string(
+                "Sampling and adaptive counting are not supported with targeted counting")));
+    }
+}
+
+void kat::InputHandler::reportConvergence(ostream& out, const MultiKCounter& counter) {
+    
+    if (counter.getTolerance() <= 0.0) {
+        return;
+    }
+    
+    if (counter.isConverged()) {
+        out << "  Spectrum converged after reading ~" << (int)(counter.getProgress() * 100.0 + 0.5) << "% of the input";
+    }
+    else {
+        out << "  Read all input before the spectrum converged";
+    }
+
+    if (counter.getLastChange() >= 0.0) {
+        out << " (spectrum changed by " << (counter.getLastChange() * 100.0) << "% at the last checkpoint)";
+    }
+    out << ".";
+    
+    // Only an estimate from the last two sample sizes, but shows how far the counts can be trusted
+    if (counter.isConverged() && counter.getSpectrumError() >= 0.0) {
+        out << endl << "  Uncertainty from the change between the last two checkpoints: fraction of distinct K-mers at each frequency ±" 
+            << (counter.getSpectrumError() * 100.0) << " percentage points, distinct K-mers per K-mer read ±" 
+            << (counter.getDistinctError() * 100.0) << "%.";
+    }
+}
+
+void kat::InputHandler::createHeader() {
     
-    // Create header for newly counted hash
     header = make_shared<file_header>();
     header->fill_standard();
     header->update_from_ary(*hash);
     header->counter_len(4);  // Hard code for now.
     header->canonical(canonical);
     header->format(binary_dumper::format);
+}
+
+void kat::InputHandler::setHash(LargeHashArrayPtr h) {
+
+    hash = h;
+    lookup = hash != nullptr && hash->key_len() <= 2 * BatchLookup::MAX_MER_LEN ?
+            make_shared<BatchLookup>(*hash) :
+            nullptr;
+}
+
+shared_ptr<kat::HashLoader> kat::InputHandler::newLoader() const {
+    
+    shared_ptr<HashLoader> loader = make_shared<HashLoader>();
+    loader->setHugePages(hugePages);
+    loader->setPrefaultThreads(prefaultThreads);
+    return loader;
+}
+
+void kat::InputHandler::placeHash(const uint16_t threads) {
+    
+    if (numa == NumaPlacement::NONE || hash == nullptr || !Numa::isNuma()) {
+        return;
+    }
+    
+    if (!Numa::place(*hash, numa, threads)) {
+        *out << "Warning: Could not place the hash for input " << index << " across NUMA nodes.  Continuing with the hash where it is." << endl;
+    }
+}
+
+string kat::InputHandler::cacheKey() const {
     
-    cout << " done.";
-    cout.flush();    
+    // Sampled and targeted counts depend on more than the input, so aren't reused
+    if (cacheDir.empty() || targetHash != nullptr || sampleFraction < 1.0 || tolerance > 0.0) {
+        return string();
+    }
+    
+    return HashCache::key(input, merLen, canonical, hashSize, minQual, cacheDigest);
+}
+
+bool kat::InputHandler::loadCached(const string& key) {
+    
+    HashCache cache(cacheDir, cacheSize);
+    path cached = cache.find(key);
+    if (cached.empty()) {
+        return false;
+    }
+    
+    auto_cpu_timer timer(*out, 1, "  Time taken: %ws\n\n");      
+    Metrics::Phase phase("load", cached.string());
+    phase.addBytesRead(bfs::file_size(cached));
+    
+    *out << "Input " << index << " was counted by an earlier run.  Loading kmers for input " << index << " (" << pathString() << ") from " << cached.string() << " ...";
+    out->flush();
+    
+    hashLoader = newLoader();
+    hashLoader->loadHash(cached, false);
+    setHash(hashLoader->getHash());
+    header = make_shared<file_header>(hashLoader->getHeader());
+    
+    *out << " done.";
+    out->flush();
+    
+    return true;
+}
+
+void kat::InputHandler::storeCached(const string& key, const uint16_t threads) {
+    
+    auto_cpu_timer timer(*out, 1, "  Time taken: %ws\n\n");      
+    Metrics::Phase phase("cache", pathString());
+    
+    *out << "Storing hash for input " << index << " in cache " << cacheDir.string() << " ...";
+    out->flush();
+    
+    // The cache is only an optimisation, so carry on without it if it can't be written
+    try {
+        HashCache(cacheDir, cacheSize).store(key, hash, *header, threads);
+        *out << " done.";
+    }
+    catch(std::exception& e) {
+        *out << " failed, continuing without caching: " << e.what();
+    }
+    out->flush();
 }
 
 void kat::InputHandler::loadHash() {
     
-    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+    auto_cpu_timer timer(*out, 1, "  Time taken: %ws\n\n");        
+    Metrics::Phase phase("load", pathString());
 
-    cout << "Loading hashes into memory...";
-    cout.flush();  
+    hashLoader = newLoader();
+    
+    if (header != nullptr && JellyfishHelper::isBloomCounter(*header)) {
+        
+        *out << "Memory mapping bloom counter...";
+        out->flush();
+        
+        bloom = hashLoader->loadBloomCounter(input[0], false);
+        canonical = hashLoader->getCanonical();
+        merLen = hashLoader->getMerLen();
+        bloomFpr = bloom->expectedFpr();
+        
+        *out << " done.  Counts are approximate (0, 1 or 2+).  Expected false positive rate: " << bloomFpr;
+        out->flush();
+        return;
+    }
+
+    // Query the hash where it's already held, if the server has it
+    if (!hashServer.empty()) {
+        
+        *out << "Connecting to hash server at " << hashServer.string() << " ...";
+        out->flush();
+        
+        client = HashClient::connect(hashServer, input[0]);
+        if (client != nullptr) {
+            canonical = client->getCanonical();
+            merLen = client->getMerLen();
+            mer_dna::k(merLen);
+            
+            *out << " done.  Counts for input " << index << " will be looked up from the server.";
+            out->flush();
+            return;
+        }
+        
+        *out << " server doesn't hold " << input[0].string() << ".  ";
+    }
+
+    // Query the hash in place if loading it wouldn't fit, and the tool allows it
+    const uint64_t limit = memoryLimit();
+    const uint64_t needed = limit > 0 ? HashLoader::loadedBytes(input[0]) : 0;
+    if (limit > 0 && needed > MemoryBudget::remaining(limit)) {
+        
+        if (allowBloom) {
+            *out << "Loading the hash would need about " << MemoryBudget::toMB(needed) << ", more than the " << MemoryBudget::toMB(limit) << " memory limit allows.  Memory mapping it to query in place...";
+            out->flush();
+            
+            mapped = hashLoader->mapHash(input[0], false);
+            canonical = hashLoader->getCanonical();
+            merLen = hashLoader->getMerLen();
+            
+            *out << " done.";
+            out->flush();
+            return;
+        }
+        
+        *out << "Warning: loading the hash will need about " << MemoryBudget::toMB(needed) << ", more than the " << MemoryBudget::toMB(limit) << " memory limit allows.  ";
+    }
+
+    *out << "Loading hashes into memory...";
+    out->flush();  
+    
+    phase.addBytesRead(sizeOnDisk());
     
-    hashLoader = make_shared<HashLoader>();
     hashLoader->loadHash(input[0], false); 
-    hash = hashLoader->getHash();
+    setHash(hashLoader->getHash());
     canonical = hashLoader->getCanonical();
     merLen = hashLoader->getMerLen();
     
-    cout << " done.";
-    cout.flush();    
+    *out << " done.";
+    out->flush();    
 }
 
 void kat::InputHandler::dump(const path& outputPath, const uint16_t threads) {
     
+    if (dumpShards > 1) {
+        dumpSharded(outputPath, threads);
+        return;
+    }
+    
     // Remove anything that exists at the target location
     if (bfs::is_symlink(outputPath) || bfs::exists(outputPath)) {
         bfs::remove(outputPath.c_str());
@@ -177,6 +762,7 @@ void kat::InputHandler::dump(const path& outputPath, const uint16_t threads) {
     if (mode == InputHandler::InputHandler::InputMode::COUNT) {
     
         auto_cpu_timer timer(1, "  Time taken: %ws\n\n"); 
+        Metrics::Phase phase("dump", outputPath.string());
         cout << "Dumping hash to " << outputPath.string() << " ...";
         cout.flush();
 
@@ -190,6 +776,46 @@ void kat::InputHandler::dump(const path& outputPath, const uint16_t threads) {
     }
 }
 
+void kat::InputHandler::dumpSharded(const path& outputPath, const uint16_t threads) {
+    
+    if (isServed() || isBloom()) {
+        BOOST_THROW_EXCEPTION(InputFileException() << InputFileErrorInfo(string(
+                "Can only split a jellyfish hash held in memory into shards: ") + pathString()));
+    }
+    
+    auto_cpu_timer timer(*out, 1, "  Time taken: %ws\n\n"); 
+    Metrics::Phase phase("dump", outputPath.string());
+    *out << "Dumping hash as " << dumpShards << " shards, to " << shardPath(outputPath, 1, dumpShards).string() 
+         << " to " << shardPath(outputPath, dumpShards, dumpShards).filename().string() << " ...";
+    out->flush();
+    
+    // Split off one shard at a time, so only one extra shard is ever held in memory
+    for(uint32_t i = 0; i < dumpShards; i++) {
+        
+        path shardOutputPath = shardPath(outputPath, i + 1, dumpShards);
+        if (bfs::is_symlink(shardOutputPath) || bfs::exists(shardOutputPath)) {
+            bfs::remove(shardOutputPath);
+        }
+        
+        LargeHashArrayPtr shard = JellyfishHelper::shardHash(*hash, i, dumpShards, threads);
+        
+        file_header shardHeader(*header);
+        shardHeader.update_from_ary(*shard);
+        
+        JellyfishHelper::dumpHash(shard, shardHeader, threads, shardOutputPath);
+        delete shard;
+    }
+    
+    *out << " done.";
+    out->flush();
+}
+
+path kat::InputHandler::shardPath(const path& hashPath, uint32_t shard, uint32_t nbShards) {
+    
+    return hashPath.parent_path() / (hashPath.stem().string() + "-shard" + lexical_cast<string>(shard) + 
+            "of" + lexical_cast<string>(nbShards) + hashPath.extension().string());
+}
+
 shared_ptr<vector<path>> kat::InputHandler::globFiles(const string& input) {
 
     vector<string> inputvec;
@@ -278,6 +904,9 @@ string kat::InputHandler::determineSequenceFileType(const path& filename) {
                 boost::iequals(ext, ".scafSeq")) {
         return "fasta";
     }
+    else if (boost::iequals(ext, ".bam") || ParallelSeqReader::isBamFile(filename)) {
+        return "bam";
+    }
     else {
         // Now check first character of the file
         char ch;
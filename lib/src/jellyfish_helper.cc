@@ -19,10 +19,15 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
 #include <thread>
 #include <vector>
 #include <fstream>
 using std::thread;
+using std::unique_ptr;
 using std::vector;
 using std::fstream;
 
@@ -49,7 +54,11 @@ using jellyfish::large_hash::reprobe_limit_t;
 using jellyfish::Offsets;
 using jellyfish::quadratic_reprobes;
 
+#include <kat/count_checkpoint.hpp>
+#include <kat/fixed_mer.hpp>
 #include <kat/jellyfish_helper.hpp>
+#include <kat/memory_pages.hpp>
+#include <kat/thread_pool.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 using kat::JellyfishHelper;
 
@@ -109,10 +118,10 @@ LargeHashArrayPtr kat::HashLoader::loadHash(const path& jfHashPath, bool verbose
         kat::JellyfishHelper::printHeader(header, cerr);
     }
 
-    if (header.format() == "bloomcounter") {
+    if (JellyfishHelper::isBloomCounter(header)) {
         in.close();
         BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
-                "KAT does not currently support bloom counted kmer hashes.  Please create a binary hash with jellyfish or KAT and use that instead.")));
+                "Bloom counted kmer hashes cannot be loaded as a hash array.  Only tools that query individual K-mers (sect and filter seq) support them.  Please create a binary hash with jellyfish or KAT and use that instead.")));
     } else if (header.format() == text_dumper::format) {
         in.close();
         BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
@@ -131,8 +140,13 @@ LargeHashArrayPtr kat::HashLoader::loadHash(const path& jfHashPath, bool verbose
 
         // Create a binary map for the input file
         mapped_file map(jfHashPath.c_str());
-        map.sequential(); // Prep for reading sequentially
-        map.load(); // Load
+        if (prefaultThreads > 0) {
+            MemoryPages::prefault(map.base(), map.length(), prefaultThreads);
+        }
+        else {
+            map.sequential(); // Prep for reading sequentially
+            map.load(); // Load
+        }
 
         const char* dataStart = map.base() + header.offset();
         size_t fileSizeBytes = map.length() - header.offset();
@@ -141,7 +155,8 @@ LargeHashArrayPtr kat::HashLoader::loadHash(const path& jfHashPath, bool verbose
         size_t record_len = header.counter_len() + key_len;
         size_t nbRecords = fileSizeBytes / record_len;
 
-        size_t lsize = jellyfish::ceilLog2(nbRecords * 2);
+        // Keep a minimum size, so that empty hashes, e.g. shards with no K-mers, still load
+        size_t lsize = jellyfish::ceilLog2(std::max(nbRecords * 2, (size_t)1024));
         size_t size_ = (size_t) 1 << lsize;
 
         if (verbose) {
@@ -172,6 +187,11 @@ LargeHashArrayPtr kat::HashLoader::loadHash(const path& jfHashPath, bool verbose
                 header.val_len(),
                 header.max_reprobe());
 
+        // Advise before adding anything, so the pages are huge from the first fault
+        if (hugePages) {
+            MemoryPages::adviseHugePages(*hash);
+        }
+
         while (reader.next()) {
             hash->add(reader.key(), reader.val());
         }
@@ -187,6 +207,210 @@ LargeHashArrayPtr kat::HashLoader::loadHash(const path& jfHashPath, bool verbose
 
 }
 
+/**
+ * Memory maps an existing jellyfish bloom counter
+ * @param bcPath
+ * @param verbose
+ * @return 
+ */
+kat::BloomCounterPtr kat::HashLoader::loadBloomCounter(const path& bcPath, bool verbose) {
+
+    ifstream in(bcPath.c_str(), std::ios::in | std::ios::binary);
+    header = file_header(in);
+
+    if (!in.good()) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Failed to parse header of file: ") + bcPath.string()));
+    }
+    
+    in.close();
+
+    if (verbose) {
+        kat::JellyfishHelper::printHeader(header, cerr);
+    }
+
+    if (!JellyfishHelper::isBloomCounter(header)) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Expected a bloom counter but found format '") + header.format() + "' in: " + bcPath.string()));
+    }
+
+    // Makes sure jellyfish knows what size kmers we are working with
+    merLen = header.key_len() / 2;
+    mer_dna::k(merLen);
+
+    bloom = make_shared<BloomCounter>(header, bcPath);
+    
+    if (prefaultThreads > 0) {
+        bloom->prefault(prefaultThreads);
+    }
+
+    if (verbose) {
+        cerr << endl
+                << "Bloom counter properties:" << endl
+                << " - Kmer length: " << merLen << endl
+                << " - # cells: " << bloom->m() << endl
+                << " - # hash functions: " << bloom->k() << endl
+                << " - Data size (bytes): " << bloom->nb_bytes() << endl << endl;
+    }
+
+    return bloom;
+}
+
+kat::MappedHashPtr kat::HashLoader::mapHash(const path& jfHashPath, bool verbose) {
+
+    ifstream in(jfHashPath.c_str(), std::ios::in | std::ios::binary);
+    header = file_header(in);
+
+    if (!in.good()) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Failed to parse header of file: ") + jfHashPath.string()));
+    }
+    
+    in.close();
+
+    if (verbose) {
+        kat::JellyfishHelper::printHeader(header, cerr);
+    }
+
+    if (header.format() != binary_dumper::format) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Only binary jellyfish hashes can be queried in place, but found format '") + header.format() + 
+                "' in: " + jfHashPath.string()));
+    }
+
+    merLen = header.key_len() / 2;
+    mer_dna::k(merLen);
+
+    mapped = make_shared<MappedHash>(header, jfHashPath);
+    
+    if (prefaultThreads > 0) {
+        mapped->prefault(prefaultThreads);
+    }
+
+    if (verbose) {
+        cerr << endl
+                << "Mapped hash properties:" << endl
+                << " - Kmer length: " << merLen << endl
+                << " - # records: " << mapped->nbRecords() << endl << endl;
+    }
+
+    return mapped;
+}
+
+uint64_t kat::HashLoader::loadedBytes(const path& jfHashPath) {
+
+    ifstream in(jfHashPath.c_str(), std::ios::in | std::ios::binary);
+    file_header h(in);
+    if (!in.good() || h.format() != binary_dumper::format) {
+        return 0;
+    }
+    in.close();
+
+    // As sized by loadHash
+    const size_t keyBytes = h.key_len() / 8 + (h.key_len() % 8 != 0);
+    const size_t recordBytes = h.counter_len() + keyBytes;
+    const uint64_t records = (bfs::file_size(jfHashPath) - h.offset()) / recordBytes;
+    const size_t size = (size_t)1 << jellyfish::ceilLog2(std::max(records * 2, (uint64_t)1024));
+    
+    LargeHashArray::usage_info ui(h.key_len(), h.val_len(), h.max_reprobe());
+    return ui.mem(size);
+}
+
+kat::MappedHash::MappedHash(const file_header& header, const path& hashPath) :
+        map(hashPath.c_str()),
+        matrix(header.matrix()),
+        mask(header.size() - 1) {
+    
+    keyBytes = header.key_len() / 8 + (header.key_len() % 8 != 0);
+    valBytes = header.counter_len();
+    recordBytes = keyBytes + valBytes;
+    data = map.base() + header.offset();
+    
+    const size_t dataBytes = map.length() - header.offset();
+    if (dataBytes % recordBytes != 0) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Size of database (") + lexical_cast<string>(dataBytes) +
+                ") must be a multiple of the length of a record (" + lexical_cast<string>(recordBytes) + ")"));
+    }
+    records = dataBytes / recordBytes;
+    
+    // Lookups jump around the file
+    map.random();
+}
+
+void kat::MappedHash::keyAt(uint64_t i, mer_dna& key) const {
+    memcpy(key.data__(), data + i * recordBytes, keyBytes);
+    key.clean_msw();
+}
+
+uint64_t kat::MappedHash::valAt(uint64_t i) const {
+    uint64_t val = 0;
+    memcpy(&val, data + i * recordBytes + keyBytes, valBytes);
+    return val;
+}
+
+uint64_t kat::MappedHash::check(const mer_dna& key) const {
+    
+    const uint64_t p = pos(key);
+    mer_dna mid;
+    
+    // First record not before the key, ordering by position then key
+    uint64_t lo = 0, hi = records;
+    while (lo < hi) {
+        const uint64_t m = lo + (hi - lo) / 2;
+        keyAt(m, mid);
+        const uint64_t midPos = pos(mid);
+        if (midPos < p || (midPos == p && mid < key)) {
+            lo = m + 1;
+        }
+        else {
+            hi = m;
+        }
+    }
+    
+    if (lo < records) {
+        keyAt(lo, mid);
+        if (mid == key) {
+            return valAt(lo);
+        }
+    }
+    return 0;
+}
+
+void kat::MappedHash::prefault(uint16_t threads) const {
+    MemoryPages::prefault(map.base(), map.length(), threads);
+}
+
+double kat::BloomCounter::occupancy() const {
+    
+    // Each byte packs 5 cells, each holding a value of 0, 1 or 2.  Build a table
+    // containing the number of non-zero cells for every possible byte value.
+    uint8_t nonZero[243];
+    for (uint16_t b = 0; b < 243; b++) {
+        uint8_t c = 0;
+        for (uint16_t v = b; v > 0; v /= 3) {
+            if (v % 3 != 0) c++;
+        }
+        nonZero[b] = c;
+    }
+    
+    uint64_t set = 0;
+    const unsigned char* end = data_ + nb_bytes();
+    for (const unsigned char* p = data_; p < end; p++) {
+        if (*p < 243) set += nonZero[*p];
+    }
+    
+    return m() == 0 ? 0.0 : (double)set / (double)m();
+}
+
+double kat::BloomCounter::expectedFpr() const {
+    return std::pow(occupancy(), (double)k());
+}
+
+void kat::BloomCounter::prefault(uint16_t threads) const {
+    MemoryPages::prefault(base(), length(), threads);
+}
+
 uint64_t kat::JellyfishHelper::getCount(LargeHashArrayPtr hash, const mer_dna& kmer, bool canonical) {
     const mer_dna k = canonical ? kmer.get_canonical() : kmer;
     uint64_t val = 0;
@@ -194,6 +418,14 @@ uint64_t kat::JellyfishHelper::getCount(LargeHashArrayPtr hash, const mer_dna& k
     return val;
 }
 
+uint64_t kat::JellyfishHelper::getCount(BloomCounterPtr bloom, const mer_dna& kmer, bool canonical) {
+    return canonical ? bloom->check(kmer.get_canonical()) : bloom->check(kmer);
+}
+
+uint64_t kat::JellyfishHelper::getCount(MappedHashPtr mapped, const mer_dna& kmer, bool canonical) {
+    return canonical ? mapped->check(kmer.get_canonical()) : mapped->check(kmer);
+}
+
 /**
  * Simple count routine
  * @param ary Hash array which contains the counted kmers
@@ -211,13 +443,213 @@ void kat::JellyfishHelper::countSlice(HashCounter& ary, SequenceParser& parser,
     ary.done();
 }
 
+void kat::JellyfishHelper::countSliceQual(HashCounter& ary, ReadParser& parser, bool canonical, char minQualChar) {
+
+    MerQualIterator mers(parser, minQualChar, canonical);
+
+    for (; mers; ++mers) {
+        ary.add(*mers, 1);
+    }
+
+    ary.done();
+}
+
+/**
+ * Calls f for every K-mer in the given stretch of sequence.  Invalid bases
+ * (e.g. N) break the sequence.  W is the FixedMer word type for the current
+ * K-mer length.
+ */
+template<typename W, typename F>
+static void forEachMer(const char* seq, size_t len, bool canonical, F f) {
+
+    kat::FixedMer<W> m(mer_dna::k());
+    mer_dna key;
+    const unsigned int k = m.merLen();
+    unsigned int filled = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        int code = mer_dna::code(seq[i]);
+        if (code >= 0) {
+            m.shiftLeft(code);
+            if (filled < k) filled++;
+            if (filled >= k) {
+                kat::FixedMer<W>::toMer(m.get(canonical), key);
+                f(key);
+            }
+        }
+        else {
+            filled = 0;
+        }
+    }
+}
+
+static vector<ParallelSeqReaderPtr> createReaders(const vector<path>& seqFiles, uint16_t merLen, uint16_t threads, uint16_t minQual) {
+
+    vector<ParallelSeqReaderPtr> readers;
+    for (auto& p : seqFiles) {
+        readers.push_back(make_shared<ParallelSeqReader>(p, merLen, threads));
+        readers.back()->setMinQual(minQual);
+    }
+    return readers;
+}
+
+/**
+ * Converts a Phred score to the equivalent Phred+33 quality character
+ */
+static char qualChar(uint16_t minQual) {
+    return (char)std::min<uint16_t>(kat::PHRED_OFFSET + minQual, 127);
+}
+
+static void checkReaders(const vector<ParallelSeqReaderPtr>& readers) {
+
+    for (auto& r : readers) {
+        string error = r->getError();
+        if (!error.empty()) {
+            BOOST_THROW_EXCEPTION(kat::JellyfishException() << kat::JellyfishErrorInfo(string(
+                    "Error reading sequence file: ") + error));
+        }
+    }
+}
+
+bool kat::JellyfishHelper::useParallelReader(const vector<path>& seqFiles, uint16_t threads) {
+
+    bool compressed = false;
+    for (auto& p : seqFiles) {
+        if (isPipe(p)) return false;
+        if (ParallelSeqReader::detectCompression(p) != ParallelSeqReader::Compression::NONE) {
+            compressed = true;
+        }
+    }
+
+    return compressed || seqFiles.size() < threads;
+}
+
+template<typename W>
+static void addReaders(HashCounter& ary, vector<ParallelSeqReaderPtr>& readers, bool canonical) {
+
+    for (auto& r : readers) {
+        r->process([&](const char* seq, size_t len, size_t owned) {
+            forEachMer<W>(seq, len, canonical, [&](const mer_dna& m) { ary.add(m, 1); });
+        });
+    }
+}
+
+void kat::JellyfishHelper::countSliceParallel(HashCounter& ary, vector<ParallelSeqReaderPtr>& readers, bool canonical) {
+
+    switch (kat::merWidth(mer_dna::k())) {
+        case kat::MerWidth::ONE_WORD:
+            addReaders<uint64_t>(ary, readers, canonical);
+            break;
+        case kat::MerWidth::TWO_WORDS:
+            addReaders<kat::uint128_t>(ary, readers, canonical);
+            break;
+        default:
+            addReaders<mer_dna>(ary, readers, canonical);
+            break;
+    }
+
+    ary.done();
+}
+
+/**
+ * Gets at the parts of jellyfish's hash_counter needed to count in rounds, and to
+ * carry on counting into a hash loaded from a checkpoint
+ */
+class HashCounterAccess : public HashCounter {
+public:
+
+    /**
+     * Lets the counter's threads add K-mers again after they have all called done()
+     */
+    static void restart(HashCounter& counter) {
+        counter.*(&HashCounterAccess::done_threads_) = 0;
+    }
+
+    /**
+     * Swaps the counter's hash for the given one, which the counter takes ownership of
+     */
+    static void replaceArray(HashCounter& counter, LargeHashArrayPtr ary) {
+        LargeHashArrayPtr& current = counter.*(&HashCounterAccess::ary_);
+        delete current;
+        current = ary;
+    }
+};
+
+/**
+ * Counts the files in rounds of a few units of input per thread.  Between rounds, 
+ * when the checkpoint is due, the hash is saved along with where the round ended.
+ */
+static LargeHashArrayPtr countCheckpointed(const vector<path>& seqFiles, HashCounter& hashCounter, bool canonical, uint16_t threads, uint16_t minQual, kat::CountCheckpoint& checkpoint) {
+
+    for (auto& p : seqFiles) {
+        if (JellyfishHelper::isPipe(p)) {
+            BOOST_THROW_EXCEPTION(kat::JellyfishException() << kat::JellyfishErrorInfo(string(
+                    "Checkpointing is not supported for pipes: ") + p.string()));
+        }
+    }
+
+    const uint16_t merLen = mer_dna::k();
+    checkpoint.setRun(seqFiles, vector<uint16_t>(1, merLen), canonical, minQual, 1.0, threads);
+
+    // Units of input only line up with the checkpoint if split for as many threads as before
+    kat::CountCheckpoint::Position position;
+    uint16_t splitThreads = threads;
+    vector<LargeHashArrayPtr> loaded;
+    if (checkpoint.load(loaded, position, splitThreads)) {
+        HashCounterAccess::replaceArray(hashCounter, loaded[0]);
+        mer_dna::k(merLen);
+    }
+
+    vector<ParallelSeqReaderPtr> readers = createReaders(seqFiles, merLen, splitThreads, minQual);
+    const size_t roundUnits = (size_t)splitThreads * kat::CHECKPOINT_ROUND_UNITS_PER_THREAD;
+
+    for (size_t i = position.file; i < readers.size(); i++) {
+
+        ParallelSeqReaderPtr r = readers[i];
+        if (i == position.file) {
+            r->setFirstUnit(position.unit);
+        }
+        vector<ParallelSeqReaderPtr> current(1, r);
+
+        while (!r->isFinished()) {
+
+            r->setUnitLimit(r->getUnitsStarted() + roundUnits);
+            HashCounterAccess::restart(hashCounter);
+
+            vector<thread> t(threads);
+
+            for (int j = 0; j < threads; j++) {
+                t[j] = thread(&kat::JellyfishHelper::countSliceParallel, std::ref(hashCounter), std::ref(current), canonical);
+            }
+
+            for (int j = 0; j < threads; j++) {
+                t[j].join();
+            }
+
+            // Never checkpoint past input that failed to parse
+            checkReaders(current);
+
+            if (checkpoint.due()) {
+                kat::CountCheckpoint::Position done;
+                done.file = r->isFinished() ? i + 1 : i;
+                done.unit = r->isFinished() ? 0 : r->getUnitsStarted();
+                checkpoint.save(vector<LargeHashArrayPtr>(1, hashCounter.ary()), done);
+            }
+        }
+    }
+
+    checkpoint.remove();
+
+    return hashCounter.ary();
+}
+
 /**
  * Counts kmers in the given sequence file (Fasta or Fastq) returning
  * a hash array of those kmers
  * @param seqFile Sequence file to count
  * @return The hash array
  */
-LargeHashArrayPtr kat::JellyfishHelper::countSeqFile(const vector<path>& seqFiles, HashCounter& hashCounter, bool canonical, uint16_t threads) {
+LargeHashArrayPtr kat::JellyfishHelper::countSeqFile(const vector<path>& seqFiles, HashCounter& hashCounter, bool canonical, uint16_t threads, uint16_t minQual, CountCheckpoint* checkpoint) {
 
     // Convert paths to a format jellyfish is happy with
     vector<const char*> paths;
@@ -229,30 +661,391 @@ LargeHashArrayPtr kat::JellyfishHelper::countSeqFile(const vector<path>& seqFile
     unsigned int merLen = hashCounter.key_len() / 2;
     mer_dna::k(merLen);
 
-    StreamManager streams(paths.begin(), paths.end(), (const int) std::min(paths.size(), (size_t) threads));
+    if (checkpoint != nullptr) {
+        return countCheckpointed(seqFiles, hashCounter, canonical, threads, minQual, *checkpoint);
+    }
+
+    if (useParallelReader(seqFiles, threads)) {
+
+        vector<ParallelSeqReaderPtr> readers = createReaders(seqFiles, merLen, threads, minQual);
 
-    SequenceParser parser(merLen, streams.nb_streams(), 3 * threads, 4096, streams);
+        // Not the thread pool: the counter needs every one of its threads
+        // running at once to grow the hash
+        vector<thread> t(threads);
+
+        for (int i = 0; i < threads; i++) {
+            t[i] = thread(&kat::JellyfishHelper::countSliceParallel, std::ref(hashCounter), std::ref(readers), canonical);
+        }
+
+        for (int i = 0; i < threads; i++) {
+            t[i].join();
+        }
+
+        checkReaders(readers);
+
+        return hashCounter.ary();
+    }
+
+    StreamManager streams(paths.begin(), paths.end(), (int) std::min(paths.size(), (size_t) threads));
 
     vector<thread> t(threads);
 
+    if (minQual > 0) {
+
+        // The overlap parser discards qualities, so read whole records instead
+        ReadParser parser(3 * threads, 100, streams.nb_streams(), streams);
+
+        for (int i = 0; i < threads; i++) {
+            t[i] = thread(&kat::JellyfishHelper::countSliceQual, std::ref(hashCounter), std::ref(parser), canonical, qualChar(minQual));
+        }
+
+        for (int i = 0; i < threads; i++) {
+            t[i].join();
+        }
+    }
+    else {
+
+        SequenceParser parser(merLen, streams.nb_streams(), 3 * threads, 4096, streams);
+
+        for (int i = 0; i < threads; i++) {
+            t[i] = thread(&kat::JellyfishHelper::countSlice, std::ref(hashCounter), std::ref(parser), canonical);
+        }
+
+        for (int i = 0; i < threads; i++) {
+            t[i].join();
+        }
+    }
+
+    return hashCounter.ary();
+}
+
+/**
+ * Inserts the keys from one slice of the source hash into the target.  Sets full
+ * if the target could not hold all the keys.
+ */
+static void setTargetSlice(LargeHashArray& target, const LargeHashArray& source, int th_id, uint16_t threads, bool& full) {
+
+    LargeHashArray::eager_iterator it = source.eager_slice(th_id, threads);
+    while (it.next()) {
+        if (!target.set(it.key())) {
+            full = true;
+            return;
+        }
+    }
+}
+
+LargeHashArrayPtr kat::JellyfishHelper::createTargetHash(const LargeHashArray& source, uint16_t threads) {
+
+    // The source is already sized for the target K-mers, but counts from the new
+    // input are likely to be larger, so give the hash extra room for large values
+    LargeHashArrayPtr target = new LargeHashArray(
+            source.size() * 2,
+            source.key_len(),
+            source.val_len(),
+            source.max_reprobe());
+
+    unique_ptr<bool[]> full(new bool[threads]());
+
+    ThreadPool::global().parallelFor(threads, [&](size_t i) {
+        setTargetSlice(*target, source, i, threads, full[i]);
+    });
+
+    bool anyFull = false;
+    for (int i = 0; i < threads; i++) {
+        anyFull = anyFull || full[i];
+    }
+
+    if (anyFull) {
+        delete target;
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Target hash is full")));
+    }
+
+    return target;
+}
+
+/**
+ * Increments the count of each K-mer from the iterator that is already in the hash
+ */
+template<typename Iterator>
+static void addTargeted(LargeHashArray& ary, Iterator& mers, uint64_t& absent, bool& full) {
+
+    mer_dna tmp;
+    unsigned int carry_shift = 0;
+    uint64_t val = 0;
+    uint64_t notFound = 0;
+
+    for (; mers; ++mers) {
+        if (!ary.update_add(*mers, 1, &carry_shift, tmp)) {
+            
+            // Either the K-mer isn't targeted, or the hash couldn't hold a large count
+            if (ary.get_val_for_key(*mers, &val)) {
+                full = true;
+            }
+            else {
+                notFound++;
+            }
+        }
+    }
+
+    absent = notFound;
+}
+
+void kat::JellyfishHelper::countSliceTargeted(LargeHashArray& ary, SequenceParser& parser, bool canonical, uint64_t& absent, bool& full) {
+
+    MerIterator mers(parser, canonical);
+    addTargeted(ary, mers, absent, full);
+}
+
+void kat::JellyfishHelper::countSliceTargetedQual(LargeHashArray& ary, ReadParser& parser, bool canonical, char minQualChar, uint64_t& absent, bool& full) {
+
+    MerQualIterator mers(parser, minQualChar, canonical);
+    addTargeted(ary, mers, absent, full);
+}
+
+template<typename W>
+static void addReadersTargeted(LargeHashArray& ary, vector<ParallelSeqReaderPtr>& readers, bool canonical, uint64_t& absent, bool& full) {
+
+    mer_dna tmp;
+    uint64_t val = 0;
+    uint64_t notFound = 0;
+
+    for (auto& r : readers) {
+        r->process([&](const char* seq, size_t len, size_t owned) {
+            forEachMer<W>(seq, len, canonical, [&](const mer_dna& m) {
+                unsigned int carry_shift = 0;
+                if (!ary.update_add(m, 1, &carry_shift, tmp)) {
+                    if (ary.get_val_for_key(m, &val)) {
+                        full = true;
+                    }
+                    else {
+                        notFound++;
+                    }
+                }
+            });
+        });
+    }
+
+    absent = notFound;
+}
+
+void kat::JellyfishHelper::countSliceTargetedParallel(LargeHashArray& ary, vector<ParallelSeqReaderPtr>& readers, bool canonical, uint64_t& absent, bool& full) {
+
+    switch (kat::merWidth(mer_dna::k())) {
+        case kat::MerWidth::ONE_WORD:
+            addReadersTargeted<uint64_t>(ary, readers, canonical, absent, full);
+            break;
+        case kat::MerWidth::TWO_WORDS:
+            addReadersTargeted<kat::uint128_t>(ary, readers, canonical, absent, full);
+            break;
+        default:
+            addReadersTargeted<mer_dna>(ary, readers, canonical, absent, full);
+            break;
+    }
+}
+
+uint64_t kat::JellyfishHelper::countSeqFileTargeted(const vector<path>& seqFiles, LargeHashArray& target, bool canonical, uint16_t threads, uint16_t minQual) {
+
+    // Convert paths to a format jellyfish is happy with
+    vector<const char*> paths;
+    for (auto& p : seqFiles) {
+        paths.push_back(p.c_str());
+    }
+
+    // Ensures jellyfish knows what kind of kmers we are working with
+    unsigned int merLen = target.key_len() / 2;
+    mer_dna::k(merLen);
+
+    vector<uint64_t> absent(threads, 0);
+    unique_ptr<bool[]> full(new bool[threads]());
+
+    if (useParallelReader(seqFiles, threads)) {
+
+        vector<ParallelSeqReaderPtr> readers = createReaders(seqFiles, merLen, threads, minQual);
+
+        ThreadPool::global().parallelFor(threads, [&](size_t i) {
+            countSliceTargetedParallel(target, readers, canonical, absent[i], full[i]);
+        });
+
+        checkReaders(readers);
+    }
+    else if (minQual > 0) {
+
+        StreamManager streams(paths.begin(), paths.end(), (int) std::min(paths.size(), (size_t) threads));
+
+        ReadParser parser(3 * threads, 100, streams.nb_streams(), streams);
+
+        ThreadPool::global().parallelFor(threads, [&](size_t i) {
+            countSliceTargetedQual(target, parser, canonical, qualChar(minQual), absent[i], full[i]);
+        });
+    }
+    else {
+
+        StreamManager streams(paths.begin(), paths.end(), (int) std::min(paths.size(), (size_t) threads));
+
+        SequenceParser parser(merLen, streams.nb_streams(), 3 * threads, 4096, streams);
+
+        ThreadPool::global().parallelFor(threads, [&](size_t i) {
+            countSliceTargeted(target, parser, canonical, absent[i], full[i]);
+        });
+    }
+
+    uint64_t totalAbsent = 0;
+    bool anyFull = false;
+    for (int i = 0; i < threads; i++) {
+        totalAbsent += absent[i];
+        anyFull = anyFull || full[i];
+    }
+
+    if (anyFull) {
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Hash is full.  Unable to store large counts for some targeted K-mers.")));
+    }
+
+    return totalAbsent;
+}
+
+/**
+ * Copies all non-zero entries from one slice of the source hash into the destination.
+ * Sets full if the destination could not hold all the entries.
+ */
+static void compactSlice(LargeHashArray& dest, const LargeHashArray& source, int th_id, uint16_t threads, bool& full) {
+
+    LargeHashArray::eager_iterator it = source.eager_slice(th_id, threads);
+    while (it.next()) {
+        if (it.val() > 0 && !dest.add(it.key(), it.val())) {
+            full = true;
+            return;
+        }
+    }
+}
+
+LargeHashArrayPtr kat::JellyfishHelper::compactHash(const LargeHashArray& ary, uint16_t threads) {
+
+    LargeHashArrayPtr compact = new LargeHashArray(
+            ary.size(),
+            ary.key_len(),
+            ary.val_len(),
+            ary.max_reprobe());
+
+    unique_ptr<bool[]> full(new bool[threads]());
+
+    ThreadPool::global().parallelFor(threads, [&](size_t i) {
+        compactSlice(*compact, ary, i, threads, full[i]);
+    });
+
+    bool anyFull = false;
     for (int i = 0; i < threads; i++) {
-        t[i] = thread(&kat::JellyfishHelper::countSlice, std::ref(hashCounter), std::ref(parser), canonical);
+        anyFull = anyFull || full[i];
+    }
+
+    if (anyFull) {
+        delete compact;
+        BOOST_THROW_EXCEPTION(JellyfishException() << JellyfishErrorInfo(string(
+                "Hash is full")));
+    }
+
+    return compact;
+}
+
+uint32_t kat::JellyfishHelper::shardOf(const mer_dna& kmer, uint32_t nbShards) {
+
+    // Mix the K-mer's words (splitmix64 finaliser), so that shards are even
+    // however the K-mers are distributed
+    uint64_t h = 0;
+    for (unsigned int i = 0; i < kmer.nb_words(); i++) {
+        h ^= kmer.word(i) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+    }
+
+    // Scale the hash onto [0, nbShards) by its high bits
+    return (uint32_t)(((uint128_t)h * nbShards) >> 64);
+}
+
+/**
+ * Counts the K-mers with a non-zero count in one slice of the source hash that
+ * fall in the given shard
+ */
+static void countShardSlice(const LargeHashArray& source, uint32_t shard, uint32_t nbShards, int th_id, uint16_t threads, uint64_t& count) {
+
+    LargeHashArray::eager_iterator it = source.eager_slice(th_id, threads);
+    while (it.next()) {
+        if (it.val() > 0 && JellyfishHelper::shardOf(it.key(), nbShards) == shard) {
+            count++;
+        }
+    }
+}
+
+/**
+ * Copies the entries in one slice of the source hash that fall in the given
+ * shard into the destination.  Sets full if the destination could not hold all
+ * the entries.
+ */
+static void shardSlice(LargeHashArray& dest, const LargeHashArray& source, uint32_t shard, uint32_t nbShards, int th_id, uint16_t threads, bool& full) {
+
+    LargeHashArray::eager_iterator it = source.eager_slice(th_id, threads);
+    while (it.next()) {
+        if (it.val() > 0 && JellyfishHelper::shardOf(it.key(), nbShards) == shard && !dest.add(it.key(), it.val())) {
+            full = true;
+            return;
+        }
     }
+}
+
+LargeHashArrayPtr kat::JellyfishHelper::shardHash(const LargeHashArray& ary, uint32_t shard, uint32_t nbShards, uint16_t threads) {
+
+    vector<uint64_t> counts(threads, 0);
 
+    ThreadPool::global().parallelFor(threads, [&](size_t i) {
+        countShardSlice(ary, shard, nbShards, i, threads, counts[i]);
+    });
+
+    uint64_t count = 0;
     for (int i = 0; i < threads; i++) {
-        t[i].join();
+        count += counts[i];
     }
 
-    return hashCounter.ary();
+    // Leave the shard's hash half empty, so reprobing stays short.  Grow it if it
+    // still fills up.
+    uint64_t size = std::max(count * 2, (uint64_t)1024);
+
+    while (true) {
+        LargeHashArrayPtr part = new LargeHashArray(
+                size,
+                ary.key_len(),
+                ary.val_len(),
+                ary.max_reprobe());
+
+        unique_ptr<bool[]> full(new bool[threads]());
+
+        ThreadPool::global().parallelFor(threads, [&](size_t i) {
+            shardSlice(*part, ary, shard, nbShards, i, threads, full[i]);
+        });
+
+        bool anyFull = false;
+        for (int i = 0; i < threads; i++) {
+            anyFull = anyFull || full[i];
+        }
+
+        if (!anyFull) {
+            return part;
+        }
+
+        delete part;
+        size *= 2;
+    }
 }
 
-void kat::JellyfishHelper::dumpHash(LargeHashArrayPtr ary, file_header& header, uint16_t threads, const path& outputFile) {
+void kat::JellyfishHelper::dumpHash(LargeHashArrayPtr ary, file_header& header, uint16_t threads, const path& outputFile, bool keepHash) {
 
     //JellyfishHelper::printHeader(header, cout);
 
     // Create the dumper
     binary_dumper dumper(4, ary->key_len(), threads, outputFile.c_str(), &header);
     dumper.one_file(true);
+    dumper.zero_array(!keepHash);
     dumper.dump(ary);
 }
 
@@ -275,12 +1068,12 @@ bool kat::JellyfishHelper::isSequenceFile(const path& filename) {
     
     string ext = filename.extension().string();
 
-    // Actually we can't handle gz files directly, so turning this off for now
-    /*if (boost::iequals(ext, ".gz")) {
+    // Gzipped (and bgzipped) files are decompressed by ParallelSeqReader
+    if (boost::iequals(ext, ".gz") || boost::iequals(ext, ".bgz")) {
         string name = filename.filename().string();
-        string shortName = name.substr(0, name.length() - 3);
+        string shortName = name.substr(0, name.length() - ext.length());
         ext = path(shortName).extension().string();
-    }*/
+    }
 
     // Check extension first
     bool seqext = boost::iequals(ext, ".fastq") ||
@@ -289,10 +1082,13 @@ bool kat::JellyfishHelper::isSequenceFile(const path& filename) {
             boost::iequals(ext, ".fa") ||
             boost::iequals(ext, ".fna") ||
             boost::iequals(ext, ".fas") ||
-            boost::iequals(ext, ".scafSeq"); // For SOAP de novo scaffolder output
+            boost::iequals(ext, ".scafSeq") || // For SOAP de novo scaffolder output
+            boost::iequals(ext, ".bam");       // Unaligned reads
 
 
     if (seqext) return true;
+    
+    if (ParallelSeqReader::isBamFile(filename)) return true;
 
     // Now check first character of the file
     char ch;
@@ -0,0 +1,309 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+using std::endl;
+using std::ifstream;
+using std::ofstream;
+using std::unordered_map;
+
+#include <boost/lexical_cast.hpp>
+using boost::lexical_cast;
+
+#include <kat/fixed_mer.hpp>
+#include <kat/parallel_seq_reader.hpp>
+#include <kat/thread_pool.hpp>
+
+#include <kat/kmer_sketch.hpp>
+
+// Starting value for K-mer hashes, so they don't follow the shard hashes
+static const uint64_t SKETCH_SEED = 0x5bd1e9955bd1e995ULL;
+
+kat::KmerSketch::KmerSketch(uint16_t _merLen, bool _canonical, uint64_t _scale) :
+    merLen(_merLen), canonical(_canonical), scale(std::max<uint64_t>(_scale, 1)) {
+
+    maxHash = std::numeric_limits<uint64_t>::max() / scale;
+}
+
+uint64_t kat::KmerSketch::hashOf(const mer_dna& kmer) {
+
+    // Same mixing as JellyfishHelper::shardOf, from a different start
+    uint64_t h = SKETCH_SEED;
+    for (unsigned int i = 0; i < kmer.nb_words(); i++) {
+        h ^= kmer.word(i) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+    }
+    return h;
+}
+
+void kat::KmerSketch::setEntries(vector<Entry>& unsorted) {
+
+    std::sort(unsorted.begin(), unsorted.end());
+
+    entries.clear();
+    for (auto& e : unsorted) {
+        if (!entries.empty() && entries.back().first == e.first) {
+            entries.back().second += e.second;
+        }
+        else {
+            entries.push_back(e);
+        }
+    }
+}
+
+template<typename W>
+static void sketchReaders(const kat::KmerSketch& sketch, vector<ParallelSeqReaderPtr>& readers, unordered_map<uint64_t, uint64_t>& kept) {
+
+    const unsigned int k = sketch.getMerLen();
+    const bool canonical = sketch.isCanonical();
+    kat::FixedMer<W> m(k);
+    mer_dna key;
+
+    for (auto& r : readers) {
+        r->process([&](const char* seq, size_t len, size_t owned) {
+            unsigned int filled = 0;
+            for (size_t i = 0; i < len; i++) {
+                const int code = mer_dna::code(seq[i]);
+                if (code < 0) {
+                    filled = 0;
+                    continue;
+                }
+                m.shiftLeft(code);
+                if (filled < k) filled++;
+                if (filled >= k) {
+                    kat::FixedMer<W>::toMer(m.get(canonical), key);
+                    const uint64_t h = kat::KmerSketch::hashOf(key);
+                    if (sketch.keeps(h)) {
+                        kept[h]++;
+                    }
+                }
+            }
+        });
+    }
+}
+
+void kat::KmerSketch::sketchSeqFiles(const vector<path>& seqFiles, uint16_t threads, uint16_t minQual) {
+
+    for (auto& p : seqFiles) {
+        if (JellyfishHelper::isPipe(p)) {
+            BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                    "Sketching is not supported for pipes: ") + p.string()));
+        }
+    }
+
+    mer_dna::k(merLen);
+
+    vector<ParallelSeqReaderPtr> readers;
+    for (auto& p : seqFiles) {
+        readers.push_back(make_shared<ParallelSeqReader>(p, merLen, threads));
+        readers.back()->setMinQual(minQual);
+    }
+
+    // Each thread keeps its own sample, which are put together at the end
+    vector<Entry> all;
+    std::mutex mu;
+
+    ThreadPool::global().parallelFor(threads, [&](size_t i) {
+        unordered_map<uint64_t, uint64_t> kept;
+        switch (merWidth(merLen)) {
+            case MerWidth::ONE_WORD:
+                sketchReaders<uint64_t>(*this, readers, kept);
+                break;
+            case MerWidth::TWO_WORDS:
+                sketchReaders<uint128_t>(*this, readers, kept);
+                break;
+            default:
+                sketchReaders<mer_dna>(*this, readers, kept);
+                break;
+        }
+        std::lock_guard<std::mutex> lock(mu);
+        all.insert(all.end(), kept.begin(), kept.end());
+    });
+
+    for (auto& r : readers) {
+        string error = r->getError();
+        if (!error.empty()) {
+            BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                    "Error reading sequence file: ") + error));
+        }
+    }
+
+    setEntries(all);
+}
+
+void kat::KmerSketch::sketchHash(const LargeHashArray& hash, uint16_t threads) {
+
+    if (hash.key_len() != merLen * 2) {
+        BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                "Hash has a different K-mer length to the sketch.  Expected: ") + lexical_cast<string>(merLen) +
+                ".  Hash: " + lexical_cast<string>(hash.key_len() / 2)));
+    }
+
+    mer_dna::k(merLen);
+
+    vector<Entry> all;
+    std::mutex mu;
+
+    ThreadPool::global().parallelFor(threads, [&](size_t i) {
+        vector<Entry> kept;
+        LargeHashArray::eager_iterator it = hash.eager_slice(i, threads);
+        while (it.next()) {
+            const uint64_t h = hashOf(it.key());
+            if (it.val() > 0 && keeps(h)) {
+                kept.push_back(Entry(h, it.val()));
+            }
+        }
+        std::lock_guard<std::mutex> lock(mu);
+        all.insert(all.end(), kept.begin(), kept.end());
+    });
+
+    setEntries(all);
+}
+
+void kat::KmerSketch::checkCompatible(const KmerSketch& other) const {
+
+    if (merLen != other.merLen || canonical != other.canonical || scale != other.scale) {
+        BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                "Sketches can only be compared if they have the same K-mer length, canonical setting and scale.  Got K=") +
+                lexical_cast<string>(merLen) + (canonical ? " canonical" : " non-canonical") + " scale " + lexical_cast<string>(scale) +
+                " and K=" + lexical_cast<string>(other.merLen) + (other.canonical ? " canonical" : " non-canonical") +
+                " scale " + lexical_cast<string>(other.scale)));
+    }
+}
+
+void kat::KmerSketch::save(ostream& out) const {
+
+    out << SKETCH_MAGIC << endl
+        << "mer_len " << merLen << endl
+        << "canonical " << canonical << endl
+        << "scale " << scale << endl
+        << "source " << source << endl
+        << "entries " << entries.size() << endl;
+
+    for (auto& e : entries) {
+        out << e.first << " " << e.second << "\n";
+    }
+}
+
+void kat::KmerSketch::save(const path& file) const {
+
+    ofstream out(file.c_str());
+    save(out);
+    out.close();
+    if (!out) {
+        BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                "Could not write sketch to: ") + file.string()));
+    }
+}
+
+kat::KmerSketch kat::KmerSketch::load(istream& in) {
+
+    string line;
+    if (!getline(in, line) || line != SKETCH_MAGIC) {
+        BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                "Not a KAT sketch")));
+    }
+
+    uint16_t merLen = 0;
+    bool canonical = true;
+    uint64_t scale = 0;
+    string source;
+    size_t nbEntries = 0;
+
+    // Header lines up to and including the number of entries
+    try {
+        while (getline(in, line)) {
+            const size_t sep = line.find(' ');
+            const string key = line.substr(0, sep);
+            const string value = sep == string::npos ? string() : line.substr(sep + 1);
+
+            if (key == "mer_len") {
+                merLen = lexical_cast<uint16_t>(value);
+            }
+            else if (key == "canonical") {
+                canonical = lexical_cast<bool>(value);
+            }
+            else if (key == "scale") {
+                scale = lexical_cast<uint64_t>(value);
+            }
+            else if (key == "source") {
+                source = value;
+            }
+            else if (key == "entries") {
+                nbEntries = lexical_cast<size_t>(value);
+                break;
+            }
+            else {
+                BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                        "Unknown entry in sketch file: ") + key));
+            }
+        }
+    }
+    catch (boost::bad_lexical_cast& e) {
+        BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                "Could not parse sketch entry: ") + line));
+    }
+
+    if (merLen == 0 || scale == 0) {
+        BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                "Sketch is missing its K-mer length or scale")));
+    }
+
+    KmerSketch sketch(merLen, canonical, scale);
+    sketch.source = source;
+    sketch.entries.reserve(nbEntries);
+
+    Entry e;
+    while (sketch.entries.size() < nbEntries && in >> e.first >> e.second) {
+        sketch.entries.push_back(e);
+    }
+
+    if (sketch.entries.size() != nbEntries) {
+        BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                "Sketch is truncated.  Expected ") + lexical_cast<string>(nbEntries) + " entries, found " +
+                lexical_cast<string>(sketch.entries.size())));
+    }
+
+    return sketch;
+}
+
+kat::KmerSketch kat::KmerSketch::load(const path& file) {
+
+    ifstream in(file.c_str());
+    if (!in) {
+        BOOST_THROW_EXCEPTION(KmerSketchException() << KmerSketchErrorInfo(string(
+                "Could not open sketch: ") + file.string()));
+    }
+    return load(in);
+}
+
+bool kat::KmerSketch::isSketchFile(const path& file) {
+
+    ifstream in(file.c_str());
+    string line;
+    return in && getline(in, line) && line == SKETCH_MAGIC;
+}
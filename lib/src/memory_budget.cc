@@ -0,0 +1,140 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+using std::ifstream;
+using std::ostringstream;
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+using boost::lexical_cast;
+
+#include <kat/jellyfish_helper.hpp>
+
+#include <kat/memory_budget.hpp>
+
+uint64_t kat::MemoryBudget::limit(uint64_t requested) {
+
+    const uint64_t cgroup = cgroupLimit();
+    if (requested == 0) return cgroup;
+    if (cgroup == 0) return requested;
+    return std::min(requested, cgroup);
+}
+
+uint64_t kat::MemoryBudget::cgroupLimit() {
+
+    static std::once_flag once;
+    static uint64_t limit = 0;
+    std::call_once(once, []() {
+        limit = cgroupLimit("/proc/self/cgroup", "/sys/fs/cgroup");
+    });
+    return limit;
+}
+
+/**
+ * Reads a memory.max file, which holds either a number of bytes or "max"
+ */
+static uint64_t readMemoryMax(const path& p) {
+
+    ifstream in(p.c_str());
+    string value;
+    if (!(in >> value) || value == "max") {
+        return 0;
+    }
+    try {
+        return lexical_cast<uint64_t>(value);
+    }
+    catch(boost::bad_lexical_cast&) {
+        return 0;
+    }
+}
+
+uint64_t kat::MemoryBudget::cgroupLimit(const path& procCgroup, const path& cgroupRoot) {
+
+    // The cgroup v2 entry is the one with hierarchy ID 0 and no controllers, e.g. "0::/user.slice/job"
+    ifstream in(procCgroup.c_str());
+    string line, rel;
+    bool found = false;
+    while (std::getline(in, line)) {
+        if (boost::starts_with(line, "0::")) {
+            rel = line.substr(3);
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        return 0;
+    }
+
+    // A limit on any ancestor also applies, so take the tightest on the way down
+    uint64_t limit = 0;
+    path dir = cgroupRoot;
+    const path relPath = path(rel).relative_path();
+    for (auto it = relPath.begin(); ; ++it) {
+        const uint64_t max = readMemoryMax(dir / "memory.max");
+        if (max > 0 && (limit == 0 || max < limit)) {
+            limit = max;
+        }
+        if (it == relPath.end()) break;
+        dir /= *it;
+    }
+    return limit;
+}
+
+uint64_t kat::MemoryBudget::currentRss() {
+
+    ifstream in("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    if (!(in >> size >> resident)) {
+        return 0;
+    }
+    return resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+uint64_t kat::MemoryBudget::remaining(uint64_t limit) {
+
+    if (limit == 0) return 0;
+    const uint64_t rss = currentRss();
+    return rss < limit ? limit - rss : 0;
+}
+
+uint64_t kat::MemoryBudget::hashBytes(uint64_t entries, uint16_t merLen) {
+
+    LargeHashArray::usage_info ui(merLen * 2, 7, 126);
+    return ui.mem(std::max(entries, (uint64_t)1));
+}
+
+uint64_t kat::MemoryBudget::hashEntries(uint64_t bytes, uint16_t merLen) {
+
+    // usage_info only fits sizes needing strictly less than the given bytes
+    LargeHashArray::usage_info ui(merLen * 2, 7, 126);
+    return ui.size(bytes + 1);
+}
+
+string kat::MemoryBudget::toMB(uint64_t bytes) {
+
+    return lexical_cast<string>(bytes / 1000000) + "MB";
+}
@@ -0,0 +1,82 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include <kat/memory_pages.hpp>
+#include <kat/thread_pool.hpp>
+
+bool kat::MemoryPages::adviseHugePages(void* addr, size_t len) {
+
+#ifdef MADV_HUGEPAGE
+    // madvise wants a page aligned start
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t start = (uintptr_t)addr & ~(page - 1);
+    return madvise((void*)start, len + ((uintptr_t)addr - start), MADV_HUGEPAGE) == 0;
+#else
+    return false;
+#endif
+}
+
+bool kat::MemoryPages::adviseHugePages(const LargeHashArray& ary) {
+
+    char* base;
+    size_t len;
+    ary.block_to_ptr(0, ary.blocks_for_records(ary.size()).first, &base, &len);
+    return adviseHugePages(base, ary.size_bytes());
+}
+
+/**
+ * Reads a byte from every page in [start, end)
+ */
+static void prefaultRange(const volatile char* start, const volatile char* end, size_t page) {
+
+    char sum = 0;
+    for (const volatile char* p = start; p < end; p += page) {
+        sum += *p;
+    }
+    (void)sum;
+}
+
+void kat::MemoryPages::prefault(const void* addr, size_t len, uint16_t threads) {
+
+    if (len == 0) return;
+
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t start = (uintptr_t)addr & ~(page - 1);
+    len += (uintptr_t)addr - start;
+
+    // Start readahead for the whole range while the threads fault it in
+    madvise((void*)start, len, MADV_WILLNEED);
+
+    // Split into whole pages per thread
+    const size_t nbPages = (len + page - 1) / page;
+    threads = std::max((uint16_t)1, (uint16_t)std::min((size_t)threads, nbPages));
+    const size_t pagesPerThread = (nbPages + threads - 1) / threads;
+
+    ThreadPool::global().parallelFor(threads, [&](size_t i) {
+        const size_t first = std::min(nbPages, i * pagesPerThread) * page;
+        const size_t last = std::min(nbPages, (i + 1) * pagesPerThread) * page;
+        prefaultRange((const volatile char*)(start + first), (const volatile char*)(start + std::min(last, len)), page);
+    });
+}
@@ -0,0 +1,222 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/resource.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+using std::endl;
+using std::ofstream;
+using std::ostringstream;
+
+#include <kat/metrics.hpp>
+
+#ifndef PACKAGE_VERSION
+#define PACKAGE_VERSION "2.X.X"
+#endif
+
+kat::Metrics::Phase::Phase(const string& name, const string& input) {
+
+    record.phase = name;
+    record.input = input;
+    record.bytesRead = 0;
+    record.kmers = 0;
+    record.lookups = 0;
+    record.hasPerf = false;
+    owner = std::this_thread::get_id();
+
+    if (PerfCounters::isEnabled()) {
+        counters.reset(new PerfCounters(true));
+    }
+}
+
+void kat::Metrics::Phase::addThreadCounters(uint16_t th_id, const PerfCounters& threadCounters) {
+
+    if (!threadCounters.isOpen()) return;
+
+    const PerfValues values = threadCounters.read();
+
+    std::lock_guard<std::mutex> lk(mu);
+    if (record.threadPerf.size() <= th_id) {
+        record.threadPerf.resize(th_id + 1);
+    }
+    record.threadPerf[th_id] += values;
+
+    // The phase's own counters already cover its thread
+    if (std::this_thread::get_id() != owner) {
+        others += values;
+    }
+}
+
+kat::Metrics::Phase::~Phase() {
+
+    const boost::timer::cpu_times t = timer.elapsed();
+    record.wall = t.wall / 1e9;
+    record.user = t.user / 1e9;
+    record.system = t.system / 1e9;
+    record.peakRss = peakRss();
+
+    if (counters && counters->isOpen()) {
+        record.hasPerf = true;
+        record.perf = counters->read();
+        record.perf += others;
+    }
+
+    Metrics::global().add(record);
+}
+
+// Created at startup, so the run's total time covers everything
+static kat::Metrics globalMetrics;
+
+kat::Metrics& kat::Metrics::global() {
+    return globalMetrics;
+}
+
+void kat::Metrics::add(const Record& record) {
+
+    std::lock_guard<std::mutex> lk(mu);
+    records.push_back(record);
+
+    if (report != nullptr && record.hasPerf) {
+        *report << "Hardware counters for " << record.phase << (record.input.empty() ? "" : " of " + record.input) << ": ";
+        record.perf.print(*report);
+        *report << endl;
+        for (size_t i = 0; i < record.threadPerf.size(); i++) {
+            *report << "  Thread " << i << ": ";
+            record.threadPerf[i].print(*report);
+            *report << endl;
+        }
+    }
+}
+
+vector<kat::Metrics::Record> kat::Metrics::getRecords() const {
+
+    std::lock_guard<std::mutex> lk(mu);
+    return records;
+}
+
+uint64_t kat::Metrics::peakRss() {
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return (uint64_t)usage.ru_maxrss * 1024;     // ru_maxrss is in KB on Linux
+}
+
+string kat::Metrics::escape(const string& s) {
+
+    ostringstream ss;
+    for (char c : s) {
+        switch (c) {
+            case '"':  ss << "\\\""; break;
+            case '\\': ss << "\\\\"; break;
+            case '\n': ss << "\\n"; break;
+            case '\t': ss << "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+                }
+                else {
+                    ss << c;
+                }
+        }
+    }
+    return ss.str();
+}
+
+/**
+ * Amount per second of wall time, or 0 if the phase took no measurable time
+ */
+static double rate(uint64_t amount, double wall) {
+    return wall > 0.0 ? amount / wall : 0.0;
+}
+
+/**
+ * Writes hardware counters as a JSON object
+ */
+static void writePerf(ostream& out, const kat::PerfValues& p) {
+    out << "{\"cycles\": " << p.cycles
+        << ", \"instructions\": " << p.instructions
+        << ", \"ipc\": " << p.ipc()
+        << ", \"llc_misses\": " << p.llcMisses
+        << ", \"dtlb_misses\": " << p.dtlbMisses << "}";
+}
+
+void kat::Metrics::write(ostream& out, const string& tool, uint16_t threads) const {
+
+    const vector<Record> phases = getRecords();
+    const boost::timer::cpu_times t = timer.elapsed();
+
+    out << std::fixed << std::setprecision(6);
+    out << "{" << endl
+        << "  \"tool\": \"" << escape(tool) << "\"," << endl
+        << "  \"version\": \"" << PACKAGE_VERSION << "\"," << endl
+        << "  \"threads\": " << threads << "," << endl
+        << "  \"wall_s\": " << t.wall / 1e9 << "," << endl
+        << "  \"user_s\": " << t.user / 1e9 << "," << endl
+        << "  \"system_s\": " << t.system / 1e9 << "," << endl
+        << "  \"peak_rss_bytes\": " << peakRss() << "," << endl
+        << "  \"phases\": [";
+
+    for (size_t i = 0; i < phases.size(); i++) {
+        const Record& r = phases[i];
+        out << (i > 0 ? "," : "") << endl
+            << "    {" << endl
+            << "      \"phase\": \"" << escape(r.phase) << "\"," << endl
+            << "      \"input\": \"" << escape(r.input) << "\"," << endl
+            << "      \"wall_s\": " << r.wall << "," << endl
+            << "      \"user_s\": " << r.user << "," << endl
+            << "      \"system_s\": " << r.system << "," << endl
+            << "      \"peak_rss_bytes\": " << r.peakRss << "," << endl
+            << "      \"bytes_read\": " << r.bytesRead << "," << endl
+            << "      \"kmers\": " << r.kmers << "," << endl
+            << "      \"lookups\": " << r.lookups << "," << endl
+            << "      \"bytes_per_s\": " << rate(r.bytesRead, r.wall) << "," << endl
+            << "      \"kmers_per_s\": " << rate(r.kmers, r.wall) << "," << endl
+            << "      \"lookups_per_s\": " << rate(r.lookups, r.wall);
+
+        if (r.hasPerf) {
+            out << "," << endl << "      \"perf\": ";
+            writePerf(out, r.perf);
+            out << "," << endl << "      \"thread_perf\": [";
+            for (size_t j = 0; j < r.threadPerf.size(); j++) {
+                out << (j > 0 ? ", " : "");
+                writePerf(out, r.threadPerf[j]);
+            }
+            out << "]";
+        }
+
+        out << endl << "    }";
+    }
+
+    out << endl << "  ]" << endl << "}" << endl;
+}
+
+void kat::Metrics::save(const path& file, const string& tool, uint16_t threads) const {
+
+    ofstream out(file.c_str());
+    if (!out) {
+        BOOST_THROW_EXCEPTION(MetricsException() << MetricsErrorInfo(string(
+                "Could not open metrics file for writing: ") + file.string()));
+    }
+    write(out, tool, threads);
+}
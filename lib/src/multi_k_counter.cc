@@ -0,0 +1,403 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <vector>
+using std::cout;
+using std::thread;
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+using boost::lexical_cast;
+
+#include <kat/fixed_mer.hpp>
+#include <kat/multi_k_counter.hpp>
+#include <kat/thread_pool.hpp>
+
+kat::MultiKCounter::MultiKCounter(const vector<uint16_t>& _merLens, const vector<uint64_t>& hashSizes, bool _canonical, uint16_t _threads) :
+    merLens(_merLens), canonical(_canonical), threads(std::max<uint16_t>(_threads, 1)), minQual(0), doSizeDoubling(true),
+    sampleFraction(1.0), tolerance(0.0), converged(false), progress(0.0), lastChange(-1.0),
+    spectrumError(-1.0), distinctError(-1.0),
+    full(new std::atomic<bool>[_merLens.size()]), sizeBarrier(std::max<uint16_t>(_threads, 1)), doneThreads(0), sliceId(0) {
+
+    if (merLens.empty() || merLens.size() != hashSizes.size()) {
+        BOOST_THROW_EXCEPTION(MultiKCounterException() << MultiKCounterErrorInfo(string(
+                "Expected a hash size for each of one or more K-mer lengths")));
+    }
+
+    maxMerLen = *std::max_element(merLens.begin(), merLens.end());
+
+    for (size_t i = 0; i < merLens.size(); i++) {
+        if (merLens[i] == 0) {
+            BOOST_THROW_EXCEPTION(MultiKCounterException() << MultiKCounterErrorInfo(string(
+                    "K-mer lengths must be greater than 0")));
+        }
+        arrays.push_back(new LargeHashArray(hashSizes[i], merLens[i] * 2, 7, 126, jellyfish::quadratic_reprobes));
+        newArrays.push_back(nullptr);
+        full[i] = false;
+    }
+}
+
+kat::MultiKCounter::~MultiKCounter() {
+
+    for (auto a : arrays) {
+        if (a != nullptr) delete a;
+    }
+}
+
+LargeHashArrayPtr kat::MultiKCounter::releaseHash(size_t index) {
+
+    LargeHashArrayPtr a = arrays[index];
+    arrays[index] = nullptr;
+    return a;
+}
+
+void kat::MultiKCounter::count(const vector<path>& seqFiles) {
+
+    for (auto& p : seqFiles) {
+        if (JellyfishHelper::isPipe(p)) {
+            BOOST_THROW_EXCEPTION(MultiKCounterException() << MultiKCounterErrorInfo(string(
+                    "Counting several K-mer lengths at once is not supported for pipes: ") + p.string()));
+        }
+    }
+
+    // Ensures jellyfish knows what kind of kmers we are working with
+    mer_dna::k(maxMerLen);
+
+    vector<ParallelSeqReaderPtr> readers;
+    vector<uint64_t> sizes;
+    uint64_t totalSize = 0;
+    for (auto& p : seqFiles) {
+        readers.push_back(make_shared<ParallelSeqReader>(p, maxMerLen, threads));
+        readers.back()->setMinQual(minQual);
+        readers.back()->setSampleFraction(sampleFraction);
+        sizes.push_back(boost::filesystem::file_size(p));
+        totalSize += sizes.back();
+    }
+
+    converged = false;
+    lastChange = -1.0;
+    spectrumError = -1.0;
+    distinctError = -1.0;
+    lastSpectra.clear();
+
+    uint64_t sizeBefore = 0;        // Size of the files already read
+    size_t unitsBefore = 0;         // Units of work in the files already read
+
+    // Small files are only split into a few units, so check them more often
+    const size_t firstCheckpoint = std::max<size_t>(1, std::min<size_t>((size_t)threads * CHECKPOINT_UNITS_PER_THREAD, readers.empty() ? 0 : readers[0]->getNbUnits() / 8));
+    size_t nextCheckpoint = firstCheckpoint;
+
+    for (size_t i = 0; i < readers.size() && !converged; i++) {
+
+        ParallelSeqReader& r = *readers[i];
+        const bool last = i + 1 == readers.size();
+
+        while (!r.isFinished()) {
+
+            if (tolerance > 0.0) {
+                r.setUnitLimit(std::max(r.getUnitsStarted() + 1, nextCheckpoint - std::min(nextCheckpoint, unitsBefore)));
+            }
+
+            doneThreads = 0;
+
+            vector<thread> t(threads);
+
+            for (int j = 0; j < threads; j++) {
+                t[j] = thread(&MultiKCounter::countSlice, this, std::ref(r));
+            }
+
+            for (int j = 0; j < threads; j++) {
+                t[j].join();
+            }
+
+            if (tolerance > 0.0 && !(last && r.isFinished())) {
+
+                progress = totalSize > 0 ? (sizeBefore + r.getProgress() * sizes[i]) / (double)totalSize : 1.0;
+
+                checkpoint();
+                if (converged) break;
+
+                const size_t units = unitsBefore + r.getUnitsStarted();
+                nextCheckpoint = std::max(units + firstCheckpoint, (size_t)(units * CHECKPOINT_GROWTH));
+            }
+        }
+
+        sizeBefore += sizes[i];
+        unitsBefore += r.getUnitsStarted();
+    }
+
+    if (!converged) {
+        progress = 1.0;
+    }
+
+    for (auto& r : readers) {
+        string error = r->getError();
+        if (!error.empty()) {
+            BOOST_THROW_EXCEPTION(MultiKCounterException() << MultiKCounterErrorInfo(string(
+                    "Error reading sequence file: ") + error));
+        }
+    }
+}
+
+void kat::MultiKCounter::countSlice(ParallelSeqReader& reader) {
+
+    switch (merWidth(maxMerLen)) {
+        case MerWidth::ONE_WORD:
+            countSliceFixed<uint64_t>(reader);
+            break;
+        case MerWidth::TWO_WORDS:
+            countSliceFixed<uint128_t>(reader);
+            break;
+        default:
+            countSliceFixed<mer_dna>(reader);
+            break;
+    }
+
+    done();
+}
+
+template<typename W>
+void kat::MultiKCounter::countSliceFixed(ParallelSeqReader& reader) {
+
+    const unsigned int kmax = maxMerLen;
+
+    // The longest K-mer ending at each base is rolled as usual.  Shorter K-mers are
+    // the low bits of the forward K-mer and the high bits of its reverse complement.
+    FixedMer<W> m(kmax);
+    W fwd, rev;
+    mer_dna key;
+
+    reader.process([&](const char* seq, size_t len, size_t owned) {
+
+        unsigned int filled = 0;
+
+        for (size_t i = 0; i < len; i++) {
+            const int code = mer_dna::code(seq[i]);
+            if (code < 0) {
+                filled = 0;
+                continue;
+            }
+
+            m.shiftLeft(code);
+            if (filled < kmax) filled++;
+
+            for (size_t j = 0; j < merLens.size(); j++) {
+                const unsigned int k = merLens[j];
+
+                // Skip incomplete K-mers, and those owned by the next chunk
+                if (filled < k || i + 1 - k >= owned) continue;
+
+                if (k == kmax) {
+                    FixedMer<W>::toMer(m.get(canonical), key);
+                }
+                else {
+                    m.forward(k, fwd);
+                    if (canonical) {
+                        m.reverse(k, rev);
+                        FixedMer<W>::toMer(fwd < rev ? fwd : rev, key);
+                    }
+                    else {
+                        FixedMer<W>::toMer(fwd, key);
+                    }
+                }
+
+                add(j, key);
+            }
+        }
+    });
+}
+
+/**
+ * Fraction of distinct K-mers at each frequency up to maxCount, and the number
+ * of distinct K-mers per K-mer counted
+ */
+static double normalise(const vector<Pos>& spectrum, uint32_t maxCount, vector<double>& fractions) {
+
+    double distinct = 0.0, total = 0.0;
+    for (auto& p : spectrum) {
+        distinct += p.second;
+        total += (double)p.first * p.second;
+    }
+
+    fractions.assign(maxCount + 1, 0.0);
+    for (auto& p : spectrum) {
+        fractions[p.first] = p.second / distinct;
+    }
+
+    return total > 0.0 ? distinct / total : 0.0;
+}
+
+/**
+ * Compares the spectrum of each hash with the one from the last checkpoint, and
+ * notes whether they have all converged, and how uncertain the spectra still are
+ */
+void kat::MultiKCounter::checkpoint() {
+
+    vector<vector<Pos>> spectra;
+    for (auto a : arrays) {
+        spectra.push_back(spectrum(*a));
+    }
+
+    if (!lastSpectra.empty()) {
+        lastChange = 0.0;
+        for (size_t i = 0; i < spectra.size(); i++) {
+            lastChange = std::max(lastChange, SpectraHelper::spectraDistance(lastSpectra[i], spectra[i]));
+        }
+
+        spectrumError = 0.0;
+        distinctError = 0.0;
+        for (size_t i = 0; i < spectra.size(); i++) {
+            vector<double> before, after;
+            const double distinctBefore = normalise(lastSpectra[i], CHECKPOINT_MAX_COUNT, before);
+            const double distinctAfter = normalise(spectra[i], CHECKPOINT_MAX_COUNT, after);
+            for (size_t c = 0; c < before.size(); c++) {
+                spectrumError = std::max(spectrumError, std::abs(after[c] - before[c]));
+            }
+            if (distinctAfter > 0.0) {
+                distinctError = std::max(distinctError, std::abs(distinctAfter - distinctBefore) / distinctAfter);
+            }
+        }
+        converged = lastChange < tolerance;
+    }
+
+    lastSpectra = spectra;
+}
+
+vector<Pos> kat::MultiKCounter::spectrum(LargeHashArray& hash) {
+
+    vector<vector<uint64_t>> counts(threads, vector<uint64_t>(CHECKPOINT_MAX_COUNT + 1, 0));
+
+    ThreadPool::global().parallelFor(threads, [&](size_t i) {
+        LargeHashArray::region_iterator it = hash.region_slice(i, threads);
+        while (it.next()) {
+            ++counts[i][std::min<uint64_t>(it.val(), CHECKPOINT_MAX_COUNT)];
+        }
+    });
+
+    vector<Pos> result;
+    for (uint32_t c = 1; c <= CHECKPOINT_MAX_COUNT; c++) {
+        uint64_t n = 0;
+        for (auto& tc : counts) {
+            n += tc[c];
+        }
+        if (n > 0) {
+            result.push_back(Pos(c, n));
+        }
+    }
+
+    return result;
+}
+
+void kat::MultiKCounter::add(size_t index, const mer_dna& key) {
+
+    unsigned int carryShift = 0;
+    bool isNew = false;
+    size_t id = 0;
+    uint64_t v = 1;
+
+    while (!arrays[index]->add(key, v, &carryShift, &isNew, &id)) {
+        full[index] = true;
+        handleFull();
+        v &= ~(uint64_t)0 << carryShift;
+    }
+}
+
+void kat::MultiKCounter::done() {
+
+    doneThreads++;
+    while (!handleFull());
+}
+
+/**
+ * Waits for all threads, then doubles the size of any full hashes.  Returns true
+ * without doing anything if all threads are done.
+ */
+bool kat::MultiKCounter::handleFull() {
+
+    bool serialThread = sizeBarrier.wait();
+    if (doneThreads >= threads) {
+        return true;
+    }
+
+    // Note which hashes are full before any thread gets the chance to carry on
+    // adding after the first one has grown
+    vector<size_t> toDouble;
+    for (size_t i = 0; i < arrays.size(); i++) {
+        if (full[i]) {
+            toDouble.push_back(i);
+        }
+    }
+
+    for (auto i : toDouble) {
+        doubleSize(i, serialThread);
+    }
+
+    return false;
+}
+
+void kat::MultiKCounter::doubleSize(size_t index, bool serialThread) {
+
+    if (serialThread) {
+        cout << endl << "Warning: Specified hash size insufficent for " << merLens[index] << "-mers - attempting to double hash size...";
+        cout.flush();
+
+        LargeHashArrayPtr old = arrays[index];
+        try {
+            newArrays[index] = doSizeDoubling ?
+                new LargeHashArray(old->size() * 2, old->key_len(), old->val_len(), old->max_reprobe(), old->reprobes()) :
+                nullptr;
+        }
+        catch (LargeHashArray::ErrorAllocation& e) {
+            newArrays[index] = nullptr;
+        }
+        sliceId = 0;
+    }
+
+    sizeBarrier.wait();
+
+    LargeHashArrayPtr newArray = newArrays[index];
+    if (newArray == nullptr) {
+        throw std::runtime_error(string("Hash full for ") + lexical_cast<string>(merLens[index]) + "-mers");
+    }
+
+    // Copy data from old to new
+    uint16_t id = sliceId++;
+    LargeHashArray::eager_iterator it = arrays[index]->eager_slice(id, threads);
+    while (it.next()) {
+        newArray->add(it.key(), it.val());
+    }
+
+    sizeBarrier.wait();
+
+    if (serialThread) {
+        delete arrays[index];
+        arrays[index] = newArray;
+        newArrays[index] = nullptr;
+        full[index] = false;
+        cout << " success!" << endl;
+    }
+
+    sizeBarrier.wait();
+}
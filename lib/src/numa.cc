@@ -0,0 +1,207 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+using std::ifstream;
+using std::map;
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+using boost::lexical_cast;
+
+#include <jellyfish/misc.hpp>
+
+#include <kat/numa.hpp>
+
+// Memory policies and flags for mbind, from linux/mempolicy.h
+static const int MPOL_PREFERRED_MODE = 1;
+static const int MPOL_INTERLEAVE_MODE = 3;
+static const unsigned int MPOL_MF_MOVE_FLAG = 1 << 1;
+
+static const string NODE_DIR = "/sys/devices/system/node";
+
+/**
+ * Reads the first line of a small sysfs file, or returns an empty string
+ */
+static string readLine(const string& file) {
+    ifstream in(file.c_str());
+    string line;
+    getline(in, line);
+    return boost::trim_copy(line);
+}
+
+vector<uint16_t> kat::Numa::parseList(const string& list) {
+
+    vector<uint16_t> ids;
+    vector<string> parts;
+    boost::split(parts, list, boost::is_any_of(","));
+    for (auto& part : parts) {
+        boost::trim(part);
+        if (part.empty()) continue;
+
+        try {
+            const size_t dash = part.find('-');
+            if (dash == string::npos) {
+                ids.push_back(lexical_cast<uint16_t>(part));
+            }
+            else {
+                const uint16_t first = lexical_cast<uint16_t>(part.substr(0, dash));
+                const uint16_t last = lexical_cast<uint16_t>(part.substr(dash + 1));
+                for (uint32_t id = first; id <= last; id++) {
+                    ids.push_back(id);
+                }
+            }
+        }
+        catch (boost::bad_lexical_cast&) {
+            return vector<uint16_t>();
+        }
+    }
+    return ids;
+}
+
+const vector<uint16_t>& kat::Numa::nodes() {
+
+    static const vector<uint16_t> online = []() {
+        vector<uint16_t> ids = parseList(readLine(NODE_DIR + "/online"));
+        return ids.empty() ? vector<uint16_t>(1, 0) : ids;
+    }();
+
+    return online;
+}
+
+const vector<uint16_t>& kat::Numa::cpusOf(uint16_t node) {
+
+    static const map<uint16_t, vector<uint16_t>> cpus = []() {
+        map<uint16_t, vector<uint16_t>> m;
+        for (auto n : nodes()) {
+            m[n] = parseList(readLine(NODE_DIR + "/node" + lexical_cast<string>(n) + "/cpulist"));
+        }
+        return m;
+    }();
+
+    return cpus.at(node);
+}
+
+uint16_t kat::Numa::nodeOf(uint16_t th_id, uint16_t threads) {
+
+    const vector<uint16_t>& n = nodes();
+    return n[(size_t)th_id * n.size() / std::max(threads, (uint16_t)1)];
+}
+
+bool kat::Numa::pinThread(uint16_t th_id, uint16_t threads) {
+
+    if (!isNuma()) return true;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    size_t nbCpus = 0;
+    for (auto cpu : cpusOf(nodeOf(th_id, threads))) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+            nbCpus++;
+        }
+    }
+
+    // Memory only nodes have no CPUs to run on
+    if (nbCpus == 0) return false;
+
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+kat::Numa::ThreadPin::ThreadPin(uint16_t th_id, uint16_t threads, bool enabled) : pinned(false) {
+
+    if (!enabled || !isNuma()) return;
+
+    CPU_ZERO(&previous);
+    if (sched_getaffinity(0, sizeof(previous), &previous) == 0) {
+        pinned = pinThread(th_id, threads);
+    }
+}
+
+kat::Numa::ThreadPin::~ThreadPin() {
+    if (pinned) {
+        sched_setaffinity(0, sizeof(previous), &previous);
+    }
+}
+
+bool kat::Numa::mbind(void* addr, size_t len, int mode, const vector<uint16_t>& nodeSet) {
+
+    // The kernel wants a page aligned start
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t start = (uintptr_t)addr & ~(page - 1);
+    len += (uintptr_t)addr - start;
+
+    const uint16_t maxNode = *std::max_element(nodeSet.begin(), nodeSet.end());
+    const size_t bitsPerWord = sizeof(unsigned long) * 8;
+    vector<unsigned long> mask(maxNode / bitsPerWord + 1, 0);
+    for (auto n : nodeSet) {
+        mask[n / bitsPerWord] |= 1UL << (n % bitsPerWord);
+    }
+
+    return syscall(SYS_mbind, start, len, mode, mask.data(), mask.size() * bitsPerWord + 1, MPOL_MF_MOVE_FLAG) == 0;
+}
+
+bool kat::Numa::interleave(void* addr, size_t len) {
+    return mbind(addr, len, MPOL_INTERLEAVE_MODE, nodes());
+}
+
+bool kat::Numa::bind(void* addr, size_t len, uint16_t node) {
+    // Preferred rather than strictly bound, so a full node spills over to others
+    return mbind(addr, len, MPOL_PREFERRED_MODE, vector<uint16_t>(1, node));
+}
+
+bool kat::Numa::place(const LargeHashArray& ary, NumaPlacement placement, uint16_t threads) {
+
+    if (placement == NumaPlacement::NONE || !isNuma()) return true;
+
+    const size_t nbBlocks = ary.blocks_for_records(ary.size()).first + 1;
+    char* base;
+    size_t len;
+    ary.block_to_ptr(0, nbBlocks, &base, &len);
+
+    if (placement == NumaPlacement::INTERLEAVE) {
+        return interleave(base, ary.size_bytes());
+    }
+
+    // Slices of the hash are contiguous runs of blocks, so find where each
+    // thread's slice starts in memory, rounded to a page
+    const size_t page = sysconf(_SC_PAGESIZE);
+    vector<size_t> starts(threads + 1, ary.size_bytes());
+    for (uint16_t i = 0; i < threads; i++) {
+        std::pair<size_t, size_t> ids = jellyfish::slice((size_t)i, (size_t)threads, ary.size());
+        char* sliceStart;
+        ary.block_to_ptr(ary.blocks_for_records(ids.first).first, 1, &sliceStart, &len);
+        starts[i] = std::min((size_t)(sliceStart - base) / page * page, ary.size_bytes());
+    }
+
+    bool ok = true;
+    for (uint16_t i = 0; i < threads; i++) {
+        if (starts[i + 1] > starts[i]) {
+            ok = bind(base + starts[i], starts[i + 1] - starts[i], nodeOf(i, threads)) && ok;
+        }
+    }
+    return ok;
+}
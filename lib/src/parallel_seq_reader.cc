@@ -0,0 +1,1008 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+using std::ifstream;
+using std::lock_guard;
+using std::unique_lock;
+using std::make_shared;
+
+#include <boost/lexical_cast.hpp>
+using boost::lexical_cast;
+
+#include <kat/parallel_seq_reader.hpp>
+#include <kat/thread_pool.hpp>
+
+static const size_t GZIP_READ_SIZE = 1024 * 1024;
+static const size_t BGZF_MAX_BLOCKS_PER_UNIT = 64;   // Blocks hold at most 64KB, so ~4MB per unit
+static const size_t BAM_BLOCKS_PER_THREAD = 8;       // Blocks decompressed by each thread per batch
+static const char BAM_MAGIC[4] = { 'B', 'A', 'M', 1 };
+
+kat::ParallelSeqReader::ParallelSeqReader(const path& _file, uint16_t _merLen, uint16_t _threads) :
+    file(_file), merLen(_merLen), threads(std::max<uint16_t>(_threads, 1)), fastq(false), bam(false), minQual(0),
+    sampleFraction(1.0), unitLimit(std::numeric_limits<size_t>::max()),
+    fd(-1), mapped(nullptr), fileSize(0), unitSize(SEQ_READER_UNIT_SIZE), blocksPerUnit(1),
+    nbUnits(0), nextUnit(0), firstUnit(0), produced(0), producerDone(false), drained(false), stop(false), compressedRead(0) {
+
+    compression = detectCompression(file);
+
+    if (compression == Compression::GZIP) {
+
+        // Only needed to report progress
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0) {
+            fileSize = st.st_size;
+        }
+
+        // Just need to know the format here.  Everything else happens on the producer thread.
+        gzFile gz = gzopen(file.c_str(), "rb");
+        if (gz == NULL) {
+            BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                    "Could not open gzipped file: ") + file.string()));
+        }
+        int c = gzgetc(gz);
+        gzclose(gz);
+        fastq = c == '@';
+        if (c != -1 && c != '@' && c != '>') {
+            BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                    "Unrecognised sequence format (expected FastA or FastQ) in: ") + file.string()));
+        }
+        return;
+    }
+
+    fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                "Could not open file: ") + file.string()));
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    fileSize = st.st_size;
+
+    char first = 0;
+
+    if (compression == Compression::BGZF) {
+        indexBlocks();
+
+        const size_t nbBlocks = blockOffsets.size() - 1;
+        blocksPerUnit = std::max<size_t>(1, std::min(BGZF_MAX_BLOCKS_PER_UNIT, nbBlocks / (threads * 4)));
+        nbUnits = (nbBlocks + blocksPerUnit - 1) / blocksPerUnit;
+
+        string buf;
+        for(size_t i = 0; i < nbBlocks && buf.empty(); i++) {
+            inflateBlock(i, buf);
+        }
+        first = buf.empty() ? 0 : buf[0];
+
+        // Reads from BAM files are unpacked into FastA for parsing
+        if (buf.compare(0, 4, BAM_MAGIC, 4) == 0) {
+            bam = true;
+            return;
+        }
+    }
+    else {
+        mapFile();
+
+        // Aim for several units per thread so that the load is balanced
+        unitSize = std::max(SEQ_READER_MIN_UNIT_SIZE, std::min(SEQ_READER_UNIT_SIZE, fileSize / (threads * 4)));
+        nbUnits = (fileSize + unitSize - 1) / unitSize;
+        first = fileSize > 0 ? mapped[0] : 0;
+    }
+
+    fastq = first == '@';
+    if (first != 0 && first != '@' && first != '>') {
+        BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                "Unrecognised sequence format (expected FastA or FastQ) in: ") + file.string()));
+    }
+}
+
+kat::ParallelSeqReader::~ParallelSeqReader() {
+
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stop = true;
+    }
+    queueNotFull.notify_all();
+
+    if (producer.joinable()) {
+        producer.join();
+    }
+
+    if (mapped != nullptr) {
+        munmap((void*)mapped, fileSize);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+kat::ParallelSeqReader::Compression kat::ParallelSeqReader::detectCompression(const path& file) {
+
+    unsigned char h[18];
+    ifstream in(file.c_str(), std::ios::binary);
+    in.read((char*)h, 18);
+    size_t n = in.gcount();
+
+    if (n < 2 || h[0] != 0x1f || h[1] != 0x8b) {
+        return Compression::NONE;
+    }
+
+    // BGZF blocks are gzip members with a "BC" extra subfield holding the block size
+    if (n == 18 && (h[3] & 0x04) && h[12] == 'B' && h[13] == 'C' && h[14] == 2 && h[15] == 0) {
+        return Compression::BGZF;
+    }
+
+    return Compression::GZIP;
+}
+
+bool kat::ParallelSeqReader::isBamFile(const path& file) {
+
+    if (detectCompression(file) != Compression::BGZF) {
+        return false;
+    }
+
+    gzFile gz = gzopen(file.c_str(), "rb");
+    if (gz == NULL) return false;
+    char magic[4];
+    int n = gzread(gz, magic, 4);
+    gzclose(gz);
+
+    return n == 4 && memcmp(magic, BAM_MAGIC, 4) == 0;
+}
+
+void kat::ParallelSeqReader::mapFile() {
+
+    if (fileSize == 0) return;
+
+    void* m = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+        BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                "Could not memory map file: ") + file.string()));
+    }
+    mapped = (const char*)m;
+}
+
+void kat::ParallelSeqReader::indexBlocks() {
+
+    uint64_t offset = 0;
+    unsigned char h[18];
+
+    while (offset < fileSize) {
+
+        if (pread(fd, h, 18, offset) != 18 || h[0] != 0x1f || h[1] != 0x8b ||
+                !(h[3] & 0x04) || h[12] != 'B' || h[13] != 'C') {
+            BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                    "Invalid BGZF block at offset ") + lexical_cast<string>(offset) + " in: " + file.string()));
+        }
+
+        blockOffsets.push_back(offset);
+
+        uint64_t bsize = (uint64_t)h[16] | ((uint64_t)h[17] << 8);
+        offset += bsize + 1;
+    }
+
+    blockOffsets.push_back(fileSize);
+}
+
+void kat::ParallelSeqReader::inflateBlock(size_t block, string& out) const {
+
+    const size_t csize = blockOffsets[block + 1] - blockOffsets[block];
+    vector<unsigned char> in(csize);
+
+    if (csize < 18 || pread(fd, in.data(), csize, blockOffsets[block]) != (ssize_t)csize) {
+        BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                "Could not read BGZF block ") + lexical_cast<string>(block) + " in: " + file.string()));
+    }
+
+    // Uncompressed size is stored in the last 4 bytes of the block
+    const size_t isize = (size_t)in[csize - 4] | ((size_t)in[csize - 3] << 8) |
+            ((size_t)in[csize - 2] << 16) | ((size_t)in[csize - 1] << 24);
+
+    if (isize == 0) return;
+
+    const size_t old = out.size();
+    out.resize(old + isize);
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    inflateInit2(&zs, 15 + 16);
+    zs.next_in = in.data();
+    zs.avail_in = csize;
+    zs.next_out = (unsigned char*)&out[old];
+    zs.avail_out = isize;
+    int ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+
+    if (ret != Z_STREAM_END || zs.avail_out != 0) {
+        BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                "Corrupt BGZF block ") + lexical_cast<string>(block) + " in: " + file.string()));
+    }
+}
+
+void kat::ParallelSeqReader::setError(const string& msg) {
+    lock_guard<mutex> lock(errorMutex);
+    if (error.empty()) {
+        error = msg;
+    }
+}
+
+bool kat::ParallelSeqReader::claimUnit(size_t& unit) {
+
+    // Gzip and BAM input is cut into units as it's decompressed, so we don't know
+    // how many there are up front
+    const bool queued = compression == Compression::GZIP || bam;
+
+    size_t u = nextUnit;
+    do {
+        if (u >= unitLimit || (!queued && u >= nbUnits) || !getError().empty()) {
+            return false;
+        }
+    } while (!nextUnit.compare_exchange_weak(u, u + 1));
+
+    unit = u;
+    return true;
+}
+
+bool kat::ParallelSeqReader::isFinished() {
+
+    if (!getError().empty()) {
+        return true;
+    }
+
+    if (compression == Compression::GZIP || bam) {
+        lock_guard<mutex> lock(queueMutex);
+        return drained;
+    }
+
+    return nextUnit >= nbUnits;
+}
+
+double kat::ParallelSeqReader::getProgress() {
+
+    if (isFinished()) {
+        return 1.0;
+    }
+
+    if (compression == Compression::GZIP || bam) {
+        return fileSize > 0 ? std::min(1.0, (double)compressedRead / (double)fileSize) : 0.0;
+    }
+
+    return nbUnits > 0 ? (double)nextUnit / (double)nbUnits : 1.0;
+}
+
+string kat::ParallelSeqReader::getError() const {
+    lock_guard<mutex> lock(errorMutex);
+    return error;
+}
+
+void kat::ParallelSeqReader::process(const SeqHandler& handler) {
+
+    try {
+        switch (compression) {
+            case Compression::NONE:
+                processMapped(handler);
+                break;
+            case Compression::BGZF:
+                if (bam) {
+                    processQueue(handler);
+                }
+                else {
+                    processBgzf(handler);
+                }
+                break;
+            case Compression::GZIP:
+                processQueue(handler);
+                break;
+        }
+    }
+    catch (const boost::exception& e) {
+        const string* msg = boost::get_error_info<SeqReaderErrorInfo>(e);
+        setError(msg != nullptr ? *msg : boost::diagnostic_information(e));
+    }
+    catch (const std::exception& e) {
+        setError(e.what());
+    }
+}
+
+void kat::ParallelSeqReader::processMapped(const SeqHandler& handler) {
+
+    size_t unit;
+    while (claimUnit(unit)) {
+
+        SeqChunk chunk;
+        chunk.data = mapped;
+        chunk.len = fileSize;
+        chunk.begin = unit * unitSize;
+        chunk.end = std::min(chunk.begin + unitSize, fileSize);
+        chunk.lineStartAt0 = true;
+        chunk.atEof = true;
+
+        parse(chunk, fastq, merLen, handler, minQual, sampleFraction);
+    }
+}
+
+void kat::ParallelSeqReader::processBgzf(const SeqHandler& handler) {
+
+    const size_t nbBlocks = blockOffsets.size() - 1;
+
+    size_t unit;
+    while (claimUnit(unit)) {
+
+        const size_t first = unit * blocksPerUnit;
+        const size_t last = std::min(first + blocksPerUnit, nbBlocks);
+
+        // Decompress the preceding block as well, which tells us where we are in the
+        // record or line at the start of the unit
+        string buf;
+        size_t ctx = first;
+        while (buf.empty() && ctx > 0) {
+            inflateBlock(--ctx, buf);
+        }
+
+        // Sampled FastA sequences are selected by name, so we need to see the header
+        // of the sequence the unit starts in
+        if (sampleFraction < 1.0 && !fastq) {
+            while (ctx > 0 && findHeader(buf.data(), buf.size(), false) == string::npos) {
+                string earlier;
+                inflateBlock(--ctx, earlier);
+                buf.insert(0, earlier);
+            }
+        }
+
+        SeqChunk chunk;
+        chunk.lineStartAt0 = ctx == 0;
+        chunk.begin = buf.size();
+        for(size_t b = first; b < last; b++) {
+            inflateBlock(b, buf);
+        }
+        chunk.end = buf.size();
+
+        // Keep decompressing blocks until we can finish off the last record or K-mer
+        size_t next = last;
+        while (true) {
+            chunk.data = buf.data();
+            chunk.len = buf.size();
+            chunk.atEof = next >= nbBlocks;
+            if (hasLookahead(chunk, fastq, merLen)) break;
+            inflateBlock(next++, buf);
+        }
+
+        parse(chunk, fastq, merLen, handler, minQual, sampleFraction);
+    }
+}
+
+void kat::ParallelSeqReader::processQueue(const SeqHandler& handler) {
+
+    std::call_once(producerStarted, [this]() {
+        producer = thread(bam ? &ParallelSeqReader::produceBam : &ParallelSeqReader::produceGzip, this);
+    });
+
+    size_t unit;
+    while (claimUnit(unit)) {
+
+        shared_ptr<string> data;
+        size_t end;
+
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueNotEmpty.wait(lock, [this]() { return !chunks.empty() || producerDone; });
+
+            if (chunks.empty()) {
+                drained = true;
+                return;
+            }
+
+            data = chunks.front();
+            end = chunkEnds.front();
+            chunks.pop_front();
+            chunkEnds.pop_front();
+        }
+        queueNotFull.notify_one();
+
+        SeqChunk chunk;
+        chunk.data = data->data();
+        chunk.len = data->size();
+        chunk.begin = 0;
+        chunk.end = end;
+        chunk.lineStartAt0 = true;
+        chunk.atEof = true;       // Producer already ensured there's enough lookahead
+
+        // BAM reads are sampled as they're unpacked
+        parse(chunk, fastq, merLen, handler, minQual, bam ? 1.0 : sampleFraction);
+    }
+}
+
+void kat::ParallelSeqReader::produceGzip() {
+
+    gzFile gz = gzopen(file.c_str(), "rb");
+
+    try {
+        if (gz == NULL) {
+            BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                    "Could not open gzipped file: ") + file.string()));
+        }
+        gzbuffer(gz, GZIP_READ_SIZE);
+
+        string pending;
+        bool eof = false;
+
+        auto readMore = [&]() {
+            const size_t old = pending.size();
+            pending.resize(old + GZIP_READ_SIZE);
+            int n = gzread(gz, &pending[old], GZIP_READ_SIZE);
+            if (n < 0) {
+                BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                        "Error decompressing: ") + file.string()));
+            }
+            pending.resize(old + n);
+            eof = n == 0;
+            compressedRead = gzoffset(gz);
+        };
+
+        // Last FastA header line seen, including the newline
+        string header;
+
+        while (getError().empty()) {
+
+            // Chunks must start at the beginning of a line, so cut at the last line
+            // break before the target size.  Very long lines force bigger chunks.
+            size_t target = unitSize;
+            size_t cut = 0;
+            while (true) {
+                while (!eof && pending.size() < target) readMore();
+
+                if (eof && pending.size() <= target) {
+                    cut = pending.size();
+                    break;
+                }
+
+                size_t nl = pending.rfind('\n', target - 1);
+                if (nl != string::npos) {
+                    cut = nl + 1;
+                    break;
+                }
+                target *= 2;
+            }
+
+            if (cut == 0) break;
+
+            // Make sure there's enough data to finish the last record or K-mer in the chunk
+            SeqChunk chunk;
+            chunk.begin = 0;
+            chunk.end = cut;
+            chunk.lineStartAt0 = true;
+            while (true) {
+                chunk.data = pending.data();
+                chunk.len = pending.size();
+                chunk.atEof = eof;
+                if (hasLookahead(chunk, fastq, merLen)) break;
+                readMore();
+            }
+
+            // Sampled FastA sequences are selected by name, so if the chunk starts part
+            // way through a sequence, give it the header of that sequence
+            string prefix;
+            if (sampleFraction < 1.0 && !fastq) {
+                if (!pending.empty() && pending[0] != '>') {
+                    prefix = header;
+                }
+                size_t h = findHeader(pending.data(), cut, true);
+                if (h != string::npos) {
+                    header = pending.substr(h, pending.find('\n', h) + 1 - h);
+                }
+            }
+
+            shared_ptr<string> data = make_shared<string>(prefix + pending);
+            pending.erase(0, cut);
+
+            if (!pushChunk(data, prefix.size() + cut)) break;
+        }
+    }
+    catch (const boost::exception& e) {
+        const string* msg = boost::get_error_info<SeqReaderErrorInfo>(e);
+        setError(msg != nullptr ? *msg : boost::diagnostic_information(e));
+    }
+    catch (const std::exception& e) {
+        setError(e.what());
+    }
+
+    if (gz != NULL) {
+        gzclose(gz);
+    }
+
+    {
+        lock_guard<mutex> lock(queueMutex);
+        producerDone = true;
+    }
+    queueNotEmpty.notify_all();
+}
+
+bool kat::ParallelSeqReader::pushChunk(const shared_ptr<string>& data, size_t end) {
+
+    // Units skipped with setFirstUnit still have to be decompressed to find where
+    // the rest start, but are then dropped
+    if (produced++ < firstUnit) {
+        return true;
+    }
+
+    unique_lock<mutex> lock(queueMutex);
+    queueNotFull.wait(lock, [this]() { return chunks.size() < (size_t)threads * 2 || stop; });
+    if (stop) return false;
+    chunks.push_back(data);
+    chunkEnds.push_back(end);
+    lock.unlock();
+    queueNotEmpty.notify_one();
+    return true;
+}
+
+static int32_t readInt32(const string& buf, size_t pos) {
+    int32_t v;
+    memcpy(&v, buf.data() + pos, 4);
+    return v;
+}
+
+static uint16_t readUint16(const string& buf, size_t pos) {
+    uint16_t v;
+    memcpy(&v, buf.data() + pos, 2);
+    return v;
+}
+
+void kat::ParallelSeqReader::produceBam() {
+
+    // 4-bit encoded bases, and their complements
+    static const char BASES[] = "=ACMGRSVTWYHKDBN";
+    static const char COMP_BASES[] = "=TGKCYSBAWRDMHVN";
+
+    const size_t nbBlocks = blockOffsets.size() - 1;
+    const size_t batchSize = (size_t)threads * BAM_BLOCKS_PER_THREAD;
+
+    try {
+        string pending;
+        size_t pos = 0;
+        size_t nextBlock = 0;
+        bool headerDone = false;
+        shared_ptr<string> chunk = make_shared<string>();
+
+        // Decompresses the next batch of blocks in parallel, appending them to pending
+        auto readBatch = [&]() {
+            const size_t first = nextBlock;
+            const size_t last = std::min(first + batchSize, nbBlocks);
+            vector<string> out(last - first);
+            vector<string> errors(threads);
+            ThreadPool::global().parallelFor(std::min<size_t>(threads, last - first), [&](size_t i) {
+                try {
+                    for(size_t b = first + i; b < last; b += threads) {
+                        inflateBlock(b, out[b - first]);
+                    }
+                }
+                catch (const boost::exception& e) {
+                    const string* msg = boost::get_error_info<SeqReaderErrorInfo>(e);
+                    errors[i] = msg != nullptr ? *msg : string("Error decompressing BAM block");
+                }
+            });
+            for(auto& e : errors) {
+                if (!e.empty()) {
+                    BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(e));
+                }
+            }
+
+            pending.erase(0, pos);
+            pos = 0;
+            for(auto& o : out) {
+                pending.append(o);
+            }
+            nextBlock = last;
+            compressedRead = blockOffsets[last];
+        };
+
+        // Size of the record starting at p.  The fixed length fields alone take 32 bytes.
+        auto blockSizeAt = [&](size_t p) -> size_t {
+            const int32_t blockSize = readInt32(pending, p);
+            if (blockSize < 32) {
+                BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                        "Corrupt BAM record, block size of ") + lexical_cast<string>(blockSize) + ": " + file.string()));
+            }
+            return blockSize;
+        };
+
+        while (getError().empty()) {
+
+            const size_t avail = pending.size() - pos;
+
+            // Skip the header: magic, text and reference sequence dictionary
+            if (!headerDone) {
+                size_t p = pos + 4;
+                bool complete = false;
+                if (pending.size() >= p + 4) {
+                    const int32_t textLen = readInt32(pending, p);
+                    if (textLen < 0) {
+                        BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                                "Corrupt BAM header, negative text length: ") + file.string()));
+                    }
+                    p += 4 + (size_t)textLen;
+                    if (pending.size() >= p + 4) {
+                        int32_t nRef = readInt32(pending, p);
+                        if (nRef < 0) {
+                            BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                                    "Corrupt BAM header, negative number of reference sequences: ") + file.string()));
+                        }
+                        p += 4;
+                        int32_t r = 0;
+                        for(; r < nRef && pending.size() >= p + 4; r++) {
+                            const int32_t nameLen = readInt32(pending, p);
+                            if (nameLen < 0) {
+                                BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                                        "Corrupt BAM header, negative reference name length: ") + file.string()));
+                            }
+                            p += 4 + (size_t)nameLen + 4;
+                        }
+                        complete = r == nRef && pending.size() >= p;
+                    }
+                }
+
+                if (complete) {
+                    pos = p;
+                    headerDone = true;
+                    continue;
+                }
+            }
+            else if (avail >= 4 && avail >= 4 + blockSizeAt(pos)) {
+
+                const size_t rec = pos + 4;
+                const size_t blockSize = blockSizeAt(pos);
+                pos += 4 + blockSize;
+
+                const uint8_t nameLen = pending[rec + 8];
+                const uint16_t nCigar = readUint16(pending, rec + 12);
+                const uint16_t flag = readUint16(pending, rec + 14);
+                const int32_t seqLen = readInt32(pending, rec + 16);
+
+                // The variable length fields must fit in the record
+                if (seqLen < 0 || 32 + (uint64_t)nameLen + 4 * (uint64_t)nCigar + ((uint64_t)seqLen + 1) / 2 + (uint64_t)seqLen > blockSize) {
+                    BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                            "Corrupt BAM record, fields overrun the record: ") + file.string()));
+                }
+
+                // Only want each read once
+                if (flag & (0x100 | 0x800)) continue;
+
+                // Names are NUL terminated
+                if (sampleFraction < 1.0 && !isSampled(&pending[rec + 32], nameLen > 0 ? nameLen - 1 : 0, sampleFraction)) continue;
+
+                const size_t seq = rec + 32 + nameLen + 4 * nCigar;
+                const size_t qual = seq + (seqLen + 1) / 2;
+                chunk->append(">\n");
+                const size_t start = chunk->size();
+                chunk->resize(start + seqLen + 1);
+                char* out = &(*chunk)[start];
+
+                // Reverse strand reads are stored reverse complemented
+                const bool rc = flag & 0x10;
+                for(int32_t i = 0; i < seqLen; i++) {
+                    const uint8_t packed = pending[seq + i / 2];
+                    uint8_t code = i % 2 == 0 ? packed >> 4 : packed & 0x0f;
+
+                    // BAM qualities are raw Phred scores, or 0xff if absent.  Mask low
+                    // quality bases as N so they break the sequence.
+                    const uint8_t q = pending[qual + i];
+                    if (minQual > 0 && q != 0xff && q < minQual) code = 15;
+
+                    if (rc) {
+                        out[seqLen - 1 - i] = COMP_BASES[code];
+                    }
+                    else {
+                        out[i] = BASES[code];
+                    }
+                }
+                out[seqLen] = '\n';
+
+                if (chunk->size() >= unitSize) {
+                    const size_t end = chunk->size();
+                    if (!pushChunk(chunk, end)) break;
+                    chunk = make_shared<string>();
+                }
+                continue;
+            }
+
+            // Need more data
+            if (nextBlock >= nbBlocks) {
+                if (avail > 0) {
+                    BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                            "Truncated BAM file: ") + file.string()));
+                }
+                break;
+            }
+
+            readBatch();
+        }
+
+        if (!chunk->empty() && getError().empty()) {
+            const size_t end = chunk->size();
+            pushChunk(chunk, end);
+        }
+    }
+    catch (const boost::exception& e) {
+        const string* msg = boost::get_error_info<SeqReaderErrorInfo>(e);
+        setError(msg != nullptr ? *msg : boost::diagnostic_information(e));
+    }
+    catch (const std::exception& e) {
+        setError(e.what());
+    }
+
+    {
+        lock_guard<mutex> lock(queueMutex);
+        producerDone = true;
+    }
+    queueNotEmpty.notify_all();
+}
+
+size_t kat::ParallelSeqReader::findLineStart(const char* data, size_t pos, size_t limit, bool lineStartAt0, bool& found) {
+
+    const size_t stop = pos > limit ? pos - limit : 0;
+
+    for(size_t i = pos; i > stop; i--) {
+        if (data[i - 1] == '\n') {
+            found = true;
+            return i;
+        }
+    }
+
+    found = stop == 0 && lineStartAt0;
+    return found ? 0 : pos;
+}
+
+static size_t nextLine(const char* data, size_t len, size_t pos) {
+    const char* nl = pos < len ? (const char*)memchr(data + pos, '\n', len - pos) : nullptr;
+    return nl == nullptr ? len : (nl - data) + 1;
+}
+
+size_t kat::ParallelSeqReader::findHeader(const char* data, size_t pos, bool lineStartAt0) {
+
+    for(size_t i = pos; i > 0; i--) {
+        if (data[i - 1] == '>' && (i == 1 ? lineStartAt0 : data[i - 2] == '\n')) {
+            return i - 1;
+        }
+    }
+
+    return string::npos;
+}
+
+bool kat::ParallelSeqReader::isSampled(const char* name, size_t len, double sampleFraction) {
+
+    if (sampleFraction >= 1.0) return true;
+    if (sampleFraction <= 0.0) return false;
+
+    size_t n = 0;
+    while (n < len && name[n] != ' ' && name[n] != '\t' && name[n] != '\n' && name[n] != '\r') n++;
+    if (n >= 2 && name[n - 2] == '/' && (name[n - 1] == '1' || name[n - 1] == '2')) n -= 2;
+
+    // FNV-1a, then mixed so that the top bits are evenly spread
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < n; i++) {
+        h = (h ^ (uint8_t)name[i]) * 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (double)(h >> 11) < sampleFraction * (double)(1ULL << 53);
+}
+
+size_t kat::ParallelSeqReader::resyncFastq(const SeqChunk& chunk, size_t from) {
+
+    const char* data = chunk.data;
+    const size_t len = chunk.len;
+
+    // Move to the start of a line
+    size_t p = from;
+    if (!(p == 0 ? chunk.lineStartAt0 : data[p - 1] == '\n')) {
+        p = nextLine(data, len, p);
+    }
+
+    // A record header starts with '@' and is followed two lines later by a '+'.  A
+    // quality line may also start with '@', but two lines on is a sequence line.
+    while (p < len) {
+        size_t l1 = nextLine(data, len, p);
+        if (data[p] == '@') {
+            size_t l2 = nextLine(data, len, l1);
+            if (l2 >= len) return string::npos;
+            if (data[l2] == '+') return p;
+        }
+        p = l1;
+    }
+
+    return string::npos;
+}
+
+bool kat::ParallelSeqReader::hasLookahead(const SeqChunk& chunk, bool fastq, uint16_t merLen) {
+
+    if (chunk.atEof) return true;
+
+    // The last record is complete once we can see where the next one starts
+    if (fastq) {
+        return resyncFastq(chunk, chunk.end) != string::npos;
+    }
+
+    // Otherwise we need merLen - 1 bases beyond the end, or the start of the next sequence
+    if (merLen <= 1) return true;
+
+    const char* data = chunk.data;
+    bool atLineStart = chunk.end == 0 ? chunk.lineStartAt0 : data[chunk.end - 1] == '\n';
+    size_t bases = 0;
+
+    for(size_t pos = chunk.end; pos < chunk.len; pos++) {
+        const char c = data[pos];
+        if (c == '\n') {
+            atLineStart = true;
+            continue;
+        }
+        if (atLineStart && c == '>') return true;
+        atLineStart = false;
+        if (c != '\r' && ++bases >= (size_t)merLen - 1) return true;
+    }
+
+    return false;
+}
+
+void kat::ParallelSeqReader::parse(const SeqChunk& chunk, bool fastq, uint16_t merLen, const SeqHandler& handler, uint16_t minQual, double sampleFraction) {
+
+    const char* data = chunk.data;
+    const size_t len = chunk.len;
+
+    if (fastq) {
+
+        size_t p = resyncFastq(chunk, chunk.begin);
+
+        while (p < chunk.end && p < len) {
+            size_t seq = nextLine(data, len, p);
+            size_t plus = nextLine(data, len, seq);
+            if (seq >= len) break;
+
+            size_t seqEnd = plus;
+            while (seqEnd > seq && (data[seqEnd - 1] == '\n' || data[seqEnd - 1] == '\r')) seqEnd--;
+
+            if (plus < len && data[plus] != '+') {
+                BOOST_THROW_EXCEPTION(SeqReaderException() << SeqReaderErrorInfo(string(
+                        "Invalid FastQ record (only 4 line records are supported) near byte ") + lexical_cast<string>(p)));
+            }
+
+            const size_t qual = nextLine(data, len, plus);
+
+            if (!isSampled(data + p + 1, seq - p - 1, sampleFraction)) {
+                // Not part of the sample
+            }
+            else if (minQual == 0) {
+                handler(data + seq, seqEnd - seq, seqEnd - seq);
+            }
+            else {
+                // Only pass on stretches of good quality bases.  Missing qualities
+                // (e.g. a truncated record) are treated as good, like jellyfish does.
+                const char threshold = (char)std::min<uint16_t>(PHRED_OFFSET + minQual, 127);
+                const size_t qualEnd = nextLine(data, len, qual);
+                size_t start = seq;
+                for (size_t i = seq; i < seqEnd; i++) {
+                    const size_t q = qual + (i - seq);
+                    if (q < qualEnd && data[q] != '\n' && data[q] != '\r' && data[q] < threshold) {
+                        if (i > start) handler(data + start, i - start, i - start);
+                        start = i + 1;
+                    }
+                }
+                if (seqEnd > start) handler(data + start, seqEnd - start, seqEnd - start);
+            }
+
+            p = nextLine(data, len, qual);
+        }
+
+        return;
+    }
+
+    // FastA.  Process K-mers that start in [begin, end), so if we start part way
+    // through a header line skip to the sequence that follows.
+    size_t pos = chunk.begin;
+    bool found = false;
+    size_t ls = findLineStart(data, pos, SEQ_READER_LOOKBACK, chunk.lineStartAt0, found);
+    if (found && ls < len && data[ls] == '>') {
+        pos = nextLine(data, len, pos);
+    }
+
+    const size_t extraBases = merLen > 0 ? merLen - 1 : 0;
+    size_t extra = 0;
+    bool atLineStart = pos == 0 ? chunk.lineStartAt0 : data[pos - 1] == '\n';
+    string seg;
+    size_t owned = 0;
+
+    // Whether the sequence we're in is part of the sample.  If we can't see its
+    // header it's included.
+    bool sampled = true;
+    if (sampleFraction < 1.0) {
+        size_t h = findHeader(data, std::min(pos, len), chunk.lineStartAt0);
+        if (h != string::npos) {
+            sampled = isSampled(data + h + 1, len - h - 1, sampleFraction);
+        }
+    }
+
+    auto flush = [&]() {
+        if (owned > 0) {
+            handler(seg.data(), seg.size(), owned);
+        }
+        seg.clear();
+        owned = 0;
+    };
+
+    while (pos < len) {
+
+        if (pos >= chunk.end && extra >= extraBases) break;
+
+        if (atLineStart && data[pos] == '>') {
+            flush();
+            if (pos >= chunk.end) break;
+            sampled = isSampled(data + pos + 1, len - pos - 1, sampleFraction);
+            pos = nextLine(data, len, pos);
+            continue;
+        }
+
+        if (!sampled) {
+            if (pos >= chunk.end) break;
+            pos = nextLine(data, len, pos);
+            atLineStart = true;
+            continue;
+        }
+
+        size_t lineEnd = nextLine(data, len, pos);
+        size_t e = lineEnd;
+        while (e > pos && (data[e - 1] == '\n' || data[e - 1] == '\r')) e--;
+
+        // Bases in our range
+        if (pos < chunk.end) {
+            size_t stop = std::min(e, chunk.end);
+            seg.append(data + pos, stop - pos);
+            owned = seg.size();
+        }
+
+        // Bases beyond our range needed to finish K-mers that start within it
+        size_t from = std::max(pos, chunk.end);
+        if (from < e) {
+            size_t take = std::min(e - from, extraBases - extra);
+            seg.append(data + from, take);
+            extra += take;
+        }
+
+        pos = lineEnd;
+        atLineStart = true;
+    }
+
+    flush();
+}
@@ -0,0 +1,160 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <iomanip>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include <kat/perf_counters.hpp>
+
+static std::atomic<bool> enabled(false);
+
+kat::PerfValues& kat::PerfValues::operator+=(const PerfValues& other) {
+
+    cycles += other.cycles;
+    instructions += other.instructions;
+    llcMisses += other.llcMisses;
+    dtlbMisses += other.dtlbMisses;
+    return *this;
+}
+
+void kat::PerfValues::print(ostream& out) const {
+
+    const std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(2)
+        << cycles << " cycles, " << instructions << " instructions (IPC " << ipc() << "), "
+        << llcMisses << " LLC misses (" << llcMpki() << " per 1000 instructions), "
+        << dtlbMisses << " dTLB misses (" << dtlbMpki() << " per 1000 instructions)";
+    out.flags(flags);
+}
+
+void kat::PerfCounters::setEnabled(bool e) {
+    enabled = e;
+}
+
+bool kat::PerfCounters::isEnabled() {
+    return enabled;
+}
+
+#ifdef __linux__
+
+static int openCounter(uint32_t type, uint64_t config, bool inherit) {
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = inherit ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // This thread, on any CPU
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+kat::PerfCounters::PerfCounters(bool inherit) {
+
+    for (int i = 0; i < NB_EVENTS; i++) {
+        fds[i] = -1;
+    }
+
+    if (!enabled) return;
+
+    fds[0] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, inherit);
+    fds[1] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, inherit);
+    fds[2] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, inherit);
+    fds[3] = openCounter(PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            inherit);
+}
+
+kat::PerfCounters::~PerfCounters() {
+
+    for (int i = 0; i < NB_EVENTS; i++) {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+}
+
+/**
+ * Reads a counter, scaling up for any time it wasn't running because the
+ * kernel was multiplexing counters
+ */
+static uint64_t readCounter(int fd) {
+
+    if (fd < 0) return 0;
+
+    uint64_t v[3];      // value, time enabled, time running
+    if (read(fd, v, sizeof(v)) != sizeof(v) || v[2] == 0) {
+        return 0;
+    }
+    return v[2] < v[1] ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+}
+
+kat::PerfValues kat::PerfCounters::read() const {
+
+    PerfValues values;
+    values.cycles = readCounter(fds[0]);
+    values.instructions = readCounter(fds[1]);
+    values.llcMisses = readCounter(fds[2]);
+    values.dtlbMisses = readCounter(fds[3]);
+    return values;
+}
+
+#else
+
+kat::PerfCounters::PerfCounters(bool inherit) {
+    for (int i = 0; i < NB_EVENTS; i++) {
+        fds[i] = -1;
+    }
+}
+
+kat::PerfCounters::~PerfCounters() {
+}
+
+kat::PerfValues kat::PerfCounters::read() const {
+    return PerfValues();
+}
+
+#endif
+
+bool kat::PerfCounters::isAvailable() {
+
+    const bool wasEnabled = enabled.exchange(true);
+    const bool available = PerfCounters().isOpen();
+    enabled = wasEnabled;
+    return available;
+}
+
+bool kat::PerfCounters::isOpen() const {
+
+    for (int i = 0; i < NB_EVENTS; i++) {
+        if (fds[i] >= 0) return true;
+    }
+    return false;
+}
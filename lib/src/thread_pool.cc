@@ -0,0 +1,209 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+using std::exception_ptr;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+#include <kat/thread_pool.hpp>
+
+// The pool and queue of the worker running on this thread, if any
+static thread_local const kat::ThreadPool* currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+static mutex globalMu;
+static unique_ptr<kat::ThreadPool> globalPool;
+static uint16_t globalThreads = 0;
+
+kat::ThreadPool::ThreadPool(uint16_t threads) : pending(0), nextQueue(0), stopping(false) {
+
+    threads = std::max<uint16_t>(threads, 1);
+
+    for (uint16_t i = 0; i < threads; i++) {
+        queues.push_back(unique_ptr<Queue>(new Queue()));
+    }
+
+    for (uint16_t i = 0; i < threads; i++) {
+        workers.push_back(thread(&ThreadPool::work, this, i));
+    }
+}
+
+kat::ThreadPool::~ThreadPool() {
+
+    {
+        lock_guard<mutex> lk(mu);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+kat::ThreadPool& kat::ThreadPool::global() {
+
+    lock_guard<mutex> lk(globalMu);
+    if (!globalPool) {
+        globalPool.reset(new ThreadPool(globalThreads > 0 ? globalThreads : std::max(thread::hardware_concurrency(), 1u)));
+    }
+    return *globalPool;
+}
+
+void kat::ThreadPool::init(uint16_t threads) {
+
+    lock_guard<mutex> lk(globalMu);
+    if (!globalPool) {
+        globalThreads = threads;
+    }
+}
+
+void kat::ThreadPool::push(function<void()> task) {
+
+    // Keep nested work on this worker's own queue, where it's likely to run on
+    // the same core as the task that created it
+    const size_t q = currentPool == this && currentWorker >= 0 ?
+            currentWorker :
+            nextQueue++ % queues.size();
+
+    {
+        // Count it before it's visible, so pending never drops below zero
+        lock_guard<mutex> lk(mu);
+        pending++;
+        lock_guard<mutex> qlk(queues[q]->mu);
+        queues[q]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+bool kat::ThreadPool::runOne() {
+
+    function<void()> task;
+    const int home = currentPool == this ? currentWorker : -1;
+
+    if (home >= 0) {
+        Queue& own = *queues[home];
+        lock_guard<mutex> lk(own.mu);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+    }
+
+    // Steal the oldest task from the next queue that has one
+    const size_t n = queues.size();
+    const size_t start = home >= 0 ? home + 1 : nextQueue.load();
+    for (size_t k = 0; k < n && !task; k++) {
+        Queue& other = *queues[(start + k) % n];
+        lock_guard<mutex> lk(other.mu);
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+        }
+    }
+
+    if (!task) return false;
+
+    {
+        lock_guard<mutex> lk(mu);
+        pending--;
+    }
+
+    task();
+    return true;
+}
+
+void kat::ThreadPool::taskFinished() {
+
+    // Take the lock so a waiter can't miss this between checking and sleeping
+    {
+        lock_guard<mutex> lk(mu);
+    }
+    wake.notify_all();
+}
+
+void kat::ThreadPool::helpUntil(const function<bool()>& done) {
+
+    while (!done()) {
+        if (runOne()) continue;
+
+        unique_lock<mutex> lk(mu);
+        wake.wait(lk, [this, &done]() { return pending > 0 || done(); });
+    }
+}
+
+void kat::ThreadPool::work(uint16_t id) {
+
+    currentPool = this;
+    currentWorker = id;
+
+    while (true) {
+        if (runOne()) continue;
+
+        unique_lock<mutex> lk(mu);
+        wake.wait(lk, [this]() { return pending > 0 || stopping; });
+        if (stopping && pending == 0) return;
+    }
+}
+
+void kat::ThreadPool::parallelFor(size_t n, const function<void(size_t)>& body) {
+
+    if (n == 0) return;
+
+    struct State {
+        std::atomic<size_t> left;
+        mutex errorMu;
+        exception_ptr error;
+    };
+
+    shared_ptr<State> state = std::make_shared<State>();
+    state->left = n;
+
+    auto run = [this, state, &body](size_t i) {
+        try {
+            body(i);
+        }
+        catch(...) {
+            lock_guard<mutex> lk(state->errorMu);
+            if (!state->error) state->error = std::current_exception();
+        }
+        if (--state->left == 0) {
+            taskFinished();
+        }
+    };
+
+    for (size_t i = 1; i < n; i++) {
+        push([run, i]() { run(i); });
+    }
+
+    run(0);
+    helpUntil([&state]() { return state->left == 0; });
+
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
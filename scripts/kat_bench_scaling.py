@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+
+import sys
+import os
+import argparse
+import csv
+import math
+import random
+import subprocess
+import time
+
+# ----- command line parsing -----
+parser = argparse.ArgumentParser(
+	description="Measure how KAT tools scale with threads and input size.  " \
+				"Generates a synthetic genome and reads from it for each " \
+				"genome size, runs each tool over every thread count, and " \
+				"writes wall time, peak memory and throughput to a CSV file " \
+				"and a scaling plot.")
+
+parser.add_argument("-k", "--kat", type=str, default="kat",
+					help="Path to the kat executable")
+parser.add_argument("-m", "--modes", type=str, default="hist,gcp,comp,sect,filter",
+					help="Comma separated list of KAT tools to run")
+parser.add_argument("-t", "--threads", type=str, default="1,2,4,8,16,32,64,128",
+					help="Comma separated list of thread counts.  Counts " \
+						 "above the number of cores are skipped unless " \
+						 "--oversubscribe is given.")
+parser.add_argument("-s", "--sizes", type=str, default="1000000,10000000",
+					help="Comma separated list of genome sizes, in bases")
+parser.add_argument("-c", "--coverage", type=int, default=20,
+					help="Read coverage of the genome")
+parser.add_argument("-l", "--read_length", type=int, default=100,
+					help="Length of the reads")
+parser.add_argument("-e", "--error_rate", type=float, default=0.005,
+					help="Probability that a base in a read is wrong")
+parser.add_argument("-r", "--repeats", type=int, default=1,
+					help="Number of times to run each tool at each setting")
+parser.add_argument("--seed", type=int, default=42,
+					help="Seed for the synthetic genomes and reads")
+parser.add_argument("-o", "--output_dir", type=str, default="kat-bench",
+					help="Directory for the synthetic data, tool output, CSV " \
+						 "file and plot.  Synthetic data already there is reused.")
+parser.add_argument("--oversubscribe", dest="oversubscribe", action="store_true",
+					help="Also run thread counts above the number of cores")
+parser.add_argument("--no_plot", dest="plot", action="store_false",
+					help="Only write the CSV file")
+parser.add_argument("-v", "--verbose", dest="verbose",
+					action="store_true",
+					help="Print extra information")
+parser.set_defaults(verbose=False, oversubscribe=False, plot=True)
+
+args = parser.parse_args()
+# ----- end command line parsing -----
+
+modes = args.modes.split(',')
+sizes = list(map(int, args.sizes.split(',')))
+threads = list(map(int, args.threads.split(',')))
+
+known_modes = ["hist", "gcp", "comp", "sect", "filter"]
+for mode in modes:
+	if mode not in known_modes:
+		sys.exit("Unknown mode: {:s}.  Choose from: {:s}".format(mode, ",".join(known_modes)))
+
+cores = os.cpu_count() or 1
+if not args.oversubscribe:
+	skipped = [t for t in threads if t > cores]
+	threads = [t for t in threads if t <= cores]
+	if skipped:
+		print("Skipping thread counts above the {:d} cores available: {:s}".format(
+			cores, ",".join(map(str, skipped))), file=sys.stderr)
+if not threads:
+	sys.exit("No thread counts to run")
+
+os.makedirs(args.output_dir, exist_ok=True)
+
+
+def write_genome(path, size, rng):
+	"""Writes a random genome as a single FASTA entry and returns its sequence"""
+	genome = "".join(rng.choices("ACGT", k=size))
+	with open(path, "w") as out:
+		out.write(">genome_{:d}\n".format(size))
+		for i in range(0, size, 70):
+			out.write(genome[i:i + 70] + "\n")
+	return genome
+
+
+def write_reads(path, genome, rng):
+	"""Samples reads from both strands of the genome, with substitution errors"""
+	complement = str.maketrans("ACGT", "TGCA")
+	length = min(args.read_length, len(genome))
+	nb_reads = len(genome) * args.coverage // length
+	qual = "I" * length
+	with open(path, "w") as out:
+		for r in range(nb_reads):
+			start = rng.randrange(len(genome) - length + 1)
+			read = genome[start:start + length]
+			if rng.random() < 0.5:
+				read = read.translate(complement)[::-1]
+			# Jump between errors, with geometrically distributed gaps
+			bases = None
+			pos = -1
+			while args.error_rate > 0.0:
+				pos += 1 + int(math.log(1.0 - rng.random()) / math.log(1.0 - args.error_rate))
+				if pos >= length:
+					break
+				if bases is None:
+					bases = list(read)
+				bases[pos] = rng.choice([b for b in "ACGT" if b != bases[pos]])
+			if bases is not None:
+				read = "".join(bases)
+			out.write("@read_{:d}\n{:s}\n+\n{:s}\n".format(r, read, qual))
+
+
+def synthetic_data(size):
+	"""Paths to the genome and reads for the given genome size, generated if needed"""
+	genome_path = os.path.join(args.output_dir, "genome_{:d}.fa".format(size))
+	reads_path = os.path.join(args.output_dir, "reads_{:d}_{:d}x.fq".format(size, args.coverage))
+	if not (os.path.exists(genome_path) and os.path.exists(reads_path)):
+		if args.verbose:
+			print("Generating a {:d} base genome and {:d}x reads".format(size, args.coverage))
+		# Seeded by size, so each genome is the same whichever other sizes are run
+		rng = random.Random(args.seed * 1000003 + size)
+		genome = write_genome(genome_path + ".tmp", size, rng)
+		write_reads(reads_path + ".tmp", genome, rng)
+		os.rename(genome_path + ".tmp", genome_path)
+		os.rename(reads_path + ".tmp", reads_path)
+	return genome_path, reads_path
+
+
+def command(mode, nb_threads, size, genome_path, reads_path, prefix):
+	"""The kat command line for one run, and the number of input bases it reads"""
+	hash_size = str(max(size * 4, 1000000))
+	read_bases = size * args.coverage
+	t = ["-t", str(nb_threads)]
+	o = ["-o", prefix]
+	if mode == "hist":
+		return [args.kat, "hist"] + t + o + ["-H", hash_size, reads_path], read_bases
+	elif mode == "gcp":
+		return [args.kat, "gcp"] + t + o + ["-H", hash_size, reads_path], read_bases
+	elif mode == "comp":
+		return [args.kat, "comp"] + t + o + ["-H", hash_size, "-I", str(max(size * 2, 1000000)),
+											 reads_path, genome_path], read_bases + size
+	elif mode == "sect":
+		return [args.kat, "sect"] + t + o + ["-H", hash_size, genome_path, reads_path], read_bases + size
+	else:
+		return [args.kat, "filter", "kmer"] + t + o + ["-H", hash_size, "-c", "5", reads_path], read_bases
+
+
+def run(cmd, log_path):
+	"""Runs cmd, returning its exit status, wall, user and system time and peak RSS in MB"""
+	with open(log_path, "w") as log:
+		start = time.monotonic()
+		proc = subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT)
+		pid, status, usage = os.wait4(proc.pid, 0)
+		wall = time.monotonic() - start
+	proc.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -os.WTERMSIG(status)
+	# ru_maxrss is in kilobytes on Linux
+	return proc.returncode, wall, usage.ru_utime, usage.ru_stime, usage.ru_maxrss / 1024.0
+
+
+fields = ["mode", "genome_size", "input_bases", "threads", "repeat", "status",
+		  "wall_s", "user_s", "sys_s", "peak_rss_mb", "bases_per_s", "speedup", "efficiency"]
+rows = []
+
+for size in sizes:
+	genome_path, reads_path = synthetic_data(size)
+	for mode in modes:
+		for nb_threads in threads:
+			for repeat in range(args.repeats):
+				prefix = os.path.join(args.output_dir, "run", "{:s}_{:d}_t{:d}_r{:d}".format(mode, size, nb_threads, repeat))
+				os.makedirs(os.path.dirname(prefix), exist_ok=True)
+				cmd, input_bases = command(mode, nb_threads, size, genome_path, reads_path, prefix)
+				if args.verbose:
+					print(" ".join(cmd))
+				status, wall, user, sys_time, rss = run(cmd, prefix + ".log")
+				if status != 0:
+					print("{:s} failed with status {:d}, see {:s}.log".format(" ".join(cmd), status, prefix),
+						  file=sys.stderr)
+				print("{:s}\tsize={:d}\tthreads={:d}\twall={:.2f}s\trss={:.0f}MB".format(
+					mode, size, nb_threads, wall, rss))
+				rows.append({"mode": mode, "genome_size": size, "input_bases": input_bases,
+							 "threads": nb_threads, "repeat": repeat, "status": status,
+							 "wall_s": wall, "user_s": user, "sys_s": sys_time, "peak_rss_mb": rss,
+							 "bases_per_s": input_bases / wall if wall > 0 else 0.0})
+
+# Speedup and parallel efficiency relative to the fewest threads run for each mode and size
+for row in rows:
+	base = [r["wall_s"] for r in rows if r["mode"] == row["mode"] and r["genome_size"] == row["genome_size"]
+			and r["threads"] == min(threads) and r["status"] == 0]
+	if base and row["status"] == 0 and row["wall_s"] > 0:
+		row["speedup"] = (sum(base) / len(base)) / row["wall_s"]
+		row["efficiency"] = row["speedup"] * min(threads) / row["threads"]
+	else:
+		row["speedup"] = ""
+		row["efficiency"] = ""
+
+csv_path = os.path.join(args.output_dir, "kat-scaling.csv")
+with open(csv_path, "w", newline="") as out:
+	writer = csv.DictWriter(out, fieldnames=fields)
+	writer.writeheader()
+	for row in rows:
+		writer.writerow(row)
+print("Results written to " + csv_path)
+
+if args.plot:
+	plot_script = os.path.join(os.path.dirname(os.path.abspath(__file__)), "kat_plot_scaling.py")
+	plot_path = os.path.join(args.output_dir, "kat-scaling")
+	status = subprocess.call([sys.executable, plot_script, "-o", plot_path, csv_path])
+	if status != 0:
+		print("Plotting failed", file=sys.stderr)
+		exit(1)
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+
+import sys
+import argparse
+import csv
+import numpy as np
+import matplotlib
+
+matplotlib.use('Agg')
+import matplotlib.pyplot as plt
+import matplotlib.ticker as ticker
+
+from kat_plot_misc import *
+
+# ----- command line parsing -----
+parser = argparse.ArgumentParser(
+	description="Create Thread Scaling Plot.")
+
+parser.add_argument("scaling_file", type=str,
+					help="The CSV file written by kat_bench_scaling.py")
+
+parser.add_argument("-o", "--output", type=str, default="kat-scaling",
+					help="The path to the output file.")
+parser.add_argument("-p", "--output_type", type=str,
+					help="The plot file type to create (default is based on " \
+						 "given output name).")
+parser.add_argument("-t", "--title", type=str,
+					help="Title for plot")
+parser.add_argument("-w", "--width", type=int, default=12,
+					help="Width of canvas")
+parser.add_argument("-l", "--height", type=int, default=5,
+					help="Height of canvas")
+parser.add_argument("--dpi", type=int, default=300,
+					help="Resolution in dots per inch of output graphic.")
+parser.add_argument("-v", "--verbose", dest="verbose",
+					action="store_true",
+					help="Print extra information")
+parser.set_defaults(verbose=False)
+
+args = parser.parse_args()
+# ----- end command line parsing -----
+
+# Mean wall time and throughput of the successful runs, by mode, genome size and threads
+runs = {}
+with open(args.scaling_file) as input_file:
+	for row in csv.DictReader(input_file):
+		if int(row["status"]) != 0:
+			continue
+		key = (row["mode"], int(row["genome_size"]))
+		runs.setdefault(key, {}).setdefault(int(row["threads"]), []).append(
+			(float(row["wall_s"]), float(row["bases_per_s"])))
+
+if not runs:
+	sys.exit("No successful runs in " + args.scaling_file)
+
+if args.title is not None:
+	title = args.title
+else:
+	title = "Thread Scaling"
+
+fig, (ax1, ax2) = plt.subplots(1, 2, figsize=(args.width, args.height))
+
+max_threads = 1
+for (mode, size), by_threads in sorted(runs.items()):
+	threads = np.array(sorted(by_threads.keys()))
+	wall = np.array([np.mean([r[0] for r in by_threads[t]]) for t in threads])
+	rate = np.array([np.mean([r[1] for r in by_threads[t]]) for t in threads])
+	speedup = wall[0] / wall * threads[0]
+	label = "{:s} ({:g} Mb)".format(mode, size / 1e6)
+	ax1.plot(threads, speedup, marker='o', label=label)
+	ax2.plot(threads, rate / 1e6, marker='o', label=label)
+	max_threads = max(max_threads, threads[-1])
+	if args.verbose:
+		for t, w, s in zip(threads, wall, speedup):
+			print("{:s}\t{:d}\t{:d}\t{:.2f}s\t{:.2f}x".format(mode, size, t, w, s))
+
+ideal = np.array([1, max_threads])
+ax1.plot(ideal, ideal, linestyle='--', color='grey', label="ideal")
+
+for ax in (ax1, ax2):
+	ax.set_xscale('log', base=2)
+	ax.xaxis.set_major_formatter(ticker.ScalarFormatter())
+	ax.set_xlabel("Threads")
+	ax.grid(True, color="black", alpha=0.2)
+ax1.set_yscale('log', base=2)
+ax1.yaxis.set_major_formatter(ticker.ScalarFormatter())
+ax1.set_ylabel("Speedup")
+ax2.set_ylabel("Throughput (Mbases/s)")
+ax1.legend(loc=2, fontsize='small')
+
+fig.suptitle(title)
+fig.tight_layout()
+
+if args.output_type is not None:
+	output_name = args.output + '.' + args.output_type
+else:
+	output_name = args.output
+
+plt.savefig(correct_filename(output_name), dpi=args.dpi)
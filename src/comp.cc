@@ -27,6 +27,8 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <sstream>
+#include <exception>
 #include <sys/ioctl.h>
 using std::vector;
 using std::string;
@@ -53,14 +55,22 @@ using bfs::path;
 #include <kat/sparse_matrix.hpp>
 #include <kat/distance_metrics.hpp>
 #include <kat/input_handler.hpp>
+#include <kat/memory_budget.hpp>
+#include <kat/metrics.hpp>
+#include <kat/thread_pool.hpp>
 #include <kat/comp_counters.hpp>
+#include <kat/kmer_sketch.hpp>
+using kat::BatchLookup;
 using kat::JellyfishHelper;
 using kat::InputHandler;
 using kat::HashLoader;
+using kat::HashClient;
 using kat::CompCounters;
 using kat::ThreadedCompCounters;
 using kat::ThreadedSparseMatrix;
 using kat::SparseMatrix;
+using kat::MemoryBudget;
+using kat::KmerSketch;
 
 #include "plot.hpp"
 #include "plot_spectra_cn.hpp"
@@ -96,7 +106,12 @@ void kat::Comp::init(const vector<path>& _input1, const vector<path>& _input2) {
     d2Bins = DEFAULT_NB_BINS;
     threads = 1;
     densityPlot = false;
+    partial = false;
     threeInputs = false;
+    targeted = false;
+    sketchScale = 0;
+    kmersCompared = 0;
+    lookups = 0;
     verbose = false;
 }
 
@@ -110,10 +125,29 @@ void kat::Comp::setThirdInput(const vector<path>& _input3) {
 
 void kat::Comp::execute() {
 
+    // Sketches saved by an earlier run can be compared without asking for sketching again
+    bool anySketches = false;
+    for(uint16_t i = 0; i < inputSize(); i++) {
+        anySketches = anySketches || (input[i].input.size() == 1 && KmerSketch::isSketchFile(input[i].input[0]));
+    }
+    
+    if (sketchScale > 0 || anySketches) {
+        executeSketched();
+        return;
+    }
+
     // Check input files exist and determine input mode
     for(uint16_t i = 0; i < inputSize(); i++) {
         input[i].validateInput();
     }
+    
+    if (targeted) {
+        if (input[0].mode != InputHandler::InputMode::COUNT) {
+            BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "Targeted counting requires input 1 to be sequence file(s), not a jellyfish hash.")));
+        }
+
+    }
         
     // Create output directory
     path parentDir = bfs::absolute(outputPrefix).parent_path();
@@ -138,20 +172,12 @@ void kat::Comp::execute() {
 
     string merLenStr = lexical_cast<string>(this->getMerLen());
 
-    // Count kmers in sequence files if necessary (sets load and hashes and hashcounters as appropriate)
-    for(size_t i = 0; i < inputSize(); i++) {
-        if (input[i].mode == InputHandler::InputHandler::InputMode::COUNT) {
-            input[i].count(threads);
-        }
-    }
-    
-    // Check to see if user specified any hashes to load
-    bool anyLoad = false;
+    // Check to see if user specified any hashes to load.  Only the headers are read
+    // at this stage, so we can validate the K-mer lengths before doing any heavy lifting
     bool allLoad = true;
     for(size_t i = 0; i < inputSize(); i++) {
         if (input[i].mode == InputHandler::InputMode::LOAD) {
             input[i].loadHeader();
-            anyLoad = true;            
         }
         else if (input[i].mode == InputHandler::InputHandler::InputMode::COUNT) {
             allLoad = false;
@@ -166,8 +192,38 @@ void kat::Comp::execute() {
         input[i].validateMerLen(this->getMerLen());
     }
     
-    // Load any hashes if necessary
-    if (anyLoad) loadHashes();
+    // Count kmers in sequence files and load any hashes.  If targeting, input 1 is 
+    // counted later once we have input 2's K-mers
+    vector<size_t> toCount;
+    for(size_t i = 0; i < inputSize(); i++) {
+        if (input[i].mode == InputHandler::InputHandler::InputMode::COUNT && !(targeted && i == 0)) {
+            toCount.push_back(i);
+        }
+    }
+    
+    // Targeted counting pre-populates a hash from input 2's K-mers, so needs it in memory
+    if (targeted) {
+        input[1].hashServer = path();
+    }
+    
+    countAndLoad(toCount);
+    
+    // Count input 1, only keeping K-mers found in input 2
+    if (targeted) {
+        if (input[0].canonical != input[1].canonical) {
+            BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "Targeted counting requires inputs 1 and 2 to both be canonical or both be non-canonical.  Hash for input 2 is ") +
+                (input[1].canonical ? "canonical." : "non-canonical.")));
+        }
+        
+        input[0].targetHash = input[1].hash;
+        input[0].count(threads);
+    }
+    
+    // Each hash is looked up at random from the others' K-mers
+    for(size_t i = 0; i < inputSize(); i++) {
+        input[i].placeHash(threads);
+    }
     
     // Run the threads
     compare();
@@ -183,11 +239,151 @@ void kat::Comp::execute() {
 
     // Merge results
     merge();    
+    
+    // K-mers from input 1 not in input 2 weren't stored, but we know how many there were
+    if (targeted) {
+        CompCounters& cc = comp_counters.getFinalMatrix();
+        cc.hash1_targeted = true;
+        cc.hash1_total += input[0].untargetedTotal;
+        cc.hash1_only_total += input[0].untargetedTotal;
+    }
+}
+
+void kat::Comp::executeSketched() {
+    
+    if (doThirdHash() || targeted) {
+        BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+            "Sketches can only be compared between two inputs, without targeted counting.")));
+    }
+    
+    // Create output directory
+    path parentDir = bfs::absolute(outputPrefix).parent_path();
+    KatFS::ensureDirectoryExists(parentDir);
+    
+    // Sketches saved by earlier runs are reused as they are
+    vector<KmerSketch> sketches(2);
+    vector<bool> loaded(2, false);
+    for(size_t i = 0; i < 2; i++) {
+        if (input[i].input.size() == 1 && KmerSketch::isSketchFile(input[i].input[0])) {
+            sketches[i] = KmerSketch::load(input[i].input[0]);
+            loaded[i] = true;
+        }
+        else {
+            input[i].validateInput();
+            if (input[i].mode == InputHandler::InputMode::LOAD) {
+                input[i].loadHeader();
+            }
+        }
+    }
+    
+    // The K-mer length comes from a loaded sketch or hash if there's nothing to count.
+    // Any other input is sketched at the same scale as a loaded sketch, so they can be compared
+    if (loaded[0] || loaded[1]) {
+        const KmerSketch& first = sketches[loaded[0] ? 0 : 1];
+        if (sketchScale > 0 && sketchScale != first.getScale()) {
+            BOOST_THROW_EXCEPTION(CompException() << CompErrorInfo(string(
+                "--sketch_scale is ") + lexical_cast<string>(sketchScale) + " but the sketch in " + 
+                input[loaded[0] ? 0 : 1].pathString() + " keeps 1 in " + lexical_cast<string>(first.getScale()) + " K-mers."));
+        }
+        this->setMerLen(first.getMerLen());
+        sketchScale = first.getScale();
+    }
+    else if (input[0].mode == InputHandler::InputMode::LOAD && input[1].mode == InputHandler::InputMode::LOAD) {
+        this->setMerLen(input[0].header->key_len() / 2);
+    }
+    
+    for(size_t i = 0; i < 2; i++) {
+        if (loaded[i]) continue;
+        
+        input[i].validateMerLen(this->getMerLen());
+        
+        auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+        Metrics::Phase phase("sketch", input[i].pathString());
+        
+        cout << "Sketching input " << input[i].index << " keeping 1 in " << sketchScale << " K-mers ...";
+        cout.flush();
+        
+        if (input[i].mode == InputHandler::InputMode::COUNT) {
+            sketches[i] = KmerSketch(this->getMerLen(), input[i].canonical, sketchScale);
+            sketches[i].sketchSeqFiles(input[i].input, threads, input[i].minQual);
+        }
+        else {
+            // The hash is only needed until it's sketched
+            input[i].hashServer = path();
+            input[i].loadHash();
+            sketches[i] = KmerSketch(this->getMerLen(), input[i].canonical, sketchScale);
+            sketches[i].sketchHash(*input[i].hash, threads);
+            input[i].hash = nullptr;
+        }
+        sketches[i].setSource(input[i].pathString());
+        
+        path sketchPath(outputPrefix.string() + "-" + lexical_cast<string>(input[i].index) + SKETCH_EXTENSION);
+        sketches[i].save(sketchPath);
+        
+        cout << " done.  Kept " << sketches[i].size() << " K-mers in " << sketchPath.string();
+        cout.flush();
+    }
+    
+    sketches[0].checkCompatible(sketches[1]);
+    for(size_t i = 0; i < 2; i++) {
+        input[i].canonical = sketches[i].isCanonical();
+    }
+    
+    {
+        auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+        Metrics::Phase phase("compare");
+    
+        cout << "Comparing sketches ...";
+        cout.flush();
+    
+        // Sketches are small, so a single matrix and set of counters will do
+        main_matrix = ThreadedSparseMatrix(d1Bins, d2Bins, 1);
+        comp_counters = ThreadedCompCounters(
+                input[0].getSingleInput(), 
+                input[1].getSingleInput(), 
+                path(),
+                std::min(d1Bins, d2Bins));
+    
+        // Each K-mer in the sketches stands for scale K-mers in the whole inputs
+        const uint64_t scale = sketches[0].getScale();
+        shared_ptr<CompCounters> cc = make_shared<CompCounters>(std::min(this->d1Bins, this->d2Bins));
+    
+        KmerSketch::forEachPair(sketches[0], sketches[1], [&](uint64_t hash1_count, uint64_t hash2_count) {
+        
+            if (hash1_count > 0) {
+                cc->updateHash1Counters(hash1_count, hash2_count);
+                cc->updateSharedCounters(hash1_count, hash2_count);
+            }
+            if (hash2_count > 0) {
+                cc->updateHash2Counters(hash1_count, hash2_count);
+            }
+        
+            uint64_t scaled_hash1_count = scaleCounter(hash1_count, d1Scale);
+            uint64_t scaled_hash2_count = scaleCounter(hash2_count, d2Scale);
+            if (scaled_hash1_count >= d1Bins) scaled_hash1_count = d1Bins - 1;
+            if (scaled_hash2_count >= d2Bins) scaled_hash2_count = d2Bins - 1;
+        
+            main_matrix.incTM(0, scaled_hash1_count, scaled_hash2_count, scale);
+        });
+    
+        comp_counters.add(cc);
+        kmersCompared += cc->hash1_distinct + cc->hash2_distinct;
+    
+        cout << " done.";
+        cout.flush();
+    }
+    
+    merge();
+    
+    CompCounters& counters = comp_counters.getFinalMatrix();
+    counters.scaleUp(sketches[0].getScale());
+    counters.sketch_scale = sketches[0].getScale();
 }
 
 void kat::Comp::save() {
     
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+    Metrics::Phase phase("save");
 
     cout << "Saving results to disk ...";
     cout.flush();
@@ -220,6 +416,13 @@ void kat::Comp::save() {
     printCounters(stats_out_stream);
     stats_out_stream.close();
     
+    // Send K-mer statistics to file in a form that can be added up with those from other shards
+    if (partial) {
+        ofstream counters_out_stream(string(outputPrefix.string() + ".counters").c_str());
+        comp_counters.getFinalMatrix().save(counters_out_stream);
+        counters_out_stream.close();
+    }
+    
     if (outputHists) {
         
         ofstream hist1_out_stream(string(outputPrefix.string() + ".1.hist").c_str());
@@ -250,15 +453,26 @@ void kat::Comp::printHist(std::ostream &out, InputHandler& input, vector<uint64_
 
 void kat::Comp::merge() {
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+    Metrics::Phase phase("merge");
 
     cout << "Merging results ...";
     cout.flush();
-    // Merge results from the threads
-    main_matrix.mergeThreadedMatricies();
-    if (doThirdHash()) {
-        ends_matrix.mergeThreadedMatricies();
-        middle_matrix.mergeThreadedMatricies();
-        mixed_matrix.mergeThreadedMatricies();
+    // Merge results from the threads, freeing each as it goes if memory is limited
+    if (input[0].memoryLimit() > 0) {
+        main_matrix.streamMergeThreadedMatricies();
+        if (doThirdHash()) {
+            ends_matrix.streamMergeThreadedMatricies();
+            middle_matrix.streamMergeThreadedMatricies();
+            mixed_matrix.streamMergeThreadedMatricies();
+        }
+    }
+    else {
+        main_matrix.mergeThreadedMatricies();
+        if (doThirdHash()) {
+            ends_matrix.mergeThreadedMatricies();
+            middle_matrix.mergeThreadedMatricies();
+            mixed_matrix.mergeThreadedMatricies();
+        }
     }
 
     comp_counters.merge();
@@ -277,20 +491,17 @@ void kat::Comp::loadHashes() {
     // If using parallel IO load hashes in parallel, otherwise do one at a time
     if (threads > 1) {
         
-        vector<thread> threads(inputSize());
-        
-        void (kat::InputHandler::*memfunc)() = &kat::InputHandler::loadHash;
+        ThreadPool& pool = ThreadPool::global();
+        vector<std::future<void>> loads;
         
         for(size_t i = 0; i < inputSize(); i++) {
             if (input[i].mode == InputHandler::InputMode::LOAD) {
-                threads[i] = thread(memfunc, &input[i]);                
+                loads.push_back(pool.submit([this, i]() { input[i].loadHash(); }));
             }
         }
         
-        for(size_t i = 0; i < inputSize(); i++) {
-            if (input[i].mode == InputHandler::InputMode::LOAD) {
-                threads[i].join();                 
-            }
+        for(auto& f : loads) {
+            pool.wait(f);
         }        
     }
     else {
@@ -305,6 +516,153 @@ void kat::Comp::loadHashes() {
     cout.flush();
 }
 
+vector<uint16_t> kat::Comp::splitThreads(const vector<uint64_t>& weights, uint16_t threads) {
+    
+    const size_t n = weights.size();
+    vector<uint16_t> split(n, 1);
+    
+    if (n == 0 || threads <= n) {
+        return split;
+    }
+    
+    // Inputs of unknown size get the average size of the others, or all get the
+    // same weight if nothing is known
+    uint64_t known = 0;
+    size_t nbKnown = 0;
+    for(auto w : weights) {
+        if (w > 0) {
+            known += w;
+            nbKnown++;
+        }
+    }
+    
+    vector<double> w(n);
+    double total = 0.0;
+    for(size_t i = 0; i < n; i++) {
+        w[i] = weights[i] > 0 ? (double)weights[i] : nbKnown > 0 ? (double)known / (double)nbKnown : 1.0;
+        total += w[i];
+    }
+    
+    // Share out the spare threads in proportion to size, then hand any left over
+    // due to rounding to the tasks with the largest remainders
+    const uint16_t spare = threads - n;
+    uint16_t assigned = 0;
+    vector<double> remainder(n);
+    for(size_t i = 0; i < n; i++) {
+        double share = spare * w[i] / total;
+        uint16_t whole = (uint16_t)share;
+        split[i] += whole;
+        assigned += whole;
+        remainder[i] = share - whole;
+    }
+    
+    while (assigned < spare) {
+        size_t best = 0;
+        for(size_t i = 1; i < n; i++) {
+            if (remainder[i] > remainder[best]) best = i;
+        }
+        split[best]++;
+        remainder[best] = -1.0;
+        assigned++;
+    }
+    
+    return split;
+}
+
+void kat::Comp::countAndLoad(const vector<size_t>& toCount) {
+    
+    vector<size_t> toLoad;
+    for(size_t i = 0; i < inputSize(); i++) {
+        if (input[i].mode == InputHandler::InputMode::LOAD) {
+            toLoad.push_back(i);
+        }
+    }
+    
+    // Not worth running concurrently if there's only one thing to do, or not enough
+    // threads to give every count its own.  Just count each input using all threads
+    // in turn and then load hashes as before.
+    if (toCount.size() + toLoad.size() <= 1 || toCount.size() > threads) {
+        
+        for(auto i : toCount) {
+            input[i].count(threads);
+        }
+        
+        if (!toLoad.empty()) loadHashes();
+        
+        return;
+    }
+    
+    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");
+    
+    // Divide the thread budget between the inputs to count by size.  Hashes are
+    // loaded on their own threads as this is mostly I/O.
+    vector<uint64_t> sizes;
+    for(auto i : toCount) {
+        sizes.push_back(input[i].sizeOnDisk());
+    }
+    vector<uint16_t> countThreads = splitThreads(sizes, threads);
+    
+    cout << "Processing " << inputSize() << " inputs concurrently (";
+    for(size_t j = 0; j < toCount.size(); j++) {
+        cout << (j > 0 ? ", " : "") << "counting input " << input[toCount[j]].index << " with " << countThreads[j] << " thread" << (countThreads[j] > 1 ? "s" : "");
+    }
+    for(size_t j = 0; j < toLoad.size(); j++) {
+        cout << (j > 0 || !toCount.empty() ? ", " : "") << "loading input " << input[toLoad[j]].index;
+    }
+    cout << ") ..." << endl << endl;
+    
+    // Buffer progress messages from each input so they don't get interleaved
+    vector<std::ostringstream> messages(inputSize());
+    vector<std::exception_ptr> errors(inputSize());
+    ThreadPool& pool = ThreadPool::global();
+    vector<std::future<void>> t;
+    
+    for(size_t j = 0; j < toCount.size(); j++) {
+        const size_t i = toCount[j];
+        const uint16_t nbThreads = countThreads[j];
+        input[i].out = &messages[i];
+        t.push_back(pool.submit([this, i, nbThreads, &errors]() {
+            try {
+                input[i].count(nbThreads);
+            }
+            catch(...) {
+                errors[i] = std::current_exception();
+            }
+        }));
+    }
+    
+    for(auto i : toLoad) {
+        input[i].out = &messages[i];
+        t.push_back(pool.submit([this, i, &errors]() {
+            try {
+                input[i].loadHash();
+            }
+            catch(...) {
+                errors[i] = std::current_exception();
+            }
+        }));
+    }
+    
+    for(auto& f : t) {
+        pool.wait(f);
+    }
+    
+    for(size_t i = 0; i < inputSize(); i++) {
+        input[i].out = &cout;
+        string msg = messages[i].str();
+        if (!msg.empty()) {
+            cout << msg;
+        }
+    }
+    
+    for(auto& e : errors) {
+        if (e) std::rethrow_exception(e);
+    }
+    
+    cout << "Finished processing inputs.";
+    cout.flush();
+}
+
 
 // Print K-mer comparison matrix
 
@@ -369,120 +727,260 @@ void kat::Comp::printCounters(ostream &out) {
 void kat::Comp::compare() {
 
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+    Metrics::Phase phase("compare");
+    kmersCompared = 0;
+    lookups = 0;
+
+    // If a matrix per thread might not fit the memory limit, share fewer between
+    // the slices, comparing with fewer threads at once
+    const uint16_t matrices = matricesWithinLimit();
+    if (matrices < threads) {
+        cout << "Using " << matrices << " matrices rather than one per thread to fit the " 
+             << MemoryBudget::toMB(input[0].memoryLimit()) << " memory limit." << endl;
+        main_matrix = ThreadedSparseMatrix(d1Bins, d2Bins, matrices);
+        if (doThirdHash()) {
+            ends_matrix = ThreadedSparseMatrix(d1Bins, d2Bins, matrices);
+            middle_matrix = ThreadedSparseMatrix(d1Bins, d2Bins, matrices);
+            mixed_matrix = ThreadedSparseMatrix(d1Bins, d2Bins, matrices);
+        }
+    }
 
     cout << "Comparing hashes ...";
     cout.flush();
     
-    vector<thread> t(threads);
+    ThreadPool::global().parallelFor(matrices, [this, &phase, matrices](size_t m) {
+        PerfCounters counters;
+        for (size_t slice = m; slice < threads; slice += matrices) {
+            compareSlice(slice, m);
+        }
+        phase.addThreadCounters(m, counters);
+    });
+    phase.addKmers(kmersCompared);
+    phase.addLookups(lookups);
+    
+    cout << " done.";
+    cout.flush();
+}
 
-    for(uint16_t i = 0; i < threads; i++) {
-        t[i] = thread(&Comp::compareSlice, this, i);
+/**
+ * Looks up the counts for the first n keys in the given input, canonicalising 
+ * them first if requested.  Uses batched lookups if the input has them, or a
+ * single request if the input is held by a hash server.
+ */
+static void lookupCounts(const InputHandler& in, const vector<mer_dna>& keys, size_t n, bool canonicalise,
+        vector<uint64_t>& words, vector<uint64_t>& counts) {
+    
+    if (in.client != nullptr) {
+        const uint16_t nbWords = in.client->nbWords();
+        if (words.size() < n * nbWords) words.resize(n * nbWords);
+        for (size_t i = 0; i < n; i++) {
+            const mer_dna key = canonicalise ? keys[i].get_canonical() : keys[i];
+            for (uint16_t w = 0; w < nbWords; w++) {
+                words[i * nbWords + w] = key.word(w);
+            }
+        }
+        in.client->getCounts(words.data(), n, counts.data());
     }
+    else if (in.lookup != nullptr) {
+        for (size_t i = 0; i < n; i++) {
+            words[i] = keys[i].word(0);
+        }
+        if (canonicalise) kat::BatchLookup::canonicalise(words.data(), n, in.merLen);
+        in.lookup->getCounts(words.data(), n, counts.data());
+    }
+    else {
+        for (size_t i = 0; i < n; i++) {
+            counts[i] = JellyfishHelper::getCount(in.hash, keys[i], canonicalise);
+        }
+    }
+}
 
-    for(uint16_t i = 0; i < threads; i++){
-        t[i].join();
+/**
+ * Iterates over one thread's slice of an input's hash, whether it's in memory
+ * or held by a hash server
+ */
+class HashSlice {
+public:
+    
+    HashSlice(const InputHandler& in, int slice, int nbSlices) {
+        if (in.client != nullptr) {
+            served.reset(new HashClient::Slice(*in.client, slice, nbSlices));
+            nbWords = in.client->nbWords();
+        }
+        else {
+            local.reset(new LargeHashArray::eager_iterator(in.hash->eager_slice(slice, nbSlices)));
+        }
     }
     
-    cout << " done.";
-    cout.flush();
+    /**
+     * Fills keys and vals with up to keys.size() entries.  Returns how many were 
+     * read.
+     */
+    size_t next(vector<mer_dna>& keys, vector<uint64_t>& vals) {
+        
+        size_t n = 0;
+        if (local != nullptr) {
+            while (n < keys.size() && local->next()) {
+                keys[n] = local->key();
+                vals[n] = local->val();
+                n++;
+            }
+        }
+        else {
+            n = served->next(keys.size(), words, vals);
+            for (size_t i = 0; i < n; i++) {
+                for (uint16_t w = 0; w < nbWords; w++) {
+                    keys[i].word__(w) = words[i * nbWords + w];
+                }
+            }
+        }
+        return n;
+    }
+    
+private:
+    unique_ptr<LargeHashArray::eager_iterator> local;
+    unique_ptr<HashClient::Slice> served;
+    uint16_t nbWords = 0;
+    vector<uint64_t> words;
+};
+
+uint16_t kat::Comp::matricesWithinLimit() {
+    
+    const uint64_t limit = input[0].memoryLimit();
+    if (limit == 0) {
+        return threads;
+    }
+    
+    // Worst case, with every cell of every matrix set.  Only use half of what's 
+    // left, as the final matrices need room too.
+    const uint64_t perThread = ThreadedSparseMatrix::maxBytes(d1Bins, d2Bins) * (doThirdHash() ? 4 : 1);
+    const uint64_t fit = MemoryBudget::remaining(limit) / 2 / perThread;
+    return (uint16_t)std::max((uint64_t)1, std::min((uint64_t)threads, fit));
 }
 
-void kat::Comp::compareSlice(int th_id) {
+void kat::Comp::compareSlice(int th_id, int mx_id) {
+
+    // Pool workers go back to running anywhere once this task is done
+    Numa::ThreadPin pin(mx_id, threads, isNuma());
 
     shared_ptr<CompCounters> cc = make_shared<CompCounters>(std::min(this->d1Bins, this->d2Bins));
 
+    // Keys from a canonical hash are already canonical, so only need converting
+    // when looking them up in a canonical hash from a non-canonical one
+    const bool canonical1to2 = input[1].canonical && !input[0].canonical;
+    const bool canonical1to3 = doThirdHash() && input[2].canonical && !input[0].canonical;
+    const bool canonical2to1 = input[0].canonical && !input[1].canonical;
+    
+    // K-mers are looked up in the other hashes in batches, so their cache misses overlap
+    const size_t batchSize = BatchLookup::BATCH_SIZE * 8;
+    vector<mer_dna> keys(batchSize);
+    vector<uint64_t> words(batchSize), vals(batchSize), counts(batchSize), counts3(batchSize);
+    size_t n = 0;
+
     // Setup iterator for this thread's chunk of hash1
-    LargeHashArray::eager_iterator hash1Iterator = input[0].hash->eager_slice(th_id, threads);
+    HashSlice hash1Slice(input[0], th_id, threads);
 
     // Go through this thread's slice for hash1
-    while (hash1Iterator.next()) {
+    while ((n = hash1Slice.next(keys, vals)) > 0) {
         
-        // Get the current K-mer count for hash1
-        uint64_t hash1_count = hash1Iterator.val();
-
-        // Get the count for this K-mer in hash2 (assuming it exists... 0 if not)
-        uint64_t hash2_count = JellyfishHelper::getCount(input[1].hash, hash1Iterator.key(), input[1].canonical);
-
-        // Get the count for this K-mer in hash3 (assuming it exists... 0 if not)
-        uint64_t hash3_count = doThirdHash() ? JellyfishHelper::getCount(input[2].hash, hash1Iterator.key(), input[2].canonical) : 0;
-
-        // Increment hash1's unique counters
-        cc->updateHash1Counters(hash1_count, hash2_count);
+        // Get the count for these K-mers in hash2 and hash3 (assuming they exist... 0 if not)
+        lookupCounts(input[1], keys, n, canonical1to2, words, counts);
+        if (doThirdHash()) lookupCounts(input[2], keys, n, canonical1to3, words, counts3);
+        
+        for (size_t i = 0; i < n; i++) {
+        
+            // Get the current K-mer count for hash1, hash2 and hash3
+            uint64_t hash1_count = vals[i];
+            uint64_t hash2_count = counts[i];
+            uint64_t hash3_count = doThirdHash() ? counts3[i] : 0;
 
-        // Increment shared counters
-        cc->updateSharedCounters(hash1_count, hash2_count);
+            // Increment hash1's unique counters
+            cc->updateHash1Counters(hash1_count, hash2_count);
 
-        // Scale counters to make the matrix look pretty
-        uint64_t scaled_hash1_count = scaleCounter(hash1_count, d1Scale);
-        uint64_t scaled_hash2_count = scaleCounter(hash2_count, d2Scale);
-        uint64_t scaled_hash3_count = scaleCounter(hash3_count, d2Scale);
+            // Increment shared counters
+            cc->updateSharedCounters(hash1_count, hash2_count);
 
-        // Modifies hash counts so that K-mer counts larger than MATRIX_SIZE are dumped in the last slot
-        if (scaled_hash1_count >= d1Bins) scaled_hash1_count = d1Bins - 1;
-        if (scaled_hash2_count >= d2Bins) scaled_hash2_count = d2Bins - 1;
-        if (scaled_hash3_count >= d2Bins) scaled_hash3_count = d2Bins - 1;
+            // Scale counters to make the matrix look pretty
+            uint64_t scaled_hash1_count = scaleCounter(hash1_count, d1Scale);
+            uint64_t scaled_hash2_count = scaleCounter(hash2_count, d2Scale);
+            uint64_t scaled_hash3_count = scaleCounter(hash3_count, d2Scale);
 
-        // Increment the position in the matrix determined by the scaled counts found in hash1 and hash2
-        main_matrix.incTM(th_id, scaled_hash1_count, scaled_hash2_count, 1);
+            // Modifies hash counts so that K-mer counts larger than MATRIX_SIZE are dumped in the last slot
+            if (scaled_hash1_count >= d1Bins) scaled_hash1_count = d1Bins - 1;
+            if (scaled_hash2_count >= d2Bins) scaled_hash2_count = d2Bins - 1;
+            if (scaled_hash3_count >= d2Bins) scaled_hash3_count = d2Bins - 1;
 
-        // Update hash 3 related matricies if hash 3 was provided
-        if (doThirdHash()) {
-            if (scaled_hash2_count == scaled_hash3_count)
-                ends_matrix.incTM(th_id, scaled_hash1_count, scaled_hash3_count, 1);
-            else if (scaled_hash3_count > 0)
-                mixed_matrix.incTM(th_id, scaled_hash1_count, scaled_hash3_count, 1);
-            else
-                middle_matrix.incTM(th_id, scaled_hash1_count, scaled_hash3_count, 1);
+            // Increment the position in the matrix determined by the scaled counts found in hash1 and hash2
+            main_matrix.incTM(mx_id, scaled_hash1_count, scaled_hash2_count, 1);
+
+            // Update hash 3 related matricies if hash 3 was provided
+            if (doThirdHash()) {
+                if (scaled_hash2_count == scaled_hash3_count)
+                    ends_matrix.incTM(mx_id, scaled_hash1_count, scaled_hash3_count, 1);
+                else if (scaled_hash3_count > 0)
+                    mixed_matrix.incTM(mx_id, scaled_hash1_count, scaled_hash3_count, 1);
+                else
+                    middle_matrix.incTM(mx_id, scaled_hash1_count, scaled_hash3_count, 1);
+            }
         }
     }
 
     // Setup iterator for this thread's chunk of hash2
     // We setup hash2 for random access, so hopefully performance isn't too bad here...
     // Hash2 should be smaller than hash1 in most cases so hopefully we can get away with this.
-    LargeHashArray::eager_iterator hash2Iterator = input[1].hash->eager_slice(th_id, threads);
+    HashSlice hash2Slice(input[1], th_id, threads);
 
     // Iterate through this thread's slice of hash2
-    while (hash2Iterator.next()) {
-        // Get the current K-mer count for hash2
-        uint64_t hash2_count = hash2Iterator.val();
-
-        // Get the count for this K-mer in hash1 (assuming it exists... 0 if not)
-        uint64_t hash1_count = JellyfishHelper::getCount(input[0].hash, hash2Iterator.key(), input[0].hash);
+    while ((n = hash2Slice.next(keys, vals)) > 0) {
+        
+        // Get the count for these K-mers in hash1 (assuming they exist... 0 if not)
+        lookupCounts(input[0], keys, n, canonical2to1, words, counts);
+        
+        for (size_t i = 0; i < n; i++) {
+        
+            // Get the current K-mer count for hash1 and hash2
+            uint64_t hash1_count = counts[i];
+            uint64_t hash2_count = vals[i];
 
-        // Increment hash2's unique counters (don't bother with shared counters... we've already done this)
-        cc->updateHash2Counters(hash1_count, hash2_count);
+            // Increment hash2's unique counters (don't bother with shared counters... we've already done this)
+            cc->updateHash2Counters(hash1_count, hash2_count);
 
-        // Only bother updating thread matrix with K-mers not found in hash1 (we've already done the rest)
-        if (hash1_count == 0) {
-            // Scale counters to make the matrix look pretty
-            uint64_t scaled_hash2_count = scaleCounter(hash2_count, d2Scale);
+            // Only bother updating thread matrix with K-mers not found in hash1 (we've already done the rest)
+            if (hash1_count == 0) {
+                // Scale counters to make the matrix look pretty
+                uint64_t scaled_hash2_count = scaleCounter(hash2_count, d2Scale);
 
-            // Modifies hash counts so that K-mer counts larger than MATRIX_SIZE are dumped in the last slot
-            if (scaled_hash2_count >= d2Bins) scaled_hash2_count = d2Bins - 1;
+                // Modifies hash counts so that K-mer counts larger than MATRIX_SIZE are dumped in the last slot
+                if (scaled_hash2_count >= d2Bins) scaled_hash2_count = d2Bins - 1;
 
-            // Increment the position in the matrix determined by the scaled counts found in hash1 and hash2
-            main_matrix.incTM(th_id, 0, scaled_hash2_count, 1);
+                // Increment the position in the matrix determined by the scaled counts found in hash1 and hash2
+                main_matrix.incTM(mx_id, 0, scaled_hash2_count, 1);
+            }
         }
     }
 
     // Only update hash3 counters if hash3 was provided
     if (doThirdHash()) {
         // Setup iterator for this thread's chunk of hash3
-        LargeHashArray::eager_iterator hash3Iterator = input[2].hash->eager_slice(th_id, threads);
+        HashSlice hash3Slice(input[2], th_id, threads);
 
         // Iterate through this thread's slice of hash2
-        while (hash3Iterator.next()) {
-            // Get the current K-mer count for hash2
+        while ((n = hash3Slice.next(keys, vals)) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                // Get the current K-mer count for hash2
 
-            uint64_t hash3_count = hash3Iterator.val();
+                uint64_t hash3_count = vals[i];
 
-            // Increment hash3's unique counters (don't bother with shared counters... we've already done this)
-            cc->updateHash3Counters(hash3_count);
+                // Increment hash3's unique counters (don't bother with shared counters... we've already done this)
+                cc->updateHash3Counters(hash3_count);
+            }
         }
     }
 
     mu.lock();
     comp_counters.add(cc);
+    kmersCompared += cc->hash1_distinct + cc->hash2_distinct + cc->hash3_distinct;
+    lookups += cc->hash1_distinct * (doThirdHash() ? 2 : 1) + cc->hash2_distinct;
     mu.unlock();
 }
 
@@ -490,6 +988,7 @@ void kat::Comp::compareSlice(int th_id) {
 void kat::Comp::plot(const string& output_type) {
     
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+    Metrics::Phase phase("plot");
 
     cout << "Creating plot(s) ...";
     cout.flush();
@@ -614,11 +1113,29 @@ int kat::Comp::main(int argc, char *argv[]) {
     uint64_t hash_size_1;
     uint64_t hash_size_2;
     uint64_t hash_size_3;
+    uint64_t max_memory;
+    uint16_t min_qual;
+    path hash_server;
+    path cache_dir;
+    uint64_t cache_size;
+    bool cache_digest;
+    path checkpoint_dir;
+    double checkpoint_interval;
+    bool resume;
     bool dump_hashes;
+    uint32_t dump_shards;
     bool disable_hash_grow;
+    bool targeted;
     bool density_plot;
     string plot_output_type;
     bool output_hists;
+    bool partial;
+    uint64_t sketch_scale;
+    bool numa;
+    bool huge_pages;
+    bool populate;
+    bool perf_counters;
+    bool metrics;
     bool verbose;
     bool help;
     
@@ -661,16 +1178,52 @@ int kat::Comp::main(int argc, char *argv[]) {
                 "If kmer counting is required for input 2, then use this value as the hash size.  If this hash size is not large enough for your dataset then the default behaviour is to double the size of the hash and recount, which will increase runtime and memory usage.")
             ("hash_size_3,J", po::value<uint64_t>(&hash_size_3)->default_value(DEFAULT_HASH_SIZE),
                 "If kmer counting is required for input 3, then use this value as the hash size.  If this hash size is not large enough for your dataset then the default behaviour is to double the size of the hash and recount, which will increase runtime and memory usage.")
+            ("max_memory", po::value<uint64_t>(&max_memory)->default_value(0),
+                "Memory budget in MB.  If a hash of the requested --hash_size won't fit, uncompressed sequence files are counted out-of-core instead, splitting sequences into minimizer buckets on disk (under TMPDIR) and counting each bucket in a hash that fits.  Compressed files and pipes are counted in memory regardless, with a warning.  Loaded hashes that won't fit are warned about, and fewer per-thread matrices are used, merged one at a time.  The cgroup v2 memory.max of the process is also respected, though on its own it only warns before counting in memory.  The default (0) sets no limit beyond the cgroup's.")
+            ("min_qual", po::value<uint16_t>(&min_qual)->default_value(0),
+                "If kmer counting is required for any input, then ignore any K-mer containing a base with a Phred quality score below this value.  Qualities are assumed to be Phred+33 encoded.  Only applies to FastQ and BAM input.  The default (0) counts all K-mers.")
+            ("hash_server", po::value<path>(&hash_server),
+                "Socket of a kat serve process.  If an input is a jellyfish hash held by that server, K-mer counts are looked up from the server instead of loading the hash.  Saves loading the same large hash on every run.")
+            ("cache_dir", po::value<path>(&cache_dir)->default_value(HashCache::defaultDir(), "$" + CACHE_DIR_ENV),
+                "If kmer counting is required for any input, then first look for a hash counted by an earlier run on the same file(s) with the same settings in this directory, and store newly counted hashes here for later runs.  Files are recognised by path, size and modification time.  Hashes are not cached when sampling, counting adaptively or counting only targeted K-mers.  Defaults to the KAT_CACHE_DIR environment variable.  Caching is disabled if neither is set.")
+            ("cache_size", po::value<uint64_t>(&cache_size)->default_value(DEFAULT_CACHE_SIZE),
+                "Maximum size of the hash cache in MB.  Once exceeded, the least recently used hashes are removed.  Set to 0 for no limit.")
+            ("cache_digest", po::bool_switch(&cache_digest)->default_value(false),
+                "Also recognise cached hashes by a digest of the input files' content, which is safer when files might be rewritten in place but requires reading the inputs once more.")
+            ("checkpoint_dir", po::value<path>(&checkpoint_dir),
+                "If kmer counting is required for the input, then periodically save the hash being counted, and how far through the input counting got, to this directory.  If the run is interrupted, e.g. by a node failure or preemption, run the same command again with --resume to carry on from the last checkpoint.  Snapshots are written in the background by a forked process, so counting only pauses briefly, but memory use can grow by up to the size of the hash while a snapshot is written.  Checkpoints are removed once counting finishes.  Only applies when counting a single K-mer length in memory, without sampling or targeting.  Disabled by default.")
+            ("checkpoint_interval", po::value<double>(&checkpoint_interval)->default_value(DEFAULT_CHECKPOINT_INTERVAL),
+                "Minutes between checkpoints when using --checkpoint_dir.")
+            ("resume", po::bool_switch(&resume)->default_value(false),
+                "Carry on counting from the checkpoint left in --checkpoint_dir by an earlier, interrupted run of the same command.  The input files must not have changed since.  Counting starts from scratch if there is no checkpoint.")
             ("dump_hashes,d", po::bool_switch(&dump_hashes)->default_value(false), 
                 "Dumps any jellyfish hashes to disk that were produced during this run.")
+            ("dump_shards", po::value<uint32_t>(&dump_shards)->default_value(0), 
+                "Dumps any jellyfish hashes to disk that were produced or loaded during this run as this many shards, named <hash>-shard<i>of<N>.jf<k>, instead of one file.  Each shard holds a distinct part of the K-mers, chosen by a hash of each K-mer, so that shards with the same number from different inputs can be processed on their own, e.g. on separate machines, and the partial results added up with kat mx-merge.  Shards only match between inputs with the same K-mer length and canonical setting.  Implies --dump_hashes.")
             ("disable_hash_grow,g", po::bool_switch(&disable_hash_grow)->default_value(false), 
                 "By default jellyfish will double the size of the hash if it gets filled, and then attempt to recount.  Setting this option to true, disables automatic hash growing.  If the hash gets filled an error is thrown.  This option is useful if you are working with large genomes, or have strict memory limits on your system.")   
+            ("targeted", po::bool_switch(&targeted)->default_value(false),
+                "Only count K-mers from input 1 that are also found in input 2.  Useful when comparing reads (input 1) against an assembly (input 2), as memory for input 1 then scales with the assembly rather than the reads.  Input 1 must be sequence file(s).  K-mers only found in input 1 are tallied in the totals but not stored, so their distinct counts, spectra and matrix entries are not available.")
             ("density_plot,n", po::bool_switch(&density_plot)->default_value(false),
                 "Makes a density plot.  By default we create a spectra_cn plot.")
             ("output_type,p", po::value<string>(&plot_output_type)->default_value(DEFAULT_COMP_PLOT_OUTPUT_TYPE), 
                 "The plot file type to create: png, ps, pdf.  Warning... if pdf is selected please ensure your gnuplot installation can export pdf files.")
             ("output_hists,h", po::bool_switch(&output_hists)->default_value(false), 
                 "Whether or not to output histogram data and plots for input 1 and input 2")
+            ("sketch_scale", po::value<uint64_t>(&sketch_scale)->default_value(0),
+                "Rather than comparing whole hashes, compare sketches of the inputs that keep the K-mers whose hash is in the lowest 1 in this many of all hashes (FracMinHash), e.g. 1000.  Sequence files are read without building a hash, so sketching takes a fraction of the memory and time of counting.  The same K-mers are sampled from every input, so the statistics, distances, spectra and matrix are estimated by scaling up those of the sketches.  Each sketch is saved to <output_prefix>-<input>.sketch, and can be given as an input to later runs in place of the original files, in which case the other input is sketched at the same scale.  This is a quick way to compare many samples against each other.  Only two inputs are supported, and not with --targeted.  The default (0) compares whole hashes.")
+            ("partial", po::bool_switch(&partial)->default_value(false), 
+                "Also write the K-mer statistics to <output_prefix>.counters, in a form that kat mx-merge can add up.  Use this when comparing one shard of hashes that were dumped with --dump_shards, then merge the matrices and counters from all the shards with kat mx-merge.")
+            ("numa", po::bool_switch(&numa)->default_value(false), 
+                "Interleave the hashes across NUMA nodes, since K-mers are looked up at random, and pin worker threads to nodes.  Has no effect on machines with a single NUMA node.")
+            ("huge_pages", po::bool_switch(&huge_pages)->default_value(false), 
+                "Back hashes with transparent huge pages.  K-mers are looked up at random, so with normal pages most lookups into a large hash miss the TLB.  Only has an effect if transparent huge pages are enabled in \"madvise\" or \"always\" mode.")
+            ("populate", po::bool_switch(&populate)->default_value(false), 
+                "Read hash and bloom counter files into memory up front, using all threads, rather than page by page as they are loaded or queried.")
+            ("perf_counters", po::bool_switch(&perf_counters)->default_value(false), 
+                "Count cycles, instructions, last level cache misses and dTLB misses in each phase, and in each worker thread, using the CPU's hardware counters.  They are shown in the verbose output and written to the --metrics file.  Helps tell whether a run is bound by memory latency, bandwidth or compute.  Requires perf_event_paranoid to be 2 or less.")
+            ("metrics", po::bool_switch(&metrics)->default_value(false), 
+                "Write timings, memory use and throughput for each phase of the run to <output_prefix>.metrics.json.")
             ("verbose,v", po::bool_switch(&verbose)->default_value(false), 
                 "Print extra information.")
             ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
@@ -707,6 +1260,18 @@ int kat::Comp::main(int argc, char *argv[]) {
         return 1;
     }
 
+    ThreadPool::init(threads);
+    
+    if (perf_counters) {
+        if (!PerfCounters::isAvailable()) {
+            cerr << "WARNING: Hardware performance counters are not available on this machine.  Continuing without them." << endl << endl;
+        }
+        PerfCounters::setEnabled(true);
+        if (verbose) {
+            Metrics::global().setReport(&cerr);
+        }
+    }
+
     auto_cpu_timer timer(1, "KAT COMP completed.\nTotal runtime: %ws\n\n");        
 
     cout << "Running KAT in COMP mode" << endl
@@ -755,10 +1320,26 @@ int kat::Comp::main(int argc, char *argv[]) {
     comp.setHashSize(0, hash_size_1);
     comp.setHashSize(1, hash_size_2);
     comp.setHashSize(2, hash_size_3);
-    comp.setDumpHashes(dump_hashes);
+    comp.setMaxMemory(max_memory * 1000000);
+    comp.setMinQual(min_qual);
+    comp.setHashServer(hash_server);
+    comp.setCacheDir(cache_dir);
+    comp.setCacheSize(cache_size * 1000000);
+    comp.setCacheDigest(cache_digest);
+    comp.setCheckpointDir(checkpoint_dir);
+    comp.setCheckpointInterval(checkpoint_interval);
+    comp.setResume(resume);
+    comp.setDumpHashes(dump_hashes || dump_shards > 1);
+    comp.setDumpShards(dump_shards);
     comp.setDisableHashGrow(disable_hash_grow);
+    comp.setTargeted(targeted);
     comp.setDensityPlot(density_plot);
     comp.setOutputHists(output_hists);
+    comp.setPartial(partial);
+    comp.setSketchScale(sketch_scale);
+    comp.setNuma(numa);
+    comp.setHugePages(huge_pages);
+    comp.setPrefaultThreads(populate ? threads : 0);
     comp.setVerbose(verbose);
     
     // Do the work
@@ -773,5 +1354,9 @@ int kat::Comp::main(int argc, char *argv[]) {
     // Send K-mer statistics to stdout as well
     comp.printCounters(cout);
     
+    if (metrics) {
+        Metrics::global().save(path(output_prefix + ".metrics.json"), "comp", threads);
+    }
+    
     return 0;
 }
@@ -40,6 +40,7 @@ using bfs::path;
 #include <kat/jellyfish_helper.hpp>
 #include <kat/input_handler.hpp>
 #include <kat/comp_counters.hpp>
+#include <kat/kmer_sketch.hpp>
 using kat::JellyfishHelper;
 using kat::InputHandler;
 using kat::ThreadedCompCounters;
@@ -66,7 +67,10 @@ namespace kat {
         uint16_t threads;
         bool densityPlot;
         bool outputHists;
+        bool partial;           // Also write the counters in a form kat mx-merge can add up
         bool threeInputs;
+        bool targeted;
+        uint64_t sketchScale;   // If > 0, compare sketches keeping 1 in this many K-mers instead of whole hashes
         bool verbose;
 
         // Threaded matrix data
@@ -78,6 +82,10 @@ namespace kat {
         // Final data (created by merging thread results)
         ThreadedCompCounters comp_counters;
         
+        // Throughput of the comparison, for metrics
+        uint64_t kmersCompared;
+        uint64_t lookups;
+        
         std::mutex mu;
         
         void init(const vector<path>& _input1, const vector<path>& _input2);
@@ -191,6 +199,129 @@ namespace kat {
             }
         }
         
+        uint32_t getDumpShards() const {
+            return input[0].dumpShards;
+        }
+
+        void setDumpShards(uint32_t dumpShards) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].dumpShards = dumpShards;
+            }
+        }
+        
+        uint64_t getMaxMemory() const {
+            return input[0].maxMemory;
+        }
+
+        void setMaxMemory(uint64_t maxMemory) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].maxMemory = maxMemory;
+            }
+        }
+        
+        uint16_t getMinQual() const {
+            return input[0].minQual;
+        }
+
+        void setMinQual(uint16_t minQual) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].minQual = minQual;
+            }
+        }
+
+        path getHashServer() const {
+            return input[0].hashServer;
+        }
+
+        void setHashServer(const path& hashServer) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].hashServer = hashServer;
+            }
+        }
+
+        path getCacheDir() const {
+            return input[0].cacheDir;
+        }
+
+        void setCacheDir(const path& cacheDir) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].cacheDir = cacheDir;
+            }
+        }
+
+        uint64_t getCacheSize() const {
+            return input[0].cacheSize;
+        }
+
+        void setCacheSize(uint64_t cacheSize) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].cacheSize = cacheSize;
+            }
+        }
+
+        bool isCacheDigest() const {
+            return input[0].cacheDigest;
+        }
+
+        void setCacheDigest(bool cacheDigest) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].cacheDigest = cacheDigest;
+            }
+        }
+
+        path getCheckpointDir() const {
+            return input[0].checkpointDir;
+        }
+
+        void setCheckpointDir(const path& checkpointDir) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].checkpointDir = checkpointDir;
+            }
+        }
+
+        double getCheckpointInterval() const {
+            return input[0].checkpointInterval;
+        }
+
+        void setCheckpointInterval(double checkpointInterval) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].checkpointInterval = checkpointInterval;
+            }
+        }
+
+        bool isResume() const {
+            return input[0].resume;
+        }
+
+        void setResume(bool resume) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].resume = resume;
+            }
+        }
+        
+        bool isTargeted() const {
+            return targeted;
+        }
+
+        /**
+         * If set, input 1 is only counted for K-mers that are present in input 2
+         */
+        void setTargeted(bool targeted) {
+            this->targeted = targeted;
+        }
+
+        uint64_t getSketchScale() const {
+            return sketchScale;
+        }
+
+        /**
+         * If > 0, inputs are sketched, keeping 1 in this many K-mers, and the
+         * statistics and matrix are estimated from the sketches
+         */
+        void setSketchScale(uint64_t sketchScale) {
+            this->sketchScale = sketchScale;
+        }
+        
         bool hashGrowDisabled() const {
             return input[0].disableHashGrow;
         }
@@ -201,6 +332,36 @@ namespace kat {
             }
         }
 
+        bool isNuma() const {
+            return input[0].numa != NumaPlacement::NONE;
+        }
+
+        void setNuma(bool numa) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].numa = numa ? NumaPlacement::INTERLEAVE : NumaPlacement::NONE;
+            }
+        }
+
+        bool isHugePages() const {
+            return input[0].hugePages;
+        }
+
+        void setHugePages(bool hugePages) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].hugePages = hugePages;
+            }
+        }
+
+        uint16_t getPrefaultThreads() const {
+            return input[0].prefaultThreads;
+        }
+
+        void setPrefaultThreads(uint16_t prefaultThreads) {
+            for(size_t i = 0; i < input.size(); i++) {
+                this->input[i].prefaultThreads = prefaultThreads;
+            }
+        }
+
         bool isVerbose() const {
             return verbose;
         }
@@ -225,6 +386,14 @@ namespace kat {
             this->outputHists = outputHists;
         }
 
+        bool isPartial() const {
+            return partial;
+        }
+
+        void setPartial(bool partial) {
+            this->partial = partial;
+        }
+
 
         
         void execute();
@@ -279,15 +448,40 @@ namespace kat {
         path getMxOutPath() { return path(string(outputPrefix.string() + "-main.mx")); }
         
         void plot(const string& output_type);
+        
+        /**
+         * Divides a budget of threads between concurrent tasks in proportion to the
+         * given weights (e.g. input sizes).  Every task gets at least one thread.
+         * Tasks with zero weight (e.g. pipes, where the size is unknown) are treated
+         * as average sized.
+         */
+        static vector<uint16_t> splitThreads(const vector<uint64_t>& weights, uint16_t threads);
 
 
     private:
 
         void loadHashes();
         
+        /**
+         * Compares sketches of the first two inputs rather than the whole hashes
+         */
+        void executeSketched();
+        
+        void countAndLoad(const vector<size_t>& toCount);
+        
         void compare();
         
-        void compareSlice(int th_id);
+        /**
+         * Number of matrices of each kind to use while comparing.  One per thread, 
+         * unless that might not fit the memory limit.
+         */
+        uint16_t matricesWithinLimit();
+        
+        /**
+         * Compares slice th_id of the hashes, adding to the matrices at mx_id.  
+         * Slices sharing matrices must not be compared at the same time.
+         */
+        void compareSlice(int th_id, int mx_id);
 
         void merge();
         
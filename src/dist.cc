@@ -0,0 +1,209 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using std::cout;
+using std::endl;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/timer/timer.hpp>
+namespace po = boost::program_options;
+using boost::timer::auto_cpu_timer;
+
+#include <kat/kat_fs.hpp>
+#include <kat/spectra_helper.hpp>
+#include <kat/thread_pool.hpp>
+using kat::KatFS;
+using kat::SpectraHelper;
+using kat::ThreadPool;
+
+#include "dist.hpp"
+
+kat::Dist::Dist(const vector<path>& _inputs) : inputs(_inputs), distances(vector<vector<uint64_t>>()) {
+    outputPrefix = "kat-dist";
+}
+
+vector<uint64_t> kat::Dist::loadSpectrum(const path& file) {
+
+    if (!bfs::exists(file)) {
+        BOOST_THROW_EXCEPTION(DistException() << DistErrorInfo(string(
+                "Could not find histogram: ") + file.string()));
+    }
+
+    vector<Pos> hist;
+    SpectraHelper::loadHist(file, hist);
+
+    vector<uint64_t> spectrum;
+    for (auto& p : hist) {
+        if (p.first >= spectrum.size()) {
+            spectrum.resize(p.first + 1, 0);
+        }
+        spectrum[p.first] += p.second;
+    }
+    return spectrum;
+}
+
+void kat::Dist::execute() {
+
+    if (inputs.size() < 2) {
+        BOOST_THROW_EXCEPTION(DistException() << DistErrorInfo(string(
+                "Need at least two histograms to compare")));
+    }
+
+    {
+        auto_cpu_timer timer(1, "  Time taken: %ws\n\n");
+
+        cout << "Loading " << inputs.size() << " histograms ...";
+        cout.flush();
+
+        spectra.assign(inputs.size(), vector<uint64_t>());
+        ThreadPool::global().parallelFor(inputs.size(), [&](size_t i) {
+            spectra[i] = loadSpectrum(inputs[i]);
+        });
+
+        cout << " done.";
+        cout.flush();
+    }
+
+    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");
+
+    cout << "Calculating distances between " << inputs.size() * (inputs.size() - 1) / 2 << " pairs ...";
+    cout.flush();
+
+    distances = DistanceMatrix(spectra);
+    distances.compute();
+
+    cout << " done.";
+    cout.flush();
+}
+
+void kat::Dist::printMatrix(ostream& out, DistanceMatrix::Metric metric) {
+
+    out << DistanceMatrix::metricName(metric);
+    for (auto& p : inputs) {
+        out << "\t" << p.string();
+    }
+    out << endl;
+
+    for (size_t i = 0; i < distances.size(); i++) {
+        out << inputs[i].string();
+        for (size_t j = 0; j < distances.size(); j++) {
+            out << "\t" << distances.get(metric, i, j);
+        }
+        out << "\n";
+    }
+}
+
+void kat::Dist::save() {
+
+    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");
+
+    cout << "Saving results to disk ...";
+    cout.flush();
+
+    // Create output directory
+    path parentDir = bfs::absolute(outputPrefix).parent_path();
+    KatFS::ensureDirectoryExists(parentDir);
+
+    for (size_t m = 0; m < DistanceMatrix::NB_METRICS; m++) {
+        const DistanceMatrix::Metric metric = (DistanceMatrix::Metric)m;
+        ofstream out(string(outputPrefix.string() + "-" + boost::to_lower_copy(DistanceMatrix::metricName(metric)) + ".dist").c_str());
+        printMatrix(out, metric);
+        out.close();
+    }
+
+    cout << " done.";
+    cout.flush();
+}
+
+int kat::Dist::main(int argc, char *argv[]) {
+
+    vector<path>    inputs;
+    path            output_prefix;
+    uint16_t        threads;
+    bool            help;
+
+    struct winsize w;
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+
+
+    // Declare the supported options.
+    po::options_description generic_options(Dist::helpMessage(), w.ws_col);
+    generic_options.add_options()
+            ("output_prefix,o", po::value<path>(&output_prefix)->default_value("kat-dist"),
+                "Path prefix for files generated by this program.")
+            ("threads,t", po::value<uint16_t>(&threads)->default_value(1),
+                "The number of threads to use.")
+            ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
+            ;
+
+    // Hidden options, will be allowed both on command line and
+    // in config file, but will not be shown to the user.
+    po::options_description hidden_options("Hidden options");
+    hidden_options.add_options()
+            ("inputs", po::value<std::vector<path>>(&inputs), "Path to the histograms to compare.")
+            ;
+
+    // Positional option for the histograms
+    po::positional_options_description p;
+    p.add("inputs", -1);
+
+    // Combine non-positional options
+    po::options_description cmdline_options;
+    cmdline_options.add(generic_options).add(hidden_options);
+
+    // Parse command line
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(p).run(), vm);
+    po::notify(vm);
+
+    // Output help information the exit if requested
+    if (help || argc <= 1 || inputs.empty()) {
+        cout << generic_options << endl;
+        return 1;
+    }
+
+
+
+    ThreadPool::init(threads);
+
+    auto_cpu_timer timer(1, "KAT DIST completed.\nTotal runtime: %ws\n\n");
+
+    cout << "Running KAT in DIST mode" << endl
+         << "------------------------" << endl << endl;
+
+    Dist dist(inputs);
+    dist.setOutputPrefix(output_prefix);
+    dist.execute();
+    dist.save();
+
+    return 0;
+}
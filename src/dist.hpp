@@ -0,0 +1,98 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+using std::ostream;
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+namespace bfs = boost::filesystem;
+using bfs::path;
+
+#include <kat/distance_matrix.hpp>
+using kat::DistanceMatrix;
+
+namespace kat {
+
+    typedef boost::error_info<struct DistError,string> DistErrorInfo;
+    struct DistException: virtual boost::exception, virtual std::exception { };
+
+    /**
+     * Distances between every pair of a set of K-mer spectra, e.g. to spot
+     * outlying samples in a cohort
+     */
+    class Dist {
+    public:
+
+        Dist(const vector<path>& _inputs);
+
+        path getOutputPrefix() const {
+            return outputPrefix;
+        }
+
+        void setOutputPrefix(path outputPrefix) {
+            this->outputPrefix = outputPrefix;
+        }
+
+        void execute();
+
+        /**
+         * Writes one matrix file per metric, named <output_prefix>-<metric>.dist
+         */
+        void save();
+
+        /**
+         * Writes the distances for one metric as a tab separated matrix, with
+         * the input paths as row and column names
+         */
+        void printMatrix(ostream& out, DistanceMatrix::Metric metric);
+
+        static int main(int argc, char *argv[]);
+
+    protected:
+
+        vector<path> inputs;
+        path outputPrefix;
+
+        vector<vector<uint64_t>> spectra;
+        DistanceMatrix distances;
+
+        /**
+         * Reads a histogram into a spectrum indexed by K-mer frequency
+         */
+        static vector<uint64_t> loadSpectrum(const path& file);
+
+        static string helpMessage() {
+            return string("Usage: kat dist [options] (<hist>)+\n\n") +
+                    "Distances between every pair of K-mer spectra.\n\n" \
+                    "Loads histograms from kat hist, or spectra from kat comp --output_hists, and works out the " \
+                    "Manhattan, Euclidean, Cosine, Canberra and Jaccard distances between every pair, as kat comp " \
+                    "does for its two inputs.  Each metric is written as an N x N tab separated matrix to " \
+                    "<output_prefix>-<metric>.dist.  Spectra with fewer bins are treated as having zeros in the " \
+                    "rest, so histograms should be made with the same settings, e.g. --high and --inc, for the " \
+                    "distances to be meaningful.\n\n" \
+                    "Options";
+        }
+    };
+}
@@ -54,9 +54,12 @@ using bfs::path;
 #include <kat/input_handler.hpp>
 #include <kat/jellyfish_helper.hpp>
 #include <kat/kat_fs.hpp>
+#include <kat/memory_budget.hpp>
+#include <kat/thread_pool.hpp>
 using kat::InputHandler;
 using kat::JellyfishHelper;
 using kat::KatFS;
+using kat::MemoryBudget;
 
 #include "plot_density.hpp"
 using kat::PlotDensity;
@@ -174,6 +177,18 @@ void kat::filter::FilterKmer::execute() {
     out_header.size(input.header->size());
     out_header.val_len(input.header->val_len());
     
+    // The output hashes are the same size as the input, so there's no cheaper 
+    // strategy if they don't fit.  Better to say so now than be killed later.
+    const uint64_t limit = input.memoryLimit();
+    const uint64_t needed = MemoryBudget::hashBytes(size, key_len / 2) * (separate ? 2 : 1);
+    if (limit > 0 && needed > MemoryBudget::remaining(limit)) {
+        BOOST_THROW_EXCEPTION(FilterKmerException() << FilterKmerErrorInfo(string(
+                "Filtering needs about ") + MemoryBudget::toMB(needed) + " for the output hash" + 
+                (separate ? "es" : "") + ", but only " + MemoryBudget::toMB(MemoryBudget::remaining(limit)) + 
+                " of the " + MemoryBudget::toMB(limit) + " memory limit is left.  Try increasing --max_memory" + 
+                (separate ? " or dropping --separate." : "."))); 
+    }
+    
     HashCounter* inCounter = new HashCounter(size, key_len, val_len, threads);
     inCounter->do_size_doubling(false);   // We know the size of the hash
     
@@ -243,6 +258,8 @@ void kat::filter::FilterKmer::filter(HashCounter& inCounter, HashCounter& outCou
     cout << "Filtering kmers ...";
     cout.flush();
 
+    // The counters synchronise all their threads when they grow, so this can't
+    // use the thread pool
     vector<thread> t(threads);
 
     for(uint16_t i = 0; i < threads; i++) {
@@ -325,6 +342,8 @@ int kat::filter::FilterKmer::main(int argc, char *argv[]) {
     bool            non_canonical;
     uint16_t        mer_len;
     uint64_t        hash_size;
+    uint64_t        max_memory;
+    uint16_t        min_qual;
     bool            verbose;
     bool            help;
     
@@ -357,6 +376,10 @@ int kat::filter::FilterKmer::main(int argc, char *argv[]) {
                 "The kmer length to use in the kmer hashes.  Larger values will provide more discriminating power between kmers but at the expense of additional memory and lower coverage.")
             ("hash_size,H", po::value<uint64_t>(&hash_size)->default_value(DEFAULT_HASH_SIZE),
                 "If kmer counting is required for the input, then use this value as the hash size.  If this hash size is not large enough for your dataset then the default behaviour is to double the size of the hash and recount, which will increase runtime and memory usage.")
+            ("max_memory", po::value<uint64_t>(&max_memory)->default_value(0),
+                "Memory budget in MB.  If a hash of the requested --hash_size won't fit, uncompressed sequence files are counted out-of-core instead, splitting sequences into minimizer buckets on disk (under TMPDIR) and counting each bucket in a hash that fits.  Compressed files and pipes are counted in memory regardless, with a warning.  Fails early if the filtered hashes won't fit.  The cgroup v2 memory.max of the process is also respected, though on its own it only warns before counting in memory.  The default (0) sets no limit beyond the cgroup's.")
+            ("min_qual", po::value<uint16_t>(&min_qual)->default_value(0),
+                "If kmer counting is required for the input, then ignore any K-mer containing a base with a Phred quality score below this value.  Qualities are assumed to be Phred+33 encoded.  Only applies to FastQ and BAM input.  The default (0) counts all K-mers.")
             ("verbose,v", po::bool_switch(&verbose)->default_value(false), 
                 "Print extra information.")
             ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
@@ -390,6 +413,8 @@ int kat::filter::FilterKmer::main(int argc, char *argv[]) {
 
 
 
+    ThreadPool::init(threads);
+
     auto_cpu_timer timer(1, "KAT filter kmer completed.\nTotal runtime: %ws\n\n");        
 
     cout << "Running KAT in filter kmer mode" << endl
@@ -408,6 +433,8 @@ int kat::filter::FilterKmer::main(int argc, char *argv[]) {
     filter.setSeparate(separate);
     filter.setMerLen(mer_len);
     filter.setHashSize(hash_size);
+    filter.setMaxMemory(max_memory * 1000000);
+    filter.setMinQual(min_qual);
     filter.setVerbose(verbose);
 
     // Do the work
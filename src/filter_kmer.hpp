@@ -200,6 +200,22 @@ public:
     void setHashSize(uint64_t hashSize) {
         this->input.hashSize = hashSize;
     }
+
+    uint64_t getMaxMemory() const {
+        return input.maxMemory;
+    }
+
+    void setMaxMemory(uint64_t maxMemory) {
+        this->input.maxMemory = maxMemory;
+    }
+
+    uint16_t getMinQual() const {
+        return input.minQual;
+    }
+
+    void setMinQual(uint16_t minQual) {
+        this->input.minQual = minQual;
+    }
             
     bool isVerbose() const {
         return verbose;
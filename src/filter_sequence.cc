@@ -59,6 +59,7 @@ using bfs::path;
 #include <kat/input_handler.hpp>
 #include <kat/jellyfish_helper.hpp>
 #include <kat/kat_fs.hpp>
+#include <kat/thread_pool.hpp>
 using kat::InputHandler;
 using kat::JellyfishHelper;
 using kat::KatFS;
@@ -90,6 +91,7 @@ kat::filter::FilterSeq::FilterSeq(const path& _seq_file_1, const path& _seq_file
 void kat::filter::FilterSeq::init(const vector<path>& _input) {
     
     input.setMultipleInputs(_input);
+    input.allowBloom = true;
     output_prefix = "kat.filter-kmer";
     
     threads = 1;
@@ -174,10 +176,10 @@ void kat::filter::FilterSeq::processSeqFile() {
     cout << "Filtering sequences ..." << endl;
     
     // Temporary storage for sequence data
-    reader = unique_ptr<seqan::SeqFileIn>(new seqan::SeqFileIn(seq_file_1.c_str()));
+    reader = unique_ptr<SeqFileReader>(new SeqFileReader(seq_file_1));
     
     if (this->isPaired()) {
-        reader2 = unique_ptr<seqan::SeqFileIn>(new seqan::SeqFileIn(seq_file_2.c_str()));
+        reader2 = unique_ptr<SeqFileReader>(new SeqFileReader(seq_file_2));
     }
     
     // Setup output file for statistics and output header if requested
@@ -187,8 +189,8 @@ void kat::filter::FilterSeq::processSeqFile() {
         (*stats_stream) << "index\tnb_bases\tnb_kmers\tnb_hits\tratio" << endl;
     }
     
-    // Setup file paths
-    path ext = seq_file_1.extension();
+    // Setup file paths.  We can't write BAM, so reads from BAM files are output as FastQ.
+    path ext = reader->isBam() ? path(".fastq") : seq_file_1.extension();
     
     path output_path_in(output_prefix.string() + ".in" + (this->isPaired() ? ".R1" : "") + ext.string());
     inWriter = unique_ptr<seqan::SeqFileOut>(new seqan::SeqFileOut(output_path_in.c_str()));    
@@ -213,12 +215,12 @@ void kat::filter::FilterSeq::processSeqFile() {
     
     // Processes sequences in batches of records to reduce memory requirements
     uint64_t index = 0;
-    while (!seqan::atEnd(*reader)) {
+    while (!reader->atEnd()) {
         
-        seqan::readRecord(name, seq, qual, *reader);
+        reader->readRecord(name, seq, qual);
             
         if (this->isPaired()) {
-            seqan::readRecord(name2, seq2, qual2, *reader2);
+            reader2->readRecord(name2, seq2, qual2);
         }
         
         // Generate a random value for this sequence between 0 and 1 (we may use
@@ -237,12 +239,12 @@ void kat::filter::FilterSeq::processSeqFile() {
 
     }
     
-    if (this->isPaired() && !seqan::atEnd(*reader2)) {
+    if (this->isPaired() && !reader2->atEnd()) {
         BOOST_THROW_EXCEPTION(FilterSeqException() << FilterSeqErrorInfo(string(
                     "Second sequence file appears to be longer than the first.")));
     }
 
-    seqan::close(*reader);    
+    reader->close();    
     
     seqan::close(*inWriter);
     if (separate) {
@@ -250,7 +252,7 @@ void kat::filter::FilterSeq::processSeqFile() {
     }
     
     if (this->isPaired()) {
-        seqan::close(*reader2);
+        reader2->close();
         seqan::close(*inWriter2);
         if (separate) {
             seqan::close(*outWriter2);
@@ -331,42 +333,16 @@ void kat::filter::FilterSeq::processSeq(uint64_t index, double random_val) {
 
 void kat::filter::FilterSeq::getProfile(seqan::CharString& sequence, vector<bool>& hits) {
     // There's no substring functionality in SeqAn in this version (2.0.0).  So we'll just
-    // use regular c++ string's for this bit.  This conversion of strings:
-    // {CharString -> c++ string -> substring -> jellyfish mer_dna} is 
-    // inefficient. Reducing the number of conversions necessary will 
-    // make a big performance improvement here
+    // use a regular c++ string, and roll K-mers along it from there.
     stringstream ssSeq;
     ssSeq << sequence;
     string s = ssSeq.str();
     
-    uint64_t seqLength = s.length();
-    uint64_t nbCounts = seqLength - input.merLen + 1;
-    uint64_t nbInvalid = 0;
-    
-    
-    if (nbCounts <= 0) {
-
-        // Can't analyse this sequence because it's too short
-        //cerr << names[index] << ": " << seq << " is too short to compute coverage.  Sequence length is "
-        //       << seqLength << " and K-mer length is " << merLen << ". Setting sequence coverage to 0." << endl;
-                
-    } else {
-
-        for (uint64_t i = 0; i < nbCounts; i++) {
-
-            string merstr = s.substr(i, input.merLen);
-            
-            // Jellyfish compacted hash does not support Ns so if we find one set this kmer to false
-            if (!validKmer(merstr)) {
-                hits.push_back(false);
-                nbInvalid++;
-            } else {                
-                mer_dna mer(merstr);
-                uint64_t count = JellyfishHelper::getCount(input.hash, mer, input.canonical);
-                hits.push_back(count > 0);
-            }
-        }
-    }
+    // Jellyfish compacted hash does not support Ns so K-mers containing one are never hits.
+    // Sequences shorter than K have no K-mers, so no hits.
+    input.forEachCount(s, [&](size_t pos, bool valid, uint64_t count) {
+        hits.push_back(valid && count > 0);
+    });
 }
 
 
@@ -385,6 +361,11 @@ int kat::filter::FilterSeq::main(int argc, char *argv[]) {
     bool            non_canonical;
     uint16_t        mer_len;
     uint64_t        hash_size;
+    uint64_t        max_memory;
+    uint16_t        min_qual;
+    path            hash_server;
+    bool            huge_pages;
+    bool            populate;
     bool            verbose;
     bool            help;
     
@@ -419,6 +400,16 @@ int kat::filter::FilterSeq::main(int argc, char *argv[]) {
                 "The kmer length to use in the kmer hashes.  Larger values will provide more discriminating power between kmers but at the expense of additional memory and lower coverage.")
             ("hash_size,H", po::value<uint64_t>(&hash_size)->default_value(DEFAULT_HASH_SIZE),
                 "If kmer counting is required for the input, then use this value as the hash size.  If this hash size is not large enough for your dataset then the default behaviour is to double the size of the hash and recount, which will increase runtime and memory usage.")
+            ("max_memory", po::value<uint64_t>(&max_memory)->default_value(0),
+                "Memory budget in MB.  If a hash of the requested --hash_size won't fit, uncompressed sequence files are counted out-of-core instead, splitting sequences into minimizer buckets on disk (under TMPDIR) and counting each bucket in a hash that fits.  Compressed files and pipes are counted in memory regardless, with a warning.  Loaded hashes that won't fit are queried in place, from the file.  The cgroup v2 memory.max of the process is also respected, though on its own it only warns before counting in memory.  The default (0) sets no limit beyond the cgroup's.")
+            ("min_qual", po::value<uint16_t>(&min_qual)->default_value(0),
+                "If kmer counting is required for the input, then ignore any K-mer containing a base with a Phred quality score below this value.  Qualities are assumed to be Phred+33 encoded.  Only applies to FastQ and BAM input.  The default (0) counts all K-mers.")
+            ("hash_server", po::value<path>(&hash_server),
+                "Socket of a kat serve process.  If the input is a jellyfish hash held by that server, K-mer counts are looked up from the server instead of loading the hash.  Saves loading the same large hash on every run.")
+            ("huge_pages", po::bool_switch(&huge_pages)->default_value(false), 
+                "Back hashes with transparent huge pages.  K-mers are looked up at random, so with normal pages most lookups into a large hash miss the TLB.  Only has an effect if transparent huge pages are enabled in \"madvise\" or \"always\" mode.")
+            ("populate", po::bool_switch(&populate)->default_value(false), 
+                "Read hash and bloom counter files into memory up front, using all threads, rather than page by page as they are loaded or queried.")
             ("verbose,v", po::bool_switch(&verbose)->default_value(false), 
                 "Print extra information.")
             ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
@@ -455,6 +446,8 @@ int kat::filter::FilterSeq::main(int argc, char *argv[]) {
                     "You must specify at least one sequence file to filter")));
     }
 
+    ThreadPool::init(threads);
+
     auto_cpu_timer timer(1, "KAT filter seq completed.\nTotal runtime: %ws\n\n");        
 
     cout << "Running KAT in filter sequence mode" << endl
@@ -473,6 +466,11 @@ int kat::filter::FilterSeq::main(int argc, char *argv[]) {
     filter.setDoStats(stats);
     filter.setMerLen(mer_len);
     filter.setHashSize(hash_size);
+    filter.setMaxMemory(max_memory * 1000000);
+    filter.setMinQual(min_qual);
+    filter.setHashServer(hash_server);
+    filter.setHugePages(huge_pages);
+    filter.setPrefaultThreads(populate ? threads : 0);
     filter.setVerbose(verbose);
 
     // Do the work
@@ -30,6 +30,9 @@ using std::ofstream;
 
 #include <kat/input_handler.hpp>
 using kat::InputHandler;
+
+#include "seq_file_reader.hpp"
+using kat::SeqFileReader;
  
 
 typedef boost::error_info<struct FilterSeqError,string> FilterSeqErrorInfo;
@@ -99,8 +102,8 @@ private:
     seqan::CharString qual2;
     string extension;
     
-    unique_ptr<seqan::SeqFileIn> reader = nullptr;
-    unique_ptr<seqan::SeqFileIn> reader2 = nullptr;    
+    unique_ptr<SeqFileReader> reader = nullptr;
+    unique_ptr<SeqFileReader> reader2 = nullptr;    
     
     unique_ptr<seqan::SeqFileOut> inWriter = nullptr;
     unique_ptr<seqan::SeqFileOut> outWriter = nullptr;
@@ -210,7 +213,47 @@ public:
     void setHashSize(uint64_t hashSize) {
         this->input.hashSize = hashSize;
     }
+
+    uint64_t getMaxMemory() const {
+        return input.maxMemory;
+    }
+
+    void setMaxMemory(uint64_t maxMemory) {
+        this->input.maxMemory = maxMemory;
+    }
+
+    uint16_t getMinQual() const {
+        return input.minQual;
+    }
+
+    void setMinQual(uint16_t minQual) {
+        this->input.minQual = minQual;
+    }
+
+    path getHashServer() const {
+        return input.hashServer;
+    }
+
+    void setHashServer(const path& hashServer) {
+        this->input.hashServer = hashServer;
+    }
             
+    bool isHugePages() const {
+        return input.hugePages;
+    }
+
+    void setHugePages(bool hugePages) {
+        this->input.hugePages = hugePages;
+    }
+
+    uint16_t getPrefaultThreads() const {
+        return input.prefaultThreads;
+    }
+
+    void setPrefaultThreads(uint16_t prefaultThreads) {
+        this->input.prefaultThreads = prefaultThreads;
+    }
+
     bool isVerbose() const {
         return verbose;
     }
@@ -239,7 +282,8 @@ protected:
                         "Filter sequences based on whether those sequences contain specific k-mers.\n\n" \
                         "The user loads a k-mer hash and then filters sequences (either in or out) depending on whether those\n" \
                         "sequences contain the k-mer or not.  The user can also apply a threshold requiring X% of k-mers to be\n" \
-                        "in the sequence before filtering is applied.\n\n" \
+                        "in the sequence before filtering is applied.  The k-mer input may also be a jellyfish bloom counter, in\n" \
+                        "which case presence is approximate and the expected false positive rate is reported.\n\n" \
                         "Should the user have paired-end data to filter the first two positional arguments represent the paired\n" \
                         "end read files to filter, and the remaining positional arguments are for loading the kmer hash.  If\n" \
                         "user wants filter paired end reads then the --paired option must be selected\n\n" \
@@ -23,12 +23,14 @@
 #include <iostream>
 #include <math.h>
 #include <memory>
+#include <numeric>
 #include <thread>
 #include <vector>
 #include <sys/ioctl.h>
 using std::shared_ptr;
 using std::make_shared;
 using std::ostream;
+using std::cerr;
 using std::ofstream;
 using std::thread;
 using std::vector;
@@ -48,6 +50,8 @@ using boost::lexical_cast;
 #include <kat/jellyfish_helper.hpp>
 #include <kat/sparse_matrix.hpp>
 #include <kat/input_handler.hpp>
+#include <kat/metrics.hpp>
+#include <kat/thread_pool.hpp>
 using kat::InputHandler;
 using kat::HashLoader;
 using kat::ThreadedSparseMatrix;
@@ -89,6 +93,9 @@ void kat::Gcp::execute() {
         input.loadHash();                
     }
     
+    // Each thread analyses its own slice of the hash
+    input.placeHash(threads);
+    
     // Create matrix of appropriate size (adds 1 to cvg bins to account for 0)
     gcp_mx = make_shared<ThreadedSparseMatrix>(input.header->key_len() / 2, cvgBins + 1, threads);
 
@@ -112,6 +119,7 @@ void kat::Gcp::execute() {
 void kat::Gcp::save() {
 
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+    Metrics::Phase phase("save");
 
     cout << "Saving results to disk ...";
     cout.flush();
@@ -128,10 +136,17 @@ void kat::Gcp::save() {
 void kat::Gcp::merge() {
     
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+    Metrics::Phase phase("merge");
 
     cout << "Merging matrices ...";
     cout.flush(); 
-    gcp_mx->mergeThreadedMatricies();
+    // Free each thread's matrix as it's merged if memory is limited
+    if (input.memoryLimit() > 0) {
+        gcp_mx->streamMergeThreadedMatricies();
+    }
+    else {
+        gcp_mx->mergeThreadedMatricies();
+    }
     
     cout << "done.";
     cout.flush();
@@ -158,28 +173,32 @@ void kat::Gcp::printMainMatrix(ostream &out) {
 void kat::Gcp::analyse() {
 
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+    Metrics::Phase phase("analyse", input.pathString());
 
     cout << "Analysing kmers in hash ...";
     cout.flush();
     
-    vector<thread> t(threads);
-
-    for(uint16_t i = 0; i < threads; i++) {
-        t[i] = thread(&Gcp::analyseSlice, this, i);
-    }
-
-    for(uint16_t i = 0; i < threads; i++){
-        t[i].join();
-    }
+    vector<uint64_t> kmers(threads, 0);
+    ThreadPool::global().parallelFor(threads, [this, &kmers, &phase](size_t i) {
+        PerfCounters counters;
+        kmers[i] = analyseSlice(i);
+        phase.addThreadCounters(i, counters);
+    });
+    phase.addKmers(std::accumulate(kmers.begin(), kmers.end(), (uint64_t)0));
     
     cout << "done.";
     cout.flush();
 }
 
-void kat::Gcp::analyseSlice(int th_id) {
+uint64_t kat::Gcp::analyseSlice(int th_id) {
+
+    // Pool workers go back to running anywhere once this task is done
+    Numa::ThreadPin pin(th_id, threads, isNuma());
    
+    uint64_t nbKmers = 0;
     LargeHashArray::region_iterator it = input.hash->region_slice(th_id, threads);
     while (it.next()) {
+        nbKmers++;
         string kmer = it.key().to_str();
         uint64_t kmer_count = it.val();
 
@@ -194,11 +213,14 @@ void kat::Gcp::analyseSlice(int th_id) {
         else
             gcp_mx->incTM(th_id, g_or_c, cvg_pos, 1);
     }
+    
+    return nbKmers;
 }
 
 void kat::Gcp::plot(const string& output_type) {
     
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+    Metrics::Phase phase("plot");
 
     cout << "Creating plot ...";
     cout.flush();
@@ -230,6 +252,22 @@ void kat::Gcp::plot(const string& output_type) {
     cout.flush();
 }
 
+void kat::Gcp::countMultiK(const vector<shared_ptr<Gcp>>& runs, uint16_t threads) {
+    
+    vector<InputHandler*> inputs;
+    for(auto& r : runs) {
+        r->input.validateInput();
+        inputs.push_back(&r->input);
+    }
+    
+    if (inputs[0]->mode != InputHandler::InputHandler::InputMode::COUNT) {
+        BOOST_THROW_EXCEPTION(GcpException() << GcpErrorInfo(string(
+                "Multiple K-mer lengths can only be used when counting sequence files")));
+    }
+    
+    InputHandler::countMultiK(inputs, threads);
+}
+
 int kat::Gcp::main(int argc, char *argv[]) {
 
     vector<path>    inputs;
@@ -239,10 +277,25 @@ int kat::Gcp::main(int argc, char *argv[]) {
     uint16_t        cvg_bins;
     bool            canonical;      // Deprecated... for removal in KAT 3.0
     bool            non_canonical;
-    uint16_t        mer_len;
+    string          mer_len;
     uint64_t        hash_size;
+    uint64_t        max_memory;
+    uint16_t        min_qual;
+    path            cache_dir;
+    uint64_t        cache_size;
+    bool            cache_digest;
+    path            checkpoint_dir;
+    double          checkpoint_interval;
+    bool            resume;
+    double          sample_fraction;
+    bool            adaptive;
+    double          adaptive_tolerance;
     bool            dump_hash;
+    uint32_t        dump_shards;
     string          plot_output_type;
+    bool            numa;
+    bool            perf_counters;
+    bool            metrics;
     bool            verbose;
     bool            help;
     
@@ -265,14 +318,44 @@ int kat::Gcp::main(int argc, char *argv[]) {
                 "(DEPRECATED) If counting fast(a/q) input, this option specifies whether the jellyfish hash represents K-mers produced for both strands (canonical), or only the explicit kmer found.")
             ("non_canonical,N", po::bool_switch(&non_canonical)->default_value(false),
                 "If counting fast(a/q) input, this option specifies whether the jellyfish hash represents K-mers produced for both strands (canonical), or only the explicit kmer found.")
-            ("mer_len,m", po::value<uint16_t>(&mer_len)->default_value(DEFAULT_MER_LEN),
-                "The kmer length to use in the kmer hashes.  Larger values will provide more discriminating power between kmers but at the expense of additional memory and lower coverage.")
+            ("mer_len,m", po::value<string>(&mer_len)->default_value(lexical_cast<string>(DEFAULT_MER_LEN)),
+                "The kmer length to use in the kmer hashes.  Larger values will provide more discriminating power between kmers but at the expense of additional memory and lower coverage.  If counting fast(a/q) input, a comma separated list of kmer lengths (e.g. 17,21,25,27,31) can be given to count them all in a single pass over the input.  Output files for each kmer length are then suffixed with \"-k<length>\".")
             ("hash_size,H", po::value<uint64_t>(&hash_size)->default_value(DEFAULT_HASH_SIZE),
                 "If kmer counting is required for the input, then use this value as the hash size.  If this hash size is not large enough for your dataset then the default behaviour is to double the size of the hash and recount, which will increase runtime and memory usage.")
+            ("max_memory", po::value<uint64_t>(&max_memory)->default_value(0),
+                "Memory budget in MB.  If a hash of the requested --hash_size won't fit, uncompressed sequence files are counted out-of-core instead, splitting sequences into minimizer buckets on disk (under TMPDIR) and counting each bucket in a hash that fits.  Compressed files and pipes are counted in memory regardless, with a warning.  Per-thread matrices are merged one at a time.  The cgroup v2 memory.max of the process is also respected, though on its own it only warns before counting in memory.  The default (0) sets no limit beyond the cgroup's.")
+            ("min_qual", po::value<uint16_t>(&min_qual)->default_value(0),
+                "If kmer counting is required for the input, then ignore any K-mer containing a base with a Phred quality score below this value.  Qualities are assumed to be Phred+33 encoded.  Only applies to FastQ and BAM input.  The default (0) counts all K-mers.")
+            ("cache_dir", po::value<path>(&cache_dir)->default_value(HashCache::defaultDir(), "$" + CACHE_DIR_ENV),
+                "If kmer counting is required for the input, then first look for a hash counted by an earlier run on the same file(s) with the same settings in this directory, and store newly counted hashes here for later runs.  Files are recognised by path, size and modification time.  Hashes are not cached when sampling, counting adaptively or counting only targeted K-mers.  Defaults to the KAT_CACHE_DIR environment variable.  Caching is disabled if neither is set.")
+            ("cache_size", po::value<uint64_t>(&cache_size)->default_value(DEFAULT_CACHE_SIZE),
+                "Maximum size of the hash cache in MB.  Once exceeded, the least recently used hashes are removed.  Set to 0 for no limit.")
+            ("cache_digest", po::bool_switch(&cache_digest)->default_value(false),
+                "Also recognise cached hashes by a digest of the input files' content, which is safer when files might be rewritten in place but requires reading the inputs once more.")
+            ("checkpoint_dir", po::value<path>(&checkpoint_dir),
+                "If kmer counting is required for the input, then periodically save the hash being counted, and how far through the input counting got, to this directory.  If the run is interrupted, e.g. by a node failure or preemption, run the same command again with --resume to carry on from the last checkpoint.  Snapshots are written in the background by a forked process, so counting only pauses briefly, but memory use can grow by up to the size of the hash while a snapshot is written.  Checkpoints are removed once counting finishes.  Only applies when counting a single K-mer length in memory, without sampling or targeting.  Disabled by default.")
+            ("checkpoint_interval", po::value<double>(&checkpoint_interval)->default_value(DEFAULT_CHECKPOINT_INTERVAL),
+                "Minutes between checkpoints when using --checkpoint_dir.")
+            ("resume", po::bool_switch(&resume)->default_value(false),
+                "Carry on counting from the checkpoint left in --checkpoint_dir by an earlier, interrupted run of the same command.  The input files must not have changed since.  Counting starts from scratch if there is no checkpoint.")
+            ("sample_fraction", po::value<double>(&sample_fraction)->default_value(1.0),
+                "If kmer counting is required for the input, then only count this fraction of the reads.  Reads are picked by a hash of their name, so the same reads are used on every run, and from both files of a pair.  Useful for a quick look at the shape of the spectrum from a deep dataset.  Counts are not scaled up to the full dataset.  The default (1) counts all reads.")
+            ("adaptive", po::bool_switch(&adaptive)->default_value(false),
+                "If kmer counting is required for the input, then stop reading the input once the shape of the spectrum has settled down.  The spectrum is compared with the last one at checkpoints, after reading geometrically increasing amounts of the input.  The amount of input read and the final change are reported.")
+            ("adaptive_tolerance", po::value<double>(&adaptive_tolerance)->default_value(DEFAULT_ADAPTIVE_TOLERANCE),
+                "When using --adaptive, the spectrum has settled down once it changes by less than this fraction between checkpoints.  The change is the earth mover's distance between the spectra, after scaling each by the number of K-mers counted, relative to the mean K-mer frequency.")
             ("dump_hash,d", po::bool_switch(&dump_hash)->default_value(false), 
                         "Dumps any jellyfish hashes to disk that were produced during this run.") 
+            ("dump_shards", po::value<uint32_t>(&dump_shards)->default_value(0), 
+                        "Dumps any jellyfish hashes to disk that were produced or loaded during this run as this many shards, named <hash>-shard<i>of<N>.jf<k>, instead of one file.  Each shard holds a distinct part of the K-mers, chosen by a hash of each K-mer, so that shards with the same number from different inputs can be processed on their own, e.g. on separate machines, and the partial results added up with kat mx-merge.  Shards only match between inputs with the same K-mer length and canonical setting.  Implies --dump_hash.") 
             ("output_type,p", po::value<string>(&plot_output_type)->default_value(DEFAULT_GCP_PLOT_OUTPUT_TYPE), 
                 "The plot file type to create: png, ps, pdf.  Warning... if pdf is selected please ensure your gnuplot installation can export pdf files.")            
+            ("numa", po::bool_switch(&numa)->default_value(false), 
+                "Place the hash across NUMA nodes and pin worker threads to nodes, so that each thread works on a slice of the hash held on its own node.  Has no effect on machines with a single NUMA node.")
+            ("perf_counters", po::bool_switch(&perf_counters)->default_value(false), 
+                "Count cycles, instructions, last level cache misses and dTLB misses in each phase, and in each worker thread, using the CPU's hardware counters.  They are shown in the verbose output and written to the --metrics file.  Helps tell whether a run is bound by memory latency, bandwidth or compute.  Requires perf_event_paranoid to be 2 or less.")
+            ("metrics", po::bool_switch(&metrics)->default_value(false), 
+                "Write timings, memory use and throughput for each phase of the run to <output_prefix>.metrics.json.")
             ("verbose,v", po::bool_switch(&verbose)->default_value(false), 
                 "Print extra information.")
             ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
@@ -306,31 +389,73 @@ int kat::Gcp::main(int argc, char *argv[]) {
 
 
 
+    ThreadPool::init(threads);
+    
+    if (perf_counters) {
+        if (!PerfCounters::isAvailable()) {
+            cerr << "WARNING: Hardware performance counters are not available on this machine.  Continuing without them." << endl << endl;
+        }
+        PerfCounters::setEnabled(true);
+        if (verbose) {
+            Metrics::global().setReport(&cerr);
+        }
+    }
+
     auto_cpu_timer timer(1, "KAT GCP completed.\nTotal runtime: %ws\n\n");        
 
     cout << "Running KAT in GCP mode" << endl
          << "------------------------" << endl << endl;
 
-    // Create the sequence coverage object
-    Gcp gcp(inputs);
-    gcp.setThreads(threads);
-    gcp.setCanonical(non_canonical ? non_canonical : canonical ? canonical : true);        // Some crazy logic to default behaviour to canonical if not told otherwise
-    gcp.setCvgBins(cvg_bins);
-    gcp.setCvgScale(cvg_scale);
-    gcp.setHashSize(hash_size);
-    gcp.setMerLen(mer_len);
-    gcp.setOutputPrefix(output_prefix);
-    gcp.setDumpHash(dump_hash);
-    gcp.setVerbose(verbose);
-
-    // Do the work (outputs data to files as it goes)
-    gcp.execute();
-
-    // Save results
-    gcp.save();
-    
-    // Plot results
-    gcp.plot(plot_output_type);
+    vector<uint16_t> mer_lens = InputHandler::parseMerLens(mer_len);
+
+    // Create the sequence coverage object(s), one per K-mer length
+    vector<shared_ptr<Gcp>> gcps;
+    for(auto k : mer_lens) {
+        shared_ptr<Gcp> gcp = make_shared<Gcp>(inputs);
+        gcp->setThreads(threads);
+        gcp->setCanonical(non_canonical ? non_canonical : canonical ? canonical : true);        // Some crazy logic to default behaviour to canonical if not told otherwise
+        gcp->setCvgBins(cvg_bins);
+        gcp->setCvgScale(cvg_scale);
+        gcp->setHashSize(hash_size);
+        gcp->setMaxMemory(max_memory * 1000000);
+        gcp->setMinQual(min_qual);
+        gcp->setCacheDir(cache_dir);
+        gcp->setCacheSize(cache_size * 1000000);
+        gcp->setCacheDigest(cache_digest);
+        gcp->setCheckpointDir(checkpoint_dir);
+        gcp->setCheckpointInterval(checkpoint_interval);
+        gcp->setResume(resume);
+        gcp->setSampleFraction(sample_fraction);
+        gcp->setTolerance(adaptive ? adaptive_tolerance : 0.0);
+        gcp->setMerLen(k);
+        gcp->setOutputPrefix(mer_lens.size() > 1 ? path(output_prefix.string() + "-k" + lexical_cast<string>(k)) : output_prefix);
+        gcp->setDumpHash(dump_hash || dump_shards > 1);
+        gcp->setDumpShards(dump_shards);
+        gcp->setNuma(numa);
+        gcp->setVerbose(verbose);
+        gcps.push_back(gcp);
+    }
+    
+    // Count all K-mer lengths together
+    if (gcps.size() > 1) {
+        Gcp::countMultiK(gcps, threads);
+    }
+
+    for(auto& gcp : gcps) {
+    
+        // Do the work (outputs data to files as it goes)
+        gcp->execute();
+
+        // Save results
+        gcp->save();
+
+        // Plot results
+        gcp->plot(plot_output_type);
+    }
+    
+    if (metrics) {
+        Metrics::global().save(path(output_prefix.string() + ".metrics.json"), "gcp", threads);
+    }
     
     return 0;
 }
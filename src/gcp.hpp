@@ -111,6 +111,86 @@ namespace kat {
             this->input.hashSize = hashSize;
         }
 
+        uint64_t getMaxMemory() const {
+            return input.maxMemory;
+        }
+
+        void setMaxMemory(uint64_t maxMemory) {
+            this->input.maxMemory = maxMemory;
+        }
+
+        uint16_t getMinQual() const {
+            return input.minQual;
+        }
+
+        void setMinQual(uint16_t minQual) {
+            this->input.minQual = minQual;
+        }
+
+        path getCacheDir() const {
+            return input.cacheDir;
+        }
+
+        void setCacheDir(const path& cacheDir) {
+            this->input.cacheDir = cacheDir;
+        }
+
+        uint64_t getCacheSize() const {
+            return input.cacheSize;
+        }
+
+        void setCacheSize(uint64_t cacheSize) {
+            this->input.cacheSize = cacheSize;
+        }
+
+        bool isCacheDigest() const {
+            return input.cacheDigest;
+        }
+
+        void setCacheDigest(bool cacheDigest) {
+            this->input.cacheDigest = cacheDigest;
+        }
+
+        path getCheckpointDir() const {
+            return input.checkpointDir;
+        }
+
+        void setCheckpointDir(const path& checkpointDir) {
+            this->input.checkpointDir = checkpointDir;
+        }
+
+        double getCheckpointInterval() const {
+            return input.checkpointInterval;
+        }
+
+        void setCheckpointInterval(double checkpointInterval) {
+            this->input.checkpointInterval = checkpointInterval;
+        }
+
+        bool isResume() const {
+            return input.resume;
+        }
+
+        void setResume(bool resume) {
+            this->input.resume = resume;
+        }
+
+        double getSampleFraction() const {
+            return input.sampleFraction;
+        }
+
+        void setSampleFraction(double sampleFraction) {
+            this->input.sampleFraction = sampleFraction;
+        }
+
+        double getTolerance() const {
+            return input.tolerance;
+        }
+
+        void setTolerance(double tolerance) {
+            this->input.tolerance = tolerance;
+        }
+
         uint16_t getMerLen() const {
             return input.merLen;
         }
@@ -143,6 +223,22 @@ namespace kat {
             this->input.dumpHash = dumpHash;
         }
 
+        uint32_t getDumpShards() const {
+            return input.dumpShards;
+        }
+
+        void setDumpShards(uint32_t dumpShards) {
+            this->input.dumpShards = dumpShards;
+        }
+
+        bool isNuma() const {
+            return input.numa != NumaPlacement::NONE;
+        }
+
+        void setNuma(bool numa) {
+            this->input.numa = numa ? NumaPlacement::SLICES : NumaPlacement::NONE;
+        }
+
         bool isVerbose() const {
             return verbose;
         }
@@ -154,6 +250,12 @@ namespace kat {
         
         void execute();
         
+        /**
+         * Counts the input for all the given runs, which differ only by K-mer 
+         * length, in a single pass.  Call before executing each run.
+         */
+        static void countMultiK(const vector<shared_ptr<Gcp>>& runs, uint16_t threads);
+        
 
         // Print K-mer comparison matrix
 
@@ -167,7 +269,7 @@ namespace kat {
         
         void analyse();
         
-        void analyseSlice(int th_id);
+        uint64_t analyseSlice(int th_id);
         
         void merge();
         
@@ -41,14 +41,20 @@ using kat::KatFS;
 #include "filter.hpp"
 #include "gcp.hpp"
 #include "histogram.hpp"
+#include "dist.hpp"
+#include "mx_merge.hpp"
 #include "plot.hpp"
 #include "sect.hpp"
+#include "serve.hpp"
 using kat::Comp;
 using kat::Filter;
 using kat::Gcp;
 using kat::Histogram;
+using kat::Dist;
+using kat::MxMerge;
 using kat::Plot;
 using kat::Sect;
+using kat::Serve;
 
 
 typedef boost::error_info<struct KatError,string> KatErrorInfo;
@@ -61,11 +67,14 @@ KatFS katFileSystem;
 
 enum Mode {
     COMP,
+    DIST,
     FILTER,
     GCP,
     HIST,
+    MX_MERGE,
     PLOT,
-    SECT
+    SECT,
+    SERVE
 };
 
 Mode parseMode(string mode) {
@@ -75,6 +84,9 @@ Mode parseMode(string mode) {
     if (upperMode == string("COMP")) {
         return COMP;                
     }
+    else if (upperMode == string("DIST")) {
+        return DIST;
+    }
     else if (upperMode == string("FILTER")) {
         return FILTER;
     }
@@ -84,12 +96,18 @@ Mode parseMode(string mode) {
     else if (upperMode == string("HIST")) {
         return HIST;
     }
+    else if (upperMode == string("MX-MERGE")) {
+        return MX_MERGE;
+    }
     else if (upperMode == string("PLOT")) {
         return PLOT;
     }    
     else if (upperMode == string("SECT")) {
         return SECT;
     }
+    else if (upperMode == string("SERVE")) {
+        return SERVE;
+    }
     else {
         BOOST_THROW_EXCEPTION(KatException() << KatErrorInfo(string(
                     "Could not recognise mode string: ") + mode));
@@ -111,7 +129,12 @@ const string helpMessage() {
                    "   * filter: Filtering tools.  Contains tools for filtering k-mers and sequences based on\n" \
                    "             user-defined GC and coverage limits.\n" \
                    "   * plot:   Plotting tools.  Contains several plotting tools to visualise K-mer and compare\n" \
-                   "             distributions.\n\n" \
+                   "             distributions.\n" \
+                   "   * serve:  Holds jellyfish hashes in memory and serves K-mer counts from them to other KAT\n" \
+                   "             runs, so large hashes only need loading once.\n" \
+                   "   * mx-merge: Adds up the matrices, histograms and statistics from comp, gcp or hist runs\n" \
+                   "             on each shard of hashes dumped with --dump_shards.\n" \
+                   "   * dist:   Distances between every pair of K-mer spectra from hist or comp runs.\n\n" \
                    "Options";
 }
 
@@ -169,7 +192,7 @@ int main(int argc, char *argv[])
         // Positional options
         po::positional_options_description p;
         p.add("mode", 1);
-        p.add("others", 100);
+        p.add("others", -1);
         
         // Combine non-positional options
         po::options_description cmdline_options;
@@ -221,6 +244,9 @@ int main(int argc, char *argv[])
             case COMP:
                 Comp::main(modeArgC, modeArgV);
                 break;
+            case DIST:
+                Dist::main(modeArgC, modeArgV);
+                break;
             case FILTER:
                 Filter::main(modeArgC, modeArgV);
                 break;
@@ -230,12 +256,18 @@ int main(int argc, char *argv[])
             case HIST:
                 Histogram::main(modeArgC, modeArgV);
                 break;
+            case MX_MERGE:
+                MxMerge::main(modeArgC, modeArgV);
+                break;
             case PLOT:
                 Plot::main(modeArgC, modeArgV);            
                 break;
             case SECT:
                 Sect::main(modeArgC, modeArgV);            
                 break;
+            case SERVE:
+                Serve::main(modeArgC, modeArgV);
+                break;
             default:
                 BOOST_THROW_EXCEPTION(KatException() << KatErrorInfo(string(
                     "Unrecognised KAT mode: ") + modeStr));
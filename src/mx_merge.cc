@@ -0,0 +1,293 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::ofstream;
+using std::pair;
+using std::string;
+using std::vector;
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <boost/timer/timer.hpp>
+namespace po = boost::program_options;
+using boost::lexical_cast;
+using boost::timer::auto_cpu_timer;
+
+#include <kat/comp_counters.hpp>
+#include <kat/matrix_metadata_extractor.hpp>
+#include <kat/sparse_matrix.hpp>
+#include <kat/str_utils.hpp>
+using kat::CompCounters;
+using kat::SM64;
+
+#include "mx_merge.hpp"
+
+kat::MxMerge::MxMerge(const vector<path>& _inputs, const path& _output) : inputs(_inputs), output(_output) {
+}
+
+kat::MxMerge::OutputType kat::MxMerge::determineType(const path& file) {
+
+    ifstream in(file.c_str());
+    if (!in) {
+        BOOST_THROW_EXCEPTION(MxMergeException() << MxMergeErrorInfo(string(
+                "Could not open partial output: ") + file.string()));
+    }
+
+    string line;
+    getline(in, line);
+
+    if (line == COUNTERS_MAGIC) {
+        return OutputType::COUNTERS;
+    }
+
+    return file.extension() == ".mx" ? OutputType::MATRIX : OutputType::HIST;
+}
+
+void kat::MxMerge::execute() {
+
+    OutputType type = determineType(inputs[0]);
+    for(auto& p : inputs) {
+        if (determineType(p) != type) {
+            BOOST_THROW_EXCEPTION(MxMergeException() << MxMergeErrorInfo(string(
+                    "Can only merge outputs of the same kind, but ") + p.string() + 
+                    " is not the same kind as " + inputs[0].string()));
+        }
+    }
+
+    auto_cpu_timer timer(1, "  Time taken: %ws\n\n");
+
+    cout << "Merging " << inputs.size() << " partial outputs into " << output.string() << " ...";
+    cout.flush();
+
+    switch(type) {
+        case OutputType::MATRIX:
+            mergeMatrices();
+            break;
+        case OutputType::HIST:
+            mergeHists();
+            break;
+        case OutputType::COUNTERS:
+            mergeCounters();
+            break;
+    }
+
+    cout << " done.";
+    cout.flush();
+}
+
+vector<string> kat::MxMerge::readHeader(const path& file) {
+
+    ifstream in(file.c_str());
+    vector<string> header;
+    string line;
+    while (getline(in, line) && !line.empty() && line[0] == '#') {
+        header.push_back(line);
+    }
+    return header;
+}
+
+void kat::MxMerge::mergeMatrices() {
+
+    SM64 merged(inputs[0]);
+
+    for(size_t k = 1; k < inputs.size(); k++) {
+
+        SM64 part(inputs[k]);
+
+        if (part.width() != merged.width() || part.height() != merged.height()) {
+            BOOST_THROW_EXCEPTION(MxMergeException() << MxMergeErrorInfo(string(
+                    "Matrix in ") + inputs[k].string() + " is " + 
+                    lexical_cast<string>(part.width()) + "x" + lexical_cast<string>(part.height()) + 
+                    ", but the matrix in " + inputs[0].string() + " is " + 
+                    lexical_cast<string>(merged.width()) + "x" + lexical_cast<string>(merged.height())));
+        }
+
+        for(uint32_t i = 0; i < part.width(); i++) {
+            for(uint32_t j = 0; j < part.height(); j++) {
+                const uint64_t val = part.get(i, j);
+                if (val > 0) {
+                    merged.inc(i, j, val);
+                }
+            }
+        }
+    }
+
+    // Keep the first input's header, updating the maximum value for the sums
+    ofstream out(output.c_str());
+    for(auto& line : readHeader(inputs[0])) {
+        if (boost::starts_with(line, mme::KEY_MAX_VAL)) {
+            out << mme::KEY_MAX_VAL << merged.getMaxVal() << endl;
+        }
+        else {
+            out << line << endl;
+        }
+    }
+    merged.printMatrix(out);
+    out.close();
+}
+
+/**
+ * Reads the bins and counts from a histogram file
+ */
+static vector<pair<uint64_t, uint64_t>> loadHist(const path& file) {
+
+    ifstream in(file.c_str());
+    vector<pair<uint64_t, uint64_t>> hist;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        vector<uint64_t> parts = kat::splitUInt64(line, ' ');
+        if (parts.size() != 2) {
+            BOOST_THROW_EXCEPTION(kat::MxMergeException() << kat::MxMergeErrorInfo(string(
+                    "Expected a bin and a count on each line of histogram ") + file.string() + ", but found: " + line));
+        }
+        hist.push_back(std::make_pair(parts[0], parts[1]));
+    }
+    return hist;
+}
+
+void kat::MxMerge::mergeHists() {
+
+    vector<pair<uint64_t, uint64_t>> merged = loadHist(inputs[0]);
+
+    for(size_t k = 1; k < inputs.size(); k++) {
+
+        vector<pair<uint64_t, uint64_t>> part = loadHist(inputs[k]);
+
+        if (part.size() != merged.size()) {
+            BOOST_THROW_EXCEPTION(MxMergeException() << MxMergeErrorInfo(string(
+                    "Histogram in ") + inputs[k].string() + " has " + lexical_cast<string>(part.size()) + 
+                    " bins, but the histogram in " + inputs[0].string() + " has " + lexical_cast<string>(merged.size())));
+        }
+
+        for(size_t i = 0; i < part.size(); i++) {
+            if (part[i].first != merged[i].first) {
+                BOOST_THROW_EXCEPTION(MxMergeException() << MxMergeErrorInfo(string(
+                        "Histograms in ") + inputs[k].string() + " and " + inputs[0].string() + " have different bins"));
+            }
+            merged[i].second += part[i].second;
+        }
+    }
+
+    ofstream out(output.c_str());
+    for(auto& line : readHeader(inputs[0])) {
+        out << line << endl;
+    }
+    for(auto& bin : merged) {
+        out << bin.first << " " << bin.second << "\n";
+    }
+    out.close();
+}
+
+void kat::MxMerge::mergeCounters() {
+
+    ifstream in(inputs[0].c_str());
+    CompCounters merged = CompCounters::load(in);
+    in.close();
+
+    for(size_t k = 1; k < inputs.size(); k++) {
+        ifstream partIn(inputs[k].c_str());
+        merged.add(CompCounters::load(partIn));
+        partIn.close();
+    }
+
+    ofstream out(output.c_str());
+    merged.save(out);
+    out.close();
+
+    // The statistics, including distances, for the whole hashes
+    path statsPath = output.extension() == ".counters" ? 
+            path(output).replace_extension(".stats") : 
+            path(output.string() + ".stats");
+    ofstream stats(statsPath.c_str());
+    merged.printCounts(stats);
+    stats.close();
+}
+
+int kat::MxMerge::main(int argc, char *argv[]) {
+
+    vector<path>    inputs;
+    path            output;
+    bool            help;
+
+    struct winsize w;
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+
+
+    // Declare the supported options.
+    po::options_description generic_options(MxMerge::helpMessage(), w.ws_col);
+    generic_options.add_options()
+            ("output,o", po::value<path>(&output),
+                "Path of the merged output file.")
+            ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
+            ;
+
+    // Hidden options, will be allowed both on command line and
+    // in config file, but will not be shown to the user.
+    po::options_description hidden_options("Hidden options");
+    hidden_options.add_options()
+            ("inputs", po::value<std::vector<path>>(&inputs), "Path to the partial outputs to merge.")
+            ;
+
+    // Positional option for the partial outputs
+    po::positional_options_description p;
+    p.add("inputs", -1);
+
+    // Combine non-positional options
+    po::options_description cmdline_options;
+    cmdline_options.add(generic_options).add(hidden_options);
+
+    // Parse command line
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(p).run(), vm);
+    po::notify(vm);
+
+    // Output help information the exit if requested
+    if (help || argc <= 1 || inputs.empty() || output.empty()) {
+        cout << generic_options << endl;
+        return 1;
+    }
+
+
+
+    auto_cpu_timer timer(1, "KAT MX-MERGE completed.\nTotal runtime: %ws\n\n");
+
+    cout << "Running KAT in MX-MERGE mode" << endl
+         << "----------------------------" << endl << endl;
+
+    MxMerge merge(inputs, output);
+    merge.execute();
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+namespace bfs = boost::filesystem;
+using bfs::path;
+
+namespace kat {
+
+    typedef boost::error_info<struct MxMergeError,string> MxMergeErrorInfo;
+    struct MxMergeException: virtual boost::exception, virtual std::exception { };
+
+    /**
+     * Adds up the partial results of running comp, gcp or hist on each shard of
+     * hashes dumped with --dump_shards, giving the result for the whole hashes
+     */
+    class MxMerge {
+    public:
+
+        enum class OutputType {
+            MATRIX,     // .mx files from comp or gcp
+            HIST,       // Histograms from hist, or from comp with --output_hists
+            COUNTERS    // .counters files from comp with --partial
+        };
+
+        MxMerge(const vector<path>& _inputs, const path& _output);
+
+        void execute();
+
+        /**
+         * Works out what kind of output the given file is, from its content and
+         * extension
+         */
+        static OutputType determineType(const path& file);
+
+        static int main(int argc, char *argv[]);
+
+    protected:
+
+        vector<path> inputs;
+        path output;
+
+        void mergeMatrices();
+        void mergeHists();
+        void mergeCounters();
+
+        /**
+         * Returns the header from the given matrix or histogram file, i.e. every
+         * line before the data, each starting with '#'
+         */
+        static vector<string> readHeader(const path& file);
+
+        static string helpMessage() {
+            return string("Usage: kat mx-merge [options] -o <output> (<partial_output>)+\n\n") +
+                    "Adds up the outputs from runs on each shard of a sharded hash.\n\n" \
+                    "Hashes dumped with --dump_shards are split into shards holding distinct parts of the K-mers.  " \
+                    "Running comp, gcp or hist on each shard, or on the matching shards of several hashes, e.g. " \
+                    "on separate machines, gives partial results that this tool adds up to give the result for " \
+                    "the whole hashes.  Matrices (.mx), histograms and comp counters (.counters, written by " \
+                    "comp --partial) are supported, and all inputs must be of the same kind.  When merging comp " \
+                    "counters, the K-mer statistics for the whole hashes are also written next to the output, " \
+                    "with a .stats extension.  The header of the first input is kept.\n\n" \
+                    "Options";
+        }
+    };
+}
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <vector>
 #include <math.h>
+#include <limits>
 #include <memory>
 #include <thread>
 #include <sys/ioctl.h>
@@ -54,15 +55,20 @@ using boost::lexical_cast;
 #include <jellyfish/mer_dna.hpp>
 
 #include <kat/jellyfish_helper.hpp>
+#include <kat/memory_budget.hpp>
+#include <kat/metrics.hpp>
+#include <kat/thread_pool.hpp>
 #include <kat/matrix_metadata_extractor.hpp>
 #include <kat/kat_fs.hpp>
 using kat::KatFS;
+using kat::MemoryBudget;
 
 #include "sect.hpp"
 
 kat::Sect::Sect(const vector<path> _counts_files, const path _seq_file) {
     input.setMultipleInputs(_counts_files);
     input.index = 1;
+    input.allowBloom = true;
     seqFile = _seq_file;
     outputPrefix = "kat-sect";
     gcBins = 1001;
@@ -74,6 +80,7 @@ kat::Sect::Sect(const vector<path> _counts_files, const path _seq_file) {
     extractNR = false;
     extractR = false;
     maxRepeat = 20;
+    targeted = false;
     verbose = false;
     contamination_mx = nullptr;
 }
@@ -98,12 +105,24 @@ void kat::Sect::execute() {
     
     // Either count or load input
     if (input.mode == InputHandler::InputHandler::InputMode::COUNT) {
-        input.count(threads);
+        if (targeted) {
+            countTargeted();
+        }
+        else {
+            input.count(threads);
+        }
     }
     else {
+        if (targeted) {
+            cerr << "WARNING: --targeted only applies when counting K-mers from sequence files.  " 
+                 << input.pathString() << " is a hash, so it is loaded in full." << endl << endl;
+        }
         input.loadHeader();
         input.loadHash();
     }
+    
+    // Sequences' K-mers are looked up at random
+    input.placeHash(threads);
 
     contamination_mx = make_shared<ThreadedSparseMatrix>(gcBins, cvgBins, threads);
 
@@ -121,9 +140,30 @@ void kat::Sect::execute() {
     merge();
 }
 
+void kat::Sect::countTargeted() {
+    
+    // Only K-mers in the sequences will ever be queried, so count those first and 
+    // then only keep counts from the input for those K-mers.  The sequence hash is 
+    // discarded once the input has been counted.
+    InputHandler target;
+    target.setSingleInput(seqFile);
+    target.index = 2;
+    target.canonical = input.canonical;
+    target.merLen = input.merLen;
+    target.hashSize = input.hashSize;
+    target.count(threads);
+    
+    input.targetHash = target.hash;
+    input.count(threads);
+    
+    // The target hash goes with target, so don't leave input pointing at it
+    input.targetHash = nullptr;
+}
+
 void kat::Sect::save() {
     
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");        
+    Metrics::Phase phase("save");
 
     cout << "Saving results to disk ...";
     cout.flush();
@@ -140,6 +180,7 @@ void kat::Sect::save() {
 void kat::Sect::processSeqFile() {
     
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");     
+    Metrics::Phase phase("analyse", seqFile.string());
     
     cout << "Calculating kmer coverage across sequences ...";
     cout.flush();
@@ -152,7 +193,7 @@ void kat::Sect::processSeqFile() {
     seqs = seqan::StringSet<seqan::CharString>();
     
     // Open file, create RecordReader and check all is well
-    seqan::SeqFileIn reader(seqFile.c_str());
+    SeqFileReader reader(seqFile);
 
     // Setup output stream for jellyfish initialisation
     std::ostream* out_stream = verbose ? &cerr : (std::ostream*)0;
@@ -186,17 +227,24 @@ void kat::Sect::processSeqFile() {
 
     // Average sequence coverage and GC% scores output stream
     ofstream cvg_gc_stream(string(outputPrefix.string() + "-stats.tsv").c_str());
+    // Under a memory limit, shrink batches so the sequences and their per K-mer 
+    // results fit in what's left after loading the hash
+    const uint64_t limit = input.memoryLimit();
+    const uint64_t maxBatchBases = limit > 0 ? 
+        MemoryBudget::remaining(limit) / BYTES_PER_BASE : 
+        std::numeric_limits<uint64_t>::max();
+    
     cvg_gc_stream << "seq_name\tmedian\tmean\tgc%\tseq_length\tkmers_in_seq\tinvalid_kmers\t%_invalid\tnon_zero_kmers\t%_non_zero\t%_non_zero_corrected" << endl;
     
     // Processes sequences in batches of records to reduce memory requirements
-    while (!seqan::atEnd(reader)) {
+    while (!reader.atEnd()) {
         if (verbose)
             *out_stream << "Loading Batch of sequences... ";
 
         seqan::clear(names);
         seqan::clear(seqs);
 
-        seqan::readRecords(names, seqs, reader, BATCH_SIZE);
+        reader.readRecords(names, seqs, BATCH_SIZE, maxBatchBases);
 
         recordsInBatch = seqan::length(names);
 
@@ -209,7 +257,13 @@ void kat::Sect::processSeqFile() {
         // Process batch with worker threads
         // Process each sequence is processed in a different thread.
         // In each thread lookup each K-mer in the hash
-        analyseBatch();
+        analyseBatch(phase);
+        
+        for (uint32_t i = 0; i < recordsInBatch; i++) {
+            const uint64_t nbKmers = (*counts)[i]->size();
+            phase.addKmers(nbKmers);
+            phase.addLookups(nbKmers - (*invalid)[i]);
+        }
 
         // Output counts for this batch if (not not) requested
         if (!noCountStats)
@@ -245,10 +299,14 @@ void kat::Sect::processSeqFile() {
     if (extractNR)      nr_path_stream->close();
     if (extractR)       r_path_stream->close();
 
-    seqan::close(reader);
+    reader.close();
 
     cvg_gc_stream.close();
     
+    if (bfs::is_regular_file(seqFile)) {
+        phase.addBytesRead(bfs::file_size(seqFile));
+    }
+    
     cout << " done.";
     cout.flush();
 }
@@ -256,26 +314,28 @@ void kat::Sect::processSeqFile() {
 void kat::Sect::merge() {
     
     auto_cpu_timer timer(1, "  Time taken: %ws\n\n");     
+    Metrics::Phase phase("merge");
     
     cout << "Merging matrices ...";
     cout.flush();
     
-    contamination_mx->mergeThreadedMatricies();
+    if (input.memoryLimit() > 0) {
+        contamination_mx->streamMergeThreadedMatricies();
+    }
+    else {
+        contamination_mx->mergeThreadedMatricies();
+    }
     cout << " done.";
     cout.flush();
 }
 
-void kat::Sect::analyseBatch() {
-
-    vector<thread> t(threads);
+void kat::Sect::analyseBatch(Metrics::Phase& phase) {
 
-    for(uint16_t i = 0; i < threads; i++) {
-        t[i] = thread(&Sect::analyseBatchSlice, this, i);
-    }
-
-    for(uint16_t i = 0; i < threads; i++){
-        t[i].join();
-    }            
+    ThreadPool::global().parallelFor(threads, [this, &phase](size_t i) {
+        PerfCounters counters;
+        analyseBatchSlice(i);
+        phase.addThreadCounters(i, counters);
+    });
 }
 
 void kat::Sect::analyseBatchSlice(int th_id) {
@@ -284,6 +344,9 @@ void kat::Sect::analyseBatchSlice(int th_id) {
         return;
     }
 
+    // Pool workers go back to running anywhere once this task is done
+    Numa::ThreadPin pin(th_id, threads, isNuma());
+
     //processInBlocks(th_id);
     processInterlaced(th_id);
 }
@@ -448,6 +511,9 @@ void kat::Sect::printContaminationMatrix(std::ostream &out, const path seqFile)
     out << mme::KEY_NB_ROWS << cvgBins << endl;
     out << mme::KEY_MAX_VAL << mx.getMaxVal() << endl;
     out << mme::KEY_TRANSPOSE << "0" << endl;
+    if (input.isBloom()) {
+        out << mme::KEY_FPR << " " << input.bloomFpr << endl;
+    }
     out << mme::MX_META_END << endl;
 
     mx.printMatrix(out);
@@ -485,10 +551,7 @@ void kat::Sect::processInterlaced(uint16_t th_id) {
 void kat::Sect::processSeq(const size_t index, const uint16_t th_id) {
 
     // There's no substring functionality in SeqAn in this version (2.0.0).  So we'll just
-    // use regular c++ string's for this bit.  This conversion of strings:
-    // {CharString -> c++ string -> substring -> jellyfish mer_dna} is 
-    // inefficient. Reducing the number of conversions necessary will 
-    // make a big performance improvement here
+    // use a regular c++ string, and roll K-mers along it from there.
     stringstream ssSeq;
     ssSeq << seqs[index];
     string seq = ssSeq.str();
@@ -515,25 +578,32 @@ void kat::Sect::processSeq(const size_t index, const uint16_t th_id) {
         shared_ptr<vector<int16_t>> gcCounts = make_shared<vector<int16_t>>(nbCounts, 0);
 
         uint64_t sum = 0;
+        
+        // Running count of G and C in the current K-mer, less its last base
+        const uint16_t k = input.merLen;
+        int16_t gc = 0;
+        for (uint16_t i = 0; i + 1 < k; i++) {
+            gc += isGC(seq[i]);
+        }
 
-        for (uint64_t i = 0; i < nbCounts; i++) {
-
-            string merstr = seq.substr(i, input.merLen);
+        input.forEachCount(seq, [&](size_t i, bool valid, uint64_t count) {
 
+            gc += isGC(seq[i + k - 1]);
+            
             // Jellyfish compacted hash does not support Ns so if we find one set this mer count to 0
-            if (!validKmer(merstr)) {
+            if (!valid) {
                 (*seqCounts)[i] = 0;
                 (*gcCounts)[i] = -1;
                 nbInvalid++;
             } else {                
-                mer_dna mer(merstr);
-                uint64_t count = JellyfishHelper::getCount(input.hash, mer, input.canonical);
                 sum += count;
                 (*seqCounts)[i] = count;
-                (*gcCounts)[i] = gcCount(merstr);
+                (*gcCounts)[i] = gc;
                 if (count != 0) nbNonZero++;
             }
-        }
+            
+            gc -= isGC(seq[i]);
+        });
 
         (*counts)[index] = seqCounts;
         (*gc_counts)[index] = gcCounts;
@@ -608,12 +678,27 @@ int kat::Sect::main(int argc, char *argv[]) {
     bool            non_canonical;
     uint16_t        mer_len;
     uint64_t        hash_size;
+    uint64_t        max_memory;
+    uint16_t        min_qual;
+    path            hash_server;
+    path            cache_dir;
+    uint64_t        cache_size;
+    bool            cache_digest;
+    path            checkpoint_dir;
+    double          checkpoint_interval;
+    bool            resume;
     bool            no_count_stats;
+    bool            targeted;
     bool            output_gc_stats;
     bool            extract_nr;
     bool            extract_r;
     uint32_t        max_repeat;
     bool            dump_hash;
+    bool            numa;
+    bool            huge_pages;
+    bool            populate;
+    bool            perf_counters;
+    bool            metrics;
     bool            verbose;
     bool            help;
     
@@ -642,6 +727,26 @@ int kat::Sect::main(int argc, char *argv[]) {
                 "The kmer length to use in the kmer hashes.  Larger values will provide more discriminating power between kmers but at the expense of additional memory and lower coverage.")
             ("hash_size,H", po::value<uint64_t>(&hash_size)->default_value(DEFAULT_HASH_SIZE),
                 "If kmer counting is required for the input, then use this value as the hash size.  If this hash size is not large enough for your dataset then the default behaviour is to double the size of the hash and recount, which will increase runtime and memory usage.")
+            ("max_memory", po::value<uint64_t>(&max_memory)->default_value(0),
+                "Memory budget in MB.  If a hash of the requested --hash_size won't fit, uncompressed sequence files are counted out-of-core instead, splitting sequences into minimizer buckets on disk (under TMPDIR) and counting each bucket in a hash that fits.  Compressed files and pipes are counted in memory regardless, with a warning.  Loaded hashes that won't fit are queried in place, from the file, sequences are processed in smaller batches, and per-thread matrices are merged one at a time.  The cgroup v2 memory.max of the process is also respected, though on its own it only warns before counting in memory.  The default (0) sets no limit beyond the cgroup's.")
+            ("min_qual", po::value<uint16_t>(&min_qual)->default_value(0),
+                "If kmer counting is required for the input, then ignore any K-mer containing a base with a Phred quality score below this value.  Qualities are assumed to be Phred+33 encoded.  Only applies to FastQ and BAM input.  The default (0) counts all K-mers.")
+            ("hash_server", po::value<path>(&hash_server),
+                "Socket of a kat serve process.  If the counts input is a jellyfish hash held by that server, K-mer counts are looked up from the server instead of loading the hash.  Saves loading the same large hash on every run.")
+            ("cache_dir", po::value<path>(&cache_dir)->default_value(HashCache::defaultDir(), "$" + CACHE_DIR_ENV),
+                "If kmer counting is required for the input, then first look for a hash counted by an earlier run on the same file(s) with the same settings in this directory, and store newly counted hashes here for later runs.  Files are recognised by path, size and modification time.  Hashes are not cached when sampling, counting adaptively or counting only targeted K-mers.  Defaults to the KAT_CACHE_DIR environment variable.  Caching is disabled if neither is set.")
+            ("cache_size", po::value<uint64_t>(&cache_size)->default_value(DEFAULT_CACHE_SIZE),
+                "Maximum size of the hash cache in MB.  Once exceeded, the least recently used hashes are removed.  Set to 0 for no limit.")
+            ("cache_digest", po::bool_switch(&cache_digest)->default_value(false),
+                "Also recognise cached hashes by a digest of the input files' content, which is safer when files might be rewritten in place but requires reading the inputs once more.")
+            ("checkpoint_dir", po::value<path>(&checkpoint_dir),
+                "If kmer counting is required for the input, then periodically save the hash being counted, and how far through the input counting got, to this directory.  If the run is interrupted, e.g. by a node failure or preemption, run the same command again with --resume to carry on from the last checkpoint.  Snapshots are written in the background by a forked process, so counting only pauses briefly, but memory use can grow by up to the size of the hash while a snapshot is written.  Checkpoints are removed once counting finishes.  Only applies when counting a single K-mer length in memory, without sampling or targeting.  Disabled by default.")
+            ("checkpoint_interval", po::value<double>(&checkpoint_interval)->default_value(DEFAULT_CHECKPOINT_INTERVAL),
+                "Minutes between checkpoints when using --checkpoint_dir.")
+            ("resume", po::bool_switch(&resume)->default_value(false),
+                "Carry on counting from the checkpoint left in --checkpoint_dir by an earlier, interrupted run of the same command.  The input files must not have changed since.  Counting starts from scratch if there is no checkpoint.")
+            ("targeted", po::bool_switch(&targeted)->default_value(false),
+                "If kmer counting is required for the input, only count K-mers that are found in the sequence file.  This saves memory when the input is much larger than the sequences, such as when comparing reads against an assembly.")
             ("no_count_stats,n", po::bool_switch(&no_count_stats)->default_value(false),
                 "Tells SECT not to output count stats.  Sometimes when using SECT on read files the output can get very large.  When flagged this just outputs summary stats for each sequence.")
             ("output_gc_stats,g", po::bool_switch(&output_gc_stats)->default_value(false),
@@ -654,6 +759,16 @@ int kat::Sect::main(int argc, char *argv[]) {
                 "If user requests repeat region extraction (--max_repeat), this value allows the user to override the default maximum limit on the amount of repetition allowed.  This allows users to avoid regions that are likely to be due to low complexity sequences.")
             ("dump_hash,d", po::bool_switch(&dump_hash)->default_value(false), 
                         "Dumps any jellyfish hashes to disk that were produced during this run.") 
+            ("numa", po::bool_switch(&numa)->default_value(false), 
+                "Interleave the hash across NUMA nodes, since K-mers are looked up at random, and pin worker threads to nodes.  Has no effect on machines with a single NUMA node.")
+            ("huge_pages", po::bool_switch(&huge_pages)->default_value(false), 
+                "Back hashes with transparent huge pages.  K-mers are looked up at random, so with normal pages most lookups into a large hash miss the TLB.  Only has an effect if transparent huge pages are enabled in \"madvise\" or \"always\" mode.")
+            ("populate", po::bool_switch(&populate)->default_value(false), 
+                "Read hash and bloom counter files into memory up front, using all threads, rather than page by page as they are loaded or queried.")
+            ("perf_counters", po::bool_switch(&perf_counters)->default_value(false), 
+                "Count cycles, instructions, last level cache misses and dTLB misses in each phase, and in each worker thread, using the CPU's hardware counters.  They are shown in the verbose output and written to the --metrics file.  Helps tell whether a run is bound by memory latency, bandwidth or compute.  Requires perf_event_paranoid to be 2 or less.")
+            ("metrics", po::bool_switch(&metrics)->default_value(false), 
+                "Write timings, memory use and throughput for each phase of the run to <output_prefix>.metrics.json.")
             ("verbose,v", po::bool_switch(&verbose)->default_value(false), 
                 "Print extra information.")
             ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
@@ -690,6 +805,18 @@ int kat::Sect::main(int argc, char *argv[]) {
 
 
 
+    ThreadPool::init(threads);
+    
+    if (perf_counters) {
+        if (!PerfCounters::isAvailable()) {
+            cerr << "WARNING: Hardware performance counters are not available on this machine.  Continuing without them." << endl << endl;
+        }
+        PerfCounters::setEnabled(true);
+        if (verbose) {
+            Metrics::global().setReport(&cerr);
+        }
+    }
+
     auto_cpu_timer timer(1, "KAT SECT completed.\nTotal runtime: %ws\n\n");        
 
     cout << "Running KAT in SECT mode" << endl
@@ -705,16 +832,33 @@ int kat::Sect::main(int argc, char *argv[]) {
     sect.setCanonical(non_canonical ? non_canonical : canonical ? canonical : true);        // Some crazy logic to default behaviour to canonical if not told otherwise
     sect.setMerLen(mer_len);
     sect.setHashSize(hash_size);
+    sect.setMaxMemory(max_memory * 1000000);
+    sect.setMinQual(min_qual);
+    sect.setHashServer(hash_server);
+    sect.setCacheDir(cache_dir);
+    sect.setCacheSize(cache_size * 1000000);
+    sect.setCacheDigest(cache_digest);
+    sect.setCheckpointDir(checkpoint_dir);
+    sect.setCheckpointInterval(checkpoint_interval);
+    sect.setResume(resume);
     sect.setNoCountStats(no_count_stats);
     sect.setOutputGCStats(output_gc_stats);
     sect.setExtractNR(extract_nr);
     sect.setExtractR(extract_r);
     sect.setMaxRepeat(max_repeat);
+    sect.setTargeted(targeted);
     sect.setDumpHash(dump_hash);
+    sect.setNuma(numa);
+    sect.setHugePages(huge_pages);
+    sect.setPrefaultThreads(populate ? threads : 0);
     sect.setVerbose(verbose);
 
     // Do the work (outputs data to files as it goes)
     sect.execute();
 
+    if (metrics) {
+        Metrics::global().save(path(output_prefix.string() + ".metrics.json"), "sect", threads);
+    }
+    
     return 0;
 }
@@ -53,9 +53,13 @@ using boost::lexical_cast;
 #include <kat/jellyfish_helper.hpp>
 #include <kat/input_handler.hpp>
 #include <kat/sparse_matrix.hpp>
+#include <kat/metrics.hpp>
 using kat::InputHandler;
 using kat::ThreadedSparseMatrix;
 
+#include "seq_file_reader.hpp"
+using kat::SeqFileReader;
+
 typedef boost::error_info<struct SectError,string> SectErrorInfo;
 struct SectException: virtual boost::exception, virtual std::exception { };
 
@@ -67,6 +71,9 @@ namespace kat {
 
         static const uint16_t BATCH_SIZE = 1024;
         
+        // Approximate bytes needed per base in a batch: the sequence plus its K-mer count
+        static const uint64_t BYTES_PER_BASE = 16;
+        
         // Input args
         InputHandler    input;
         path            seqFile;
@@ -80,6 +87,7 @@ namespace kat {
         bool            extractNR;
         bool            extractR;
         uint32_t        maxRepeat;
+        bool            targeted;
         bool            verbose;
             
         // Chunking vars
@@ -162,6 +170,17 @@ namespace kat {
             this->noCountStats = no_count_stats;
         }
         
+        bool isTargeted() const {
+            return targeted;
+        }
+
+        /**
+         * If set, only K-mers found in the sequence file are counted from the input
+         */
+        void setTargeted(bool targeted) {
+            this->targeted = targeted;
+        }
+        
         bool isOutputGCStats() const {
             return outputGCStats;
         }
@@ -218,6 +237,78 @@ namespace kat {
             this->input.hashSize = hashSize;
         }
 
+        uint64_t getMaxMemory() const {
+            return input.maxMemory;
+        }
+
+        void setMaxMemory(uint64_t maxMemory) {
+            this->input.maxMemory = maxMemory;
+        }
+
+        uint16_t getMinQual() const {
+            return input.minQual;
+        }
+
+        void setMinQual(uint16_t minQual) {
+            this->input.minQual = minQual;
+        }
+
+        path getHashServer() const {
+            return input.hashServer;
+        }
+
+        void setHashServer(const path& hashServer) {
+            this->input.hashServer = hashServer;
+        }
+
+        path getCacheDir() const {
+            return input.cacheDir;
+        }
+
+        void setCacheDir(const path& cacheDir) {
+            this->input.cacheDir = cacheDir;
+        }
+
+        uint64_t getCacheSize() const {
+            return input.cacheSize;
+        }
+
+        void setCacheSize(uint64_t cacheSize) {
+            this->input.cacheSize = cacheSize;
+        }
+
+        bool isCacheDigest() const {
+            return input.cacheDigest;
+        }
+
+        void setCacheDigest(bool cacheDigest) {
+            this->input.cacheDigest = cacheDigest;
+        }
+
+        path getCheckpointDir() const {
+            return input.checkpointDir;
+        }
+
+        void setCheckpointDir(const path& checkpointDir) {
+            this->input.checkpointDir = checkpointDir;
+        }
+
+        double getCheckpointInterval() const {
+            return input.checkpointInterval;
+        }
+
+        void setCheckpointInterval(double checkpointInterval) {
+            this->input.checkpointInterval = checkpointInterval;
+        }
+
+        bool isResume() const {
+            return input.resume;
+        }
+
+        void setResume(bool resume) {
+            this->input.resume = resume;
+        }
+
         uint16_t getMerLen() const {
             return input.merLen;
         }
@@ -234,6 +325,30 @@ namespace kat {
             this->input.dumpHash = dumpHash;
         }
 
+        bool isNuma() const {
+            return input.numa != NumaPlacement::NONE;
+        }
+
+        void setNuma(bool numa) {
+            this->input.numa = numa ? NumaPlacement::INTERLEAVE : NumaPlacement::NONE;
+        }
+
+        bool isHugePages() const {
+            return input.hugePages;
+        }
+
+        void setHugePages(bool hugePages) {
+            this->input.hugePages = hugePages;
+        }
+
+        uint16_t getPrefaultThreads() const {
+            return input.prefaultThreads;
+        }
+
+        void setPrefaultThreads(uint16_t prefaultThreads) {
+            this->input.prefaultThreads = prefaultThreads;
+        }
+
         bool isVerbose() const {
             return verbose;
         }
@@ -250,9 +365,11 @@ namespace kat {
 
     private:
 
+        void countTargeted();
+
         void processSeqFile();
         
-        void analyseBatch();
+        void analyseBatch(Metrics::Phase& phase);
         
         void analyseBatchSlice(int th_id);
         
@@ -291,8 +408,8 @@ namespace kat {
                             "Estimates coverage levels across sequences in the provided input sequence file.\n\n" \
                             "This tool will produce a fasta style representation of the input sequence file containing " \
                             "K-mer coverage counts mapped across each sequence.  K-mer coverage is determined from the " \
-                            "provided counts input file, which can be either one jellyfish hash, or one or more FastA / " \
-                            "FastQ files.  In addition, a space separated table file containing the mean coverage score and GC " \
+                            "provided counts input file, which can be either one jellyfish hash, one jellyfish bloom counter (approximate " \
+                            "counts of 0, 1 or 2+), or one or more FastA / FastQ files.  In addition, a space separated table file containing the mean coverage score and GC " \
                             "of each sequence is produced.  The row order is identical to the original sequence file.\n\n" \
                             "NOTE: K-mers containing any Ns derived from sequences in the sequence file not be included.\n\n" \
                             "Options";
@@ -0,0 +1,147 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <memory>
+using std::unique_ptr;
+
+#include <seqan/basic.h>
+#include <seqan/sequence.h>
+#include <seqan/seq_io.h>
+#include <seqan/bam_io.h>
+
+#include <boost/filesystem/path.hpp>
+using boost::filesystem::path;
+
+#include <kat/parallel_seq_reader.hpp>
+using kat::ParallelSeqReader;
+
+namespace kat {
+
+    /**
+     * Reads records from either a sequence file supported by seqan's SeqFileIn (FastA,
+     * FastQ, optionally gzipped) or an unaligned BAM file.  BAM files are read with
+     * seqan's bam_io, which decompresses BGZF blocks on multiple threads.  Secondary
+     * and supplementary alignments are skipped and reverse strand reads are restored
+     * to their original orientation, so each read is returned once, as sequenced.
+     */
+    class SeqFileReader {
+    private:
+
+        unique_ptr<seqan::SeqFileIn> seqIn;
+        unique_ptr<seqan::BamFileIn> bamIn;
+        seqan::BamAlignmentRecord record;
+        bool hasRecord;
+
+        // Moves to the next primary alignment
+        void nextBam() {
+            hasRecord = false;
+            while (!seqan::atEnd(*bamIn)) {
+                seqan::readRecord(record, *bamIn);
+                if ((record.flag & (0x100 | 0x800)) == 0) {
+                    hasRecord = true;
+                    return;
+                }
+            }
+        }
+
+    public:
+
+        SeqFileReader(const path& file) : hasRecord(false) {
+
+            if (ParallelSeqReader::isBamFile(file)) {
+                bamIn = unique_ptr<seqan::BamFileIn>(new seqan::BamFileIn(file.c_str()));
+                seqan::BamHeader header;
+                seqan::readHeader(header, *bamIn);
+                nextBam();
+            }
+            else {
+                seqIn = unique_ptr<seqan::SeqFileIn>(new seqan::SeqFileIn(file.c_str()));
+            }
+        }
+
+        bool isBam() const {
+            return bamIn != nullptr;
+        }
+
+        bool atEnd() {
+            return isBam() ? !hasRecord : seqan::atEnd(*seqIn);
+        }
+
+        void readRecord(seqan::CharString& name, seqan::CharString& seq, seqan::CharString& qual) {
+
+            if (!isBam()) {
+                seqan::readRecord(name, seq, qual, *seqIn);
+                return;
+            }
+
+            name = record.qName;
+            seq = record.seq;
+            qual = record.qual;
+
+            if (record.flag & 0x10) {
+                seqan::reverseComplement(record.seq);
+                seq = record.seq;
+                seqan::reverse(qual);
+            }
+
+            nextBam();
+        }
+
+        void readRecords(seqan::StringSet<seqan::CharString>& names, seqan::StringSet<seqan::CharString>& seqs, size_t maxRecords) {
+
+            if (!isBam()) {
+                seqan::readRecords(names, seqs, *seqIn, maxRecords);
+                return;
+            }
+
+            seqan::CharString name, seq, qual;
+            for(size_t i = 0; i < maxRecords && !atEnd(); i++) {
+                readRecord(name, seq, qual);
+                seqan::appendValue(names, name);
+                seqan::appendValue(seqs, seq);
+            }
+        }
+
+        /**
+         * Reads up to maxRecords records, stopping early once the sequences read 
+         * hold at least maxBases bases.  Always reads at least one record unless 
+         * at the end of the file.
+         */
+        void readRecords(seqan::StringSet<seqan::CharString>& names, seqan::StringSet<seqan::CharString>& seqs, size_t maxRecords, uint64_t maxBases) {
+
+            seqan::CharString name, seq, qual;
+            uint64_t bases = 0;
+            for(size_t i = 0; i < maxRecords && (i == 0 || bases < maxBases) && !atEnd(); i++) {
+                readRecord(name, seq, qual);
+                bases += seqan::length(seq);
+                seqan::appendValue(names, name);
+                seqan::appendValue(seqs, seq);
+            }
+        }
+
+        void close() {
+            if (isBam()) {
+                seqan::close(*bamIn);
+            }
+            else {
+                seqan::close(*seqIn);
+            }
+        }
+    };
+}
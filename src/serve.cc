@@ -0,0 +1,108 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/ioctl.h>
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <vector>
+using std::cout;
+using std::endl;
+using std::vector;
+
+#include <boost/filesystem/path.hpp>
+#include <boost/program_options.hpp>
+#include <boost/timer/timer.hpp>
+namespace po = boost::program_options;
+namespace bfs = boost::filesystem;
+using bfs::path;
+using boost::timer::auto_cpu_timer;
+
+#include <kat/hash_server.hpp>
+using kat::HashServer;
+
+#include "serve.hpp"
+
+int kat::Serve::main(int argc, char *argv[]) {
+
+    vector<path>    hashes;
+    path            socket;
+    bool            huge_pages;
+    bool            populate;
+    bool            help;
+
+    struct winsize w;
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+
+
+    // Declare the supported options.
+    po::options_description generic_options(Serve::helpMessage(), w.ws_col);
+    generic_options.add_options()
+            ("socket,s", po::value<path>(&socket)->default_value(DEFAULT_SERVE_SOCKET),
+                "Path of the UNIX domain socket to listen on.  Pass the same path to other tools using --hash_server.")
+            ("huge_pages", po::bool_switch(&huge_pages)->default_value(false),
+                "Back the hashes with transparent huge pages.  Lookups into large hashes are random, so with normal pages most of them miss the TLB.  Only has an effect if transparent huge pages are enabled in \"madvise\" or \"always\" mode.")
+            ("populate", po::bool_switch(&populate)->default_value(false),
+                "Read each hash file into memory up front, using all cores, rather than page by page as it's loaded.")
+            ("help", po::bool_switch(&help)->default_value(false), "Produce help message.")
+            ;
+
+    // Hidden options, will be allowed both on command line and
+    // in config file, but will not be shown to the user.
+    po::options_description hidden_options("Hidden options");
+    hidden_options.add_options()
+            ("hashes", po::value<std::vector<path>>(&hashes), "Path to the jellyfish hash(es) to serve.")
+            ;
+
+    // Positional option for the input hashes
+    po::positional_options_description p;
+    p.add("hashes", -1);
+
+    // Combine non-positional options
+    po::options_description cmdline_options;
+    cmdline_options.add(generic_options).add(hidden_options);
+
+    // Parse command line
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(p).run(), vm);
+    po::notify(vm);
+
+    // Output help information the exit if requested
+    if (help || argc <= 1 || hashes.empty()) {
+        cout << generic_options << endl;
+        return 1;
+    }
+
+
+
+    auto_cpu_timer timer(1, "KAT SERVE completed.\nTotal runtime: %ws\n\n");
+
+    cout << "Running KAT in SERVE mode" << endl
+         << "-------------------------" << endl << endl;
+
+    HashServer server(hashes, socket);
+    server.setHugePages(huge_pages);
+    server.setPrefaultThreads(populate ? std::max(1u, std::thread::hardware_concurrency()) : 0);
+    server.load(cout);
+    server.serve(cout);
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <string>
+using std::string;
+
+namespace kat {
+
+    const string DEFAULT_SERVE_SOCKET = "kat.sock";
+
+    /**
+     * Loads jellyfish hashes once and holds them in memory, answering K-mer count
+     * queries from other KAT runs given --hash_server
+     */
+    class Serve {
+    public:
+
+        static int main(int argc, char *argv[]);
+
+    protected:
+
+        static string helpMessage() {
+            return string("Usage: kat serve [options] (<jellyfish_hash>)+\n\n") +
+                    "Loads jellyfish hashes into memory and serves K-mer counts from them to other KAT runs.\n\n" \
+                    "Loading a large hash can take much longer than the work done with it, e.g. running sect " \
+                    "on a small assembly.  This tool loads the hashes once, and then answers count queries over a " \
+                    "UNIX domain socket until it is interrupted.  Pass the socket to sect, filter seq or comp using " \
+                    "--hash_server, and any of their inputs that are hashes held by the server are queried there " \
+                    "instead of being loaded.  Hashes are matched by path.  All hashes must share the same K-mer length.\n\n" \
+                    "Options";
+        }
+    };
+}
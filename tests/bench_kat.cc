@@ -0,0 +1,442 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+// Benchmarks of KAT's hot paths on synthetic data.  Build and run with
+// "make bench", or "make bench_kat && ./bench_kat --filter=get_count" to run
+// a subset.  Reads are generated the way jellyfish's generate_sequence does,
+// with a fixed seed, so runs are comparable between builds.
+
+#include <stdint.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+using std::ifstream;
+using std::make_shared;
+using std::map;
+using std::ofstream;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+#include <boost/filesystem.hpp>
+namespace bfs = boost::filesystem;
+using bfs::path;
+
+#include <jellyfish/randomc.h>
+
+#include <kat/batch_lookup.hpp>
+#include <kat/distance_metrics.hpp>
+#include <kat/input_handler.hpp>
+#include <kat/jellyfish_helper.hpp>
+#include <kat/memory_pages.hpp>
+#include <kat/sparse_matrix.hpp>
+#include <kat/thread_pool.hpp>
+using kat::BatchLookup;
+using kat::HashLoader;
+using kat::InputHandler;
+using kat::JellyfishHelper;
+using kat::MemoryPages;
+using kat::ThreadedSparseMatrix;
+using kat::ThreadPool;
+
+#include "benchmark.hpp"
+using kat::bench::State;
+using kat::bench::doNotOptimize;
+
+static const uint16_t MER_LEN = 27;
+static const int SEED = 42;
+
+static const vector<int64_t> BASES = {1000000, 10000000};
+static const vector<int64_t> THREADS = {1, 2, 4};
+
+/**
+ * Random bases and Illumina quality scores, as generated by jellyfish's
+ * generate_sequence
+ */
+class RandomDNA {
+public:
+
+    RandomDNA(CRandomMersenne& _rng) : rng(_rng), i(15), buff(0) {}
+
+    char letter() {
+        i = (i + 1) % 16;
+        if (i == 0) buff = rng.BRandom();
+        char res = "ACGT"[buff & 0x3];
+        buff >>= 2;
+        return res;
+    }
+
+    char qualIllumina() {
+        return rng.IRandom(66, 104);
+    }
+
+private:
+    CRandomMersenne& rng;
+    int i;
+    uint32_t buff;
+};
+
+/**
+ * Inputs shared by the benchmarks, created on first use and kept for the
+ * whole run so that repeated runs of a benchmark don't rebuild them
+ */
+class Fixtures {
+public:
+
+    Fixtures() {
+        dir = bfs::temp_directory_path() / bfs::unique_path("kat-bench-%%%%-%%%%");
+        bfs::create_directories(dir);
+    }
+
+    ~Fixtures() {
+        for (auto& h : pagedHashes) delete h.second;
+        boost::system::error_code ec;
+        bfs::remove_all(dir, ec);
+    }
+
+    /**
+     * FASTQ file of 70 base reads with the given total number of bases
+     */
+    const path& reads(int64_t bases) {
+        auto it = readFiles.find(bases);
+        if (it != readFiles.end()) return it->second;
+
+        path p = dir / ("reads_" + std::to_string(bases) + ".fq");
+        CRandomMersenne rng(SEED);
+        RandomDNA dna(rng);
+        ofstream out(p.c_str());
+        int64_t total = 0;
+        uint64_t id = 0;
+        while (total < bases) {
+            out << "@read_" << id++ << "\n";
+            int base;
+            for (base = 0; base < 70 && total < bases; base++, total++) out << dna.letter();
+            out << "\n+\n";
+            for (int j = 0; j < base; j++) out << dna.qualIllumina();
+            out << "\n";
+        }
+        return readFiles[bases] = p;
+    }
+
+    /**
+     * Canonical hash counted from reads(bases), with progress messages discarded
+     */
+    InputHandler& counted(int64_t bases) {
+        auto it = handlers.find(bases);
+        if (it != handlers.end()) return *it->second;
+
+        shared_ptr<InputHandler> handler = make_shared<InputHandler>();
+        handler->setSingleInput(reads(bases));
+        handler->canonical = true;
+        handler->merLen = MER_LEN;
+        handler->hashSize = bases;
+        handler->out = &quiet;
+        handler->count(std::thread::hardware_concurrency());
+        handlers[bases] = handler;
+        return *handler;
+    }
+
+    /**
+     * counted(bases) dumped to a file
+     */
+    const path& dumped(int64_t bases) {
+        auto it = hashFiles.find(bases);
+        if (it != hashFiles.end()) return it->second;
+
+        InputHandler& handler = counted(bases);
+        path p = dir / ("hash_" + std::to_string(bases) + ".jf27");
+        JellyfishHelper::dumpHash(handler.hash, *handler.header, 1, p, true);
+        return hashFiles[bases] = p;
+    }
+
+    /**
+     * Random keys for lookups into counted(bases), half of them present
+     */
+    const vector<mer_dna>& queries(int64_t bases) {
+        auto it = queryKeys.find(bases);
+        if (it != queryKeys.end()) return it->second;
+
+        vector<mer_dna>& keys = queryKeys[bases];
+        fillQueries(counted(bases).hash, keys);
+        return keys;
+    }
+
+    /**
+     * Hash of 2^log2Size entries, half filled with random K-mers, on normal or
+     * transparent huge pages, and random keys for lookups into it
+     */
+    std::pair<LargeHashArrayPtr, const vector<mer_dna>*> paged(int64_t log2Size, bool hugePages) {
+        auto key = std::make_pair(log2Size, hugePages);
+        auto it = pagedHashes.find(key);
+        if (it != pagedHashes.end()) return std::make_pair(it->second, &pagedQueries[key]);
+
+        const uint64_t size = 1ULL << log2Size;
+        LargeHashArrayPtr hash = new LargeHashArray(size, MER_LEN * 2, 7, 126, jellyfish::quadratic_reprobes);
+        if (hugePages && !MemoryPages::adviseHugePages(*hash)) {
+            std::cerr << "Transparent huge pages not supported" << std::endl;
+        }
+        srandom(SEED);
+        mer_dna m;
+        for (uint64_t i = 0; i < size / 2; i++) {
+            m.randomize();
+            hash->add(m, 1);
+        }
+        pagedHashes[key] = hash;
+        fillQueries(hash, pagedQueries[key]);
+        return std::make_pair(hash, &pagedQueries[key]);
+    }
+
+    /**
+     * The first length bases of reads(bases), as a single sequence
+     */
+    const string& sequence(int64_t bases, size_t length) {
+        auto key = std::make_pair(bases, (int64_t)length);
+        auto it = sequences.find(key);
+        if (it != sequences.end()) return it->second;
+
+        string& seq = sequences[key];
+        ifstream in(reads(bases).c_str());
+        string line;
+        for (uint64_t n = 0; seq.size() < length && std::getline(in, line); n++) {
+            if (n % 4 == 1) seq += line;
+        }
+        seq.resize(std::min(seq.size(), length));
+        return seq;
+    }
+
+private:
+
+    static const size_t NB_QUERIES = 1 << 20;
+
+    path dir;
+    std::ostream quiet{nullptr};
+    map<int64_t, path> readFiles;
+    map<int64_t, shared_ptr<InputHandler>> handlers;
+    map<int64_t, path> hashFiles;
+    map<int64_t, vector<mer_dna>> queryKeys;
+    map<std::pair<int64_t, bool>, LargeHashArrayPtr> pagedHashes;
+    map<std::pair<int64_t, bool>, vector<mer_dna>> pagedQueries;
+    map<std::pair<int64_t, int64_t>, string> sequences;
+
+    static void fillQueries(LargeHashArrayPtr hash, vector<mer_dna>& keys) {
+        keys.reserve(NB_QUERIES);
+        LargeHashArray::eager_iterator it = hash->eager_slice(0, 1);
+        while (keys.size() < NB_QUERIES / 2 && it.next()) {
+            keys.push_back(it.key());
+        }
+        srandom(SEED);
+        mer_dna m;
+        while (keys.size() < NB_QUERIES) {
+            m.randomize();
+            keys.push_back(m);
+        }
+        for (uint64_t i = keys.size() - 1; i > 0; i--) {
+            std::swap(keys[i], keys[random() % (i + 1)]);
+        }
+    }
+};
+
+static Fixtures& fixtures() {
+    static Fixtures f;
+    return f;
+}
+
+static void hash_load(State& state) {
+
+    const path& p = fixtures().dumped(state.range(0));
+    while (state.keepRunning()) {
+        HashLoader loader;
+        doNotOptimize(loader.loadHash(p, false));
+    }
+    state.setBytesProcessed(state.iterations() * bfs::file_size(p));
+}
+BENCHMARK(hash_load)->argNames({"bases"})->ranges({BASES});
+
+static void get_count(State& state) {
+
+    LargeHashArrayPtr hash = fixtures().counted(state.range(0)).hash;
+    const vector<mer_dna>& keys = fixtures().queries(state.range(0));
+    const size_t mask = keys.size() - 1;
+    size_t i = 0;
+    uint64_t total = 0;
+    while (state.keepRunning()) {
+        total += JellyfishHelper::getCount(hash, keys[i++ & mask], false);
+    }
+    doNotOptimize(total);
+    state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(get_count)->argNames({"bases"})->ranges({BASES});
+
+static void get_count_batched(State& state) {
+
+    const size_t batch = state.range(1);
+    InputHandler& handler = fixtures().counted(state.range(0));
+    const vector<mer_dna>& keys = fixtures().queries(state.range(0));
+    vector<uint64_t> words(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) words[i] = keys[i].word(0);
+    vector<uint64_t> counts(batch);
+
+    size_t offset = 0;
+    while (state.keepRunning()) {
+        if (offset + batch > words.size()) offset = 0;
+        handler.lookup->getCounts(words.data() + offset, batch, counts.data());
+        offset += batch;
+    }
+    doNotOptimize(counts[0]);
+    state.setItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(get_count_batched)->argNames({"bases", "batch"})->ranges({BASES, {64, 1024}});
+
+static void get_count_pages(State& state) {
+
+    auto hash = fixtures().paged(state.range(0), state.range(1) != 0);
+    const vector<mer_dna>& keys = *hash.second;
+    const size_t mask = keys.size() - 1;
+    size_t i = 0;
+    uint64_t total = 0;
+    while (state.keepRunning()) {
+        total += JellyfishHelper::getCount(hash.first, keys[i++ & mask], false);
+    }
+    doNotOptimize(total);
+    state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(get_count_pages)->argNames({"log2_size", "huge_pages"})->ranges({{20, 24}, {0, 1}});
+
+/**
+ * Random coordinates in a matrix the size of a comp matrix, skewed towards
+ * low counts as in a real spectrum
+ */
+static const uint16_t MATRIX_SIZE = 1001;
+static const size_t INCS_PER_ITERATION = 1 << 16;
+
+static void incRandom(ThreadedSparseMatrix& tsm, uint16_t index, size_t n, uint64_t seed) {
+    uint64_t x = seed * 0x9E3779B97F4A7C15ULL + 1;
+    for (size_t k = 0; k < n; k++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        const size_t i = (x & 0xFFFF) * (x & 0xFFFF) % MATRIX_SIZE / 8;
+        const size_t j = ((x >> 16) & 0xFFFF) * ((x >> 16) & 0xFFFF) % MATRIX_SIZE / 8;
+        tsm.incTM(index, i, j, 1);
+    }
+}
+
+static void sparse_matrix_inc(State& state) {
+
+    const uint16_t threads = state.range(0);
+    ThreadedSparseMatrix tsm(MATRIX_SIZE, MATRIX_SIZE, threads);
+    uint64_t round = 0;
+    while (state.keepRunning()) {
+        round++;
+        ThreadPool::global().parallelFor(threads, [&](size_t t) {
+            incRandom(tsm, t, INCS_PER_ITERATION / threads, round * threads + t);
+        });
+    }
+    state.setItemsProcessed(state.iterations() * INCS_PER_ITERATION);
+}
+BENCHMARK(sparse_matrix_inc)->argNames({"threads"})->ranges({THREADS});
+
+static void sparse_matrix_merge(State& state) {
+
+    const uint16_t threads = state.range(0);
+    ThreadedSparseMatrix tsm(MATRIX_SIZE, MATRIX_SIZE, threads);
+    for (uint16_t t = 0; t < threads; t++) {
+        incRandom(tsm, t, INCS_PER_ITERATION * 4, t);
+    }
+    while (state.keepRunning()) {
+        doNotOptimize(tsm.mergeThreadedMatricies());
+    }
+    state.setItemsProcessed(state.iterations() * MATRIX_SIZE * MATRIX_SIZE * threads);
+}
+BENCHMARK(sparse_matrix_merge)->argNames({"threads"})->ranges({THREADS});
+
+static void count_seq_file(State& state) {
+
+    const int64_t bases = state.range(0);
+    const uint16_t threads = state.range(1);
+    const path& p = fixtures().reads(bases);
+    while (state.keepRunning()) {
+        HashCounter hc(bases, MER_LEN * 2, 7, threads);
+        doNotOptimize(JellyfishHelper::countSeqFile(p, hc, true, threads));
+    }
+    state.setBytesProcessed(state.iterations() * bfs::file_size(p));
+    state.setItemsProcessed(state.iterations() * bases);
+}
+BENCHMARK(count_seq_file)->argNames({"bases", "threads"})->ranges({BASES, THREADS});
+
+/**
+ * Looks up the count of every K-mer along a sequence, as sect does for each
+ * base, with batched lookups or one K-mer at a time
+ */
+static void sect_per_base(State& state) {
+
+    const size_t length = 10000;
+    InputHandler& handler = fixtures().counted(state.range(0));
+    const string& seq = fixtures().sequence(state.range(0), length);
+
+    kat::BatchLookupPtr lookup = handler.lookup;
+    if (state.range(1) == 0) handler.lookup = nullptr;
+
+    uint64_t total = 0;
+    while (state.keepRunning()) {
+        handler.forEachCount(seq, [&](size_t pos, bool valid, uint64_t count) { total += count; });
+    }
+    handler.lookup = lookup;
+
+    doNotOptimize(total);
+    state.setBytesProcessed(state.iterations() * seq.size());
+    state.setItemsProcessed(state.iterations() * (seq.size() - MER_LEN + 1));
+}
+BENCHMARK(sect_per_base)->argNames({"bases", "batched"})->ranges({BASES, {0, 1}});
+
+/**
+ * Distance between two random spectra of the given length
+ */
+template<typename M>
+static void distance(State& state) {
+
+    const size_t length = state.range(0);
+    CRandomMersenne rng(SEED);
+    vector<uint64_t> s1(length), s2(length);
+    for (size_t i = 0; i < length; i++) {
+        s1[i] = rng.IRandom(0, 1000000) / (i + 1);
+        s2[i] = rng.IRandom(0, 1000000) / (i + 1);
+    }
+    M m;
+    kat::DistanceMetric& metric = m;
+    while (state.keepRunning()) {
+        doNotOptimize(metric.calcDistance(s1, s2));
+    }
+    state.setItemsProcessed(state.iterations() * length);
+}
+BENCHMARK(distance<kat::ManhattanDistance>)->argNames({"length"})->ranges({{1000, 10000}});
+BENCHMARK(distance<kat::EuclideanDistance>)->argNames({"length"})->ranges({{1000, 10000}});
+BENCHMARK(distance<kat::CosineDistance>)->argNames({"length"})->ranges({{1000, 10000}});
+BENCHMARK(distance<kat::CanberraDistance>)->argNames({"length"})->ranges({{1000, 10000}});
+BENCHMARK(distance<kat::JaccardDistance>)->argNames({"length"})->ranges({{1000, 10000}});
+
+int main(int argc, char* argv[]) {
+
+    mer_dna::k(MER_LEN);
+    ThreadPool::init(*std::max_element(THREADS.begin(), THREADS.end()));
+
+    return kat::bench::runBenchmarks(argc, argv);
+}
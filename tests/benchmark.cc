@@ -0,0 +1,184 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <sstream>
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ostringstream;
+
+#include "benchmark.hpp"
+
+using kat::bench::Benchmark;
+using kat::bench::State;
+
+static const uint64_t MAX_ITERATIONS = 1000000000;
+
+kat::bench::Benchmark::Benchmark(const string& _name, BenchmarkFunction _function) :
+    name(_name), function(_function) {
+    registry().push_back(this);
+}
+
+Benchmark* kat::bench::Benchmark::ranges(const vector<vector<int64_t>>& values) {
+
+    vector<vector<int64_t>> combos(1);
+    for (auto& v : values) {
+        vector<vector<int64_t>> next;
+        for (auto& c : combos) {
+            for (auto x : v) {
+                next.push_back(c);
+                next.back().push_back(x);
+            }
+        }
+        combos = next;
+    }
+    argSets.insert(argSets.end(), combos.begin(), combos.end());
+    return this;
+}
+
+string kat::bench::Benchmark::runName(const vector<int64_t>& a) const {
+
+    ostringstream ss;
+    ss << name;
+    for (size_t i = 0; i < a.size(); i++) {
+        ss << "/";
+        if (i < names.size()) ss << names[i] << ":";
+        ss << a[i];
+    }
+    return ss.str();
+}
+
+vector<Benchmark*>& kat::bench::Benchmark::registry() {
+    static vector<Benchmark*> benchmarks;
+    return benchmarks;
+}
+
+static string humanRate(double perSecond, const string& unit) {
+
+    const char* prefixes[] = {"", "k", "M", "G", "T"};
+    size_t p = 0;
+    while (perSecond >= 1000.0 && p < 4) {
+        perSecond /= 1000.0;
+        p++;
+    }
+    ostringstream ss;
+    ss << std::fixed << std::setprecision(p == 0 ? 0 : 2) << perSecond << prefixes[p] << unit << "/s";
+    return ss.str();
+}
+
+static string humanTime(double ns) {
+
+    const char* units[] = {"ns", "us", "ms", "s"};
+    size_t u = 0;
+    while (ns >= 10000.0 && u < 3) {
+        ns /= 1000.0;
+        u++;
+    }
+    ostringstream ss;
+    ss << std::fixed << std::setprecision(1) << ns << " " << units[u];
+    return ss.str();
+}
+
+/**
+ * Runs one benchmark with increasing iteration counts until it takes at least
+ * minTime seconds, and returns the state of the final run
+ */
+static State runOnce(const Benchmark& b, const vector<int64_t>& a, double minTime) {
+
+    uint64_t n = 1;
+    while (true) {
+        State state(a, n);
+        b.getFunction()(state);
+        const double s = state.seconds();
+        if (s >= minTime || n >= MAX_ITERATIONS) {
+            return state;
+        }
+        // Aim 40% past the target so the next run usually suffices
+        double multiplier = s <= 0.0 ? 10.0 : minTime * 1.4 / s;
+        multiplier = std::min(10.0, std::max(1.5, multiplier));
+        n = std::min(MAX_ITERATIONS, (uint64_t)(n * multiplier) + 1);
+    }
+}
+
+int kat::bench::runBenchmarks(int argc, char* argv[]) {
+
+    string filter = ".";
+    double minTime = 0.5;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--min_time=", 11) == 0) {
+            minTime = atof(argv[i] + 11);
+        }
+        else if (strcmp(argv[i], "--list") == 0) {
+            for (auto b : Benchmark::registry()) {
+                for (auto& a : b->getArgSets().empty() ? vector<vector<int64_t>>(1) : b->getArgSets()) {
+                    cout << b->runName(a) << endl;
+                }
+            }
+            return 0;
+        }
+        else {
+            cerr << "Usage: " << argv[0] << " [--filter=<regex>] [--min_time=<seconds>] [--list]" << endl;
+            return 1;
+        }
+    }
+
+    std::regex re;
+    try {
+        re = std::regex(filter);
+    }
+    catch(std::regex_error& e) {
+        cerr << "Invalid filter: " << filter << endl;
+        return 1;
+    }
+
+    cout << std::left << std::setw(50) << "Benchmark"
+         << std::right << std::setw(16) << "Time"
+         << std::setw(14) << "Iterations"
+         << std::setw(16) << "Items"
+         << std::setw(16) << "Bytes" << endl
+         << string(112, '-') << endl;
+
+    for (auto b : Benchmark::registry()) {
+        for (auto& a : b->getArgSets().empty() ? vector<vector<int64_t>>(1) : b->getArgSets()) {
+
+            const string name = b->runName(a);
+            if (!std::regex_search(name, re)) continue;
+
+            State state = runOnce(*b, a, minTime);
+            const double s = state.seconds();
+
+            cout << std::left << std::setw(50) << name
+                 << std::right << std::setw(16) << humanTime(s * 1e9 / state.iterations())
+                 << std::setw(14) << state.iterations()
+                 << std::setw(16) << (state.getItemsProcessed() > 0 ? humanRate(state.getItemsProcessed() / s, "") : "")
+                 << std::setw(16) << (state.getBytesProcessed() > 0 ? humanRate(state.getBytesProcessed() / s, "B") : "")
+                 << endl;
+        }
+    }
+
+    return 0;
+}
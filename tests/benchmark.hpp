@@ -0,0 +1,170 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+/**
+ * A minimal benchmark harness in the style of Google Benchmark.  A benchmark
+ * is a function taking a State, which times the loop body:
+ *
+ *     static void get_count(State& state) {
+ *         ... setup, not timed ...
+ *         while (state.keepRunning()) {
+ *             ... measured operation ...
+ *         }
+ *         state.setItemsProcessed(state.iterations());
+ *     }
+ *     BENCHMARK(get_count)->argNames({"log2_size"})->arg(20)->arg(24);
+ *
+ * The runner repeats each benchmark with more iterations until it runs for at
+ * least the minimum time, then reports the time per iteration and throughput.
+ */
+namespace kat { namespace bench {
+
+    class State {
+    public:
+
+        State(const vector<int64_t>& _args, uint64_t _maxIterations) :
+            args(_args), maxIterations(_maxIterations) {}
+
+        /**
+         * True while more iterations are wanted.  The first call starts the
+         * timer and the last one stops it.
+         */
+        bool keepRunning() {
+            if (done == 0 && !running) {
+                resumeTiming();
+            }
+            if (done < maxIterations) {
+                done++;
+                return true;
+            }
+            pauseTiming();
+            return false;
+        }
+
+        /**
+         * Exclude work inside the loop from the timing, e.g. resetting state
+         * between iterations
+         */
+        void pauseTiming() {
+            if (running) {
+                elapsed += clock::now() - start;
+                running = false;
+            }
+        }
+
+        void resumeTiming() {
+            if (!running) {
+                start = clock::now();
+                running = true;
+            }
+        }
+
+        int64_t range(size_t i) const { return args.at(i); }
+        uint64_t iterations() const { return maxIterations; }
+        double seconds() const { return std::chrono::duration<double>(elapsed).count(); }
+
+        void setItemsProcessed(uint64_t items) { this->items = items; }
+        void setBytesProcessed(uint64_t bytes) { this->bytes = bytes; }
+        uint64_t getItemsProcessed() const { return items; }
+        uint64_t getBytesProcessed() const { return bytes; }
+
+    private:
+
+        typedef std::chrono::steady_clock clock;
+
+        vector<int64_t> args;
+        uint64_t maxIterations;
+        uint64_t done = 0;
+        bool running = false;
+        clock::time_point start;
+        clock::duration elapsed = clock::duration::zero();
+        uint64_t items = 0;
+        uint64_t bytes = 0;
+    };
+
+    typedef void (*BenchmarkFunction)(State&);
+
+    class Benchmark {
+    public:
+
+        Benchmark(const string& _name, BenchmarkFunction _function);
+
+        /**
+         * Adds a run with one or several arguments, read with State::range
+         */
+        Benchmark* arg(int64_t a) { argSets.push_back(vector<int64_t>(1, a)); return this; }
+        Benchmark* args(const vector<int64_t>& a) { argSets.push_back(a); return this; }
+
+        /**
+         * Adds a run for each combination of the given argument values
+         */
+        Benchmark* ranges(const vector<vector<int64_t>>& values);
+
+        /**
+         * Names the arguments in the report, e.g. "count_seq_file/bases:1000000/threads:4"
+         */
+        Benchmark* argNames(const vector<string>& names) { this->names = names; return this; }
+
+        const string& getName() const { return name; }
+        BenchmarkFunction getFunction() const { return function; }
+        const vector<vector<int64_t>>& getArgSets() const { return argSets; }
+
+        /**
+         * Name of one run, including its arguments
+         */
+        string runName(const vector<int64_t>& a) const;
+
+        static vector<Benchmark*>& registry();
+
+    private:
+
+        string name;
+        BenchmarkFunction function;
+        vector<vector<int64_t>> argSets;
+        vector<string> names;
+    };
+
+    /**
+     * Runs the registered benchmarks whose names match --filter=<regex>, each
+     * for at least --min_time=<seconds>.  Returns a process exit code.
+     */
+    int runBenchmarks(int argc, char* argv[]);
+
+    /**
+     * Stops the compiler optimising away a value that is computed but unused
+     */
+    template<typename T>
+    inline void doNotOptimize(const T& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+}}
+
+#define KAT_BENCHMARK_CONCAT2(a, b) a##b
+#define KAT_BENCHMARK_CONCAT(a, b) KAT_BENCHMARK_CONCAT2(a, b)
+
+#define BENCHMARK(f) \
+    static kat::bench::Benchmark* KAT_BENCHMARK_CONCAT(benchmark_, __LINE__) __attribute__((unused)) = \
+        (new kat::bench::Benchmark(#f, f))
@@ -0,0 +1,97 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include <kat/batch_lookup.hpp>
+#include <kat/fixed_mer.hpp>
+#include <kat/jellyfish_helper.hpp>
+using kat::BatchLookup;
+using kat::FixedMer;
+using kat::JellyfishHelper;
+
+namespace kat {
+
+// Looks up every K-mer in a counted hash, plus as many random K-mers, and checks
+// the batched buckets and counts match jellyfish's own
+void checkBatchLookup(unsigned int merLen) {
+
+    HashCounter hc(100000, merLen * 2, 7, 1);
+    LargeHashArrayPtr hash = JellyfishHelper::countSeqFile(DATADIR "/ecoli_r1.1K.fastq", hc, true, 1);
+    BatchLookup lookup(*hash);
+
+    std::mt19937_64 rng(merLen);
+    const uint64_t mask = merLen == 32 ? ~(uint64_t)0 : ((uint64_t)1 << (2 * merLen)) - 1;
+
+    vector<uint64_t> keys;
+    LargeHashArray::eager_iterator it = hash->eager_slice(0, 1);
+    while (it.next()) {
+        keys.push_back(it.key().word(0));
+        keys.push_back(rng() & mask);
+    }
+    ASSERT_GT( keys.size(), 1000u );
+
+    // Odd length, so the tails after the vectorised loops are used too
+    keys.push_back(rng() & mask);
+
+    vector<uint64_t> ids(keys.size()), counts(keys.size());
+    lookup.bucketIds(keys.data(), keys.size(), ids.data());
+    lookup.getCounts(keys.data(), keys.size(), counts.data());
+
+    mer_dna m;
+    uint64_t found = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        FixedMer<uint64_t>::toMer(keys[i], m);
+        EXPECT_EQ( ids[i], hash->matrix().times(m) & hash->size_mask() );
+        EXPECT_EQ( counts[i], JellyfishHelper::getCount(hash, m, false) );
+        if (counts[i] > 0) found++;
+    }
+    EXPECT_GE( found, keys.size() / 2 );
+}
+
+TEST(batch_lookup, counts) {
+    checkBatchLookup(17);
+    checkBatchLookup(27);
+    checkBatchLookup(32);
+}
+
+TEST(batch_lookup, canonicalise) {
+
+    for (unsigned int merLen : { 1, 13, 31, 32 }) {
+
+        mer_dna::k(merLen);
+
+        std::mt19937_64 rng(merLen);
+        const uint64_t mask = merLen == 32 ? ~(uint64_t)0 : ((uint64_t)1 << (2 * merLen)) - 1;
+
+        vector<uint64_t> keys(103);
+        for (auto& k : keys) k = rng() & mask;
+        vector<uint64_t> canon = keys;
+        BatchLookup::canonicalise(canon.data(), canon.size(), merLen);
+
+        mer_dna m, expected;
+        for (size_t i = 0; i < keys.size(); i++) {
+            FixedMer<uint64_t>::toMer(keys[i], m);
+            FixedMer<uint64_t>::toMer(canon[i], expected);
+            EXPECT_EQ( expected, m.get_canonical() ) << merLen << "-mer " << m.to_str();
+        }
+    }
+}
+
+}
@@ -18,8 +18,10 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <sstream>
 using std::shared_ptr;
 using std::make_shared;
+using std::stringstream;
 
 #include <kat/comp_counters.hpp>
 using kat::ThreadedCompCounters;
@@ -60,3 +62,47 @@ TEST( comp_counters, threaded_counters ) {
     EXPECT_EQ( tcc.getFinalMatrix().hash1_total, 60);
     
 }
+
+TEST( comp_counters, save_load ) {
+
+    CompCounters cc("path1", "path2", "", 1001);
+    cc.updateHash1Counters(10, 2);
+    cc.updateHash1Counters(20, 0);
+    cc.updateHash2Counters(0, 3);
+    cc.updateSharedCounters(10, 2);
+    
+    stringstream ss;
+    cc.save(ss);
+    CompCounters loaded = CompCounters::load(ss);
+    
+    EXPECT_EQ( loaded.hash1_path, path("path1") );
+    EXPECT_EQ( loaded.hash1_total, 30 );
+    EXPECT_EQ( loaded.hash1_only_distinct, 1 );
+    EXPECT_EQ( loaded.hash2_only_total, 3 );
+    EXPECT_EQ( loaded.shared_distinct, 1 );
+    EXPECT_EQ( loaded.spectrum1, cc.spectrum1 );
+    EXPECT_EQ( loaded.shared_spectrum2, cc.shared_spectrum2 );
+    
+    // Counters from separate shards add up
+    loaded.add(cc);
+    EXPECT_EQ( loaded.hash1_distinct, 4 );
+    EXPECT_EQ( loaded.spectrum1[10], 2 );
+    EXPECT_EQ( loaded.hash1_path, path("path1") );
+}
+
+TEST( comp_counters, scale_up ) {
+
+    CompCounters cc("path1", "path2", "", 1001);
+    cc.updateHash1Counters(10, 2);
+    cc.updateHash2Counters(10, 2);
+    cc.updateSharedCounters(10, 2);
+    
+    // Counters from a sketch keeping 1 in 100 K-mers stand for 100 times as many
+    cc.scaleUp(100);
+    
+    EXPECT_EQ( cc.hash1_distinct, 100 );
+    EXPECT_EQ( cc.hash1_total, 1000 );
+    EXPECT_EQ( cc.shared_distinct, 100 );
+    EXPECT_EQ( cc.spectrum1[10], 100 );
+    EXPECT_EQ( cc.shared_spectrum2[2], 100 );
+}
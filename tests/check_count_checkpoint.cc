@@ -0,0 +1,228 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <zlib.h>
+#include <fstream>
+#include <sstream>
+#include <thread>
+using std::thread;
+
+#include <boost/filesystem.hpp>
+namespace bfs = boost::filesystem;
+
+#include <kat/count_checkpoint.hpp>
+#include <kat/jellyfish_helper.hpp>
+#include <kat/parallel_seq_reader.hpp>
+using kat::CountCheckpoint;
+using kat::JellyfishHelper;
+
+namespace kat {
+
+static uint64_t distinct(LargeHashArray& ary) {
+    uint64_t n = 0;
+    LargeHashArray::eager_iterator it = ary.eager_slice(0, 1);
+    while (it.next()) n++;
+    return n;
+}
+
+static uint64_t total(LargeHashArray& ary) {
+    uint64_t n = 0;
+    LargeHashArray::eager_iterator it = ary.eager_slice(0, 1);
+    while (it.next()) n += it.val();
+    return n;
+}
+
+static void expectSameCounts(LargeHashArray& expected, LargeHashArray& actual) {
+    EXPECT_EQ( distinct(expected), distinct(actual) );
+    LargeHashArray::eager_iterator it = expected.eager_slice(0, 1);
+    while (it.next()) {
+        uint64_t val = 0;
+        EXPECT_TRUE( actual.get_val_for_key(it.key(), &val) );
+        EXPECT_EQ( val, it.val() );
+    }
+}
+
+/**
+ * Counts the first units of a file, as a run interrupted part way through it
+ * would have, and returns how many units were counted
+ */
+static size_t countFirstUnits(const path& file, size_t units, uint16_t threads, HashCounter& counter) {
+    vector<ParallelSeqReaderPtr> readers(1, make_shared<ParallelSeqReader>(file, 27, threads));
+    readers[0]->setUnitLimit(units);
+    vector<thread> t(threads);
+    for (uint16_t i = 0; i < threads; i++) {
+        t[i] = thread(&JellyfishHelper::countSliceParallel, std::ref(counter), std::ref(readers), true);
+    }
+    for (auto& th : t) th.join();
+    EXPECT_TRUE( readers[0]->getError().empty() );
+    EXPECT_FALSE( readers[0]->isFinished() );
+    return readers[0]->getUnitsStarted();
+}
+
+/**
+ * Checkpoints a count interrupted part way through the file, resumes it, and
+ * checks the counts match a count of the whole file
+ */
+static void checkResumeMidFile(const path& file, size_t units, uint16_t threads) {
+
+    path dir = bfs::temp_directory_path() / bfs::unique_path("kat-checkpoint-%%%%-%%%%");
+    vector<path> inputs(1, file);
+
+    mer_dna::k(27);
+    HashCounter plain(1000000, 27 * 2, 7, threads);
+    LargeHashArrayPtr expected = JellyfishHelper::countSeqFile(inputs, plain, true, threads);
+
+    mer_dna::k(27);
+    HashCounter first(1000000, 27 * 2, 7, threads);
+    const size_t counted = countFirstUnits(file, units, threads, first);
+    EXPECT_EQ( counted, units );
+    {
+        CountCheckpoint interrupted(dir, 0.0);
+        interrupted.setRun(inputs, vector<uint16_t>(1, 27), true, 0, 1.0, threads);
+        CountCheckpoint::Position position;
+        position.unit = counted;
+        interrupted.save(vector<LargeHashArrayPtr>(1, first.ary()), position);
+        EXPECT_TRUE( interrupted.wait() );
+    }
+
+    // Only part of the file was counted before the interruption
+    EXPECT_GT( total(*first.ary()), 0u );
+    EXPECT_LT( total(*first.ary()), total(*expected) );
+
+    CountCheckpoint checkpoint(dir, 3600.0);
+    HashCounter counter(1000000, 27 * 2, 7, threads);
+    LargeHashArrayPtr actual = JellyfishHelper::countSeqFile(inputs, counter, true, threads, 0, &checkpoint);
+
+    expectSameCounts(*expected, *actual);
+    EXPECT_FALSE( checkpoint.exists() );
+
+    bfs::remove_all(dir);
+}
+
+TEST(count_checkpoint, periodic) {
+
+    path dir = bfs::temp_directory_path() / bfs::unique_path("kat-checkpoint-%%%%-%%%%");
+    vector<path> inputs;
+    inputs.push_back(DATADIR "/ecoli_r1.1K.fastq");
+    inputs.push_back(DATADIR "/ecoli_r2.1K.fastq");
+
+    HashCounter plain(100000, 27 * 2, 7, 2);
+    LargeHashArrayPtr expected = JellyfishHelper::countSeqFile(inputs, plain, true, 2);
+
+    // Checkpoints after every round, which shouldn't change the counts
+    CountCheckpoint checkpoint(dir, 0.0);
+    HashCounter counter(100000, 27 * 2, 7, 2);
+    LargeHashArrayPtr actual = JellyfishHelper::countSeqFile(inputs, counter, true, 2, 0, &checkpoint);
+
+    EXPECT_GT( checkpoint.getNbSaved(), 0u );
+    EXPECT_FALSE( checkpoint.exists() );
+    expectSameCounts(*expected, *actual);
+
+    bfs::remove_all(dir);
+}
+
+TEST(count_checkpoint, resume) {
+
+    path dir = bfs::temp_directory_path() / bfs::unique_path("kat-checkpoint-%%%%-%%%%");
+    vector<path> inputs;
+    inputs.push_back(DATADIR "/ecoli_r1.1K.fastq");
+    inputs.push_back(DATADIR "/ecoli_r2.1K.fastq");
+
+    HashCounter plain(100000, 27 * 2, 7, 1);
+    LargeHashArrayPtr expected = JellyfishHelper::countSeqFile(inputs, plain, true, 1);
+
+    // Pretend a run was interrupted after counting the first file
+    HashCounter first(100000, 27 * 2, 7, 1);
+    LargeHashArrayPtr partial = JellyfishHelper::countSeqFile(inputs[0], first, true, 1);
+    {
+        CountCheckpoint interrupted(dir, 0.0);
+        interrupted.setRun(inputs, vector<uint16_t>(1, 27), true, 0, 1.0, 1);
+        CountCheckpoint::Position position;
+        position.file = 1;
+        interrupted.save(vector<LargeHashArrayPtr>(1, partial), position);
+        EXPECT_TRUE( interrupted.wait() );
+        EXPECT_EQ( interrupted.getNbSaved(), 1u );
+    }
+
+    CountCheckpoint checkpoint(dir, 3600.0);
+    EXPECT_TRUE( checkpoint.exists() );
+    HashCounter counter(100000, 27 * 2, 7, 1);
+    LargeHashArrayPtr actual = JellyfishHelper::countSeqFile(inputs, counter, true, 1, 0, &checkpoint);
+
+    expectSameCounts(*expected, *actual);
+    EXPECT_FALSE( checkpoint.exists() );
+
+    bfs::remove_all(dir);
+}
+
+TEST(count_checkpoint, different_run) {
+
+    path dir = bfs::temp_directory_path() / bfs::unique_path("kat-checkpoint-%%%%-%%%%");
+    vector<path> inputs(1, DATADIR "/ecoli_r1.1K.fastq");
+
+    mer_dna::k(27);
+    HashCounter counter(100000, 27 * 2, 7, 1);
+    {
+        CountCheckpoint checkpoint(dir, 0.0);
+        checkpoint.setRun(inputs, vector<uint16_t>(1, 27), true, 0, 1.0, 1);
+        checkpoint.save(vector<LargeHashArrayPtr>(1, counter.ary()), CountCheckpoint::Position());
+        EXPECT_TRUE( checkpoint.wait() );
+    }
+
+    // Quality filtering changes the counts, so the checkpoint can't be used
+    CountCheckpoint checkpoint(dir, 0.0);
+    checkpoint.setRun(inputs, vector<uint16_t>(1, 27), true, 20, 1.0, 1);
+    vector<LargeHashArrayPtr> hashes;
+    CountCheckpoint::Position position;
+    uint16_t threads = 0;
+    EXPECT_THROW( checkpoint.load(hashes, position, threads), CountCheckpointException );
+
+    bfs::remove_all(dir);
+}
+
+TEST(count_checkpoint, resume_mid_file) {
+
+    // The test reads are split into several units of 64KB
+    ParallelSeqReader reader(DATADIR "/ecoli_r1.1K.fastq", 27, 2);
+    ASSERT_GT( reader.getNbUnits(), 2u );
+
+    checkResumeMidFile(DATADIR "/ecoli_r1.1K.fastq", 2, 2);
+}
+
+TEST(count_checkpoint, resume_mid_gzip) {
+
+    // Gzipped input is cut into 4MB units as it is decompressed, so repeat the
+    // test reads until there are a few
+    path gz = bfs::temp_directory_path() / bfs::unique_path("kat-checkpoint-%%%%-%%%%.fastq.gz");
+    std::ifstream in(DATADIR "/ecoli_r1.1K.fastq");
+    std::stringstream reads;
+    reads << in.rdbuf();
+    gzFile out = gzopen(gz.c_str(), "wb");
+    ASSERT_TRUE( out != NULL );
+    for (int i = 0; i < 40; i++) {
+        gzwrite(out, reads.str().data(), reads.str().size());
+    }
+    gzclose(out);
+
+    checkResumeMidFile(gz, 1, 2);
+
+    bfs::remove(gz);
+}
+
+}
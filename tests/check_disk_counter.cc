@@ -0,0 +1,90 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+using boost::filesystem::remove;
+
+#include <kat/jellyfish_helper.hpp>
+#include <kat/disk_counter.hpp>
+using kat::JellyfishHelper;
+using kat::DiskCounter;
+using kat::HashLoader;
+
+namespace kat {
+
+TEST(disk_counter, buckets) {
+
+    // Pipes and other inputs of unknown size get the default
+    EXPECT_EQ( DiskCounter::calcNbBuckets(0, 27, 1000000), DEFAULT_DISK_BUCKETS );
+
+    // Tiny input fits in a single bucket
+    EXPECT_EQ( DiskCounter::calcNbBuckets(1000, 27, 1000000000), 1 );
+
+    // Huge input with a small limit is capped
+    EXPECT_EQ( DiskCounter::calcNbBuckets(1000000000000, 27, 1000000), MAX_DISK_BUCKETS );
+}
+
+void checkDiskCount(bool canonical) {
+
+    path seqFile(DATADIR "/ecoli_r1.1K.fastq");
+    path diskHash("disk_counter_test.jf27");
+
+    // Reference counts in memory
+    HashCounter hc(1000000, 27 * 2, 7, 1);
+    LargeHashArrayPtr memHash = JellyfishHelper::countSeqFile(seqFile, hc, canonical, 1);
+
+    // Same again out-of-core, forcing the K-mers to be spread across several buckets
+    vector<path> seqFiles;
+    seqFiles.push_back(seqFile);
+    DiskCounter dc(27, canonical, 100000000, 2);
+    dc.setNbBuckets(8);
+    dc.count(seqFiles, diskHash);
+
+    HashLoader hl;
+    LargeHashArrayPtr diskHashArray = hl.loadHash(diskHash, false);
+
+    EXPECT_EQ( hl.getHeader().format(), "binary/sorted" );
+    EXPECT_EQ( hl.getCanonical(), canonical );
+
+    uint64_t memDistinct = 0;
+    uint64_t mismatches = 0;
+    LargeHashArray::eager_iterator it = memHash->eager_slice(0, 1);
+    while (it.next()) {
+        memDistinct++;
+        if (JellyfishHelper::getCount(diskHashArray, it.key(), false) != it.val()) {
+            mismatches++;
+        }
+    }
+
+    EXPECT_GT( memDistinct, 0 );
+    EXPECT_EQ( dc.getDistinct(), memDistinct );
+    EXPECT_EQ( mismatches, 0 );
+
+    remove(diskHash);
+}
+
+TEST(disk_counter, canonical) {
+    checkDiskCount(true);
+}
+
+TEST(disk_counter, non_canonical) {
+    checkDiskCount(false);
+}
+
+}
@@ -0,0 +1,115 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+#include <string>
+using std::string;
+using std::unique_ptr;
+
+#include <kat/distance_matrix.hpp>
+#include <kat/distance_metrics.hpp>
+using kat::DistanceMatrix;
+using kat::DistanceMetric;
+using kat::PairSums;
+
+namespace kat {
+
+static vector<vector<uint64_t>> randomSpectra(size_t n, size_t maxBins) {
+    std::mt19937_64 rng(42);
+    vector<vector<uint64_t>> spectra(n);
+    for (auto& s : spectra) {
+        s.resize(maxBins - rng() % 50);
+        for (auto& v : s) {
+            // Plenty of empty bins, as in real spectra
+            v = rng() % 3 == 0 ? 0 : rng() % 10000;
+        }
+    }
+    return spectra;
+}
+
+TEST(distance_matrix, sums) {
+
+    // Not a multiple of 4, so the vectorised kernel has a tail to finish
+    vector<double> a(1003), b(1003);
+    std::mt19937_64 rng(7);
+    for (size_t i = 0; i < a.size(); i++) {
+        a[i] = rng() % 5 == 0 ? 0 : rng() % 1000;
+        b[i] = rng() % 5 == 0 ? 0 : rng() % 1000;
+    }
+
+    PairSums s;
+    DistanceMatrix::addSums(a.data(), b.data(), a.size(), s);
+
+    double l1 = 0, l2 = 0, dot = 0, minSum = 0, maxSum = 0, canberra = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        l1 += std::abs(a[i] - b[i]);
+        l2 += (a[i] - b[i]) * (a[i] - b[i]);
+        dot += a[i] * b[i];
+        minSum += std::min(a[i], b[i]);
+        maxSum += std::max(a[i], b[i]);
+        if (a[i] + b[i] > 0) canberra += std::abs(a[i] - b[i]) / (a[i] + b[i]);
+    }
+
+    EXPECT_DOUBLE_EQ( s.l1, l1 );
+    EXPECT_DOUBLE_EQ( s.l2, l2 );
+    EXPECT_DOUBLE_EQ( s.dot, dot );
+    EXPECT_DOUBLE_EQ( s.minSum, minSum );
+    EXPECT_DOUBLE_EQ( s.maxSum, maxSum );
+    EXPECT_NEAR( s.canberra, canberra, 1e-9 * canberra );
+}
+
+TEST(distance_matrix, matches_metrics) {
+
+    // More spectra and bins than fit in one tile
+    vector<vector<uint64_t>> spectra = randomSpectra(DistanceMatrix::TILE_SPECTRA * 2 + 3, DistanceMatrix::TILE_BINS * 2 + 100);
+
+    DistanceMatrix dm(spectra);
+    dm.compute();
+
+    vector<unique_ptr<DistanceMetric>> metrics;
+    metrics.push_back(unique_ptr<DistanceMetric>(new ManhattanDistance()));
+    metrics.push_back(unique_ptr<DistanceMetric>(new EuclideanDistance()));
+    metrics.push_back(unique_ptr<DistanceMetric>(new CosineDistance()));
+    metrics.push_back(unique_ptr<DistanceMetric>(new CanberraDistance()));
+    metrics.push_back(unique_ptr<DistanceMetric>(new JaccardDistance()));
+
+    for (size_t m = 0; m < metrics.size(); m++) {
+        const DistanceMatrix::Metric metric = (DistanceMatrix::Metric)m;
+        EXPECT_EQ( DistanceMatrix::metricName(metric), metrics[m]->getName() );
+
+        for (size_t i = 0; i < spectra.size(); i++) {
+            EXPECT_EQ( dm.get(metric, i, i), 0.0 );
+            for (size_t j = i + 1; j < spectra.size(); j++) {
+
+                // DistanceMetric expects spectra of the same length
+                vector<uint64_t> s1 = spectra[i], s2 = spectra[j];
+                s1.resize(std::max(s1.size(), s2.size()), 0);
+                s2.resize(s1.size(), 0);
+
+                const double expected = metrics[m]->calcDistance(s1, s2);
+                EXPECT_NEAR( dm.get(metric, i, j), expected, 1e-9 * std::abs(expected) + 1e-12 );
+                EXPECT_EQ( dm.get(metric, i, j), dm.get(metric, j, i) );
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,122 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+using std::string;
+
+#include <kat/fixed_mer.hpp>
+using kat::FixedMer;
+using kat::MerWidth;
+
+namespace kat {
+
+// Rolls a FixedMer along a random sequence, and checks every K-mer, its
+// canonical form, and the K-mer made of its last half, against mer_dna
+template<typename W>
+void checkFixedMer(unsigned int k) {
+
+    mer_dna::k(k);
+
+    std::mt19937 rng(k);
+    string seq;
+    for (int i = 0; i < 2000; i++) {
+        seq.push_back(rng() % 500 == 0 ? 'N' : "ACGTacgt"[rng() % 8]);
+    }
+
+    FixedMer<W> fm(k);
+    W half;
+    mer_dna key, expected;
+    const unsigned int j = (k + 1) / 2;
+    unsigned int filled = 0;
+    uint64_t checked = 0;
+
+    for (size_t i = 0; i < seq.size(); i++) {
+        const int code = mer_dna::code(seq[i]);
+        if (code < 0) {
+            filled = 0;
+            continue;
+        }
+
+        fm.shiftLeft(code);
+        if (filled < k) filled++;
+        if (filled < k) continue;
+
+        mer_dna ref;
+        ref = seq.substr(i + 1 - k, k);
+
+        FixedMer<W>::toMer(fm.forward(), key);
+        EXPECT_EQ( key, ref );
+
+        FixedMer<W>::toMer(fm.canonical(), key);
+        EXPECT_EQ( key, ref.get_canonical() );
+
+        // Shorter K-mers are written into keys of the full length, high bases clear
+        string sub = string(k - j, 'A') + seq.substr(i + 1 - j, j);
+        fm.forward(j, half);
+        FixedMer<W>::toMer(half, key);
+        expected = sub;
+        EXPECT_EQ( key, expected );
+
+        string rc(k - j, 'A');
+        for (size_t b = i + 1; b > i + 1 - j; b--) {
+            rc.push_back(mer_dna::rev_code(3 - mer_dna::code(seq[b - 1])));
+        }
+        fm.reverse(j, half);
+        FixedMer<W>::toMer(half, key);
+        expected = rc;
+        EXPECT_EQ( key, expected );
+
+        checked++;
+    }
+
+    EXPECT_GT( checked, 1000u );
+}
+
+TEST(fixed_mer, width) {
+
+    EXPECT_EQ( merWidth(1), MerWidth::ONE_WORD );
+    EXPECT_EQ( merWidth(32), MerWidth::ONE_WORD );
+    EXPECT_EQ( merWidth(33), MerWidth::TWO_WORDS );
+    EXPECT_EQ( merWidth(64), MerWidth::TWO_WORDS );
+    EXPECT_EQ( merWidth(65), MerWidth::DYNAMIC );
+}
+
+TEST(fixed_mer, one_word) {
+
+    checkFixedMer<uint64_t>(1);
+    checkFixedMer<uint64_t>(17);
+    checkFixedMer<uint64_t>(31);
+    checkFixedMer<uint64_t>(32);
+}
+
+TEST(fixed_mer, two_words) {
+
+    checkFixedMer<uint128_t>(33);
+    checkFixedMer<uint128_t>(47);
+    checkFixedMer<uint128_t>(64);
+}
+
+TEST(fixed_mer, dynamic) {
+
+    checkFixedMer<mer_dna>(65);
+    checkFixedMer<mer_dna>(101);
+}
+
+}
@@ -0,0 +1,136 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+using std::stringstream;
+
+#include <boost/filesystem.hpp>
+namespace bfs = boost::filesystem;
+
+#include <kat/hash_cache.hpp>
+#include <kat/input_handler.hpp>
+using kat::HashCache;
+using kat::InputHandler;
+
+namespace kat {
+
+TEST(hash_cache, key) {
+
+    vector<path> inputs(1, DATADIR "/ecoli_r1.1K.fastq");
+
+    string key = HashCache::key(inputs, 27, true, 1000, 0, false);
+    EXPECT_EQ( key.size(), 32u );
+    EXPECT_EQ( key, HashCache::key(inputs, 27, true, 1000, 0, false) );
+
+    // Anything that changes the counts changes the key
+    EXPECT_NE( key, HashCache::key(inputs, 25, true, 1000, 0, false) );
+    EXPECT_NE( key, HashCache::key(inputs, 27, false, 1000, 0, false) );
+    EXPECT_NE( key, HashCache::key(inputs, 27, true, 2000, 0, false) );
+    EXPECT_NE( key, HashCache::key(inputs, 27, true, 1000, 20, false) );
+    EXPECT_NE( key, HashCache::key(inputs, 27, true, 1000, 0, true) );
+
+    inputs.push_back(DATADIR "/ecoli_r2.1K.fastq");
+    EXPECT_NE( key, HashCache::key(inputs, 27, true, 1000, 0, false) );
+
+    // Pipes can't be fingerprinted
+    EXPECT_EQ( HashCache::key(vector<path>(1, "/dev/stdin"), 27, true, 1000, 0, false), "" );
+}
+
+TEST(hash_cache, reuse) {
+
+    path dir = bfs::temp_directory_path() / bfs::unique_path("kat-cache-%%%%-%%%%");
+
+    stringstream log;
+    InputHandler first;
+    first.setSingleInput(DATADIR "/ecoli_r1.1K.fastq");
+    first.canonical = true;
+    first.merLen = 27;
+    first.hashSize = 100000;
+    first.cacheDir = dir;
+    first.out = &log;
+    first.count(1);
+
+    // The hash is still usable after being stored
+    HashCache cache(dir, 0);
+    EXPECT_GT( cache.size(), 0u );
+    uint64_t distinct = 0;
+    LargeHashArray::eager_iterator it = first.hash->eager_slice(0, 1);
+    while (it.next()) distinct++;
+    EXPECT_GT( distinct, 0u );
+
+    // A second count of the same input is loaded from the cache
+    InputHandler second;
+    second.setSingleInput(DATADIR "/ecoli_r1.1K.fastq");
+    second.canonical = true;
+    second.merLen = 27;
+    second.hashSize = 100000;
+    second.cacheDir = dir;
+    second.out = &log;
+    second.count(1);
+    EXPECT_TRUE( second.hashLoader != nullptr );
+    EXPECT_NE( log.str().find("earlier run"), string::npos );
+
+    uint64_t mismatches = 0, cachedDistinct = 0;
+    it = first.hash->eager_slice(0, 1);
+    while (it.next()) {
+        if (JellyfishHelper::getCount(second.hash, it.key(), false) != it.val()) mismatches++;
+    }
+    LargeHashArray::eager_iterator cit = second.hash->eager_slice(0, 1);
+    while (cit.next()) cachedDistinct++;
+    EXPECT_EQ( mismatches, 0u );
+    EXPECT_EQ( cachedDistinct, distinct );
+
+    bfs::remove_all(dir);
+}
+
+TEST(hash_cache, evict) {
+
+    path dir = bfs::temp_directory_path() / bfs::unique_path("kat-cache-%%%%-%%%%");
+
+    HashCounter hc(100000, 2 * 21, 7, 1);
+    mer_dna::k(21);
+    LargeHashArrayPtr hash = JellyfishHelper::countSeqFile(DATADIR "/ecoli_r1.1K.fastq", hc, true, 1);
+    file_header header;
+    header.fill_standard();
+    header.update_from_ary(*hash);
+    header.counter_len(4);
+    header.canonical(true);
+    header.format(binary_dumper::format);
+
+    // Room for two hashes, so storing a third evicts the least recently used
+    HashCache unlimited(dir, 0);
+    path a = unlimited.store("a", hash, header, 1);
+    uint64_t hashBytes = bfs::file_size(a);
+    bfs::last_write_time(a, bfs::last_write_time(a) - 100);
+    path b = unlimited.store("b", hash, header, 1);
+    bfs::last_write_time(b, bfs::last_write_time(b) - 50);
+
+    HashCache cache(dir, hashBytes * 2);
+    EXPECT_FALSE( cache.find("a").empty() );    // Now the most recently used
+    cache.store("c", hash, header, 1);
+
+    EXPECT_FALSE( cache.find("a").empty() );
+    EXPECT_TRUE( cache.find("b").empty() );
+    EXPECT_FALSE( cache.find("c").empty() );
+    EXPECT_LE( cache.size(), hashBytes * 2 );
+
+    bfs::remove_all(dir);
+}
+
+}
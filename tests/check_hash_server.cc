@@ -0,0 +1,130 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <sstream>
+#include <thread>
+using std::stringstream;
+using std::thread;
+
+#include <boost/filesystem.hpp>
+namespace bfs = boost::filesystem;
+
+#include <kat/hash_server.hpp>
+#include <kat/input_handler.hpp>
+using kat::HashClient;
+using kat::HashServer;
+using kat::HashServerException;
+using kat::InputHandler;
+
+namespace kat {
+
+// Serves a hash counted from the test reads, and checks lookups and iteration
+// through the server match the hash itself
+void checkHashServer(uint16_t merLen) {
+
+    path dir = bfs::temp_directory_path() / bfs::unique_path("kat-serve-%%%%-%%%%");
+    bfs::create_directories(dir);
+    path hashPath = dir / "reads.jf";
+    path socket = dir / "kat.sock";
+
+    // Count the reads, and keep a copy of the hash to compare against
+    InputHandler counted;
+    counted.setSingleInput(DATADIR "/ecoli_r1.1K.fastq");
+    counted.canonical = true;
+    counted.merLen = merLen;
+    counted.hashSize = 100000;
+    stringstream log;
+    counted.out = &log;
+    counted.count(1);
+    JellyfishHelper::dumpHash(counted.hash, *counted.header, 1, hashPath, true);
+
+    HashServer server(vector<path>(1, hashPath), socket);
+    server.load(log);
+    thread t(&HashServer::serve, &server, std::ref(log));
+    while (!bfs::exists(socket)) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    EXPECT_TRUE( HashClient::connect(socket, DATADIR "/ecoli_r1.1K.fastq") == nullptr );
+
+    shared_ptr<HashClient> client = HashClient::connect(socket, hashPath);
+    ASSERT_TRUE( client != nullptr );
+    EXPECT_EQ( client->getMerLen(), merLen );
+    EXPECT_TRUE( client->getCanonical() );
+
+    // Look up every K-mer, and some that aren't there
+    vector<uint64_t> words;
+    vector<uint64_t> expected;
+    LargeHashArray::eager_iterator it = counted.hash->eager_slice(0, 1);
+    while (it.next()) {
+        for (uint16_t w = 0; w < client->nbWords(); w++) words.push_back(it.key().word(w));
+        expected.push_back(it.val());
+        mer_dna missing(it.key());
+        missing.shift_left('T');
+        missing.canonicalize();
+        for (uint16_t w = 0; w < client->nbWords(); w++) words.push_back(missing.word(w));
+        expected.push_back(JellyfishHelper::getCount(counted.hash, missing, false));
+    }
+    vector<uint64_t> counts(expected.size());
+    client->getCounts(words.data(), counts.size(), counts.data());
+    EXPECT_EQ( counts, expected );
+
+    // Iterating over all slices gives back every K-mer once
+    uint64_t total = 0, distinct = 0;
+    for (uint32_t slice = 0; slice < 3; slice++) {
+        HashClient::Slice s(*client, slice, 3);
+        vector<uint64_t> sliceWords, sliceCounts;
+        size_t n;
+        while ((n = s.next(100, sliceWords, sliceCounts)) > 0) {
+            distinct += n;
+            for (auto c : sliceCounts) total += c;
+        }
+    }
+    uint64_t expectedTotal = 0, expectedDistinct = 0;
+    it = counted.hash->eager_slice(0, 1);
+    while (it.next()) {
+        expectedDistinct++;
+        expectedTotal += it.val();
+    }
+    EXPECT_EQ( distinct, expectedDistinct );
+    EXPECT_EQ( total, expectedTotal );
+
+    // Slices out of range are refused, and the server carries on
+    EXPECT_THROW( HashClient::Slice(*client, 0, 0), HashServerException );
+    EXPECT_THROW( HashClient::Slice(*client, 3, 3), HashServerException );
+    it = counted.hash->eager_slice(0, 1);
+    ASSERT_TRUE( it.next() );
+    EXPECT_EQ( client->getCount(it.key()), it.val() );
+
+    client.reset();
+    server.stop();
+    t.join();
+    EXPECT_FALSE( bfs::exists(socket) );
+
+    bfs::remove_all(dir);
+}
+
+TEST(hash_server, one_word) {
+    checkHashServer(27);
+}
+
+TEST(hash_server, two_words) {
+    checkHashServer(41);
+}
+
+}
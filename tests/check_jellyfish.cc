@@ -21,9 +21,13 @@
 using boost::filesystem::remove;
 
 #include <chrono>
+#include <fstream>
+#include <sstream>
 using std::chrono::system_clock;
 using std::chrono::duration;
 using std::chrono::duration_cast;
+using std::ofstream;
+using std::stringstream;
 template<typename DtnType>
 inline double as_seconds(DtnType dtn) { return duration_cast<duration<double>>(dtn).count(); }
 
@@ -179,6 +183,232 @@ TEST(jellyfish, dump) {
     remove("temp_dump.jf");
 }
 
+TEST(jellyfish, shard) {
+    
+    HashLoader hl;
+    LargeHashArrayPtr hash = hl.loadHash(DATADIR "/ecoli.header.jf27", false);
+    
+    uint64_t distinct = 0;
+    LargeHashArray::eager_iterator it = hash->eager_slice(0, 1);
+    while (it.next()) {
+        if (it.val() > 0) distinct++;
+    }
+    
+    // Every K-mer ends up in exactly one shard, with its count intact
+    const uint32_t nbShards = 3;
+    uint64_t sharded = 0;
+    for(uint32_t i = 0; i < nbShards; i++) {
+        LargeHashArrayPtr shard = JellyfishHelper::shardHash(*hash, i, nbShards, 2);
+        
+        uint64_t inShard = 0, mismatches = 0;
+        LargeHashArray::eager_iterator sit = shard->eager_slice(0, 1);
+        while (sit.next()) {
+            inShard++;
+            if (JellyfishHelper::shardOf(sit.key(), nbShards) != i ||
+                    JellyfishHelper::getCount(hash, sit.key(), false) != sit.val()) {
+                mismatches++;
+            }
+        }
+        
+        EXPECT_EQ( mismatches, 0 );
+        EXPECT_GT( inShard, distinct / nbShards / 2 );
+        sharded += inShard;
+        delete shard;
+    }
+    
+    EXPECT_EQ( sharded, distinct );
+    
+    EXPECT_EQ( InputHandler::shardPath("out/kat-hash.jf27", 2, 4), path("out/kat-hash-shard2of4.jf27") );
+}
+
+TEST(jellyfish, bloomcounter) {
+    
+    // Count some reads exactly, to know which K-mers are present and how often
+    InputHandler counted;
+    counted.setSingleInput(DATADIR "/ecoli_r1.1K.fastq");
+    counted.canonical = true;
+    counted.merLen = 21;
+    counted.hashSize = 100000;
+    stringstream log;
+    counted.out = &log;
+    counted.count(1);
+    
+    uint64_t distinct = 0;
+    LargeHashArray::eager_iterator it = counted.hash->eager_slice(0, 1);
+    while (it.next()) distinct++;
+    
+    // Build a bloom counter from the same K-mers, written out as "jellyfish bc" does
+    const double fpr = 0.01;
+    path bcPath = "temp_bloom.bc";
+    {
+        file_header header;
+        header.fill_standard();
+        header.canonical(true);
+        header.format(BLOOM_COUNTER_FORMAT);
+        header.key_len(counted.merLen * 2);
+        jellyfish::hash_pair<mer_dna> fns;
+        header.matrix(fns.m1, 1);
+        header.matrix(fns.m2, 2);
+        
+        jellyfish::mer_dna_bloom_counter filter(fpr, distinct, fns);
+        header.size(filter.m());
+        header.nb_hashes(filter.k());
+        
+        LargeHashArray::eager_iterator kit = counted.hash->eager_slice(0, 1);
+        while (kit.next()) {
+            for (uint64_t i = 0; i < std::min(kit.val(), (uint64_t)2); i++) {
+                filter.insert(kit.key());
+            }
+        }
+        
+        ofstream bcOut(bcPath.c_str());
+        header.write(bcOut);
+        filter.write_bits(bcOut);
+    }
+    
+    EXPECT_TRUE( JellyfishHelper::isBloomCounter(*JellyfishHelper::loadHashHeader(bcPath)) );
+    EXPECT_FALSE( JellyfishHelper::isBloomCounter(*JellyfishHelper::loadHashHeader(DATADIR "/ecoli.header.jf27")) );
+    
+    HashLoader hl;
+    BloomCounterPtr bloom = hl.loadBloomCounter(bcPath, false);
+    EXPECT_EQ( hl.getMerLen(), counted.merLen );
+    EXPECT_TRUE( hl.getCanonical() );
+    EXPECT_THROW( hl.loadBloomCounter(DATADIR "/ecoli.header.jf27", false), JellyfishException );
+    
+    const double occupancy = bloom->occupancy();
+    EXPECT_GT( occupancy, 0.0 );
+    EXPECT_LT( occupancy, 1.0 );
+    EXPECT_DOUBLE_EQ( bloom->expectedFpr(), std::pow(occupancy, (double)bloom->k()) );
+    EXPECT_LT( bloom->expectedFpr(), fpr * 2 );
+    
+    // Present K-mers are never underestimated, and counts are capped at 2.  Absent 
+    // K-mers only report a count at around the expected false positive rate.
+    uint64_t wrong = 0, absent = 0, falsePositives = 0;
+    it = counted.hash->eager_slice(0, 1);
+    while (it.next()) {
+        const uint64_t expected = std::min(it.val(), (uint64_t)2);
+        const uint64_t c = JellyfishHelper::getCount(bloom, it.key(), true);
+        if (c < expected || c > 2) wrong++;
+        
+        mer_dna missing(it.key());
+        missing.shift_left('T');
+        if (JellyfishHelper::getCount(counted.hash, missing, true) == 0) {
+            absent++;
+            if (JellyfishHelper::getCount(bloom, missing, true) > 0) falsePositives++;
+        }
+    }
+    EXPECT_EQ( wrong, 0 );
+    EXPECT_GT( absent, 1000 );
+    EXPECT_LT( (double)falsePositives / (double)absent, bloom->expectedFpr() * 3 + 0.001 );
+    
+    // Tools that iterate over every K-mer reject a bloom counter
+    InputHandler rejected;
+    rejected.setSingleInput(bcPath);
+    rejected.validateInput();
+    EXPECT_THROW( rejected.loadHeader(), InputFileException );
+    
+    // Otherwise the input handler picks the bloom counter backend from the header
+    InputHandler queried;
+    queried.setSingleInput(bcPath);
+    queried.allowBloom = true;
+    queried.out = &log;
+    queried.validateInput();
+    queried.loadHeader();
+    queried.loadHash();
+    EXPECT_TRUE( queried.isBloom() );
+    EXPECT_TRUE( queried.canonical );
+    EXPECT_DOUBLE_EQ( queried.bloomFpr, bloom->expectedFpr() );
+    
+    wrong = 0;
+    it = counted.hash->eager_slice(0, 1);
+    while (it.next()) {
+        if (queried.getCount(it.key()) != JellyfishHelper::getCount(bloom, it.key(), true)) wrong++;
+    }
+    EXPECT_EQ( wrong, 0 );
+    
+    remove(bcPath);
+}
+
+void checkTargeted(const InputHandler& target, uint16_t threads, uint16_t minQual) {
+    
+    stringstream log;
+    
+    // Count the same reads in full, to compare against
+    InputHandler full;
+    full.setSingleInput(DATADIR "/ecoli_r1.1K.fastq");
+    full.canonical = true;
+    full.merLen = 21;
+    full.hashSize = 100000;
+    full.minQual = minQual;
+    full.out = &log;
+    full.count(threads);
+    
+    InputHandler targeted;
+    targeted.setSingleInput(DATADIR "/ecoli_r1.1K.fastq");
+    targeted.canonical = true;
+    targeted.merLen = 21;
+    targeted.minQual = minQual;
+    targeted.targetHash = target.hash;
+    targeted.out = &log;
+    targeted.count(threads);
+    
+    // Every target K-mer has its full count
+    uint64_t wrong = 0, found = 0;
+    LargeHashArray::eager_iterator it = target.hash->eager_slice(0, 1);
+    while (it.next()) {
+        const uint64_t c = JellyfishHelper::getCount(full.hash, it.key(), false);
+        if (targeted.getCount(it.key()) != c) wrong++;
+        if (c > 0) found++;
+    }
+    EXPECT_EQ( wrong, 0 );
+    EXPECT_GT( found, 0 );
+    
+    // The compacted hash only holds target K-mers that were found
+    uint64_t kept = 0, extra = 0;
+    it = targeted.hash->eager_slice(0, 1);
+    while (it.next()) {
+        kept++;
+        if (it.val() == 0 || JellyfishHelper::getCount(target.hash, it.key(), false) == 0) extra++;
+    }
+    EXPECT_EQ( extra, 0 );
+    EXPECT_EQ( kept, found );
+    
+    // Everything else in the input was skipped
+    uint64_t skipped = 0;
+    it = full.hash->eager_slice(0, 1);
+    while (it.next()) {
+        if (JellyfishHelper::getCount(target.hash, it.key(), false) == 0) skipped += it.val();
+    }
+    EXPECT_GT( skipped, 0 );
+    EXPECT_EQ( targeted.untargetedTotal, skipped );
+}
+
+TEST(jellyfish, targeted) {
+    
+    // Target the K-mers of the other read in each pair, so only some are shared
+    InputHandler target;
+    target.setSingleInput(DATADIR "/ecoli_r2.1K.fastq");
+    target.canonical = true;
+    target.merLen = 21;
+    target.hashSize = 100000;
+    stringstream log;
+    target.out = &log;
+    target.count(1);
+    
+    checkTargeted(target, 1, 0);    // Sequence parser
+    checkTargeted(target, 1, 20);   // Read parser, keeping quality scores
+    checkTargeted(target, 2, 0);    // Parallel reader
+    checkTargeted(target, 2, 20);
+    
+    // Compacting drops K-mers with a count of 0
+    LargeHashArrayPtr counts = JellyfishHelper::createTargetHash(*target.hash, 2);
+    LargeHashArrayPtr compact = JellyfishHelper::compactHash(*counts, 2);
+    LargeHashArray::eager_iterator it = compact->eager_slice(0, 1);
+    EXPECT_FALSE( it.next() );
+    delete compact;
+    delete counts;
+}
+
 TEST(jellyfish, negseqtest) {
     path jfpath = path(DATADIR "/ecoli.header.jf27");
     
@@ -0,0 +1,102 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+using std::stringstream;
+
+#include <kat/jellyfish_helper.hpp>
+#include <kat/kmer_sketch.hpp>
+using kat::JellyfishHelper;
+using kat::KmerSketch;
+using kat::KmerSketchException;
+
+namespace kat {
+
+TEST(kmer_sketch, seq_matches_hash) {
+
+    path input(DATADIR "/ecoli_r1.1K.fastq");
+
+    KmerSketch fromSeq(27, true, 10);
+    fromSeq.sketchSeqFiles(vector<path>(1, input), 2);
+
+    mer_dna::k(27);
+    HashCounter counter(100000, 27 * 2, 7, 2);
+    LargeHashArrayPtr hash = JellyfishHelper::countSeqFile(input, counter, true, 2);
+    KmerSketch fromHash(27, true, 10);
+    fromHash.sketchHash(*hash, 2);
+
+    // Roughly 1 in 10 of the K-mers are kept, and the same ones either way
+    uint64_t distinct = 0;
+    LargeHashArray::eager_iterator it = hash->eager_slice(0, 1);
+    while (it.next()) distinct++;
+
+    EXPECT_GT( fromSeq.size(), distinct / 20 );
+    EXPECT_LT( fromSeq.size(), distinct / 5 );
+    EXPECT_EQ( fromSeq.getEntries(), fromHash.getEntries() );
+}
+
+TEST(kmer_sketch, save_load) {
+
+    KmerSketch sketch(27, true, 10);
+    sketch.sketchSeqFiles(vector<path>(1, DATADIR "/ecoli_r1.1K.fastq"), 1);
+    sketch.setSource("ecoli_r1.1K.fastq");
+
+    stringstream ss;
+    sketch.save(ss);
+    KmerSketch loaded = KmerSketch::load(ss);
+
+    EXPECT_EQ( loaded.getMerLen(), 27 );
+    EXPECT_TRUE( loaded.isCanonical() );
+    EXPECT_EQ( loaded.getScale(), 10u );
+    EXPECT_EQ( loaded.getSource(), "ecoli_r1.1K.fastq" );
+    EXPECT_EQ( loaded.getEntries(), sketch.getEntries() );
+
+    stringstream truncated(ss.str().substr(0, ss.str().size() / 2));
+    EXPECT_THROW( KmerSketch::load(truncated), KmerSketchException );
+}
+
+TEST(kmer_sketch, pairs) {
+
+    KmerSketch s1(27, true, 10);
+    s1.sketchSeqFiles(vector<path>(1, DATADIR "/ecoli_r1.1K.fastq"), 1);
+    KmerSketch s2(27, true, 10);
+    s2.sketchSeqFiles(vector<path>(1, DATADIR "/ecoli_r2.1K.fastq"), 1);
+
+    // Every K-mer in either sketch is visited once
+    uint64_t only1 = 0, only2 = 0, shared = 0, total1 = 0;
+    KmerSketch::forEachPair(s1, s2, [&](uint64_t c1, uint64_t c2) {
+        if (c1 > 0 && c2 > 0) shared++;
+        else if (c1 > 0) only1++;
+        else only2++;
+        total1 += c1;
+    });
+
+    uint64_t expectedTotal1 = 0;
+    for (auto& e : s1.getEntries()) expectedTotal1 += e.second;
+
+    EXPECT_EQ( only1 + shared, s1.size() );
+    EXPECT_EQ( only2 + shared, s2.size() );
+    EXPECT_EQ( total1, expectedTotal1 );
+
+    // Sketches with different scales sample different K-mers
+    KmerSketch s3(27, true, 100);
+    EXPECT_THROW( KmerSketch::forEachPair(s1, s3, [](uint64_t c1, uint64_t c2) {}), KmerSketchException );
+}
+
+}
@@ -0,0 +1,286 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <zlib.h>
+
+#include <fstream>
+#include <sstream>
+using std::ifstream;
+using std::ofstream;
+
+#include <boost/filesystem.hpp>
+namespace bfs = boost::filesystem;
+
+#include <kat/jellyfish_helper.hpp>
+#include <kat/input_handler.hpp>
+#include <kat/memory_budget.hpp>
+#include <kat/sparse_matrix.hpp>
+using kat::HashLoader;
+using kat::InputHandler;
+using kat::JellyfishHelper;
+using kat::MemoryBudget;
+using kat::SparseMatrix;
+using kat::ThreadedSparseMatrix;
+
+namespace kat {
+
+static void writeFile(const path& p, const string& content) {
+    bfs::create_directories(p.parent_path());
+    ofstream out(p.c_str());
+    out << content;
+}
+
+TEST(memory_budget, cgroup_limit) {
+
+    path dir = bfs::temp_directory_path() / bfs::unique_path("kat-cgroup-%%%%-%%%%");
+    path proc = dir / "cgroup";
+    path root = dir / "fs";
+    
+    // The tightest limit on the way down to the process's cgroup applies
+    writeFile(proc, "0::/user.slice/job\n");
+    writeFile(root / "user.slice" / "memory.max", "2000000\n");
+    writeFile(root / "user.slice" / "job" / "memory.max", "max\n");
+    EXPECT_EQ( MemoryBudget::cgroupLimit(proc, root), 2000000u );
+    
+    writeFile(root / "user.slice" / "job" / "memory.max", "1000000\n");
+    EXPECT_EQ( MemoryBudget::cgroupLimit(proc, root), 1000000u );
+    
+    // No limit anywhere
+    writeFile(root / "user.slice" / "memory.max", "max\n");
+    writeFile(root / "user.slice" / "job" / "memory.max", "max\n");
+    EXPECT_EQ( MemoryBudget::cgroupLimit(proc, root), 0u );
+    
+    // Only cgroup v1 controllers
+    writeFile(proc, "4:memory:/user.slice\n");
+    EXPECT_EQ( MemoryBudget::cgroupLimit(proc, root), 0u );
+    EXPECT_EQ( MemoryBudget::cgroupLimit(dir / "missing", root), 0u );
+    
+    bfs::remove_all(dir);
+}
+
+TEST(memory_budget, limit) {
+
+    const uint64_t cgroup = MemoryBudget::cgroupLimit();
+    
+    EXPECT_EQ( MemoryBudget::limit(0), cgroup );
+    EXPECT_EQ( MemoryBudget::limit(1000), 1000u );
+    
+    EXPECT_EQ( MemoryBudget::remaining(0), 0u );
+    
+    // Already holding more than this, so nothing is left
+    EXPECT_EQ( MemoryBudget::remaining(1000), 0u );
+    
+    const uint64_t big = MemoryBudget::currentRss() + 1000000000;
+    EXPECT_GT( MemoryBudget::remaining(big), 0u );
+    EXPECT_LE( MemoryBudget::remaining(big), big );
+}
+
+TEST(memory_budget, hash_size) {
+
+    const uint64_t bytes = MemoryBudget::hashBytes(1000000, 27);
+    EXPECT_GT( bytes, 0u );
+    EXPECT_GE( MemoryBudget::hashEntries(bytes, 27), 1000000u );
+    EXPECT_LE( MemoryBudget::hashBytes(MemoryBudget::hashEntries(bytes, 27), 27), bytes );
+    
+    // Longer K-mers need more room
+    EXPECT_GT( MemoryBudget::hashBytes(1000000, 51), bytes );
+    
+    EXPECT_EQ( MemoryBudget::toMB(5000000), "5MB" );
+}
+
+TEST(memory_budget, mapped_hash) {
+
+    path dir = bfs::temp_directory_path() / bfs::unique_path("kat-mapped-%%%%-%%%%");
+    bfs::create_directories(dir);
+    path jf = dir / "hash.jf21";
+    
+    HashCounter hc(100000, 2 * 21, 7, 1);
+    mer_dna::k(21);
+    LargeHashArrayPtr hash = JellyfishHelper::countSeqFile(DATADIR "/ecoli_r1.1K.fastq", hc, true, 1);
+    file_header header;
+    header.fill_standard();
+    header.update_from_ary(*hash);
+    header.counter_len(4);
+    header.canonical(true);
+    header.format(binary_dumper::format);
+    JellyfishHelper::dumpHash(hash, header, 1, jf, true);
+    
+    HashLoader loader;
+    MappedHashPtr mapped = loader.mapHash(jf, false);
+    
+    // Every K-mer in the hash has the same count in place
+    uint64_t records = 0, mismatches = 0;
+    LargeHashArray::eager_iterator it = hash->eager_slice(0, 1);
+    while (it.next()) {
+        records++;
+        if (JellyfishHelper::getCount(mapped, it.key(), false) != it.val()) mismatches++;
+    }
+    EXPECT_GT( records, 0u );
+    EXPECT_EQ( mapped->nbRecords(), records );
+    EXPECT_EQ( mismatches, 0u );
+    
+    // K-mers not in the hash have no count
+    mer_dna absent("AAAAAAAAAAAAAAAAAAAAA");
+    EXPECT_EQ( JellyfishHelper::getCount(mapped, absent, true), JellyfishHelper::getCount(hash, absent, true) );
+    
+    EXPECT_GT( HashLoader::loadedBytes(jf), 0u );
+    
+    bfs::remove_all(dir);
+}
+
+TEST(memory_budget, count_compressed) {
+
+    path dir = bfs::temp_directory_path() / bfs::unique_path("kat-budget-%%%%-%%%%");
+    bfs::create_directories(dir);
+    path gz = dir / "ecoli_r1.1K.fastq.gz";
+    {
+        ifstream in(DATADIR "/ecoli_r1.1K.fastq");
+        std::stringstream ss;
+        ss << in.rdbuf();
+        const string reads = ss.str();
+        gzFile out = gzopen(gz.c_str(), "wb");
+        gzwrite(out, reads.data(), reads.size());
+        gzclose(out);
+    }
+    
+    InputHandler plain;
+    plain.setSingleInput(DATADIR "/ecoli_r1.1K.fastq");
+    plain.canonical = true;
+    plain.merLen = 27;
+    plain.hashSize = 100000;
+    std::ostringstream plainLog;
+    plain.out = &plainLog;
+    plain.count(1);
+    
+    // Far too small for the requested hash, but compressed input can't be
+    // counted out-of-core, so is counted in memory
+    InputHandler compressed;
+    compressed.setSingleInput(gz);
+    compressed.canonical = true;
+    compressed.merLen = 27;
+    compressed.hashSize = 100000;
+    compressed.maxMemory = 1000000;
+    std::ostringstream log;
+    compressed.out = &log;
+    EXPECT_FALSE( compressed.canCountOnDisk() );
+    EXPECT_FALSE( compressed.fitsInMemory(compressed.memoryLimit()) );
+    compressed.count(1);
+    EXPECT_NE( log.str().find("can't be counted out-of-core"), string::npos );
+    EXPECT_TRUE( compressed.hashLoader == nullptr );
+    
+    uint64_t distinct = 0, mismatches = 0;
+    LargeHashArray::eager_iterator it = plain.hash->eager_slice(0, 1);
+    while (it.next()) {
+        distinct++;
+        if (JellyfishHelper::getCount(compressed.hash, it.key(), false) != it.val()) mismatches++;
+    }
+    EXPECT_GT( distinct, 0u );
+    EXPECT_EQ( mismatches, 0u );
+    
+    uint64_t compressedDistinct = 0;
+    it = compressed.hash->eager_slice(0, 1);
+    while (it.next()) compressedDistinct++;
+    EXPECT_EQ( compressedDistinct, distinct );
+    
+    // The same reads uncompressed are counted out-of-core instead, which can't
+    // be checkpointed
+    InputHandler onDisk;
+    onDisk.setSingleInput(DATADIR "/ecoli_r1.1K.fastq");
+    onDisk.canonical = true;
+    onDisk.merLen = 27;
+    onDisk.hashSize = 100000;
+    onDisk.maxMemory = 1000000;
+    onDisk.checkpointDir = dir / "checkpoints";
+    std::ostringstream diskLog;
+    onDisk.out = &diskLog;
+    EXPECT_TRUE( onDisk.canCountOnDisk() );
+    onDisk.count(1);
+    EXPECT_NE( diskLog.str().find("checkpoints are not saved"), string::npos );
+    EXPECT_TRUE( onDisk.hashLoader != nullptr );
+    
+    mismatches = 0;
+    it = plain.hash->eager_slice(0, 1);
+    while (it.next()) {
+        if (JellyfishHelper::getCount(onDisk.hash, it.key(), false) != it.val()) mismatches++;
+    }
+    EXPECT_EQ( mismatches, 0u );
+    
+    bfs::remove_all(dir);
+}
+
+TEST(memory_budget, count_overflow) {
+
+    InputHandler plain;
+    plain.setSingleInput(DATADIR "/ecoli_r1.1K.fastq");
+    plain.canonical = true;
+    plain.merLen = 27;
+    plain.hashSize = 100000;
+    std::ostringstream plainLog;
+    plain.out = &plainLog;
+    plain.count(1);
+    
+    // The requested hash fits in the budget, but is too small for the reads.  
+    // Rather than growing past the budget, the count is redone out-of-core.
+    for (uint16_t threads = 1; threads <= 2; threads++) {
+        InputHandler bounded;
+        bounded.setSingleInput(DATADIR "/ecoli_r1.1K.fastq");
+        bounded.canonical = true;
+        bounded.merLen = 27;
+        bounded.hashSize = 1000;
+        bounded.maxMemory = MemoryBudget::currentRss() + 200000000;
+        std::ostringstream log;
+        bounded.out = &log;
+        EXPECT_TRUE( bounded.fitsInMemory(bounded.memoryLimit()) );
+        bounded.count(threads);
+        EXPECT_NE( log.str().find("Counting out-of-core instead"), string::npos );
+        EXPECT_TRUE( bounded.hashLoader != nullptr );
+        
+        uint64_t mismatches = 0;
+        LargeHashArray::eager_iterator it = plain.hash->eager_slice(0, 1);
+        while (it.next()) {
+            if (JellyfishHelper::getCount(bounded.hash, it.key(), false) != it.val()) mismatches++;
+        }
+        EXPECT_EQ( mismatches, 0u );
+    }
+}
+
+TEST(memory_budget, stream_merge) {
+
+    ThreadedSparseMatrix a(10, 10, 3);
+    ThreadedSparseMatrix b(10, 10, 3);
+    for (uint16_t t = 0; t < 3; t++) {
+        for (size_t i = 0; i < 10; i++) {
+            a.incTM(t, i, (i * t) % 10, t + 1);
+            b.incTM(t, i, (i * t) % 10, t + 1);
+        }
+    }
+    
+    const SM64& merged = a.mergeThreadedMatricies();
+    const SM64& streamed = b.streamMergeThreadedMatricies();
+    for (size_t i = 0; i < 10; i++) {
+        for (size_t j = 0; j < 10; j++) {
+            EXPECT_EQ( streamed.get(i, j), merged.get(i, j) );
+        }
+    }
+    
+    // The per-thread matrices are freed
+    EXPECT_EQ( b.getThreadMatrix(0).get(0, 0), 0u );
+}
+
+}
@@ -0,0 +1,66 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <vector>
+using std::vector;
+
+#include <kat/memory_pages.hpp>
+using kat::MemoryPages;
+
+namespace kat {
+
+TEST(memory_pages, prefault) {
+
+    vector<char> buffer(1 << 20, 'A');
+    buffer[12345] = 'B';
+
+    // Any number of threads, including more than there are pages, and
+    // unaligned ranges
+    MemoryPages::prefault(buffer.data(), buffer.size(), 1);
+    MemoryPages::prefault(buffer.data() + 1, buffer.size() - 1, 4);
+    MemoryPages::prefault(buffer.data() + 7, 100, 16);
+    MemoryPages::prefault(buffer.data(), 0, 4);
+
+    EXPECT_EQ( buffer[0], 'A' );
+    EXPECT_EQ( buffer[12345], 'B' );
+}
+
+TEST(memory_pages, load) {
+
+    HashLoader plain;
+    LargeHashArrayPtr expected = plain.loadHash(DATADIR "/ecoli.header.jf27", false);
+
+    // Hashes loaded onto huge pages from a prefaulted file have the same content
+    HashLoader hl;
+    hl.setHugePages(true);
+    hl.setPrefaultThreads(4);
+    LargeHashArrayPtr hash = hl.loadHash(DATADIR "/ecoli.header.jf27", false);
+
+    mer_dna kStart("AGCTTTTCATTCTGACTGCAACGGGCA");
+    EXPECT_EQ( JellyfishHelper::getCount(hash, kStart, false), 3 );
+
+    uint64_t mismatches = 0;
+    LargeHashArray::eager_iterator it = expected->eager_slice(0, 1);
+    while (it.next()) {
+        if (JellyfishHelper::getCount(hash, it.key(), false) != it.val()) mismatches++;
+    }
+    EXPECT_EQ( mismatches, 0u );
+}
+
+}
@@ -0,0 +1,93 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+using std::stringstream;
+
+#include <kat/metrics.hpp>
+using kat::Metrics;
+
+namespace kat {
+
+TEST(metrics, phase) {
+
+    const size_t before = Metrics::global().getRecords().size();
+
+    {
+        Metrics::Phase phase("test", "in\"put");
+        phase.addBytesRead(1000);
+        phase.addKmers(20);
+        phase.addKmers(22);
+        phase.addLookups(7);
+    }
+
+    vector<Metrics::Record> records = Metrics::global().getRecords();
+    ASSERT_EQ( records.size(), before + 1 );
+
+    const Metrics::Record& r = records.back();
+    EXPECT_EQ( r.phase, "test" );
+    EXPECT_EQ( r.input, "in\"put" );
+    EXPECT_EQ( r.bytesRead, 1000u );
+    EXPECT_EQ( r.kmers, 42u );
+    EXPECT_EQ( r.lookups, 7u );
+    EXPECT_GE( r.wall, 0.0 );
+    EXPECT_GT( r.peakRss, 0u );
+}
+
+TEST(metrics, write) {
+
+    {
+        Metrics::Phase phase("written", "a\\b\n");
+    }
+
+    stringstream ss;
+    Metrics::global().write(ss, "test", 4);
+    const string json = ss.str();
+
+    EXPECT_EQ( json.front(), '{' );
+    EXPECT_NE( json.find("\"tool\": \"test\""), string::npos );
+    EXPECT_NE( json.find("\"threads\": 4,"), string::npos );
+    EXPECT_NE( json.find("\"phase\": \"written\""), string::npos );
+    EXPECT_NE( json.find("\"input\": \"a\\\\b\\n\""), string::npos );
+    EXPECT_NE( json.find("\"lookups_per_s\""), string::npos );
+}
+
+TEST(metrics, perf) {
+
+    Metrics::Record r;
+    r.phase = "counted";
+    r.wall = r.user = r.system = 1.0;
+    r.peakRss = r.bytesRead = r.kmers = r.lookups = 0;
+    r.hasPerf = true;
+    r.perf.cycles = 2000;
+    r.perf.instructions = 1000;
+    r.threadPerf.resize(2, r.perf);
+
+    Metrics metrics;
+    metrics.add(r);
+
+    stringstream ss;
+    metrics.write(ss, "test", 2);
+    const string json = ss.str();
+
+    EXPECT_NE( json.find("\"perf\": {\"cycles\": 2000, \"instructions\": 1000, \"ipc\": 0.5"), string::npos );
+    EXPECT_NE( json.find("\"thread_perf\": [{"), string::npos );
+}
+
+}
@@ -0,0 +1,160 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+using std::ifstream;
+using std::ofstream;
+using std::stringstream;
+
+#include <boost/filesystem.hpp>
+using boost::filesystem::remove;
+
+#include <kat/jellyfish_helper.hpp>
+#include <kat/multi_k_counter.hpp>
+using kat::JellyfishHelper;
+using kat::MultiKCounter;
+
+namespace kat {
+
+// Counts the file at several K-mer lengths at once, and checks each matches a
+// separate count at that length
+void checkMultiKCount(const path& seqFile, bool canonical, uint16_t threads) {
+
+    vector<uint16_t> merLens = { 15, 21, 27, 40 };
+    vector<uint64_t> hashSizes(merLens.size(), 1000);     // Small enough to force the hashes to grow
+
+    vector<path> seqFiles;
+    seqFiles.push_back(seqFile);
+    MultiKCounter counter(merLens, hashSizes, canonical, threads);
+    counter.count(seqFiles);
+
+    for (size_t i = 0; i < merLens.size(); i++) {
+
+        shared_ptr<LargeHashArray> multi(counter.releaseHash(i));
+        EXPECT_EQ( multi->key_len(), merLens[i] * 2 );
+
+        HashCounter hc(1000000, merLens[i] * 2, 7, 1);
+        LargeHashArrayPtr ref = JellyfishHelper::countSeqFile(seqFile, hc, canonical, 1);
+
+        uint64_t refDistinct = 0, distinct = 0, mismatches = 0;
+        LargeHashArray::eager_iterator it = ref->eager_slice(0, 1);
+        while (it.next()) {
+            refDistinct++;
+            if (JellyfishHelper::getCount(multi.get(), it.key(), false) != it.val()) {
+                mismatches++;
+            }
+        }
+        LargeHashArray::eager_iterator it2 = multi->eager_slice(0, 1);
+        while (it2.next()) {
+            distinct++;
+        }
+
+        EXPECT_GT( refDistinct, 0 ) << merLens[i] << "-mers";
+        EXPECT_EQ( distinct, refDistinct ) << merLens[i] << "-mers";
+        EXPECT_EQ( mismatches, 0 ) << merLens[i] << "-mers";
+    }
+}
+
+TEST(multi_k_counter, canonical) {
+    checkMultiKCount(DATADIR "/ecoli_r1.1K.fastq", true, 4);
+}
+
+TEST(multi_k_counter, non_canonical) {
+    checkMultiKCount(DATADIR "/ecoli_r1.1K.fastq", false, 4);
+}
+
+TEST(multi_k_counter, fasta) {
+
+    // Long multi-line sequences, big enough to be split between threads, so that
+    // shorter K-mers near the split points could be counted twice
+    ifstream in(DATADIR "/ecoli_r1.1K.fastq");
+    path fa("multi_k_counter_test.fa");
+    ofstream out(fa.c_str());
+    string header, seq, plus, qual;
+    stringstream all;
+    while (std::getline(in, header) && std::getline(in, seq) && std::getline(in, plus) && std::getline(in, qual)) {
+        all << seq << "N";
+    }
+    for (int i = 0; i < 20; i++) {
+        out << ">seq" << i << endl;
+        string s = all.str();
+        for (size_t j = 0; j < s.size(); j += 61) {
+            out << s.substr(j, 61) << endl;
+        }
+    }
+    out.close();
+
+    checkMultiKCount(fa, true, 4);
+
+    remove(fa);
+}
+
+TEST(multi_k_counter, adaptive) {
+
+    path fq(DATADIR "/ecoli_r1.1K.fastq");
+    vector<path> seqFiles;
+    seqFiles.push_back(fq);
+
+    HashCounter hc(1000000, 27 * 2, 7, 1);
+    LargeHashArrayPtr ref = JellyfishHelper::countSeqFile(fq, hc, true, 1);
+    uint64_t refDistinct = 0;
+    LargeHashArray::eager_iterator it = ref->eager_slice(0, 1);
+    while (it.next()) {
+        refDistinct++;
+    }
+
+    // Any change counts as converged, so stop at the second checkpoint
+    MultiKCounter early(vector<uint16_t>(1, 27), vector<uint64_t>(1, 1000000), true, 1);
+    early.setTolerance(1000.0);
+    early.count(seqFiles);
+    EXPECT_TRUE( early.isConverged() );
+    EXPECT_LT( early.getProgress(), 1.0 );
+    EXPECT_GE( early.getLastChange(), 0.0 );
+    EXPECT_GE( early.getSpectrumError(), 0.0 );
+    EXPECT_LE( early.getSpectrumError(), 1.0 );
+    EXPECT_GE( early.getDistinctError(), 0.0 );
+
+    shared_ptr<LargeHashArray> partial(early.releaseHash(0));
+    uint64_t partialDistinct = 0;
+    LargeHashArray::eager_iterator it2 = partial->eager_slice(0, 1);
+    while (it2.next()) {
+        partialDistinct++;
+        EXPECT_LE( it2.val(), JellyfishHelper::getCount(ref, it2.key(), false) );
+    }
+    EXPECT_GT( partialDistinct, 0 );
+    EXPECT_LT( partialDistinct, refDistinct );
+
+    // Never converges, so reads everything
+    MultiKCounter full(vector<uint16_t>(1, 27), vector<uint64_t>(1, 1000000), true, 1);
+    full.setTolerance(1e-12);
+    full.count(seqFiles);
+    EXPECT_FALSE( full.isConverged() );
+    EXPECT_EQ( full.getProgress(), 1.0 );
+
+    shared_ptr<LargeHashArray> all(full.releaseHash(0));
+    uint64_t distinct = 0;
+    LargeHashArray::eager_iterator it3 = all->eager_slice(0, 1);
+    while (it3.next()) {
+        distinct++;
+    }
+    EXPECT_EQ( distinct, refDistinct );
+}
+
+}
@@ -0,0 +1,86 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <kat/numa.hpp>
+using kat::Numa;
+using kat::NumaPlacement;
+
+namespace kat {
+
+TEST(numa, parse_list) {
+
+    EXPECT_EQ( Numa::parseList("0"), vector<uint16_t>({0}) );
+    EXPECT_EQ( Numa::parseList("0-3"), vector<uint16_t>({0, 1, 2, 3}) );
+    EXPECT_EQ( Numa::parseList("0-1,4,6-7\n"), vector<uint16_t>({0, 1, 4, 6, 7}) );
+    EXPECT_TRUE( Numa::parseList("").empty() );
+    EXPECT_TRUE( Numa::parseList("x-1").empty() );
+}
+
+TEST(numa, nodes) {
+
+    // There's always at least one node, and threads are spread over all of them
+    // in order
+    const vector<uint16_t>& nodes = Numa::nodes();
+    ASSERT_FALSE( nodes.empty() );
+
+    const uint16_t threads = nodes.size() * 3;
+    EXPECT_EQ( Numa::nodeOf(0, threads), nodes.front() );
+    EXPECT_EQ( Numa::nodeOf(threads - 1, threads), nodes.back() );
+    for (uint16_t i = 1; i < threads; i++) {
+        EXPECT_LE( Numa::nodeOf(i - 1, threads), Numa::nodeOf(i, threads) );
+    }
+}
+
+TEST(numa, place) {
+
+    HashLoader hl;
+    LargeHashArrayPtr hash = hl.loadHash(DATADIR "/ecoli.header.jf27", false);
+
+    mer_dna kStart("AGCTTTTCATTCTGACTGCAACGGGCA");
+
+    EXPECT_TRUE( Numa::place(*hash, NumaPlacement::INTERLEAVE, 4) );
+    EXPECT_TRUE( Numa::place(*hash, NumaPlacement::SLICES, 4) );
+
+    // Placement moves pages, but leaves the content as it was
+    EXPECT_EQ( JellyfishHelper::getCount(hash, kStart, false), 3 );
+}
+
+TEST(numa, thread_pin) {
+
+    cpu_set_t before, after;
+    CPU_ZERO(&before);
+    CPU_ZERO(&after);
+    ASSERT_EQ( sched_getaffinity(0, sizeof(before), &before), 0 );
+
+    // Only pinned on NUMA machines, but either way the thread can run where it
+    // could before once the pin goes out of scope
+    {
+        Numa::ThreadPin pin(Numa::nodes().size() * 2 - 1, Numa::nodes().size() * 2);
+        EXPECT_EQ( pin.isPinned(), Numa::isNuma() );
+    }
+    {
+        Numa::ThreadPin pin(0, 4, false);
+        EXPECT_FALSE( pin.isPinned() );
+    }
+
+    ASSERT_EQ( sched_getaffinity(0, sizeof(after), &after), 0 );
+    EXPECT_TRUE( CPU_EQUAL(&before, &after) );
+}
+
+}
@@ -0,0 +1,489 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <thread>
+using std::ifstream;
+using std::ofstream;
+using std::stringstream;
+
+#include <boost/filesystem.hpp>
+using boost::filesystem::remove;
+
+#include <kat/jellyfish_helper.hpp>
+#include <kat/parallel_seq_reader.hpp>
+using kat::JellyfishHelper;
+using kat::ParallelSeqReader;
+using kat::SeqChunk;
+
+namespace kat {
+
+// Parses data, split into two chunks at the given point, returning all K-mers found.
+// If readerLen is greater than k, the reader is set up for longer K-mers than are
+// collected, as when counting several K-mer lengths at once.
+vector<string> splitParse(const string& data, size_t split, bool fastq, uint16_t k, uint16_t minQual = 0, uint16_t readerLen = 0) {
+
+    vector<string> mers;
+    SeqHandler handler = [&](const char* seq, size_t len, size_t owned) {
+        for(size_t i = 0; i + k <= len && i < owned; i++) {
+            mers.push_back(string(seq + i, k));
+        }
+    };
+
+    const uint16_t merLen = std::max(k, readerLen);
+    SeqChunk c1 = { data.data(), data.size(), 0, split, true, true };
+    SeqChunk c2 = { data.data(), data.size(), split, data.size(), true, true };
+    ParallelSeqReader::parse(c1, fastq, merLen, handler, minQual);
+    ParallelSeqReader::parse(c2, fastq, merLen, handler, minQual);
+
+    std::sort(mers.begin(), mers.end());
+    return mers;
+}
+
+TEST(parallel_seq_reader, fastq_split) {
+
+    // Quality lines starting with '@' mustn't be mistaken for headers
+    string fq = "@r1\nACGTACGTAC\n+\n@@@@@@@@@@\n@r2\nGGGGCCCCAA\n+r2\n@IIIIIIIII\n@r3\nTTTTT\n+\nIIIII\n";
+
+    vector<string> expected = splitParse(fq, fq.size(), true, 4);
+    EXPECT_EQ( expected.size(), 16 );
+
+    for(size_t s = 0; s <= fq.size(); s++) {
+        EXPECT_EQ( splitParse(fq, s, true, 4), expected ) << "Split at " << s;
+    }
+}
+
+TEST(parallel_seq_reader, fastq_qual_split) {
+
+    // '#' is Phred 2 and 'I' is Phred 40, so with a threshold of 20 only the
+    // stretches either side of each '#' are kept
+    string fq = "@r1\nACGTACGTAC\n+\nIIIII#IIII\n@r2\nGGGGCCCCAA\n+\n#IIIIIIII#\n";
+
+    vector<string> expected = { "ACGT", "CCCC", "CGTA", "GCCC", "GGCC", "GGGC", "GTAC", "CCCA" };
+    std::sort(expected.begin(), expected.end());
+    EXPECT_EQ( splitParse(fq, fq.size(), true, 4, 20), expected );
+    EXPECT_EQ( splitParse(fq, fq.size(), true, 4, 0).size(), 14 );
+
+    for(size_t s = 0; s <= fq.size(); s++) {
+        EXPECT_EQ( splitParse(fq, s, true, 4, 20), expected ) << "Split at " << s;
+    }
+}
+
+TEST(parallel_seq_reader, fasta_split) {
+
+    // Multi-line sequences, K-mers spanning lines, and headers containing '>'
+    string fa = ">s1 a>b\nACGTAC\nGTACGT\nAC\n>s2\r\nGGGGCCCC\r\nAATT\r\n>s3\nACG\n";
+
+    vector<string> expected = splitParse(fa, fa.size(), false, 5);
+    EXPECT_EQ( expected.size(), 10 + 8 );
+
+    for(size_t s = 0; s <= fa.size(); s++) {
+        EXPECT_EQ( splitParse(fa, s, false, 5), expected ) << "Split at " << s;
+    }
+}
+
+TEST(parallel_seq_reader, fasta_split_owned) {
+
+    // Short K-mers within the lookahead for longer K-mers mustn't be seen twice
+    string fa = ">s1\nACGTAC\nGTACGT\nAC\n>s2\nGGGGCCCC\nAATT\n>s3\nACG\n";
+
+    vector<string> expected = splitParse(fa, fa.size(), false, 3, 0, 7);
+    EXPECT_EQ( expected, splitParse(fa, fa.size(), false, 3) );
+    EXPECT_EQ( expected.size(), 12 + 10 + 1 );
+
+    for(size_t s = 0; s <= fa.size(); s++) {
+        EXPECT_EQ( splitParse(fa, s, false, 3, 0, 7), expected ) << "Split at " << s;
+    }
+}
+
+// Writes data as BGZF, using small blocks so that the input spans many blocks
+void writeBgzf(const string& data, const path& file, size_t blockSize) {
+
+    ofstream out(file.c_str(), std::ios::binary);
+
+    for(size_t pos = 0; pos <= data.size(); pos += blockSize) {
+
+        // Last block is the empty EOF marker
+        const size_t len = pos < data.size() ? std::min(blockSize, data.size() - pos) : 0;
+
+        vector<unsigned char> cdata(compressBound(len) + 16);
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        zs.next_in = (unsigned char*)data.data() + pos;
+        zs.avail_in = len;
+        zs.next_out = cdata.data();
+        zs.avail_out = cdata.size();
+        deflate(&zs, Z_FINISH);
+        const size_t clen = zs.total_out;
+        deflateEnd(&zs);
+
+        const size_t bsize = 18 + clen + 8 - 1;
+        unsigned char h[18] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+            (unsigned char)(bsize & 0xff), (unsigned char)(bsize >> 8) };
+        uint32_t crc = crc32(0, (unsigned char*)data.data() + pos, len);
+        unsigned char t[8] = {
+            (unsigned char)crc, (unsigned char)(crc >> 8), (unsigned char)(crc >> 16), (unsigned char)(crc >> 24),
+            (unsigned char)len, (unsigned char)(len >> 8), (unsigned char)(len >> 16), (unsigned char)(len >> 24) };
+
+        out.write((char*)h, 18);
+        out.write((char*)cdata.data(), clen);
+        out.write((char*)t, 8);
+    }
+}
+
+// Counts with ParallelSeqReader and checks the result matches jellyfish's own parser
+uint64_t checkParallelCount(const path& seqFile, const path& refFile, bool canonical, uint16_t minQual = 0) {
+
+    HashCounter refCounter(1000000, 27 * 2, 7, 1);
+    LargeHashArrayPtr ref = JellyfishHelper::countSeqFile(refFile, refCounter, canonical, 1, minQual);
+
+    vector<path> files;
+    files.push_back(seqFile);
+    EXPECT_TRUE( JellyfishHelper::useParallelReader(files, 4) );
+
+    HashCounter hc(1000000, 27 * 2, 7, 4);
+    LargeHashArrayPtr hash = JellyfishHelper::countSeqFile(seqFile, hc, canonical, 4, minQual);
+
+    uint64_t refDistinct = 0, distinct = 0, mismatches = 0;
+    LargeHashArray::eager_iterator it = ref->eager_slice(0, 1);
+    while (it.next()) {
+        refDistinct++;
+        if (JellyfishHelper::getCount(hash, it.key(), false) != it.val()) {
+            mismatches++;
+        }
+    }
+    LargeHashArray::eager_iterator it2 = hash->eager_slice(0, 1);
+    while (it2.next()) {
+        distinct++;
+    }
+
+    EXPECT_GT( refDistinct, 0 );
+    EXPECT_EQ( distinct, refDistinct );
+    EXPECT_EQ( mismatches, 0 );
+
+    return distinct;
+}
+
+// Converts FastQ to unaligned BAM.  Every third read is stored as if it aligned to
+// the reverse strand, and every fifth is followed by a secondary alignment, neither
+// of which should change the counts.
+string fastqToBam(const string& fq) {
+
+    static const string CODES = "=ACMGRSVTWYHKDBN";
+    static const string COMP = "=TGKCYSBAWRDMHVN";
+
+    string bam("BAM\1", 4);
+    int32_t zero = 0;
+    bam.append((char*)&zero, 4);   // l_text
+    bam.append((char*)&zero, 4);   // n_ref
+
+    stringstream in(fq);
+    string header, seq, plus, qual;
+    uint32_t index = 0;
+    while (std::getline(in, header) && std::getline(in, seq) && std::getline(in, plus) && std::getline(in, qual)) {
+
+        const bool rc = index % 3 == 0;
+        const int copies = index % 5 == 0 ? 2 : 1;
+        index++;
+
+        string s = seq;
+        string q = qual;
+        if (rc) {
+            std::reverse(s.begin(), s.end());
+            for(auto& c : s) c = CODES[COMP.find(c)];
+            std::reverse(q.begin(), q.end());
+        }
+
+        for(int copy = 0; copy < copies; copy++) {
+            string name = header.substr(1, header.find(' ') - 1);
+            string rec;
+            int32_t v = -1;
+            rec.append((char*)&v, 4);                               // refID
+            rec.append((char*)&v, 4);                               // pos
+            rec.push_back((char)(name.size() + 1));                 // l_read_name
+            rec.push_back((char)255);                               // mapq
+            uint16_t bin = 4680, nCigar = 0;
+            uint16_t flag = 4 | (rc ? 0x10 : 0) | (copy > 0 ? 0x100 : 0);
+            rec.append((char*)&bin, 2);
+            rec.append((char*)&nCigar, 2);
+            rec.append((char*)&flag, 2);
+            int32_t len = s.size();
+            rec.append((char*)&len, 4);                             // l_seq
+            rec.append((char*)&v, 4);                               // next_refID
+            rec.append((char*)&v, 4);                               // next_pos
+            rec.append((char*)&zero, 4);                            // tlen
+            rec.append(name);
+            rec.push_back('\0');
+            for(size_t i = 0; i < s.size(); i += 2) {
+                uint8_t hi = CODES.find(s[i]);
+                uint8_t lo = i + 1 < s.size() ? CODES.find(s[i + 1]) : 0;
+                rec.push_back((char)((hi << 4) | lo));
+            }
+            for(auto c : q) rec.push_back((char)(c - 33));
+
+            int32_t blockSize = rec.size();
+            bam.append((char*)&blockSize, 4);
+            bam.append(rec);
+        }
+    }
+
+    return bam;
+}
+
+string readFile(const path& file) {
+    ifstream in(file.c_str());
+    stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+TEST(parallel_seq_reader, fastq) {
+
+    path fq(DATADIR "/ecoli_r1.1K.fastq");
+    EXPECT_EQ( ParallelSeqReader::detectCompression(fq), ParallelSeqReader::Compression::NONE );
+
+    checkParallelCount(fq, fq, true);
+    checkParallelCount(fq, fq, false);
+}
+
+TEST(parallel_seq_reader, fasta) {
+
+    // Wrap each read over several lines so K-mers span line breaks
+    string fq = readFile(DATADIR "/ecoli_r1.1K.fastq");
+    stringstream in(fq);
+    path fa("parallel_seq_reader_test.fa");
+    ofstream out(fa.c_str());
+    string header, seq, plus, qual;
+    while (std::getline(in, header) && std::getline(in, seq) && std::getline(in, plus) && std::getline(in, qual)) {
+        out << ">" << header.substr(1) << endl;
+        for(size_t i = 0; i < seq.size(); i += 60) {
+            out << seq.substr(i, 60) << endl;
+        }
+    }
+    out.close();
+
+    checkParallelCount(fa, fa, true);
+
+    remove(fa);
+}
+
+TEST(parallel_seq_reader, gzip) {
+
+    path fq(DATADIR "/ecoli_r1.1K.fastq");
+    path gz("parallel_seq_reader_test.fastq.gz");
+    string data = readFile(fq);
+
+    gzFile out = gzopen(gz.c_str(), "wb");
+    gzwrite(out, data.data(), data.size());
+    gzclose(out);
+
+    EXPECT_EQ( ParallelSeqReader::detectCompression(gz), ParallelSeqReader::Compression::GZIP );
+    EXPECT_TRUE( JellyfishHelper::isSequenceFile(gz) );
+
+    checkParallelCount(gz, fq, true);
+
+    remove(gz);
+}
+
+TEST(parallel_seq_reader, bgzf) {
+
+    path fq(DATADIR "/ecoli_r1.1K.fastq");
+    path bgz("parallel_seq_reader_test.fastq.bgz");
+    writeBgzf(readFile(fq), bgz, 5000);
+
+    EXPECT_EQ( ParallelSeqReader::detectCompression(bgz), ParallelSeqReader::Compression::BGZF );
+
+    ParallelSeqReader reader(bgz, 27, 4);
+    EXPECT_TRUE( reader.isFastq() );
+    EXPECT_GT( reader.getNbUnits(), 4 );
+
+    checkParallelCount(bgz, fq, true);
+
+    remove(bgz);
+}
+
+TEST(parallel_seq_reader, bam) {
+
+    path fq(DATADIR "/ecoli_r1.1K.fastq");
+    path bam("parallel_seq_reader_test.bam");
+    writeBgzf(fastqToBam(readFile(fq)), bam, 5000);
+
+    EXPECT_TRUE( ParallelSeqReader::isBamFile(bam) );
+    EXPECT_FALSE( ParallelSeqReader::isBamFile(fq) );
+    EXPECT_TRUE( JellyfishHelper::isSequenceFile(bam) );
+
+    ParallelSeqReader reader(bam, 27, 4);
+    EXPECT_TRUE( reader.isBam() );
+
+    checkParallelCount(bam, fq, false);
+    checkParallelCount(bam, fq, true);
+
+    remove(bam);
+}
+
+// Counting a BAM with the given bytes overwritten should fail cleanly
+void checkCorruptBam(const string& bam, size_t offset, int32_t value) {
+
+    string corrupt = bam;
+    memcpy(&corrupt[offset], &value, 4);
+
+    path file("parallel_seq_reader_corrupt_test.bam");
+    writeBgzf(corrupt, file, 5000);
+
+    HashCounter hc(1000000, 27 * 2, 7, 4);
+    EXPECT_THROW( JellyfishHelper::countSeqFile(file, hc, false, 4), JellyfishException ) << "Offset " << offset << " set to " << value;
+
+    remove(file);
+}
+
+TEST(parallel_seq_reader, corrupt_bam) {
+
+    const string bam = fastqToBam(readFile(DATADIR "/ecoli_r1.1K.fastq"));
+
+    // Header: l_text, then n_ref
+    checkCorruptBam(bam, 4, -1);
+    checkCorruptBam(bam, 8, -1);
+
+    // First record: block_size, then l_seq
+    const size_t rec = 12;
+    checkCorruptBam(bam, rec, -100);
+    checkCorruptBam(bam, rec, 8);
+    checkCorruptBam(bam, rec + 4 + 16, -5);
+    checkCorruptBam(bam, rec + 4 + 16, 1000000);
+
+    // Truncated part way through a record
+    path file("parallel_seq_reader_corrupt_test.bam");
+    writeBgzf(bam.substr(0, rec + 20), file, 5000);
+    HashCounter hc(1000000, 27 * 2, 7, 4);
+    EXPECT_THROW( JellyfishHelper::countSeqFile(file, hc, false, 4), JellyfishException );
+    remove(file);
+}
+
+TEST(parallel_seq_reader, min_qual) {
+
+    // The reference counts go through jellyfish's mer_qual_iterator
+    path fq(DATADIR "/ecoli_r1.1K.fastq");
+    uint64_t all = checkParallelCount(fq, fq, true);
+    uint64_t filtered = checkParallelCount(fq, fq, true, 30);
+    EXPECT_LT( filtered, all );
+
+    path bam("parallel_seq_reader_qual_test.bam");
+    writeBgzf(fastqToBam(readFile(fq)), bam, 5000);
+    EXPECT_EQ( checkParallelCount(bam, fq, true, 30), filtered );
+    remove(bam);
+}
+
+// Total bases handed out by a reader sampling the given fraction of reads
+uint64_t sampledBases(const path& file, double fraction, uint16_t threads) {
+
+    ParallelSeqReader reader(file, 27, threads);
+    reader.setSampleFraction(fraction);
+
+    std::atomic<uint64_t> bases(0);
+    vector<thread> t;
+    for(uint16_t i = 0; i < threads; i++) {
+        t.push_back(thread([&]() {
+            reader.process([&](const char* seq, size_t len, size_t owned) { bases += owned; });
+        }));
+    }
+    for(auto& th : t) {
+        th.join();
+    }
+
+    EXPECT_EQ( reader.getError(), "" );
+    return bases;
+}
+
+TEST(parallel_seq_reader, sample_fraction) {
+
+    // Both reads of a pair are picked together
+    for(int i = 0; i < 100; i++) {
+        string r1 = string("read") + lexical_cast<string>(i) + "/1 extra";
+        string r2 = string("read") + lexical_cast<string>(i) + "/2";
+        EXPECT_EQ( ParallelSeqReader::isSampled(r1.data(), r1.size(), 0.5), ParallelSeqReader::isSampled(r2.data(), r2.size(), 0.5) );
+    }
+
+    // Work out which reads should be picked.  Also join them into long FastA
+    // sequences, so that units start a long way from their header.
+    path fq(DATADIR "/ecoli_r1.1K.fastq");
+    string data = readFile(fq);
+    stringstream in(data);
+    vector<string> faSeqs;
+    string header, seq, plus, qual;
+    uint64_t reads = 0, picked = 0, fqBases = 0;
+    while (std::getline(in, header) && std::getline(in, seq) && std::getline(in, plus) && std::getline(in, qual)) {
+        if (ParallelSeqReader::isSampled(header.data() + 1, header.size() - 1, 0.3)) {
+            picked++;
+            fqBases += seq.size();
+        }
+        if (reads++ % 50 == 0) faSeqs.push_back("");
+        faSeqs.back() += seq;
+    }
+
+    EXPECT_NEAR( (double)picked / reads, 0.3, 0.05 );
+    EXPECT_EQ( sampledBases(fq, 1.0, 4), sampledBases(fq, 1.0, 1) );
+    EXPECT_EQ( sampledBases(fq, 0.3, 1), fqBases );
+    EXPECT_EQ( sampledBases(fq, 0.3, 4), fqBases );
+
+    path gz("parallel_seq_reader_sample_test.fastq.gz");
+    gzFile gzOut = gzopen(gz.c_str(), "wb");
+    gzwrite(gzOut, data.data(), data.size());
+    gzclose(gzOut);
+    EXPECT_EQ( sampledBases(gz, 0.3, 4), fqBases );
+    remove(gz);
+
+    path bam("parallel_seq_reader_sample_test.bam");
+    writeBgzf(fastqToBam(data), bam, 5000);
+    EXPECT_EQ( sampledBases(bam, 0.3, 4), fqBases );
+    remove(bam);
+
+    path fa("parallel_seq_reader_sample_test.fa");
+    stringstream faData;
+    uint64_t faBases = 0;
+    for(size_t i = 0; i < faSeqs.size(); i++) {
+        string name = string("seq") + lexical_cast<string>(i);
+        if (ParallelSeqReader::isSampled(name.data(), name.size(), 0.5)) {
+            faBases += faSeqs[i].size();
+        }
+        faData << ">" << name << " description" << endl;
+        for(size_t j = 0; j < faSeqs[i].size(); j += 61) {
+            faData << faSeqs[i].substr(j, 61) << endl;
+        }
+    }
+    ofstream out(fa.c_str());
+    out << faData.str();
+    out.close();
+
+    EXPECT_GT( faBases, 0 );
+    EXPECT_EQ( sampledBases(fa, 0.5, 4), faBases );
+    remove(fa);
+
+    path bgz("parallel_seq_reader_sample_test.fa.bgz");
+    writeBgzf(faData.str(), bgz, 1000);
+    EXPECT_EQ( sampledBases(bgz, 0.5, 4), faBases );
+    remove(bgz);
+}
+
+}
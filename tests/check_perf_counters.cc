@@ -0,0 +1,79 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+using std::stringstream;
+
+#include <kat/perf_counters.hpp>
+using kat::PerfCounters;
+using kat::PerfValues;
+
+namespace kat {
+
+TEST(perf_counters, disabled) {
+
+    PerfCounters::setEnabled(false);
+    PerfCounters counters;
+    EXPECT_FALSE( counters.isOpen() );
+    EXPECT_EQ( counters.read().cycles, 0u );
+}
+
+TEST(perf_counters, count) {
+
+    PerfCounters::setEnabled(true);
+    PerfCounters counters;
+    PerfCounters::setEnabled(false);
+
+    // Counters may not be available, e.g. in a VM or with perf_event_paranoid
+    // set to 3, in which case everything reads 0
+    volatile uint64_t sum = 0;
+    for (uint64_t i = 0; i < 1000000; i++) {
+        sum += i;
+    }
+
+    PerfValues v = counters.read();
+    if (counters.isOpen() && v.instructions > 0) {
+        EXPECT_GT( v.instructions, 1000000u );
+    }
+}
+
+TEST(perf_counters, values) {
+
+    PerfValues a;
+    a.cycles = 200;
+    a.instructions = 100;
+    a.llcMisses = 5;
+    a.dtlbMisses = 1;
+
+    PerfValues b = a;
+    b += a;
+    EXPECT_EQ( b.cycles, 400u );
+    EXPECT_EQ( b.instructions, 200u );
+    EXPECT_DOUBLE_EQ( b.ipc(), 0.5 );
+    EXPECT_DOUBLE_EQ( b.llcMpki(), 50.0 );
+    EXPECT_DOUBLE_EQ( b.dtlbMpki(), 10.0 );
+
+    EXPECT_DOUBLE_EQ( PerfValues().ipc(), 0.0 );
+
+    stringstream ss;
+    b.print(ss);
+    EXPECT_NE( ss.str().find("IPC 0.50"), string::npos );
+}
+
+}
@@ -57,4 +57,21 @@ TEST(spectra_helper, peak) {
     EXPECT_EQ( 9762, p.second );
 }
 
+TEST(spectra_helper, spectra_distance) {
+    
+    vector<Pos> s1 = { Pos(1, 1000), Pos(9, 50), Pos(10, 100), Pos(11, 50) };
+    
+    // Twice the data, with the same shape.  Error K-mers stay at 1, but still sit
+    // close to 0 relative to the peak, so barely count.
+    vector<Pos> s2 = { Pos(1, 2000), Pos(18, 50), Pos(20, 100), Pos(22, 50) };
+    
+    // Peak in a different place
+    vector<Pos> s3 = { Pos(1, 1000), Pos(9, 100), Pos(10, 50), Pos(20, 50) };
+    
+    EXPECT_NEAR( SpectraHelper::spectraDistance(s1, s1), 0.0, 1e-12 );
+    EXPECT_LT( SpectraHelper::spectraDistance(s1, s2), 0.05 );
+    EXPECT_GT( SpectraHelper::spectraDistance(s1, s3), 0.1 );
+    EXPECT_EQ( SpectraHelper::spectraDistance(s1, vector<Pos>()), 1.0 );
+}
+
 }
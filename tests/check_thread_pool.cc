@@ -0,0 +1,93 @@
+//  ********************************************************************
+//  This file is part of KAT - the K-mer Analysis Toolkit.
+//
+//  KAT is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  KAT is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with KAT.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+using std::vector;
+
+#include <kat/thread_pool.hpp>
+using kat::ThreadPool;
+
+namespace kat {
+
+TEST(thread_pool, parallel_for) {
+
+    ThreadPool pool(4);
+    EXPECT_EQ( pool.size(), 4 );
+
+    vector<int> hits(1000, 0);
+    pool.parallelFor(hits.size(), [&](size_t i) { hits[i]++; });
+    for (auto h : hits) {
+        EXPECT_EQ( h, 1 );
+    }
+
+    // Nothing to do
+    pool.parallelFor(0, [&](size_t i) { hits[i]++; });
+}
+
+TEST(thread_pool, nested) {
+
+    // More nested work than there are workers, so waiting threads must help
+    ThreadPool pool(2);
+    std::atomic<int> total(0);
+    pool.parallelFor(8, [&](size_t i) {
+        pool.parallelFor(8, [&](size_t j) {
+            pool.parallelFor(4, [&](size_t k) { total++; });
+        });
+    });
+    EXPECT_EQ( total.load(), 8 * 8 * 4 );
+}
+
+TEST(thread_pool, futures) {
+
+    ThreadPool pool(2);
+
+    vector<std::future<int>> results;
+    for (int i = 0; i < 20; i++) {
+        results.push_back(pool.submit([&pool, i]() {
+            // Tasks can submit tasks and wait for them
+            std::future<int> inner = pool.submit([i]() { return i * i; });
+            return pool.wait(inner) + 1;
+        }));
+    }
+
+    for (int i = 0; i < 20; i++) {
+        EXPECT_EQ( pool.wait(results[i]), i * i + 1 );
+    }
+}
+
+TEST(thread_pool, exceptions) {
+
+    ThreadPool pool(3);
+    std::atomic<int> done(0);
+
+    EXPECT_THROW( pool.parallelFor(10, [&](size_t i) {
+        if (i == 5) throw std::runtime_error("failed");
+        done++;
+    }), std::runtime_error );
+
+    // Everything else still ran
+    EXPECT_EQ( done.load(), 9 );
+
+    std::future<void> f = pool.submit([]() { throw std::runtime_error("failed"); });
+    EXPECT_THROW( pool.wait(f), std::runtime_error );
+}
+
+}